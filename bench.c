@@ -0,0 +1,539 @@
+#include "bench.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdk_config.h"
+#include "nordic_common.h"
+#include "app_util.h"
+#include "nrf.h"
+#include "flash_queue.h"
+
+#ifdef SOFTDEVICE_PRESENT
+#include "nrf_soc.h"
+#endif
+
+
+#define BENCH_TIMER     CONCAT_2(NRF_TIMER, BENCH_TIMER_INSTANCE)
+#define BENCH_SEED      0x2545F491                              /**< Seed of the address and data generator. */
+
+#define CC_MAIN         0                                       /**< Capture channel of the main context. */
+#define CC_EVT          1                                       /**< Capture channel of the event handler. */
+
+STATIC_ASSERT((BENCH_BUF_SIZE % sizeof(uint32_t)) == 0);
+STATIC_ASSERT(BENCH_BUF_SIZE >= MAX(BENCH_MIXED_WRITE_SIZE, BENCH_MIXED_READ_SIZE));
+
+
+typedef enum
+{
+    OP_WRITE,
+    OP_READ,
+    OP_ERASE,
+} op_t;
+
+
+/**@brief   Latencies of a workload. Once full, samples are replaced at random, so that they
+ *          remain a uniform sample of all operations. */
+typedef struct
+{
+    uint32_t cnt;                           //!< Latencies added.
+    uint32_t lat[BENCH_LATENCY_SAMPLES];
+} samples_t;
+
+
+static void bench_evt_handler(nrf_fstorage_evt_t * p_evt);
+
+/* The workloads get their own instance, so that their events bypass the handler of the
+ * application. */
+NRF_FSTORAGE_DEF(static nrf_fstorage_t m_bench_fs) =
+{
+    .evt_handler = bench_evt_handler,
+};
+
+static uint32_t             m_buf[BENCH_BUF_SIZE / sizeof(uint32_t)];
+static samples_t            m_samples[2];
+static uint32_t             m_rand;
+
+static bool       volatile  m_done;
+static ret_code_t volatile  m_result;
+static uint32_t   volatile  m_end_us;
+
+
+static uint32_t rand_next(void)
+{
+    /* xorshift32 */
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 17;
+    m_rand ^= m_rand << 5;
+    return m_rand;
+}
+
+
+static void timer_start(void)
+{
+    BENCH_TIMER->MODE      = TIMER_MODE_MODE_Timer;
+    BENCH_TIMER->BITMODE   = TIMER_BITMODE_BITMODE_32Bit;
+    BENCH_TIMER->PRESCALER = 4;                             // 16 MHz / 2^4 = 1 MHz
+    BENCH_TIMER->TASKS_CLEAR = 1;
+    BENCH_TIMER->TASKS_START = 1;
+}
+
+
+static void timer_stop(void)
+{
+    BENCH_TIMER->TASKS_STOP = 1;
+}
+
+
+/**@brief   Read the timer. Each context uses its own capture channel. */
+static uint32_t timer_us(uint32_t cc)
+{
+    BENCH_TIMER->TASKS_CAPTURE[cc] = 1;
+    return BENCH_TIMER->CC[cc];
+}
+
+
+static void bench_evt_handler(nrf_fstorage_evt_t * p_evt)
+{
+    m_end_us = timer_us(CC_EVT);
+    m_result = p_evt->result;
+    m_done   = true;
+}
+
+
+static void event_wait(void)
+{
+#ifdef SOFTDEVICE_PRESENT
+    (void) sd_app_evt_wait();
+#else
+    __WFE();
+#endif
+}
+
+
+/**@brief   Run one operation and wait for its result.
+ *
+ * @param[in]   len         Bytes for writes and reads, pages for erases.
+ * @param[out]  p_lat_us    Latency of the operation.
+ */
+static ret_code_t op_run(op_t op, uint32_t addr, uint32_t len, uint32_t * p_lat_us)
+{
+    ret_code_t rc;
+
+    m_done = false;
+
+    uint32_t const start = timer_us(CC_MAIN);
+
+    switch (op)
+    {
+        case OP_WRITE:
+            rc = nrf_fstorage_write(&m_bench_fs, addr, m_buf, len, NULL);
+            break;
+
+        case OP_ERASE:
+            rc = nrf_fstorage_erase(&m_bench_fs, addr, len, NULL);
+            break;
+
+        default:
+            /* Reads complete before returning, without an event. */
+            rc       = nrf_fstorage_read(&m_bench_fs, addr, m_buf, len);
+            m_result = rc;
+            m_end_us = timer_us(CC_MAIN);
+            m_done   = true;
+            break;
+    }
+
+    if (rc != NRF_SUCCESS)
+    {
+        return rc;
+    }
+
+    while (!m_done)
+    {
+        event_wait();
+    }
+
+    *p_lat_us = m_end_us - start;
+    return m_result;
+}
+
+
+static void samples_add(samples_t * p_samples, uint32_t lat_us)
+{
+    uint32_t const i = p_samples->cnt++;
+
+    if (i < BENCH_LATENCY_SAMPLES)
+    {
+        p_samples->lat[i] = lat_us;
+    }
+    else
+    {
+        uint32_t const j = rand_next() % (i + 1);
+        if (j < BENCH_LATENCY_SAMPLES)
+        {
+            p_samples->lat[j] = lat_us;
+        }
+    }
+}
+
+
+static int lat_cmp(void const * p_a, void const * p_b)
+{
+    uint32_t const a = *(uint32_t const *)p_a;
+    uint32_t const b = *(uint32_t const *)p_b;
+
+    return (a > b) - (a < b);
+}
+
+
+/**@brief   Nearest-rank percentile of sorted latencies. */
+static uint32_t percentile(uint32_t const * p_lat, uint32_t cnt, uint32_t pct)
+{
+    uint32_t const rank = (cnt * pct + 99) / 100;
+
+    return p_lat[(rank > 0) ? (rank - 1) : 0];
+}
+
+
+static void result_make(samples_t      * p_samples,
+                        uint32_t         bytes,
+                        uint32_t         time_us,
+                        bench_result_t * p_result)
+{
+    uint32_t const cnt = MIN(p_samples->cnt, BENCH_LATENCY_SAMPLES);
+
+    memset(p_result, 0x00, sizeof(*p_result));
+    p_result->ops     = p_samples->cnt;
+    p_result->bytes   = bytes;
+    p_result->time_us = time_us;
+
+    if (cnt > 0)
+    {
+        qsort(p_samples->lat, cnt, sizeof(p_samples->lat[0]), lat_cmp);
+        p_result->p50_us = percentile(p_samples->lat, cnt, 50);
+        p_result->p99_us = percentile(p_samples->lat, cnt, 99);
+    }
+}
+
+
+static uint32_t area_size(void)
+{
+    return m_bench_fs.end_addr + 1 - m_bench_fs.start_addr;
+}
+
+
+/**@brief   Take over the area of @p p_fs and reset the generator and the samples. */
+static ret_code_t bench_begin(nrf_fstorage_t const * p_fs)
+{
+    if (p_fs == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+    if (flash_queue_is_busy() || nrf_fstorage_is_busy(NULL))
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    m_bench_fs.start_addr = p_fs->start_addr;
+    m_bench_fs.end_addr   = p_fs->end_addr;
+
+    /* Initializing a backend again has no effect. */
+    ret_code_t const rc = nrf_fstorage_init(&m_bench_fs, (nrf_fstorage_api_t *)p_fs->p_api, NULL);
+    if (rc != NRF_SUCCESS)
+    {
+        return rc;
+    }
+
+    m_rand = BENCH_SEED;
+    for (uint32_t i = 0; i < ARRAY_SIZE(m_buf); i++)
+    {
+        m_buf[i] = rand_next();
+    }
+    m_rand = BENCH_SEED;
+
+    memset(m_samples, 0x00, sizeof(m_samples));
+    timer_start();
+
+    return NRF_SUCCESS;
+}
+
+
+static ret_code_t bench_end(ret_code_t rc)
+{
+    timer_stop();
+    return rc;
+}
+
+
+static bool size_is_valid(uint32_t size)
+{
+    return (size != 0) && ((size % sizeof(uint32_t)) == 0)
+        && (size <= BENCH_BUF_SIZE) && (size <= area_size());
+}
+
+
+/**@brief   Erase the whole area, page by page, adding the latencies to @p p_samples if not NULL. */
+static ret_code_t area_erase(samples_t * p_samples)
+{
+    uint32_t const page_size = m_bench_fs.p_flash_info->erase_unit;
+
+    for (uint32_t addr = m_bench_fs.start_addr; addr < m_bench_fs.end_addr; addr += page_size)
+    {
+        uint32_t         lat;
+        ret_code_t const rc = op_run(OP_ERASE, addr, 1, &lat);
+
+        if (rc != NRF_SUCCESS)
+        {
+            return rc;
+        }
+        if (p_samples != NULL)
+        {
+            samples_add(p_samples, lat);
+        }
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+/**@brief   Run @p cnt operations of @p size bytes, @p stride blocks apart, wrapping around the
+ *          area. */
+static ret_code_t ops_run(op_t       op,
+                          uint32_t   size,
+                          uint32_t   cnt,
+                          uint32_t   stride,
+                          uint32_t * p_time_us)
+{
+    uint32_t const blocks = area_size() / size;
+    uint32_t const start  = timer_us(CC_MAIN);
+
+    for (uint32_t i = 0; i < cnt; i++)
+    {
+        uint32_t         lat;
+        uint32_t const   block = (uint32_t)(((uint64_t)i * stride) % blocks);
+        ret_code_t const rc    = op_run(op, m_bench_fs.start_addr + block * size, size, &lat);
+
+        if (rc != NRF_SUCCESS)
+        {
+            return rc;
+        }
+        samples_add(&m_samples[0], lat);
+    }
+
+    *p_time_us = timer_us(CC_MAIN) - start;
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t bench_write_seq(nrf_fstorage_t const * p_fs, uint32_t size, bench_result_t * p_result)
+{
+    uint32_t   time_us;
+    ret_code_t rc = bench_begin(p_fs);
+
+    if (rc != NRF_SUCCESS)
+    {
+        return rc;
+    }
+    if (p_result == NULL)
+    {
+        return bench_end(NRF_ERROR_NULL);
+    }
+    if (!size_is_valid(size))
+    {
+        return bench_end(NRF_ERROR_INVALID_LENGTH);
+    }
+
+    uint32_t const cnt = area_size() / size;
+
+    rc = area_erase(NULL);
+    if (rc == NRF_SUCCESS)
+    {
+        rc = ops_run(OP_WRITE, size, cnt, 1, &time_us);
+    }
+    if (rc == NRF_SUCCESS)
+    {
+        result_make(&m_samples[0], cnt * size, time_us, p_result);
+    }
+
+    return bench_end(rc);
+}
+
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0)
+    {
+        uint32_t const t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+
+ret_code_t bench_write_random(nrf_fstorage_t const * p_fs,
+                              uint32_t               size,
+                              uint32_t               count,
+                              bench_result_t       * p_result)
+{
+    uint32_t   time_us;
+    ret_code_t rc = bench_begin(p_fs);
+
+    if (rc != NRF_SUCCESS)
+    {
+        return rc;
+    }
+    if (p_result == NULL)
+    {
+        return bench_end(NRF_ERROR_NULL);
+    }
+    if (!size_is_valid(size))
+    {
+        return bench_end(NRF_ERROR_INVALID_LENGTH);
+    }
+
+    uint32_t const blocks = area_size() / size;
+    uint32_t       stride = (blocks / 2) + 1 + (rand_next() % MAX(blocks / 4, 1));
+
+    /* A stride coprime with the number of blocks visits each of them once. */
+    while (gcd(stride, blocks) != 1)
+    {
+        stride++;
+    }
+    if ((count == 0) || (count > blocks))
+    {
+        count = blocks;
+    }
+
+    rc = area_erase(NULL);
+    if (rc == NRF_SUCCESS)
+    {
+        rc = ops_run(OP_WRITE, size, count, stride, &time_us);
+    }
+    if (rc == NRF_SUCCESS)
+    {
+        result_make(&m_samples[0], count * size, time_us, p_result);
+    }
+
+    return bench_end(rc);
+}
+
+
+ret_code_t bench_read_seq(nrf_fstorage_t const * p_fs, uint32_t size, bench_result_t * p_result)
+{
+    uint32_t   time_us;
+    ret_code_t rc = bench_begin(p_fs);
+
+    if (rc != NRF_SUCCESS)
+    {
+        return rc;
+    }
+    if (p_result == NULL)
+    {
+        return bench_end(NRF_ERROR_NULL);
+    }
+    if (!size_is_valid(size))
+    {
+        return bench_end(NRF_ERROR_INVALID_LENGTH);
+    }
+
+    uint32_t const cnt = area_size() / size;
+
+    rc = ops_run(OP_READ, size, cnt, 1, &time_us);
+    if (rc == NRF_SUCCESS)
+    {
+        result_make(&m_samples[0], cnt * size, time_us, p_result);
+    }
+
+    return bench_end(rc);
+}
+
+
+ret_code_t bench_erase_seq(nrf_fstorage_t const * p_fs, bench_result_t * p_result)
+{
+    ret_code_t rc = bench_begin(p_fs);
+
+    if (rc != NRF_SUCCESS)
+    {
+        return rc;
+    }
+    if (p_result == NULL)
+    {
+        return bench_end(NRF_ERROR_NULL);
+    }
+
+    uint32_t const start = timer_us(CC_MAIN);
+
+    rc = area_erase(&m_samples[0]);
+    if (rc == NRF_SUCCESS)
+    {
+        result_make(&m_samples[0], area_size(), timer_us(CC_MAIN) - start, p_result);
+    }
+
+    return bench_end(rc);
+}
+
+
+ret_code_t bench_mixed(nrf_fstorage_t const * p_fs,
+                       bench_result_t       * p_write,
+                       bench_result_t       * p_read)
+{
+    ret_code_t rc = bench_begin(p_fs);
+
+    if (rc != NRF_SUCCESS)
+    {
+        return rc;
+    }
+    if ((p_write == NULL) || (p_read == NULL))
+    {
+        return bench_end(NRF_ERROR_NULL);
+    }
+    if (area_size() < BENCH_MIXED_READ_SIZE)
+    {
+        return bench_end(NRF_ERROR_INVALID_LENGTH);
+    }
+
+    rc = area_erase(NULL);
+    if (rc != NRF_SUCCESS)
+    {
+        return bench_end(rc);
+    }
+
+    uint32_t const writes    = area_size() / BENCH_MIXED_WRITE_SIZE;
+    uint32_t const read_span = (area_size() - BENCH_MIXED_READ_SIZE) / sizeof(uint32_t) + 1;
+    uint32_t const start     = timer_us(CC_MAIN);
+
+    for (uint32_t i = 0; (i < writes) && (rc == NRF_SUCCESS); i++)
+    {
+        uint32_t lat;
+
+        rc = op_run(OP_WRITE, m_bench_fs.start_addr + i * BENCH_MIXED_WRITE_SIZE,
+                    BENCH_MIXED_WRITE_SIZE, &lat);
+        if (rc == NRF_SUCCESS)
+        {
+            samples_add(&m_samples[0], lat);
+        }
+
+        for (uint32_t j = 0; (j < BENCH_MIXED_READS) && (rc == NRF_SUCCESS); j++)
+        {
+            uint32_t const addr = m_bench_fs.start_addr
+                                + (rand_next() % read_span) * sizeof(uint32_t);
+
+            rc = op_run(OP_READ, addr, BENCH_MIXED_READ_SIZE, &lat);
+            if (rc == NRF_SUCCESS)
+            {
+                samples_add(&m_samples[1], lat);
+            }
+        }
+    }
+
+    if (rc == NRF_SUCCESS)
+    {
+        uint32_t const time_us = timer_us(CC_MAIN) - start;
+
+        result_make(&m_samples[0], writes * BENCH_MIXED_WRITE_SIZE, time_us, p_write);
+        result_make(&m_samples[1], m_samples[1].cnt * BENCH_MIXED_READ_SIZE, time_us, p_read);
+    }
+
+    return bench_end(rc);
+}
@@ -0,0 +1,117 @@
+#ifndef BENCH_H__
+#define BENCH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "nrf_fstorage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup bench Flash benchmark
+ * @{
+ *
+ * @brief   Standard flash workloads, timed on the target.
+ *
+ * @details Each workload runs over the whole flash area of an fstorage instance, one operation
+ *          at a time, directly on the nrf_fstorage backend of that instance. Latencies are
+ *          measured with a TIMER instance at 1 MHz, from the call to nrf_fstorage to the result
+ *          event, and the median and 99th percentile are taken over a uniform sample of the
+ *          operations. Addresses and data are drawn from a generator with a fixed seed, so that
+ *          a workload always issues the same operations.
+ *
+ *          The workloads erase the flash area, and must not run while other operations on it
+ *          are pending. Each function blocks until its workload has completed.
+ */
+
+
+#define BENCH_MIXED_WRITE_SIZE  64      //!< Bytes per write of @ref bench_mixed.
+#define BENCH_MIXED_READ_SIZE   256     //!< Bytes per read of @ref bench_mixed.
+#define BENCH_MIXED_READS       4       //!< Reads after each write of @ref bench_mixed.
+
+
+/**@brief   Result of a workload. */
+typedef struct
+{
+    uint32_t ops;       //!< Operations issued.
+    uint32_t bytes;     //!< Bytes written, read or erased.
+    uint32_t time_us;   //!< Time taken by the whole workload.
+    uint32_t p50_us;    //!< Median latency of an operation.
+    uint32_t p99_us;    //!< 99th percentile of the latency of an operation.
+} bench_result_t;
+
+
+/**@brief   Function for writing the flash area sequentially, @p size bytes at a time.
+ *
+ * The area is erased first, which is not part of the result.
+ *
+ * @param[in]   p_fs        The fstorage instance whose area to use.
+ * @param[in]   size        Bytes per write. Must be a multiple of four, and at most
+ *                          @ref BENCH_BUF_SIZE and the size of the area.
+ * @param[out]  p_result    The result.
+ *
+ * @retval  NRF_SUCCESS             If the workload completed.
+ * @retval  NRF_ERROR_NULL          If @p p_fs or @p p_result is NULL.
+ * @retval  NRF_ERROR_INVALID_LENGTH If @p size is not valid.
+ * @retval  NRF_ERROR_BUSY          If flash operations are pending.
+ * @return  Any error returned by nrf_fstorage, or reported in its events.
+ */
+ret_code_t bench_write_seq(nrf_fstorage_t const * p_fs, uint32_t size, bench_result_t * p_result);
+
+
+/**@brief   Function for writing @p count blocks of @p size bytes, scattered over the flash area.
+ *
+ * Every block is written once. The area is erased first, which is not part of the result.
+ *
+ * @param[in]   count   Number of blocks to write. Zero, or more than fit in the area, to write
+ *                      all of them.
+ *
+ * @return  See @ref bench_write_seq.
+ */
+ret_code_t bench_write_random(nrf_fstorage_t const * p_fs,
+                              uint32_t               size,
+                              uint32_t               count,
+                              bench_result_t       * p_result);
+
+
+/**@brief   Function for reading the whole flash area, @p size bytes at a time.
+ *
+ * @return  See @ref bench_write_seq.
+ */
+ret_code_t bench_read_seq(nrf_fstorage_t const * p_fs, uint32_t size, bench_result_t * p_result);
+
+
+/**@brief   Function for erasing the flash area one page at a time.
+ *
+ * @return  See @ref bench_write_seq.
+ */
+ret_code_t bench_erase_seq(nrf_fstorage_t const * p_fs, bench_result_t * p_result);
+
+
+/**@brief   Function for writing the flash area sequentially with reads in between.
+ *
+ * Every write of @ref BENCH_MIXED_WRITE_SIZE bytes is followed by @ref BENCH_MIXED_READS reads of
+ * @ref BENCH_MIXED_READ_SIZE bytes at scattered addresses. The area is erased first, which is
+ * not part of the results. Both results carry the time of the whole workload.
+ *
+ * @param[out]  p_write     The result of the writes.
+ * @param[out]  p_read      The result of the reads.
+ *
+ * @return  See @ref bench_write_seq.
+ */
+ret_code_t bench_mixed(nrf_fstorage_t const * p_fs,
+                       bench_result_t       * p_write,
+                       bench_result_t       * p_read);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BENCH_H__
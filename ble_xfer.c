@@ -0,0 +1,436 @@
+#include "ble_xfer.h"
+
+#include <string.h>
+
+#include "sdk_config.h"
+#include "nrf.h"
+#include "nordic_common.h"
+#include "app_util.h"
+#include "nrf_sdh_ble.h"
+#include "nrf_ringbuf.h"
+#include "xfer.h"
+
+#if BLE_XFER_ENABLED
+
+/* Base of the 128-bit UUIDs of the service, least significant byte first. Bytes 12 and 13 hold
+ * the 16-bit UUIDs. */
+#define BLE_XFER_UUID_BASE  {0x3d, 0x8e, 0x1c, 0x52, 0x7a, 0x44, 0x4f, 0x9b,                     \
+                             0x91, 0x2e, 0x5b, 0x0c, 0x00, 0x00, 0x6a, 0xf3}
+
+#define HVX_HDR_LEN         3                                           /**< Opcode and handle of a notification. */
+#define VALUE_MAX_LEN       (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - HVX_HDR_LEN)
+
+
+static nrf_fstorage_t const   * m_p_fs;
+static uint8_t                  m_uuid_type;
+static uint16_t                 m_service_handle;
+static ble_gatts_char_handles_t m_rx_handles;
+static ble_gatts_char_handles_t m_tx_handles;
+
+static uint16_t volatile        m_conn_handle = BLE_CONN_HANDLE_INVALID;
+static uint16_t volatile        m_att_mtu     = BLE_GATT_ATT_MTU_DEFAULT;
+static bool     volatile        m_notify_enabled;
+static bool                     m_phy_requested;
+
+static uint8_t                  m_passkey[BLE_GAP_PASSKEY_LEN];         //!< From the device ID.
+
+static bool                     m_session;                              //!< The xfer session runs on m_session_conn.
+static uint16_t                 m_session_conn = BLE_CONN_HANDLE_INVALID;
+
+/* Frames are put in the RX buffer from the SoftDevice event handler, and replies are taken from
+ * the TX buffer in the main loop. */
+NRF_RINGBUF_DEF(m_rx_buf, BLE_XFER_RX_BUF_SIZE);
+NRF_RINGBUF_DEF(m_tx_buf, BLE_XFER_TX_BUF_SIZE);
+
+
+static ble_gap_data_length_params_t const m_dl_params =
+{
+    .max_tx_octets  = NRF_SDH_BLE_GAP_DATA_LENGTH,
+    .max_rx_octets  = NRF_SDH_BLE_GAP_DATA_LENGTH,
+    .max_tx_time_us = BLE_GAP_DATA_LENGTH_AUTO,
+    .max_rx_time_us = BLE_GAP_DATA_LENGTH_AUTO,
+};
+
+
+static void phy_request(uint16_t conn_handle)
+{
+    ble_gap_phys_t const phys =
+    {
+        .tx_phys = BLE_GAP_PHY_2MBPS,
+        .rx_phys = BLE_GAP_PHY_2MBPS,
+    };
+
+    if (!m_phy_requested)
+    {
+        m_phy_requested = true;
+        (void) sd_ble_gap_phy_update(conn_handle, &phys);
+    }
+}
+
+
+/**@brief   Request the largest ATT MTU and data length, then the 2 Mbps PHY.
+ *
+ * Link layer procedures run one at a time, so the PHY is only requested once the data length
+ * has been updated. Peers that do not support a procedure reject it, and the link keeps its
+ * default parameters.
+ */
+static void link_setup(uint16_t conn_handle)
+{
+    m_att_mtu       = BLE_GATT_ATT_MTU_DEFAULT;
+    m_phy_requested = false;
+
+    (void) sd_ble_gattc_exchange_mtu_request(conn_handle, NRF_SDH_BLE_GATT_MAX_MTU_SIZE);
+
+    if (sd_ble_gap_data_length_update(conn_handle, &m_dl_params, NULL) != NRF_SUCCESS)
+    {
+        phy_request(conn_handle);
+    }
+}
+
+
+static void mtu_set(uint16_t peer_mtu)
+{
+    m_att_mtu = MAX(BLE_GATT_ATT_MTU_DEFAULT, MIN(peer_mtu, NRF_SDH_BLE_GATT_MAX_MTU_SIZE));
+}
+
+
+static void on_write(ble_gatts_evt_write_t const * p_write)
+{
+    if ((p_write->handle == m_tx_handles.cccd_handle) && (p_write->len == 2))
+    {
+        m_notify_enabled = (uint16_decode(p_write->data) & BLE_GATT_HVX_NOTIFICATION) != 0;
+    }
+    else if ((p_write->handle == m_rx_handles.value_handle) && m_notify_enabled)
+    {
+        size_t len = p_write->len;
+
+        /* Bytes that do not fit are lost. The frames they belong to fail their CRC check, and
+         * the host sends them again. */
+        (void) nrf_ringbuf_cpy_put(&m_rx_buf, p_write->data, &len);
+    }
+}
+
+
+static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
+{
+    uint16_t const conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GAP_EVT_CONNECTED:
+            m_conn_handle    = conn_handle;
+            m_notify_enabled = false;
+            link_setup(conn_handle);
+            break;
+
+        case BLE_GAP_EVT_DISCONNECTED:
+            if (conn_handle == m_conn_handle)
+            {
+                m_conn_handle    = BLE_CONN_HANDLE_INVALID;
+                m_notify_enabled = false;
+            }
+            break;
+
+        case BLE_GAP_EVT_DATA_LENGTH_UPDATE_REQUEST:
+            (void) sd_ble_gap_data_length_update(conn_handle, &m_dl_params, NULL);
+            break;
+
+        case BLE_GAP_EVT_DATA_LENGTH_UPDATE:
+            phy_request(conn_handle);
+            break;
+
+        case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
+        {
+            ble_gap_phys_t const phys =
+            {
+                .tx_phys = BLE_GAP_PHY_AUTO,
+                .rx_phys = BLE_GAP_PHY_AUTO,
+            };
+            (void) sd_ble_gap_phy_update(conn_handle, &phys);
+        } break;
+
+        case BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST:
+            mtu_set(p_ble_evt->evt.gatts_evt.params.exchange_mtu_request.client_rx_mtu);
+            (void) sd_ble_gatts_exchange_mtu_reply(conn_handle, NRF_SDH_BLE_GATT_MAX_MTU_SIZE);
+            break;
+
+        case BLE_GATTC_EVT_EXCHANGE_MTU_RSP:
+            mtu_set(p_ble_evt->evt.gattc_evt.params.exchange_mtu_rsp.server_rx_mtu);
+            break;
+
+        case BLE_GATTS_EVT_WRITE:
+            on_write(&p_ble_evt->evt.gatts_evt.params.write);
+            break;
+
+        default:
+            break;
+    }
+}
+
+NRF_SDH_BLE_OBSERVER(m_ble_observer, BLE_XFER_BLE_OBSERVER_PRIO, ble_evt_handler, NULL);
+
+
+/**@brief   Send function of the xfer session. */
+static void tx_put(void const * p_ctx, char const * p_data, size_t len)
+{
+    /* A reply cut short for lack of room fails its CRC check on the host, which then sends the
+     * frame it answers again. */
+    (void) nrf_ringbuf_cpy_put(&m_tx_buf, (uint8_t const *)p_data, &len);
+}
+
+
+/**@brief   Hand as many notifications to the SoftDevice as it can queue.
+ *
+ * @return  Whether bytes were sent.
+ */
+static bool tx_pump(uint16_t conn_handle)
+{
+    bool sent = false;
+
+    while (conn_handle != BLE_CONN_HANDLE_INVALID)
+    {
+        uint8_t * p_data;
+        size_t    len = m_att_mtu - HVX_HDR_LEN;
+
+        if (nrf_ringbuf_get(&m_tx_buf, &p_data, &len, true) != NRF_SUCCESS)
+        {
+            break;
+        }
+        if (len == 0)
+        {
+            (void) nrf_ringbuf_free(&m_tx_buf, 0);
+            break;
+        }
+
+        uint16_t                     hvx_len = (uint16_t)len;
+        ble_gatts_hvx_params_t const hvx     =
+        {
+            .handle = m_tx_handles.value_handle,
+            .type   = BLE_GATT_HVX_NOTIFICATION,
+            .p_len  = &hvx_len,
+            .p_data = p_data,
+        };
+
+        ret_code_t const rc = sd_ble_gatts_hvx(conn_handle, &hvx);
+        if (rc == NRF_ERROR_RESOURCES)
+        {
+            /* The SoftDevice queue is full. Completed notifications wake the main loop. */
+            (void) nrf_ringbuf_free(&m_tx_buf, 0);
+            break;
+        }
+
+        /* Other errors mean that notifications were disabled; the bytes are dropped. */
+        (void) nrf_ringbuf_free(&m_tx_buf, len);
+        sent = sent || (rc == NRF_SUCCESS);
+    }
+
+    return sent;
+}
+
+
+static void rx_discard(void)
+{
+    uint8_t data[64];
+    size_t  len;
+
+    do
+    {
+        len = sizeof(data);
+        (void) nrf_ringbuf_cpy_get(&m_rx_buf, data, &len);
+    } while (len > 0);
+}
+
+
+static ret_code_t char_add(uint16_t uuid16, bool notify, ble_gatts_char_handles_t * p_handles)
+{
+    ble_uuid_t          uuid;
+    ble_gatts_char_md_t char_md;
+    ble_gatts_attr_md_t cccd_md;
+    ble_gatts_attr_md_t attr_md;
+    ble_gatts_attr_t    attr;
+
+    memset(&char_md, 0x00, sizeof(char_md));
+    memset(&cccd_md, 0x00, sizeof(cccd_md));
+    memset(&attr_md, 0x00, sizeof(attr_md));
+    memset(&attr,    0x00, sizeof(attr));
+
+    uuid.type = m_uuid_type;
+    uuid.uuid = uuid16;
+
+    BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.read_perm);
+    BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.write_perm);
+    attr_md.vloc = BLE_GATTS_VLOC_STACK;
+    attr_md.vlen = 1;
+
+    /* Frames can read, write and erase any part of the flash, so they are only taken from links
+     * encrypted by a pairing that used the passkey, and only sent to them. */
+    if (notify)
+    {
+        BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.read_perm);
+        BLE_GAP_CONN_SEC_MODE_SET_ENC_WITH_MITM(&cccd_md.write_perm);
+        cccd_md.vloc = BLE_GATTS_VLOC_STACK;
+
+        char_md.char_props.notify = 1;
+        char_md.p_cccd_md         = &cccd_md;
+    }
+    else
+    {
+        BLE_GAP_CONN_SEC_MODE_SET_ENC_WITH_MITM(&attr_md.write_perm);
+
+        char_md.char_props.write         = 1;
+        char_md.char_props.write_wo_resp = 1;
+    }
+
+    attr.p_uuid    = &uuid;
+    attr.p_attr_md = &attr_md;
+    attr.init_len  = 1;
+    attr.max_len   = VALUE_MAX_LEN;
+
+    return sd_ble_gatts_characteristic_add(m_service_handle, &char_md, &attr, p_handles);
+}
+
+
+ret_code_t ble_xfer_init(nrf_fstorage_t const * p_fs)
+{
+    ble_uuid128_t const base = {BLE_XFER_UUID_BASE};
+    ble_uuid_t          uuid;
+    ble_opt_t           opt;
+    uint64_t            id;
+    ret_code_t          rc;
+
+    if (p_fs == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    m_p_fs = p_fs;
+
+    /* The passkey is shown by this device, and entered on the central. It is taken from the
+     * device ID, so that each device has its own, but keeps it across resets. */
+    id = ((uint64_t)NRF_FICR->DEVICEID[1] << 32) | NRF_FICR->DEVICEID[0];
+
+    for (uint32_t i = BLE_GAP_PASSKEY_LEN; i > 0; i--)
+    {
+        m_passkey[i - 1] = '0' + (id % 10);
+        id /= 10;
+    }
+
+    memset(&opt, 0x00, sizeof(opt));
+    opt.gap_opt.passkey.p_passkey = m_passkey;
+
+    rc = sd_ble_opt_set(BLE_GAP_OPT_PASSKEY, &opt);
+    if (rc != NRF_SUCCESS)
+    {
+        return rc;
+    }
+
+    nrf_ringbuf_init(&m_rx_buf);
+    nrf_ringbuf_init(&m_tx_buf);
+
+    rc = sd_ble_uuid_vs_add(&base, &m_uuid_type);
+    if (rc != NRF_SUCCESS)
+    {
+        return rc;
+    }
+
+    ble_xfer_uuid_get(&uuid);
+
+    rc = sd_ble_gatts_service_add(BLE_GATTS_SRVC_TYPE_PRIMARY, &uuid, &m_service_handle);
+    if (rc != NRF_SUCCESS)
+    {
+        return rc;
+    }
+
+    rc = char_add(BLE_XFER_UUID_RX, false, &m_rx_handles);
+    if (rc != NRF_SUCCESS)
+    {
+        return rc;
+    }
+
+    return char_add(BLE_XFER_UUID_TX, true, &m_tx_handles);
+}
+
+
+void ble_xfer_uuid_get(ble_uuid_t * p_uuid)
+{
+    p_uuid->type = m_uuid_type;
+    p_uuid->uuid = BLE_XFER_UUID_SERVICE;
+}
+
+
+bool ble_xfer_process(void)
+{
+    uint16_t const conn_handle = m_conn_handle;
+    bool           busy        = false;
+
+    /* The session belongs to the link it was started on. */
+    if (m_session && (conn_handle != m_session_conn))
+    {
+        xfer_stop();
+        m_session = false;
+
+        /* Whatever is left belongs to the link that was lost. */
+        nrf_ringbuf_init(&m_tx_buf);
+        rx_discard();
+    }
+
+    for (;;)
+    {
+        uint8_t data[64];
+        size_t  len = sizeof(data);
+
+        (void) nrf_ringbuf_cpy_get(&m_rx_buf, data, &len);
+        if (len == 0)
+        {
+            break;
+        }
+        busy = true;
+
+        /* The session ends once the host has closed it, and the next frame starts a new one. */
+        if (m_session && !xfer_is_active())
+        {
+            m_session = false;
+        }
+        if (!m_session)
+        {
+            if (xfer_start(m_p_fs, tx_put, NULL, BLE_XFER_WINDOW) != NRF_SUCCESS)
+            {
+                continue;
+            }
+            m_session      = true;
+            m_session_conn = conn_handle;
+        }
+
+        xfer_rx(data, len);
+    }
+
+    if (m_session)
+    {
+        xfer_process();
+    }
+
+    return tx_pump(conn_handle) || busy;
+}
+
+#else
+
+ret_code_t ble_xfer_init(nrf_fstorage_t const * p_fs)
+{
+    UNUSED_PARAMETER(p_fs);
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+
+void ble_xfer_uuid_get(ble_uuid_t * p_uuid)
+{
+    p_uuid->type = BLE_UUID_TYPE_UNKNOWN;
+    p_uuid->uuid = BLE_XFER_UUID_SERVICE;
+}
+
+
+bool ble_xfer_process(void)
+{
+    return false;
+}
+
+#endif // BLE_XFER_ENABLED
@@ -0,0 +1,84 @@
+#ifndef BLE_XFER_H__
+#define BLE_XFER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "ble.h"
+#include "nrf_fstorage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup ble_xfer BLE flash transfer service
+ * @{
+ *
+ * @brief   GATT service carrying the frames of @ref xfer over a BLE link.
+ *
+ * @details The service has two characteristics. The host writes the frames to the RX
+ *          characteristic, preferably with Write Without Response, and receives the replies
+ *          as notifications of the TX characteristic. Frames may be split over several writes
+ *          or notifications, and several frames may share one.
+ *
+ *          A transfer session starts with the first bytes written once the host has enabled
+ *          notifications, and ends when the host closes it or the link is lost. On connection,
+ *          the largest ATT MTU and data length the SoftDevice is configured for are requested,
+ *          as well as the 2 Mbps PHY, so that every connection event carries as much data as
+ *          the radio allows.
+ *
+ *          Bytes are exchanged with the SoftDevice from its event handler, but frames are
+ *          handled from @ref ble_xfer_process, in the main loop like all other users of the
+ *          flash.
+ *
+ *          Frames give access to the whole flash, so the service is left out unless
+ *          @ref BLE_XFER_ENABLED is set, and the characteristics can only be written once the
+ *          link is encrypted with authentication: the central pairs by entering the static
+ *          passkey of this device, six digits derived from its FICR device ID. The application
+ *          answers pairing requests with MITM protection and the display-only I/O capabilities,
+ *          and shows the passkey in the log when a pairing starts.
+ */
+
+
+#define BLE_XFER_UUID_SERVICE   0x0001  //!< 16-bit part of the UUID of the service.
+#define BLE_XFER_UUID_RX        0x0002  //!< 16-bit part of the UUID of the RX characteristic.
+#define BLE_XFER_UUID_TX        0x0003  //!< 16-bit part of the UUID of the TX characteristic.
+
+
+/**@brief   Function for adding the service to the GATT table.
+ *
+ * Must be called after the BLE stack has been enabled.
+ *
+ * @param[in]   p_fs    The fstorage instance to transfer to and from.
+ *
+ * @retval  NRF_SUCCESS             If the service was added.
+ * @retval  NRF_ERROR_NULL          If @p p_fs is NULL.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If @ref BLE_XFER_ENABLED is not set.
+ * @return  Any error returned by the SoftDevice when setting the passkey or adding the service.
+ */
+ret_code_t ble_xfer_init(nrf_fstorage_t const * p_fs);
+
+
+/**@brief   Function for retrieving the UUID of the service, e.g. to advertise it. */
+void ble_xfer_uuid_get(ble_uuid_t * p_uuid);
+
+
+/**@brief   Function for handling received frames and sending the replies.
+ *
+ * Call this function from the main loop.
+ *
+ * @retval  true    If bytes were received or sent. Call again before sleeping.
+ * @retval  false   If there was nothing to do.
+ */
+bool ble_xfer_process(void);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_XFER_H__
@@ -41,14 +41,30 @@
 #include <string.h>
 
 #include "app_error.h"
+#include "app_timer.h"
+#include "bench.h"
 #include "boards.h"
+#include "flash_queue.h"
+#include "flash_cache.h"
+#include "flash_chunk.h"
+#include "flash_journal.h"
+#include "flash_part.h"
+#include "flash_power.h"
+#include "flash_sim.h"
+#include "flash_span.h"
+#include "flash_submit.h"
+#include "flash_trace.h"
+#include "kv.h"
+#include "nordic_common.h"
 #include "nrf_cli.h"
 #include "nrf_cli_uart.h"
 #include "nrf_drv_uart.h"
 #include "nrf_fstorage.h"
 #include "nrf_soc.h"
 #include "nrf_strerror.h"
+#include "record_store.h"
 #include "sdk_config.h"
+#include "xfer.h"
 
 
 #define READ_HELP   "read bytes from flash\n"                                                     \
@@ -72,19 +88,157 @@
 #define ERASE_HELP  "erase flash pages\n"                                                         \
                     "usage: erase addr pages\n"                                                   \
                     "- addr: address of the page to begin erasing from, in HEX\n"                 \
-                    "- pages: number of pages to erase"
+                    "- pages: number of pages to erase\n"                                         \
+                    "pages of the record store lose their erase count"
 
-#define FLASHAREA_HELP  "print or set the boundaries of the flash\n"                              \
+#define DUMP_HELP   "dump flash in HEX format, 32 bytes per line\n"                               \
+                    "usage: dump addr [len]\n"                                                    \
+                    "- addr: the address to begin dumping from, in HEX\n"                         \
+                    "- len: number of bytes to dump; by default up to the end of the flash area"
+
+#define XFER_HELP   "enter binary transfer mode, to upload and download data in frames\n"         \
+                    "usage: xfer\n"                                                               \
+                    "the mode is left once the host closes the session, or after 5 s without data"
+
+#define FLASHAREA_HELP  "print the partitions of the flash, or set the one commands work on\n"    \
                         "usage: flasharea print\n"                                                \
-                        "usage: flasharea set begin end"
+                        "usage: flasharea set name"
 
-#define FLASHAREA_PRINT_HELP    "print the boundaries of the flash\n"                             \
+#define FLASHAREA_PRINT_HELP    "print the partitions, and the one the commands work on\n"        \
                                 "usage: flasharea print"
 
-#define FLASHAREA_SET_HELP  "set the boundaries of the flash\n"                                   \
-                            "usage: flasharea set begin end\n"                                    \
-                            "- begin: address of the beginning of the flash area, in HEX\n"       \
-                            "- end: address of end of the flash area, in HEX"
+#define FLASHAREA_SET_HELP  "set the partition the commands work on\n"                            \
+                            "usage: flasharea set name\n"                                         \
+                            "- name: name of the partition; the config partition cannot be set"
+
+#define STATS_HELP  "print or clear flash operation statistics\n"                                 \
+                    "usage: stats print\n"                                                        \
+                    "usage: stats reset"
+
+#define STATS_PRINT_HELP    "print flash latency histograms, queue statistics and energy use\n"   \
+                            "usage: stats print"
+
+#define STATS_RESET_HELP    "clear flash operation statistics\n"                                  \
+                            "usage: stats reset"
+
+#define BENCH_HELP  "run flash benchmarks over the flash area, printing CSV rows\n"               \
+                    "usage: bench all|write|random|read|erase|mixed\n"                            \
+                    "the first row names the columns\n"                                           \
+                    "erases the flash area; reset the device afterwards to restore the record store"
+
+#define BENCH_ALL_HELP  "run all workloads; mixed runs with advertising off and on\n"             \
+                        "usage: bench all"
+
+#define BENCH_WRITE_HELP    "write the flash area sequentially\n"                                 \
+                            "usage: bench write [size]\n"                                         \
+                            "- size: bytes per write, a multiple of 4; by default 4 B to 4 KB"
+
+#define BENCH_RANDOM_HELP   "write scattered blocks of the flash area, each one once\n"           \
+                            "usage: bench random [size [count]]\n"                                \
+                            "- size: bytes per write, a multiple of 4; 16 by default\n"           \
+                            "- count: number of writes; by default, the whole area"
+
+#define BENCH_READ_HELP "read the flash area sequentially\n"                                      \
+                        "usage: bench read [size]\n"                                              \
+                        "- size: bytes per read, a multiple of 4; 256 by default"
+
+#define BENCH_ERASE_HELP    "erase the flash area page by page\n"                                 \
+                            "usage: bench erase"
+
+#define BENCH_MIXED_HELP    "64 B writes over the flash area, each followed by four 256 B reads\n"\
+                            "usage: bench mixed [on|off]\n"                                       \
+                            "- on|off: advertise during the run, on SoftDevice targets"
+
+#define KV_HELP     "read, write or delete typed records of the record store\n"                   \
+                    "usage: kv u32|i32|str key [value]\n"                                         \
+                    "usage: kv hex key\n"                                                         \
+                    "usage: kv list key|log [min [max]]\n"                                        \
+                    "usage: kv delete key"
+
+#define KV_U32_HELP     "read or write an unsigned 32-bit integer, stored as a scalar record\n"   \
+                        "usage: kv u32 key [value]\n"                                             \
+                        "- key: key of the record, in HEX\n"                                      \
+                        "- value: value to write, in decimal or 0x-prefixed HEX; read if omitted"
+
+#define KV_I32_HELP     "read or write a signed 32-bit integer, stored as a scalar record\n"      \
+                        "usage: kv i32 key [value]\n"                                             \
+                        "- key: key of the record, in HEX\n"                                      \
+                        "- value: value to write, in decimal or 0x-prefixed HEX; read if omitted"
+
+#define KV_STR_HELP     "read or write a string\n"                                                \
+                        "usage: kv str key [text]\n"                                              \
+                        "- key: key of the record, in HEX\n"                                      \
+                        "- text: text to write; use quotes for spaces; read if omitted"
+
+#define KV_HEX_HELP     "print a record of any type in HEX format\n"                              \
+                        "usage: kv hex key\n"                                                     \
+                        "- key: key of the record, in HEX"
+
+#define KV_LIST_HELP    "print the records with keys in a range, and their data in HEX\n"         \
+                        "usage: kv list key|log [min [max]]\n"                                    \
+                        "- key|log: in key order, or in the order the records were written\n"     \
+                        "- min, max: smallest and largest key, in HEX; all keys by default"
+
+#define KV_DELETE_HELP  "delete a record of any type\n"                                           \
+                        "usage: kv delete key\n"                                                  \
+                        "- key: key of the record, in HEX"
+
+#define TRACE_HELP  "dump or clear the binary trace of flash operations\n"                        \
+                    "usage: trace dump\n"                                                         \
+                    "usage: trace clear"
+
+#define TRACE_DUMP_HELP "print the trace entries added since the last dump, as HEX words\n"       \
+                        "usage: trace dump\n"                                                     \
+                        "decode the output on the host with trace_decode.py"
+
+#define TRACE_CLEAR_HELP    "skip the trace entries added so far\n"                               \
+                            "usage: trace clear"
+
+#define SIM_HELP    "run the commands on a simulated flash, and inject faults into it\n"          \
+                    "usage: sim on|off|reset|restore|stats\n"                                     \
+                    "usage: sim fault one_in [seed]\n"                                            \
+                    "usage: sim cut us"
+
+#define SIM_ON_HELP     "point the commands at the simulated flash, the bench included\n"         \
+                        "usage: sim on"
+
+#define SIM_OFF_HELP    "point the commands back at the partition they were on\n"                 \
+                        "usage: sim off"
+
+#define SIM_RESET_HELP  "erase the simulated flash, clear its counters and switch it on\n"        \
+                        "usage: sim reset"
+
+#define SIM_FAULT_HELP  "fail operations with a timeout, as without a SoftDevice timeslot\n"      \
+                        "usage: sim fault one_in [seed]\n"                                        \
+                        "- one_in: operations per failure, on average; 0 to stop\n"               \
+                        "- seed: seed of the generator, to repeat a run"
+
+#define SIM_CUT_HELP    "cut the power in the middle of an operation\n"                           \
+                        "usage: sim cut us\n"                                                     \
+                        "- us: flash busy time before the cut, from the next operation on"
+
+#define SIM_RESTORE_HELP    "switch the power back on after a cut\n"                              \
+                            "usage: sim restore"
+
+#define SIM_STATS_HELP  "print the counters of the simulated flash and the wear of each page\n"   \
+                        "usage: sim stats"
+
+
+/* The UART sends one part of its TX buffer while the next lines of a dump are put in the rest. */
+#define CLI_UART_TX_BUF_SIZE    256
+/* Holds the frames the host sends ahead in binary transfer mode. */
+#define CLI_UART_RX_BUF_SIZE    512
+
+#define ERASE_FLUSH_TIMEOUT_MS  500                                 /**< Longest wait for room in the flash queue before an erase. */
+#define XFER_IDLE_TIMEOUT_MS    5000                                /**< Binary transfer mode is left after this long without data. */
+
+#define DUMP_LINE_BYTES         32                                  /**< Bytes of flash per line of a dump. */
+#define DUMP_LINE_LEN           (8 + 2 + 2 * DUMP_LINE_BYTES + 1)   /**< "addr: " + HEX + "\n" */
+
+#define KV_HEX_MAX_BYTES        (4 * DUMP_LINE_BYTES)               /**< Bytes of a record the kv commands copy to RAM at most. */
+
+#define BENCH_RANDOM_SIZE       16                                  /**< Default bytes per write of "bench random". */
+#define BENCH_READ_SIZE         256                                 /**< Default bytes per read of "bench read". */
 
 
 typedef enum
@@ -96,31 +250,33 @@ typedef enum
 
 extern nrf_fstorage_t fstorage;                                                                     /**< The fstorage instance, defined in main.c. */
 extern void wait_for_flash_ready(nrf_fstorage_t const *);                                           /**< Wait for flash operations to complete. Defined in main.c */
+#ifdef SOFTDEVICE_PRESENT
+extern bool advertising_set(bool enable);                                                           /**< Stop or resume advertising. Defined in main.c */
+extern bool advertising_is_on(void);                                                                /**< Whether advertising is running. Defined in main.c */
+#endif
 
 
-NRF_CLI_UART_DEF(cli_uart, 0, 64, 128);
+NRF_CLI_UART_DEF(cli_uart, 0, CLI_UART_TX_BUF_SIZE, CLI_UART_RX_BUF_SIZE);
 NRF_CLI_DEF(m_cli_uart, "fstorage example:~$ ", &cli_uart.transport, '\r', 4);
 
 void custom_read(uint32_t addr, uint32_t len) {
     printf("Reading addr: %x\r\n", addr);
-    ret_code_t rc;
-    uint8_t    data[256] = {0};
+    ret_code_t   rc;
+    flash_span_t span;
 
-    if (len > sizeof(data))
-    {
-        len = sizeof(data);
-    }
-    rc = nrf_fstorage_read(&fstorage, addr, data, len);
+    /* Read in place: flash is memory mapped. */
+    rc = flash_span_get(&fstorage, addr, len, &span);
     if (rc != NRF_SUCCESS) {
       printf("unsuccessful\r\n");
+      return;
     }
 
-    //printf("STR DATA: %s\n", data);
+    //printf("STR DATA: %.*s\n", span.len, span.p_data);
 
     printf("\nHEX DATA: 0x");
-    for (int32_t i = (len -1); i >= 0; i--)
+    for (int32_t i = (span.len -1); i >= 0; i--)
     {
-      printf("%x", data[i]);
+      printf("%x", span.p_data[i]);
     }
     printf("\n\n\n");
 }
@@ -177,20 +333,29 @@ static void cli_missing_param_help(nrf_cli_t const * p_cli, char const * p_cmd)
 
 static void fstorage_read(nrf_cli_t const * p_cli, uint32_t addr, uint32_t len, data_fmt_t fmt)
 {
-    ret_code_t rc;
-    uint8_t    data[256] = {0};
+    ret_code_t      rc;
+    uint8_t         data[256];
+    uint8_t const * p_data = data;
+    flash_span_t    span;
 
     if (len > sizeof(data))
     {
         len = sizeof(data);
     }
 
-    /* Read data. */
-    rc = nrf_fstorage_read(&fstorage, addr, data, len);
+    /* Read in place, unless writes to the range are still in the write cache or the queue. */
+    rc = flash_span_get(&fstorage, addr, len, &span);
+    if (rc == NRF_SUCCESS)
+    {
+        p_data = span.p_data;
+    }
+    else if (rc == NRF_ERROR_BUSY)
+    {
+        rc = flash_cache_read(&fstorage, addr, data, len);
+    }
     if (rc != NRF_SUCCESS)
     {
-        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "nrf_fstorage_read() returned: %s\n",
-                        nrf_strerror_get(rc));
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "read: %s\n", nrf_strerror_get(rc));
         return;
     }
 
@@ -201,14 +366,15 @@ static void fstorage_read(nrf_cli_t const * p_cli, uint32_t addr, uint32_t len,
             /* Print bytes. */
             for (uint32_t i = 0; i < len; i++)
             {
-                nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "0x%x ", data[i]);
+                nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "0x%x ", p_data[i]);
             }
             nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "\n");
         } break;
 
         case DATA_FMT_STR:
         {
-            nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%s\n", data);
+            /* Flash is not NUL-terminated. */
+            nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%.*s\n", (int)len, (char const *)p_data);
         } break;
 
         default:
@@ -217,6 +383,75 @@ static void fstorage_read(nrf_cli_t const * p_cli, uint32_t addr, uint32_t len,
 }
 
 
+/**@brief   Encode bytes as pairs of HEX digits.
+ *
+ * @return  Pointer to the end of the encoded text.
+ */
+static char * hex_encode(char * p_out, uint8_t const * p_in, uint32_t len)
+{
+    static char const digits[] = "0123456789abcdef";
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        *p_out++ = digits[p_in[i] >> 4];
+        *p_out++ = digits[p_in[i] & 0x0F];
+    }
+    return p_out;
+}
+
+
+static void fstorage_dump(nrf_cli_t const * p_cli, uint32_t addr, uint32_t len)
+{
+    flash_span_t span;
+
+    /* Flash is read in place, so let cached and queued writes reach it first. */
+    wait_for_flash_ready(&fstorage);
+
+    ret_code_t const rc = flash_span_get(&fstorage, addr, len, &span);
+    if ((rc == NRF_ERROR_INVALID_ADDR) || (rc == NRF_ERROR_INVALID_LENGTH))
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "dump: range is outside of the flash area.\n");
+        return;
+    }
+    if (rc != NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "dump: %s\n", nrf_strerror_get(rc));
+        return;
+    }
+
+    uint8_t const * const p_flash = span.p_data;
+    uint32_t        const start   = app_timer_cnt_get();
+
+    for (uint32_t off = 0; off < len; off += DUMP_LINE_BYTES)
+    {
+        uint32_t const line_addr = addr + off;
+        uint8_t  const addr_be[] =
+        {
+            (uint8_t)(line_addr >> 24), (uint8_t)(line_addr >> 16),
+            (uint8_t)(line_addr >> 8),  (uint8_t)line_addr,
+        };
+
+        char   line[DUMP_LINE_LEN];
+        char * p_end;
+
+        /* Bypass the formatting of nrf_cli_fprintf(), which prints a few bytes at a time. */
+        p_end    = hex_encode(line, addr_be, sizeof(addr_be));
+        *p_end++ = ':';
+        *p_end++ = ' ';
+        p_end    = hex_encode(p_end, &p_flash[off], MIN(DUMP_LINE_BYTES, len - off));
+        *p_end++ = '\n';
+
+        nrf_cli_print_stream(p_cli, line, p_end - line);
+    }
+
+    uint32_t const ticks = app_timer_cnt_diff_compute(app_timer_cnt_get(), start);
+    uint32_t const ms    = (uint32_t)(((uint64_t)ticks * 1000) / APP_TIMER_TICKS(1000));
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "dumped %u bytes in %u ms, %u bytes/s\n",
+                    len, ms, (ms > 0) ? (uint32_t)(((uint64_t)len * 1000) / ms) : len);
+}
+
+
 static uint32_t round_up_u32(uint32_t len)
 {
     if (len % sizeof(uint32_t))
@@ -228,19 +463,39 @@ static uint32_t round_up_u32(uint32_t len)
 }
 
 
-static void fstorage_write(nrf_cli_t const * p_cli, uint32_t addr, void const * p_data)
+static void fstorage_write(nrf_cli_t const * p_cli, uint32_t addr, flash_buf_t * p_buf, uint32_t len)
 {
     /* The following code snippet make sure that the length of the data we are writing to flash
      * is a multiple of the program unit of the flash peripheral (4 bytes).
      *
      * In case of non-string piece of data, use the sizeof operator instead of strlen.
      */
-    uint32_t len = round_up_u32(strlen(p_data));
+    len = round_up_u32(len);
+
+    ret_code_t rc;
+
+    if (len <= FLASH_CACHE_LINE_SIZE)
+    {
+        /* Small writes are coalesced in the write cache, and can be read back right away. */
+        rc = flash_cache_write(&fstorage, addr, p_buf->data, len, NULL, NULL);
+        if (rc != NRF_SUCCESS)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "flash_cache_write() returned: %s\n",
+                            nrf_strerror_get(rc));
+        }
+        return;
+    }
 
-    ret_code_t rc = nrf_fstorage_write(&fstorage, addr, p_data, len, NULL);
+    /* Cached writes go first. The queue then holds its own reference to the buffer until the
+     * write has completed. */
+    rc = flash_cache_sync();
+    if (rc == NRF_SUCCESS)
+    {
+        rc = flash_queue_write_buf(&fstorage, addr, p_buf, len, NULL, NULL);
+    }
     if (rc != NRF_SUCCESS)
     {
-        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "nrf_fstorage_write() returned: %s\n",
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "flash_queue_write_buf() returned: %s\n",
                         nrf_strerror_get(rc));
     }
 }
@@ -282,10 +537,20 @@ void custom_write(uint32_t addr, char argv) {
 
 static void fstorage_erase(nrf_cli_t const * p_cli, uint32_t addr, uint32_t pages_cnt)
 {
-    ret_code_t rc = nrf_fstorage_erase(&fstorage, addr, pages_cnt, NULL);
+    /* Cached writes and writes in the journal were issued before the erase, so they must be
+     * queued before it. */
+    ret_code_t rc = flash_cache_sync();
+    if (rc == NRF_SUCCESS)
+    {
+        rc = flash_journal_flush(ERASE_FLUSH_TIMEOUT_MS);
+    }
+    if (rc == NRF_SUCCESS)
+    {
+        rc = flash_queue_erase(&fstorage, addr, pages_cnt, NULL, NULL);
+    }
     if (rc != NRF_SUCCESS)
     {
-        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "nrf_fstorage_erase() returned: %s\n",
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "flash_queue_erase() returned: %s\n",
                         nrf_strerror_get(rc));
     }
 }
@@ -350,8 +615,6 @@ static void read_cmd_str(nrf_cli_t const * p_cli, size_t argc, char ** argv)
 
 static void write_cmd(nrf_cli_t const * p_cli, size_t argc, char ** argv)
 {
-    static uint8_t m_data[256];
-
     if (nrf_cli_help_requested(p_cli))
     {
         nrf_cli_help_print(p_cli, NULL, 0);
@@ -362,15 +625,24 @@ static void write_cmd(nrf_cli_t const * p_cli, size_t argc, char ** argv)
     }
     else
     {
+        /* The command line is reused for the next command, so the data is moved into a buffer
+         * that stays alive until the write has completed. */
+        flash_buf_t * const p_buf = flash_buf_alloc();
+        if (p_buf == NULL)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "write: no free buffers, try again later.\n");
+            return;
+        }
+
         uint32_t const addr = strtol(argv[1], NULL, 16);
-        uint32_t const len  = strlen(argv[2]) < sizeof(m_data) ?
-                              strlen(argv[2]) : sizeof(m_data);
+        uint32_t const len  = strlen(argv[2]) < sizeof(p_buf->data) ?
+                              strlen(argv[2]) : sizeof(p_buf->data);
 
-        /* Copy data to a static variable. */
-        memset(m_data, 0x00, sizeof(m_data));
-        memcpy(m_data, argv[2], len);
+        memset(p_buf->data, 0x00, sizeof(p_buf->data));
+        memcpy(p_buf->data, argv[2], len);
 
-        fstorage_write(p_cli, addr, m_data);
+        fstorage_write(p_cli, addr, p_buf, len);
+        flash_buf_release(p_buf);
     }
 
 }
@@ -396,6 +668,78 @@ static void erase_cmd(nrf_cli_t const * p_cli, size_t argc, char ** argv)
 }
 
 
+static void dump_cmd(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else if ((argc != 2) && (argc != 3))
+    {
+        cli_missing_param_help(p_cli, "dump");
+    }
+    else
+    {
+        uint32_t const addr = strtol(argv[1], NULL, 16);
+        uint32_t const len  = (argc == 3) ? (uint32_t)strtol(argv[2], NULL, 10) :
+                                            (fstorage.end_addr + 1 - addr);
+
+        fstorage_dump(p_cli, addr, len);
+    }
+}
+
+
+static void xfer_cmd(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc != 1)
+    {
+        cli_unknown_param_help(p_cli, argv[1], "xfer");
+        return;
+    }
+
+    /* Replies are written to the UART as they are, like the lines of a dump. */
+    ret_code_t rc = xfer_start(&fstorage, nrf_cli_print_stream, p_cli, XFER_WINDOW);
+    if (rc != NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "xfer_start() returned: %s\n", nrf_strerror_get(rc));
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "binary transfer mode\n");
+
+    /* Bytes are taken from the transport directly, so that the CLI neither echoes nor parses
+     * them. Log messages wait in the log buffer meanwhile. */
+    nrf_cli_transport_t const * const p_transport = &cli_uart.transport;
+    uint32_t                          last_rx     = app_timer_cnt_get();
+
+    while (xfer_is_active())
+    {
+        uint8_t data[64];
+        size_t  cnt = 0;
+
+        (void) p_transport->p_api->read(p_transport, data, sizeof(data), &cnt);
+        if (cnt > 0)
+        {
+            xfer_rx(data, cnt);
+            last_rx = app_timer_cnt_get();
+        }
+        else if (app_timer_cnt_diff_compute(app_timer_cnt_get(), last_rx)
+                 >= APP_TIMER_TICKS(XFER_IDLE_TIMEOUT_MS))
+        {
+            xfer_stop();
+        }
+        xfer_process();
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "\nleft binary transfer mode\n");
+}
+
+
 static void flasharea_cmd(nrf_cli_t const * p_cli, size_t argc, char ** argv)
 {
     if (nrf_cli_help_requested(p_cli))
@@ -415,51 +759,1152 @@ static void flasharea_cmd(nrf_cli_t const * p_cli, size_t argc, char ** argv)
 
 static void flasharea_cmd_print(nrf_cli_t const * p_cli, size_t argc, char ** argv)
 {
+    static char const * const policy_names[] = {"kv", "log", "raw"};
+
     if (nrf_cli_help_requested(p_cli))
     {
         nrf_cli_help_print(p_cli, NULL, 0);
+        return;
     }
-    else
+
+    for (uint32_t i = 0; i < FLASH_PART_COUNT; i++)
     {
-        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "begin: %x, end: %x\n",
-                        fstorage.start_addr, fstorage.end_addr);
+        flash_part_t const * const p_part = flash_part_get((flash_part_id_t)i);
+
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%-6s %-3s begin: %x, end: %x, %u pages\n",
+                        p_part->p_name, policy_names[p_part->policy],
+                        p_part->p_fs->start_addr, p_part->p_fs->end_addr, p_part->pages);
     }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "current: begin: %x, end: %x\n",
+                    fstorage.start_addr, fstorage.end_addr);
 }
 
 
 static void flasharea_cmd_set(nrf_cli_t const * p_cli, size_t argc, char ** argv)
 {
+    flash_part_t const * p_part;
+
     if (nrf_cli_help_requested(p_cli))
     {
         nrf_cli_help_print(p_cli, NULL, 0);
+        return;
     }
-    else if (argc != 3)
+
+    if (argc != 2)
     {
         cli_missing_param_help(p_cli, "flasharea set");
+        return;
+    }
+
+    p_part = flash_part_find(argv[1]);
+    if (p_part == NULL)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: no such partition\n", argv[1]);
+        return;
+    }
+
+    /* The bounds of the simulated flash are not those of a partition. */
+    if (flash_sim_is_attached())
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "the simulated flash is in use; sim off first\n");
+        return;
+    }
+
+    /* The record store owns its partition; raw writes would corrupt its records. */
+    if (p_part->policy == FLASH_PART_POLICY_KV)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: partition owned by the record store\n",
+                        argv[1]);
+        return;
+    }
+
+    fstorage.start_addr = p_part->p_fs->start_addr;
+    fstorage.end_addr   = p_part->p_fs->end_addr;
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "begin: %x, end: %x\n",
+                    fstorage.start_addr, fstorage.end_addr);
+}
+
+static void kv_cmd(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else if (argc == 1)
+    {
+        cli_missing_param_help(p_cli, "kv");
     }
     else
     {
-        fstorage.start_addr = strtol(argv[1], NULL, 16);
-        fstorage.end_addr   = strtol(argv[2], NULL, 16);
+        cli_unknown_param_help(p_cli, argv[1], "kv");
+    }
+}
 
-        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "begin: %x, end: %x\n",
-                        fstorage.start_addr, fstorage.end_addr);
+
+/**@brief   Parse the key of a kv subcommand.
+ *
+ * @return  The key, or zero if it is not valid, after printing an error.
+ */
+static uint16_t kv_key_parse(nrf_cli_t const * p_cli, char const * p_arg)
+{
+    uint32_t const key = strtoul(p_arg, NULL, 16);
+
+    if ((key < RECORD_STORE_KEY_MIN) || (key > RECORD_STORE_KEY_MAX))
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%s: key must be between %x and %x\n",
+                        p_arg, RECORD_STORE_KEY_MIN, RECORD_STORE_KEY_MAX);
+        return 0;
     }
+    return (uint16_t)key;
 }
 
 
-NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_read_cmd)
+/**@brief   Print the data of a record in HEX format, a line of a dump at a time. */
+static void kv_data_print(nrf_cli_t const * p_cli, uint8_t const * p_data, uint32_t len)
 {
-    NRF_CLI_CMD(hex, NULL, READ_HEX_HELP, read_cmd_hex),
-    NRF_CLI_CMD(str, NULL, READ_STR_HELP, read_cmd_str),
-    NRF_CLI_SUBCMD_SET_END
-};
+    for (uint32_t off = 0; off < len; off += DUMP_LINE_BYTES)
+    {
+        char         line[2 * DUMP_LINE_BYTES + 1];
+        char * const p_end = hex_encode(line, &p_data[off], MIN(DUMP_LINE_BYTES, len - off));
+
+        *p_end = '\n';
+        nrf_cli_print_stream(p_cli, line, p_end + 1 - line);
+    }
+}
 
 
-NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_flasharea_cmd)
+/**@brief   Handle "kv u32" and "kv i32", which only differ in how values are parsed and printed. */
+static void kv_cmd_int(nrf_cli_t const * p_cli, size_t argc, char ** argv, bool is_signed)
 {
-    NRF_CLI_CMD(print, NULL, FLASHAREA_PRINT_HELP, flasharea_cmd_print),
-    NRF_CLI_CMD(set,   NULL, FLASHAREA_SET_HELP,   flasharea_cmd_set),
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if ((argc != 2) && (argc != 3))
+    {
+        cli_missing_param_help(p_cli, is_signed ? "kv i32" : "kv u32");
+        return;
+    }
+
+    uint16_t const key = kv_key_parse(p_cli, argv[1]);
+    ret_code_t     rc;
+
+    if (key == 0)
+    {
+        return;
+    }
+
+    if (argc == 3)
+    {
+        rc = is_signed ? kv_put_i32(key, strtol(argv[2], NULL, 0))
+                       : kv_put_u32(key, strtoul(argv[2], NULL, 0));
+    }
+    else if (is_signed)
+    {
+        int32_t value;
+
+        rc = kv_get_i32(key, &value);
+        if (rc == NRF_SUCCESS)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%d\n", value);
+        }
+    }
+    else
+    {
+        uint32_t value;
+
+        rc = kv_get_u32(key, &value);
+        if (rc == NRF_SUCCESS)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%u (0x%x)\n", value, value);
+        }
+    }
+
+    if (rc != NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "kv: %s\n", nrf_strerror_get(rc));
+    }
+}
+
+
+static void kv_cmd_u32(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    kv_cmd_int(p_cli, argc, argv, false);
+}
+
+
+static void kv_cmd_i32(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    kv_cmd_int(p_cli, argc, argv, true);
+}
+
+
+static void kv_cmd_str(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if ((argc != 2) && (argc != 3))
+    {
+        cli_missing_param_help(p_cli, "kv str");
+        return;
+    }
+
+    uint16_t const key = kv_key_parse(p_cli, argv[1]);
+    ret_code_t     rc;
+
+    if (key == 0)
+    {
+        return;
+    }
+
+    if (argc == 3)
+    {
+        rc = kv_put_str(key, argv[2]);
+    }
+    else
+    {
+        char str[128];
+
+        rc = kv_get_str(key, str, sizeof(str));
+        if ((rc == NRF_SUCCESS) || (rc == NRF_ERROR_DATA_SIZE))
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%s%s\n", str,
+                            (rc == NRF_SUCCESS) ? "" : "...");
+            rc = NRF_SUCCESS;
+        }
+    }
+
+    if (rc != NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "kv: %s\n", nrf_strerror_get(rc));
+    }
+}
+
+
+static void kv_cmd_hex(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc != 2)
+    {
+        cli_missing_param_help(p_cli, "kv hex");
+        return;
+    }
+
+    uint16_t const key = kv_key_parse(p_cli, argv[1]);
+
+    if (key == 0)
+    {
+        return;
+    }
+
+    uint8_t    data[KV_HEX_MAX_BYTES];
+    uint16_t   len = sizeof(data);
+    ret_code_t rc  = kv_get_blob(key, data, &len);
+
+    if ((rc != NRF_SUCCESS) && (rc != NRF_ERROR_DATA_SIZE))
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "kv: %s\n", nrf_strerror_get(rc));
+        return;
+    }
+
+    kv_data_print(p_cli, data, MIN(len, sizeof(data)));
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%u bytes%s\n", len,
+                    (len > sizeof(data)) ? ", only the first ones shown" : "");
+}
+
+
+static void kv_cmd_list(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if ((argc < 2) || (argc > 4))
+    {
+        cli_missing_param_help(p_cli, "kv list");
+        return;
+    }
+
+    record_store_order_t order;
+
+    if (strcmp(argv[1], "key") == 0)
+    {
+        order = RECORD_STORE_ORDER_KEY;
+    }
+    else if (strcmp(argv[1], "log") == 0)
+    {
+        order = RECORD_STORE_ORDER_LOG;
+    }
+    else
+    {
+        cli_unknown_param_help(p_cli, argv[1], "kv list");
+        return;
+    }
+
+    uint32_t const key_min = (argc > 2) ? strtoul(argv[2], NULL, 16) : RECORD_STORE_KEY_MIN;
+    uint32_t const key_max = (argc > 3) ? strtoul(argv[3], NULL, 16) : RECORD_STORE_KEY_MAX;
+
+    record_store_cursor_t cursor;
+    ret_code_t            rc = record_store_cursor_init(&cursor, order,
+                                                        (uint16_t)MIN(key_min, UINT16_MAX),
+                                                        (uint16_t)MIN(key_max, UINT16_MAX));
+    if (rc == NRF_ERROR_INVALID_STATE)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "kv: the index is full, list in log order\n");
+        return;
+    }
+    if (rc != NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "kv: %s\n", nrf_strerror_get(rc));
+        return;
+    }
+
+    /* The cursor only sees records that have reached flash. */
+    wait_for_flash_ready(&fstorage);
+
+    uint32_t     count = 0;
+    uint16_t     key;
+    flash_span_t span;
+
+    /* The data is printed from flash, one record at a time. */
+    while ((rc = record_store_cursor_next(&cursor, &key, &span)) != NRF_ERROR_NOT_FOUND)
+    {
+        if (rc == NRF_ERROR_INVALID_STATE)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "kv: the index filled up, list in log order\n");
+            break;
+        }
+
+        count++;
+
+        if (rc == NRF_SUCCESS)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%04x: %u bytes\n", key, span.len);
+            kv_data_print(p_cli, span.p_data, span.len);
+            continue;
+        }
+
+        /* Compressed records are read through a buffer. */
+        uint8_t  data[KV_HEX_MAX_BYTES];
+        uint16_t len = sizeof(data);
+
+        if ((rc == NRF_ERROR_NOT_SUPPORTED) || (rc == NRF_ERROR_BUSY))
+        {
+            rc = kv_get_blob(key, data, &len);
+        }
+        if ((rc != NRF_SUCCESS) && (rc != NRF_ERROR_DATA_SIZE))
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "%04x: %s\n", key, nrf_strerror_get(rc));
+            continue;
+        }
+
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%04x: %u bytes%s\n", key, len,
+                        (len > sizeof(data)) ? ", only the first ones shown" : "");
+        kv_data_print(p_cli, data, MIN(len, sizeof(data)));
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%u records\n", count);
+}
+
+
+static void kv_cmd_delete(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc != 2)
+    {
+        cli_missing_param_help(p_cli, "kv delete");
+        return;
+    }
+
+    uint16_t const key = kv_key_parse(p_cli, argv[1]);
+
+    if (key != 0)
+    {
+        ret_code_t const rc = kv_delete(key);
+
+        if (rc != NRF_SUCCESS)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "kv: %s\n", nrf_strerror_get(rc));
+        }
+    }
+}
+
+
+static uint32_t ticks_to_us(uint32_t ticks)
+{
+    return (uint32_t)(((uint64_t)ticks * 1000000) / APP_TIMER_TICKS(1000));
+}
+
+
+static void stats_op_print(nrf_cli_t              const * p_cli,
+                           char                   const * p_name,
+                           char                   const * p_unit,
+                           flash_queue_op_stats_t const * p_stats)
+{
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%s: %u ops, %u failed, %u %s\n",
+                    p_name, p_stats->count, p_stats->failed, p_stats->units, p_unit);
+
+    if (p_stats->count == 0)
+    {
+        return;
+    }
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "  latency: avg %u us, max %u us\n",
+                    ticks_to_us(p_stats->ticks_total / p_stats->count),
+                    ticks_to_us(p_stats->ticks_max));
+
+    /* Bucket i holds latencies from 2^(i-1) ticks up to, but excluding, 2^i ticks. */
+    for (uint32_t i = 0; i < FLASH_QUEUE_STATS_BUCKETS; i++)
+    {
+        if (p_stats->hist[i] == 0)
+        {
+            continue;
+        }
+
+        uint32_t const lo = (i == 0) ? 0 : ticks_to_us(1UL << (i - 1));
+
+        if (i == FLASH_QUEUE_STATS_BUCKETS - 1)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "  %7u us and more:  %u\n",
+                            lo, p_stats->hist[i]);
+        }
+        else
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "  %7u - %7u us: %u\n",
+                            lo, ticks_to_us(1UL << i), p_stats->hist[i]);
+        }
+    }
+}
+
+
+static void stats_cmd(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else if (argc == 1)
+    {
+        cli_missing_param_help(p_cli, "stats");
+    }
+    else
+    {
+        cli_unknown_param_help(p_cli, argv[1], "stats");
+    }
+}
+
+
+static void stats_cmd_print(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    flash_queue_stats_t  stats;
+    flash_journal_stat_t journal;
+    flash_chunk_stat_t   chunk;
+    flash_power_stat_t   power;
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    ret_code_t const rc = flash_queue_stats_get(&stats);
+    if (rc != NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "flash_queue_stats_get() returned: %s\n",
+                        nrf_strerror_get(rc));
+        return;
+    }
+
+    stats_op_print(p_cli, "write", "bytes", &stats.write);
+    stats_op_print(p_cli, "erase", "pages", &stats.erase);
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL,
+                    "queue: %u requests, %u rejected, %u retried\n"
+                    "  most queued: %u ops, %u in flight, %u staged bytes\n"
+                    "  %u reordered, %u late\n",
+                    stats.requests, stats.rejected, stats.retries,
+                    stats.ops_max, stats.in_flight_max, stats.stage_max,
+                    stats.reordered, stats.late);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "submit: %u dropped\n", flash_submit_dropped_get());
+
+    if (flash_journal_stat_get(&journal) == NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL,
+                        "journal: %u/%u bytes used, most %u\n"
+                        "  %u writes, %u dropped (%u bytes), %u failed\n",
+                        journal.used, journal.size, journal.used_max,
+                        journal.writes, journal.dropped, journal.dropped_bytes, journal.failed);
+    }
+
+    if (flash_chunk_stat_get(&chunk) == NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL,
+                        "chunk: %u bytes (cap %u, smallest %u)\n"
+                        "  %u chunks, %u slow, %u timed out, %u bytes/s\n",
+                        chunk.size, chunk.cap, chunk.size_min,
+                        chunk.chunks, chunk.slow, chunk.timeouts,
+                        (chunk.busy_us > 0) ?
+                        (uint32_t)(((uint64_t)chunk.bytes * 1000000) / chunk.busy_us) : 0);
+    }
+
+    if (flash_power_stat_get(&power) == NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL,
+                        "power: %u ms awake, %u ms asleep, %u wakeups\n"
+                        "  ~%u uA, ~%u uC, ~%u uC/KB written\n",
+                        power.awake_ms, power.asleep_ms, power.wakeups,
+                        power.avg_ua, power.charge_uc, power.uc_per_kb);
+    }
+}
+
+
+static void stats_cmd_reset(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else
+    {
+        flash_queue_stats_reset();
+        flash_journal_stat_reset();
+        flash_chunk_stat_reset();
+        flash_power_stat_reset();
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "stats cleared\n");
+    }
+}
+
+/* Sizes of the writes of "bench write", when none is given. */
+static uint32_t const m_bench_write_sizes[] = {4, 16, 64, 256, 1024, 4096};
+
+
+static char const * bench_adv_state(void)
+{
+#ifdef SOFTDEVICE_PRESENT
+    return advertising_is_on() ? "on" : "off";
+#else
+    return "-";
+#endif
+}
+
+
+/**@brief   Wait for the flash to be idle and print the setup and the names of the columns. */
+static void bench_begin(nrf_cli_t const * p_cli)
+{
+    wait_for_flash_ready(&fstorage);
+
+    if (flash_sim_is_attached())
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "# backend sim, queue %u", FLASH_SIM_QUEUE_SIZE);
+    }
+    else
+    {
+#ifdef SOFTDEVICE_PRESENT
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "# backend sd, max write %u bytes",
+                        NRF_FSTORAGE_SD_MAX_WRITE_SIZE);
+#else
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "# backend nvmc");
+#endif
+    }
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, ", area %x-%x, page %u bytes\n",
+                    fstorage.start_addr, fstorage.end_addr, fstorage.p_flash_info->erase_unit);
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL,
+                    "bench,workload,size,adv,ops,bytes,ms,ops_per_s,mb_per_s,p50_us,p99_us\n");
+}
+
+
+/**@brief   Print the result of a workload as a CSV row, or the error it failed with.
+ *
+ * @return  Whether the workload succeeded.
+ */
+static bool bench_report(nrf_cli_t      const * p_cli,
+                         char           const * p_name,
+                         uint32_t               size,
+                         ret_code_t             rc,
+                         bench_result_t const * p_result)
+{
+    if (rc != NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "bench %s: %s\n", p_name, nrf_strerror_get(rc));
+        return false;
+    }
+
+    uint32_t const us      = MAX(p_result->time_us, 1);
+    uint32_t const ops_s   = (uint32_t)(((uint64_t)p_result->ops * 1000000) / us);
+    /* Bytes per microsecond are megabytes per second. */
+    uint32_t const mb_s    = p_result->bytes / us;
+    uint32_t const mb_frac = (uint32_t)(((uint64_t)(p_result->bytes % us) * 1000) / us);
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "bench,%s,%u,%s,%u,%u,%u,%u,%u.%03u,%u,%u\n",
+                    p_name, size, bench_adv_state(), p_result->ops, p_result->bytes,
+                    p_result->time_us / 1000, ops_s, mb_s, mb_frac,
+                    p_result->p50_us, p_result->p99_us);
+    return true;
+}
+
+
+static bool bench_write_run(nrf_cli_t const * p_cli, uint32_t size)
+{
+    bench_result_t result;
+    ret_code_t     rc = bench_write_seq(&fstorage, size, &result);
+
+    return bench_report(p_cli, "write", size, rc, &result);
+}
+
+
+static bool bench_write_sweep(nrf_cli_t const * p_cli)
+{
+    uint32_t const area = fstorage.end_addr + 1 - fstorage.start_addr;
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(m_bench_write_sizes); i++)
+    {
+        uint32_t const size = m_bench_write_sizes[i];
+
+        if ((size <= BENCH_BUF_SIZE) && (size <= area) && !bench_write_run(p_cli, size))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static bool bench_random_run(nrf_cli_t const * p_cli, uint32_t size, uint32_t count)
+{
+    bench_result_t result;
+    ret_code_t     rc = bench_write_random(&fstorage, size, count, &result);
+
+    return bench_report(p_cli, "random", size, rc, &result);
+}
+
+
+static bool bench_read_run(nrf_cli_t const * p_cli, uint32_t size)
+{
+    bench_result_t result;
+    ret_code_t     rc = bench_read_seq(&fstorage, size, &result);
+
+    return bench_report(p_cli, "read", size, rc, &result);
+}
+
+
+static bool bench_erase_run(nrf_cli_t const * p_cli)
+{
+    bench_result_t result;
+    ret_code_t     rc = bench_erase_seq(&fstorage, &result);
+
+    return bench_report(p_cli, "erase", fstorage.p_flash_info->erase_unit, rc, &result);
+}
+
+
+static bool bench_mixed_run(nrf_cli_t const * p_cli)
+{
+    bench_result_t write;
+    bench_result_t read;
+    ret_code_t     rc = bench_mixed(&fstorage, &write, &read);
+
+    return    bench_report(p_cli, "mixed-write", BENCH_MIXED_WRITE_SIZE, rc, &write)
+           && bench_report(p_cli, "mixed-read",  BENCH_MIXED_READ_SIZE,  rc, &read);
+}
+
+
+static void bench_cmd(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else if (argc == 1)
+    {
+        cli_missing_param_help(p_cli, "bench");
+    }
+    else
+    {
+        cli_unknown_param_help(p_cli, argv[1], "bench");
+    }
+}
+
+
+static void bench_cmd_all(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    bench_begin(p_cli);
+
+    /* Stop at the first workload that fails. */
+    if (   bench_write_sweep(p_cli)
+        && bench_random_run(p_cli, BENCH_RANDOM_SIZE, 0)
+        && bench_read_run(p_cli, BENCH_READ_SIZE)
+        && bench_erase_run(p_cli))
+    {
+#ifdef SOFTDEVICE_PRESENT
+        bool const adv = advertising_set(false);
+
+        if (bench_mixed_run(p_cli))
+        {
+            (void) advertising_set(true);
+            (void) bench_mixed_run(p_cli);
+        }
+        (void) advertising_set(adv);
+#else
+        (void) bench_mixed_run(p_cli);
+#endif
+    }
+}
+
+
+static void bench_cmd_write(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else if (argc > 2)
+    {
+        cli_unknown_param_help(p_cli, argv[2], "bench write");
+    }
+    else
+    {
+        bench_begin(p_cli);
+        if (argc == 2)
+        {
+            (void) bench_write_run(p_cli, (uint32_t)strtol(argv[1], NULL, 10));
+        }
+        else
+        {
+            (void) bench_write_sweep(p_cli);
+        }
+    }
+}
+
+
+static void bench_cmd_random(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else if (argc > 3)
+    {
+        cli_unknown_param_help(p_cli, argv[3], "bench random");
+    }
+    else
+    {
+        uint32_t const size  = (argc > 1) ? (uint32_t)strtol(argv[1], NULL, 10) : BENCH_RANDOM_SIZE;
+        uint32_t const count = (argc > 2) ? (uint32_t)strtol(argv[2], NULL, 10) : 0;
+
+        bench_begin(p_cli);
+        (void) bench_random_run(p_cli, size, count);
+    }
+}
+
+
+static void bench_cmd_read(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else if (argc > 2)
+    {
+        cli_unknown_param_help(p_cli, argv[2], "bench read");
+    }
+    else
+    {
+        bench_begin(p_cli);
+        (void) bench_read_run(p_cli, (argc == 2) ? (uint32_t)strtol(argv[1], NULL, 10) :
+                                                   BENCH_READ_SIZE);
+    }
+}
+
+
+static void bench_cmd_erase(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else if (argc > 1)
+    {
+        cli_unknown_param_help(p_cli, argv[1], "bench erase");
+    }
+    else
+    {
+        bench_begin(p_cli);
+        (void) bench_erase_run(p_cli);
+    }
+}
+
+
+static void bench_cmd_mixed(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else if ((argc > 2) || ((argc == 2) && strcmp(argv[1], "on") && strcmp(argv[1], "off")))
+    {
+        cli_unknown_param_help(p_cli, argv[argc - 1], "bench mixed");
+    }
+    else
+    {
+#ifdef SOFTDEVICE_PRESENT
+        bool const adv = advertising_is_on();
+
+        if (argc == 2)
+        {
+            (void) advertising_set(strcmp(argv[1], "on") == 0);
+        }
+        bench_begin(p_cli);
+        (void) bench_mixed_run(p_cli);
+        (void) advertising_set(adv);
+#else
+        bench_begin(p_cli);
+        (void) bench_mixed_run(p_cli);
+#endif
+    }
+}
+
+
+/* Sequence number of the first trace entry "trace dump" prints. */
+static uint32_t m_trace_seq;
+
+
+static void trace_cmd(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else if (argc == 1)
+    {
+        cli_missing_param_help(p_cli, "trace");
+    }
+    else
+    {
+        cli_unknown_param_help(p_cli, argv[1], "trace");
+    }
+}
+
+
+static void trace_cmd_dump(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    flash_trace_entry_t entry;
+    uint32_t            lost = 0;
+    ret_code_t          rc;
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    /* The header tells the decoder how fast the timestamps count. */
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "# flash_trace %u Hz\n", APP_TIMER_TICKS(1000));
+
+    /* Entries added while dumping are printed too. */
+    for (;;)
+    {
+        uint32_t const seq = m_trace_seq;
+
+        rc = flash_trace_read(&m_trace_seq, &entry);
+        if (rc != NRF_SUCCESS)
+        {
+            break;
+        }
+
+        /* Entries skipped were overwritten before they could be printed. */
+        lost += entry.seq - seq;
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "%08x %08x %08x %08x\n",
+                        entry.seq, entry.stamp, entry.arg[0], entry.arg[1]);
+    }
+
+    if (rc != NRF_ERROR_NOT_FOUND)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "trace: %s\n", nrf_strerror_get(rc));
+    }
+    else if (lost > 0)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "# %u entries lost\n", lost);
+    }
+}
+
+
+static void trace_cmd_clear(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else
+    {
+        m_trace_seq = flash_trace_next();
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "trace cleared\n");
+    }
+}
+
+
+static void sim_cmd(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else if (argc == 1)
+    {
+        cli_missing_param_help(p_cli, "sim");
+    }
+    else
+    {
+        cli_unknown_param_help(p_cli, argv[1], "sim");
+    }
+}
+
+
+/**@brief   Print the error a sim subcommand failed with, if any. */
+static void sim_rc_print(nrf_cli_t const * p_cli, char const * p_name, ret_code_t rc)
+{
+    if (rc != NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_ERROR, "sim %s: %s\n", p_name, nrf_strerror_get(rc));
+    }
+}
+
+
+static void sim_cmd_on(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    /* Writes cached or queued for the partition must reach it first. */
+    wait_for_flash_ready(&fstorage);
+
+    ret_code_t const rc = flash_sim_attach(&fstorage);
+    if (rc == NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "begin: %x, end: %x, page %u bytes\n",
+                        fstorage.start_addr, fstorage.end_addr, fstorage.p_flash_info->erase_unit);
+    }
+    sim_rc_print(p_cli, "on", rc);
+}
+
+
+static void sim_cmd_off(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    wait_for_flash_ready(&fstorage);
+
+    ret_code_t const rc = flash_sim_detach();
+    if (rc == NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "begin: %x, end: %x\n",
+                        fstorage.start_addr, fstorage.end_addr);
+    }
+    sim_rc_print(p_cli, "off", rc);
+}
+
+
+static void sim_cmd_reset(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    ret_code_t const rc = flash_sim_reset();
+    if (rc == NRF_SUCCESS)
+    {
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "simulated flash erased\n");
+    }
+    sim_rc_print(p_cli, "reset", rc);
+}
+
+
+static void sim_cmd_fault(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if ((argc != 2) && (argc != 3))
+    {
+        cli_missing_param_help(p_cli, "sim fault");
+        return;
+    }
+
+    flash_sim_fault_set(strtoul(argv[1], NULL, 0), (argc == 3) ? strtoul(argv[2], NULL, 0) : 0);
+}
+
+
+static void sim_cmd_cut(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+    if (argc != 2)
+    {
+        cli_missing_param_help(p_cli, "sim cut");
+        return;
+    }
+
+    sim_rc_print(p_cli, "cut", flash_sim_cut(strtoul(argv[1], NULL, 0)));
+}
+
+
+static void sim_cmd_restore(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+    }
+    else
+    {
+        flash_sim_restore();
+    }
+}
+
+
+static void sim_cmd_stats(nrf_cli_t const * p_cli, size_t argc, char ** argv)
+{
+    flash_sim_stat_t stat;
+
+    if (nrf_cli_help_requested(p_cli))
+    {
+        nrf_cli_help_print(p_cli, NULL, 0);
+        return;
+    }
+
+    ret_code_t const rc = flash_sim_stat_get(&stat);
+    if (rc != NRF_SUCCESS)
+    {
+        sim_rc_print(p_cli, "stats", rc);
+        return;
+    }
+
+    uint32_t const mean = (stat.wear_total * 100) / FLASH_SIM_PAGES;
+
+    nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL,
+                    "sim: %s, %s\n"
+                    "  %u writes, %u bytes, %u pages erased, %u overwrites\n"
+                    "  %u timed out, %u power cuts, %u ms busy\n"
+                    "  erases per page: %u min, %u.%02u mean, %u max\n",
+                    flash_sim_is_attached() ? "on" : "off",
+                    flash_sim_is_off() ? "power off" : "power on",
+                    stat.writes, stat.bytes, stat.erases, stat.overwrites,
+                    stat.timeouts, stat.cuts, stat.busy_us / 1000,
+                    stat.wear_min, mean / 100, mean % 100, stat.wear_max);
+
+    /* Eight pages per line, like the words of a dump. */
+    for (uint32_t page = 0; page < FLASH_SIM_PAGES; page++)
+    {
+        if ((page % 8) == 0)
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "  %3u:", page);
+        }
+        nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, " %u", flash_sim_wear_get(page));
+        if (((page % 8) == 7) || (page == FLASH_SIM_PAGES - 1))
+        {
+            nrf_cli_fprintf(p_cli, NRF_CLI_NORMAL, "\n");
+        }
+    }
+}
+
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_read_cmd)
+{
+    NRF_CLI_CMD(hex, NULL, READ_HEX_HELP, read_cmd_hex),
+    NRF_CLI_CMD(str, NULL, READ_STR_HELP, read_cmd_str),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_flasharea_cmd)
+{
+    NRF_CLI_CMD(print, NULL, FLASHAREA_PRINT_HELP, flasharea_cmd_print),
+    NRF_CLI_CMD(set,   NULL, FLASHAREA_SET_HELP,   flasharea_cmd_set),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_kv_cmd)
+{
+    NRF_CLI_CMD(u32,    NULL, KV_U32_HELP,    kv_cmd_u32),
+    NRF_CLI_CMD(i32,    NULL, KV_I32_HELP,    kv_cmd_i32),
+    NRF_CLI_CMD(str,    NULL, KV_STR_HELP,    kv_cmd_str),
+    NRF_CLI_CMD(hex,    NULL, KV_HEX_HELP,    kv_cmd_hex),
+    NRF_CLI_CMD(list,   NULL, KV_LIST_HELP,   kv_cmd_list),
+    NRF_CLI_CMD(delete, NULL, KV_DELETE_HELP, kv_cmd_delete),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_bench_cmd)
+{
+    NRF_CLI_CMD(all,    NULL, BENCH_ALL_HELP,    bench_cmd_all),
+    NRF_CLI_CMD(write,  NULL, BENCH_WRITE_HELP,  bench_cmd_write),
+    NRF_CLI_CMD(random, NULL, BENCH_RANDOM_HELP, bench_cmd_random),
+    NRF_CLI_CMD(read,   NULL, BENCH_READ_HELP,   bench_cmd_read),
+    NRF_CLI_CMD(erase,  NULL, BENCH_ERASE_HELP,  bench_cmd_erase),
+    NRF_CLI_CMD(mixed,  NULL, BENCH_MIXED_HELP,  bench_cmd_mixed),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_stats_cmd)
+{
+    NRF_CLI_CMD(print, NULL, STATS_PRINT_HELP, stats_cmd_print),
+    NRF_CLI_CMD(reset, NULL, STATS_RESET_HELP, stats_cmd_reset),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_trace_cmd)
+{
+    NRF_CLI_CMD(clear, NULL, TRACE_CLEAR_HELP, trace_cmd_clear),
+    NRF_CLI_CMD(dump,  NULL, TRACE_DUMP_HELP,  trace_cmd_dump),
+    NRF_CLI_SUBCMD_SET_END
+};
+
+
+NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_sim_cmd)
+{
+    NRF_CLI_CMD(on,      NULL, SIM_ON_HELP,      sim_cmd_on),
+    NRF_CLI_CMD(off,     NULL, SIM_OFF_HELP,     sim_cmd_off),
+    NRF_CLI_CMD(reset,   NULL, SIM_RESET_HELP,   sim_cmd_reset),
+    NRF_CLI_CMD(fault,   NULL, SIM_FAULT_HELP,   sim_cmd_fault),
+    NRF_CLI_CMD(cut,     NULL, SIM_CUT_HELP,     sim_cmd_cut),
+    NRF_CLI_CMD(restore, NULL, SIM_RESTORE_HELP, sim_cmd_restore),
+    NRF_CLI_CMD(stats,   NULL, SIM_STATS_HELP,   sim_cmd_stats),
     NRF_CLI_SUBCMD_SET_END
 };
 
@@ -467,4 +1912,11 @@ NRF_CLI_CREATE_STATIC_SUBCMD_SET(m_flasharea_cmd)
 NRF_CLI_CMD_REGISTER(read,      &m_read_cmd,        READ_HELP,      read_cmd);
 NRF_CLI_CMD_REGISTER(write,     NULL,               WRITE_HELP,     write_cmd);
 NRF_CLI_CMD_REGISTER(erase,     NULL,               ERASE_HELP,     erase_cmd);
+NRF_CLI_CMD_REGISTER(dump,      NULL,               DUMP_HELP,      dump_cmd);
+NRF_CLI_CMD_REGISTER(xfer,      NULL,               XFER_HELP,      xfer_cmd);
 NRF_CLI_CMD_REGISTER(flasharea, &m_flasharea_cmd,   FLASHAREA_HELP, flasharea_cmd);
+NRF_CLI_CMD_REGISTER(kv,        &m_kv_cmd,          KV_HELP,        kv_cmd);
+NRF_CLI_CMD_REGISTER(stats,     &m_stats_cmd,       STATS_HELP,     stats_cmd);
+NRF_CLI_CMD_REGISTER(bench,     &m_bench_cmd,       BENCH_HELP,     bench_cmd);
+NRF_CLI_CMD_REGISTER(trace,     &m_trace_cmd,       TRACE_HELP,     trace_cmd);
+NRF_CLI_CMD_REGISTER(sim,       &m_sim_cmd,         SIM_HELP,       sim_cmd);
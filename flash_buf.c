@@ -0,0 +1,45 @@
+#include "flash_buf.h"
+
+#include "app_util.h"
+#include "nrf_assert.h"
+#include "nrf_balloc.h"
+
+STATIC_ASSERT((FLASH_BUF_SIZE % sizeof(uint32_t)) == 0);
+
+NRF_BALLOC_DEF(m_buf_pool, sizeof(flash_buf_t), FLASH_BUF_COUNT);
+
+
+ret_code_t flash_buf_init(void)
+{
+    return nrf_balloc_init(&m_buf_pool);
+}
+
+
+flash_buf_t * flash_buf_alloc(void)
+{
+    flash_buf_t * const p_buf = nrf_balloc_alloc(&m_buf_pool);
+
+    if (p_buf != NULL)
+    {
+        p_buf->ref_cnt = 1;
+    }
+
+    return p_buf;
+}
+
+
+void flash_buf_ref(flash_buf_t * p_buf)
+{
+    ASSERT(p_buf->ref_cnt != 0);
+    (void) nrf_atomic_u32_add(&p_buf->ref_cnt, 1);
+}
+
+
+void flash_buf_release(flash_buf_t * p_buf)
+{
+    ASSERT(p_buf->ref_cnt != 0);
+    if (nrf_atomic_u32_sub(&p_buf->ref_cnt, 1) == 0)
+    {
+        nrf_balloc_free(&m_buf_pool, p_buf);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef FLASH_BUF_H__
+#define FLASH_BUF_H__
+
+#include <stdint.h>
+#include "sdk_errors.h"
+#include "sdk_config.h"
+#include "nrf_atomic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup flash_buf Reference-counted flash write buffers
+ * @{
+ *
+ * @brief   Buffers from an nrf_balloc pool that can be handed to @ref flash_queue_write_buf
+ *          without being copied.
+ *
+ * @details A buffer is returned by @ref flash_buf_alloc holding one reference. The flash queue
+ *          takes its own reference for every write it is passed to, and drops it once the write
+ *          result has been reported. The buffer goes back to the pool when the last reference is
+ *          released, so the caller can drop its reference right after queueing the write.
+ */
+
+
+/**@brief   Flash write buffer. */
+typedef struct
+{
+    nrf_atomic_u32_t    ref_cnt;                            //!< Number of references held.
+    uint32_t            data[FLASH_BUF_SIZE / sizeof(uint32_t)]; //!< Payload, word-aligned.
+} flash_buf_t;
+
+
+/**@brief   Function for initializing the buffer pool. */
+ret_code_t flash_buf_init(void);
+
+
+/**@brief   Function for allocating a buffer.
+ *
+ * @return  A buffer holding one reference, or NULL if the pool is exhausted.
+ */
+flash_buf_t * flash_buf_alloc(void);
+
+
+/**@brief   Function for taking an additional reference to a buffer. */
+void flash_buf_ref(flash_buf_t * p_buf);
+
+
+/**@brief   Function for releasing a reference. The buffer is freed with the last reference. */
+void flash_buf_release(flash_buf_t * p_buf);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_BUF_H__
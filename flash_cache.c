@@ -0,0 +1,586 @@
+#include "flash_cache.h"
+
+#include <string.h>
+
+#include "sdk_config.h"
+#include "nordic_common.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+#include "app_timer.h"
+#include "flash_trace.h"
+
+
+#define LINE_WORDS  (FLASH_CACHE_LINE_SIZE / sizeof(uint32_t))
+
+STATIC_ASSERT((FLASH_CACHE_LINE_SIZE % sizeof(uint32_t)) == 0);
+STATIC_ASSERT(LINE_WORDS <= 32);    /* One bit per word in the line masks. */
+
+
+typedef struct
+{
+    nrf_fstorage_t      const * p_fs;           //!< NULL if the line is free.
+    flash_queue_evt_handler_t   evt_handler;
+    void                      * p_param;
+    uint32_t                    addr;           //!< Address of the line, a multiple of its size.
+    uint32_t                    dirty;          //!< Words written since they were last handed over.
+    uint32_t                    busy;           //!< Words handed to the flash queue, not written yet.
+    uint32_t                    data[LINE_WORDS];
+} line_t;
+
+
+static line_t   m_lines[FLASH_CACHE_LINE_COUNT];
+static uint32_t m_dirty_bytes;
+static bool     m_flush_active;
+static bool     m_sync_pending;     //!< Dirty words wait for a flash queue write of the same words.
+static bool     m_timer_running;
+
+APP_TIMER_DEF(m_flush_timer);
+
+
+static void cache_evt_handler(flash_queue_evt_t const * p_evt);
+static void space_evt_handler(flash_queue_evt_t const * p_evt);
+
+
+static bool range_is_valid(nrf_fstorage_t const * p_fs, uint32_t addr, uint32_t len)
+{
+    return (addr >= p_fs->start_addr) && (addr + len - 1 <= p_fs->end_addr);
+}
+
+
+/**@brief   Mask of the words @p first to @p last of a line. */
+static uint32_t word_mask(uint32_t first, uint32_t last)
+{
+    return (UINT32_MAX >> (31 - last)) & (UINT32_MAX << first);
+}
+
+
+static uint32_t word_cnt(uint32_t mask)
+{
+    uint32_t cnt = 0;
+
+    for (; mask != 0; mask &= mask - 1)
+    {
+        cnt++;
+    }
+    return cnt;
+}
+
+
+static line_t * line_find(nrf_fstorage_t const * p_fs, uint32_t addr)
+{
+    for (uint32_t i = 0; i < FLASH_CACHE_LINE_COUNT; i++)
+    {
+        if ((m_lines[i].p_fs == p_fs) && (m_lines[i].addr == addr))
+        {
+            return &m_lines[i];
+        }
+    }
+    return NULL;
+}
+
+
+static void line_release_if_idle(line_t * p_line)
+{
+    if ((p_line->dirty == 0) && (p_line->busy == 0))
+    {
+        p_line->p_fs = NULL;
+    }
+}
+
+
+/**@brief   Get the lines covering @p cnt line-sized blocks from @p addr, allocating free lines
+ *          as needed. Either all lines are found, or none is allocated. */
+static bool lines_get(nrf_fstorage_t      const * p_fs,
+                      uint32_t                    addr,
+                      uint32_t                    cnt,
+                      flash_queue_evt_handler_t   evt_handler,
+                      void                      * p_param,
+                      line_t                   ** pp_lines)
+{
+    for (uint32_t i = 0; i < cnt; i++)
+    {
+        uint32_t const line_addr = addr + i * FLASH_CACHE_LINE_SIZE;
+
+        pp_lines[i] = line_find(p_fs, line_addr);
+
+        if (pp_lines[i] != NULL)
+        {
+            if ((pp_lines[i]->evt_handler != evt_handler) || (pp_lines[i]->p_param != p_param))
+            {
+                /* A line holds the data of a single handler. */
+                pp_lines[i] = NULL;
+            }
+        }
+        else
+        {
+            for (uint32_t j = 0; j < FLASH_CACHE_LINE_COUNT; j++)
+            {
+                if (m_lines[j].p_fs == NULL)
+                {
+                    pp_lines[i]              = &m_lines[j];
+                    pp_lines[i]->p_fs        = p_fs;
+                    pp_lines[i]->evt_handler = evt_handler;
+                    pp_lines[i]->p_param     = p_param;
+                    pp_lines[i]->addr        = line_addr;
+                    pp_lines[i]->dirty       = 0;
+                    pp_lines[i]->busy        = 0;
+                    memset(pp_lines[i]->data, 0xFF, sizeof(pp_lines[i]->data));
+                    break;
+                }
+            }
+        }
+
+        if (pp_lines[i] == NULL)
+        {
+            for (uint32_t j = 0; j < i; j++)
+            {
+                line_release_if_idle(pp_lines[j]);
+            }
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**@brief   Hand the data of all lines to the flash queue. Must be called with the critical
+ *          region held.
+ *
+ * Runs of dirty words are handed over starting from the lowest address, so that a run which
+ * continues into the next line is written as a single request.
+ */
+static ret_code_t flush_all(void)
+{
+    if (m_flush_active)
+    {
+        /* Called from an event handler during a flush; the flush picks up new data itself. */
+        return NRF_SUCCESS;
+    }
+    m_flush_active = true;
+
+    ret_code_t rc = NRF_SUCCESS;
+
+    for (;;)
+    {
+        line_t * p_first = NULL;
+        uint32_t first   = 0;
+
+        for (uint32_t i = 0; i < FLASH_CACHE_LINE_COUNT; i++)
+        {
+            /* Words still being written are handed over again once their write has completed. */
+            uint32_t const ready = m_lines[i].dirty & ~m_lines[i].busy;
+            uint32_t       word  = 0;
+
+            if ((m_lines[i].p_fs == NULL) || (ready == 0))
+            {
+                continue;
+            }
+            while (!(ready & (1u << word)))
+            {
+                word++;
+            }
+            if (   (p_first == NULL)
+                || (m_lines[i].addr + word * sizeof(uint32_t) < p_first->addr + first * sizeof(uint32_t)))
+            {
+                p_first = &m_lines[i];
+                first   = word;
+            }
+        }
+
+        if (p_first == NULL)
+        {
+            break;
+        }
+
+        flash_queue_seg_t segs[FLASH_CACHE_LINE_COUNT];
+        line_t          * lines[FLASH_CACHE_LINE_COUNT];
+        uint32_t          masks[FLASH_CACHE_LINE_COUNT];
+        uint32_t          seg_cnt = 0;
+        line_t          * p_line  = p_first;
+        uint32_t          word    = first;
+
+        while (p_line != NULL)
+        {
+            uint32_t const ready = p_line->dirty & ~p_line->busy;
+            uint32_t       end   = word;
+
+            while ((end < LINE_WORDS) && (ready & (1u << end)))
+            {
+                end++;
+            }
+
+            segs[seg_cnt]  = (flash_queue_seg_t){ .p_data = &p_line->data[word],
+                                                  .len    = (end - word) * sizeof(uint32_t) };
+            lines[seg_cnt] = p_line;
+            masks[seg_cnt] = word_mask(word, end - 1);
+            seg_cnt++;
+
+            if ((end < LINE_WORDS) || (seg_cnt == FLASH_CACHE_LINE_COUNT))
+            {
+                break;
+            }
+
+            /* Continue with the next line if the run does. */
+            line_t * const p_next = line_find(p_line->p_fs, p_line->addr + FLASH_CACHE_LINE_SIZE);
+
+            p_line = NULL;
+            word   = 0;
+            if (   (p_next != NULL)
+                && (p_next->evt_handler == p_first->evt_handler)
+                && (p_next->p_param     == p_first->p_param)
+                && ((p_next->dirty & ~p_next->busy) & 1u))
+            {
+                p_line = p_next;
+            }
+        }
+
+        uint32_t len = 0;
+
+        /* Mark the words first: nrf_fstorage_nvmc reports the write before returning. */
+        for (uint32_t i = 0; i < seg_cnt; i++)
+        {
+            len             += segs[i].len;
+            lines[i]->busy  |= masks[i];
+            lines[i]->dirty &= ~masks[i];
+            m_dirty_bytes   -= word_cnt(masks[i]) * sizeof(uint32_t);
+        }
+
+        FLASH_TRACE(FLASH_TRACE_CACHE_FLUSH, p_first->addr + first * sizeof(uint32_t), len);
+
+        rc = flash_queue_write_gather(p_first->p_fs,
+                                      p_first->addr + first * sizeof(uint32_t),
+                                      segs, seg_cnt, cache_evt_handler, p_first);
+        if (rc != NRF_SUCCESS)
+        {
+            for (uint32_t i = 0; i < seg_cnt; i++)
+            {
+                lines[i]->busy  &= ~masks[i];
+                lines[i]->dirty |= masks[i];
+                m_dirty_bytes   += word_cnt(masks[i]) * sizeof(uint32_t);
+            }
+            break;
+        }
+    }
+
+    m_flush_active = false;
+
+    return rc;
+}
+
+
+/**@brief   Flush if a threshold has been reached, otherwise make sure the flush timer runs. */
+static void flush_check(void)
+{
+    bool       timer_start = false;
+    ret_code_t rc          = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+    if ((m_dirty_bytes >= FLASH_CACHE_FLUSH_THRESHOLD) || m_sync_pending)
+    {
+        rc             = flush_all();
+        m_sync_pending = m_sync_pending && (m_dirty_bytes > 0);
+    }
+    if ((m_dirty_bytes > 0) && !m_timer_running)
+    {
+        m_timer_running = true;
+        timer_start     = true;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (rc == NRF_ERROR_NO_MEM)
+    {
+        /* Flush again as soon as the flash queue has room, rather than when the timer expires. */
+        (void) flash_queue_space_notify(space_evt_handler, NULL);
+    }
+
+    if (timer_start)
+    {
+        rc = app_timer_start(m_flush_timer, APP_TIMER_TICKS(FLASH_CACHE_FLUSH_DELAY_MS), NULL);
+        if (rc != NRF_SUCCESS)
+        {
+            /* Retried on the next write or flash event. */
+            m_timer_running = false;
+        }
+    }
+}
+
+
+/**@brief   Flush everything, then restart the timer if the flash queue was full. */
+static void flush_retry(void)
+{
+    ret_code_t rc;
+
+    CRITICAL_REGION_ENTER();
+    rc = flush_all();
+    CRITICAL_REGION_EXIT();
+
+    if (rc == NRF_ERROR_NO_MEM)
+    {
+        (void) flash_queue_space_notify(space_evt_handler, NULL);
+    }
+
+    flush_check();
+}
+
+
+static void flush_timer_handler(void * p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    m_timer_running = false;
+    flush_retry();
+}
+
+
+static void space_evt_handler(flash_queue_evt_t const * p_evt)
+{
+    UNUSED_PARAMETER(p_evt);
+
+    flush_retry();
+}
+
+
+static void cache_evt_handler(flash_queue_evt_t const * p_evt)
+{
+    line_t    const * const p_first = (line_t const *)p_evt->p_param;
+    uint32_t          const end     = p_evt->addr + p_evt->len;
+    flash_queue_evt_t       evt     = *p_evt;
+    flash_queue_evt_handler_t evt_handler;
+
+    CRITICAL_REGION_ENTER();
+    evt_handler = p_first->evt_handler;
+    evt.p_param = p_first->p_param;
+
+    for (uint32_t i = 0; i < FLASH_CACHE_LINE_COUNT; i++)
+    {
+        line_t * const p_line = &m_lines[i];
+        uint32_t const lo     = MAX(p_evt->addr, p_line->addr);
+        uint32_t const hi     = MIN(end, p_line->addr + FLASH_CACHE_LINE_SIZE);
+
+        if ((p_line->p_fs != p_evt->p_fs) || (lo >= hi))
+        {
+            continue;
+        }
+
+        p_line->busy &= ~word_mask((lo - p_line->addr) / sizeof(uint32_t),
+                                   (hi - 1 - p_line->addr) / sizeof(uint32_t));
+        line_release_if_idle(p_line);
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (evt_handler != NULL)
+    {
+        evt_handler(&evt);
+    }
+
+    flush_check();
+}
+
+
+ret_code_t flash_cache_init(void)
+{
+    memset(m_lines, 0x00, sizeof(m_lines));
+    m_dirty_bytes   = 0;
+    m_flush_active  = false;
+    m_sync_pending  = false;
+    m_timer_running = false;
+
+    return app_timer_create(&m_flush_timer, APP_TIMER_MODE_SINGLE_SHOT, flush_timer_handler);
+}
+
+
+ret_code_t flash_cache_write(nrf_fstorage_t      const * p_fs,
+                             uint32_t                    dest,
+                             void                const * p_src,
+                             uint32_t                    len,
+                             flash_queue_evt_handler_t   evt_handler,
+                             void                      * p_param)
+{
+    flash_queue_seg_t const seg = { .p_data = p_src, .len = len };
+
+    if (p_src == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    return flash_cache_write_gather(p_fs, dest, &seg, 1, evt_handler, p_param);
+}
+
+
+ret_code_t flash_cache_write_gather(nrf_fstorage_t      const * p_fs,
+                                    uint32_t                    dest,
+                                    flash_queue_seg_t   const * p_segs,
+                                    uint32_t                    seg_cnt,
+                                    flash_queue_evt_handler_t   evt_handler,
+                                    void                      * p_param)
+{
+    uint32_t len = 0;
+
+    if ((p_fs == NULL) || (p_segs == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+    for (uint32_t i = 0; i < seg_cnt; i++)
+    {
+        if ((p_segs[i].p_data == NULL) && (p_segs[i].len != 0))
+        {
+            return NRF_ERROR_NULL;
+        }
+        len += p_segs[i].len;
+    }
+    if ((len == 0) || (len > FLASH_CACHE_LINE_SIZE))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    if (!range_is_valid(p_fs, dest, len))
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    uint32_t const base     = dest - (dest % FLASH_CACHE_LINE_SIZE);
+    uint32_t const line_cnt = (dest + len > base + FLASH_CACHE_LINE_SIZE) ? 2 : 1;
+    line_t       * lines[2];
+    ret_code_t     rc       = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+    if (!lines_get(p_fs, base, line_cnt, evt_handler, p_param, lines))
+    {
+        /* Free lines by handing their data over; nrf_fstorage_nvmc completes it right away. */
+        (void) flush_all();
+        if (!lines_get(p_fs, base, line_cnt, evt_handler, p_param, lines))
+        {
+            rc = NRF_ERROR_NO_MEM;
+        }
+    }
+
+    if (rc == NRF_SUCCESS)
+    {
+        uint32_t off = dest - base;
+
+        for (uint32_t i = 0; i < seg_cnt; i++)
+        {
+            uint8_t const * const p_src = (uint8_t const *)p_segs[i].p_data;
+
+            for (uint32_t j = 0; j < p_segs[i].len; j++, off++)
+            {
+                line_t  * const p_line = lines[off / FLASH_CACHE_LINE_SIZE];
+                uint8_t * const p_data = (uint8_t *)p_line->data;
+                uint32_t  const word   = (off % FLASH_CACHE_LINE_SIZE) / sizeof(uint32_t);
+
+                p_data[off % FLASH_CACHE_LINE_SIZE] &= p_src[j];
+
+                if (!(p_line->dirty & (1u << word)))
+                {
+                    p_line->dirty |= (1u << word);
+                    m_dirty_bytes += sizeof(uint32_t);
+                }
+            }
+        }
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (rc == NRF_SUCCESS)
+    {
+        flush_check();
+    }
+
+    return rc;
+}
+
+
+ret_code_t flash_cache_read(nrf_fstorage_t const * p_fs, uint32_t addr, void * p_dest, uint32_t len)
+{
+    ret_code_t rc;
+
+    /* Read flash and the lines together, so that no write can complete in between. */
+    CRITICAL_REGION_ENTER();
+    rc = nrf_fstorage_read(p_fs, addr, p_dest, len);
+
+    for (uint32_t i = 0; (rc == NRF_SUCCESS) && (i < FLASH_CACHE_LINE_COUNT); i++)
+    {
+        line_t  const * const p_line = &m_lines[i];
+        uint8_t const * const p_data = (uint8_t const *)p_line->data;
+        uint32_t        const lo     = MAX(addr, p_line->addr);
+        uint32_t        const hi     = MIN(addr + len, p_line->addr + FLASH_CACHE_LINE_SIZE);
+
+        if (p_line->p_fs != p_fs)
+        {
+            continue;
+        }
+
+        for (uint32_t a = lo; a < hi; a++)
+        {
+            uint32_t const word = (a - p_line->addr) / sizeof(uint32_t);
+
+            if ((p_line->dirty | p_line->busy) & (1u << word))
+            {
+                ((uint8_t *)p_dest)[a - addr] &= p_data[a - p_line->addr];
+            }
+        }
+    }
+    CRITICAL_REGION_EXIT();
+
+    return rc;
+}
+
+
+ret_code_t flash_cache_sync(void)
+{
+    ret_code_t rc;
+
+    CRITICAL_REGION_ENTER();
+    rc             = flush_all();
+    m_sync_pending = (m_dirty_bytes > 0);
+    CRITICAL_REGION_EXIT();
+
+    if (rc != NRF_SUCCESS)
+    {
+        /* Make sure the timer retries. */
+        flush_check();
+    }
+
+    return rc;
+}
+
+
+bool flash_cache_is_pending(nrf_fstorage_t const * p_fs, uint32_t addr, uint32_t len)
+{
+    bool pending = false;
+
+    CRITICAL_REGION_ENTER();
+    for (uint32_t i = 0; (i < FLASH_CACHE_LINE_COUNT) && !pending; i++)
+    {
+        line_t const * const p_line = &m_lines[i];
+        uint32_t       const lo     = MAX(addr, p_line->addr);
+        uint32_t       const hi     = MIN(addr + len, p_line->addr + FLASH_CACHE_LINE_SIZE);
+
+        if ((p_line->p_fs != p_fs) || (lo >= hi))
+        {
+            continue;
+        }
+
+        uint32_t const mask = word_mask((lo - p_line->addr) / sizeof(uint32_t),
+                                        (hi - 1 - p_line->addr) / sizeof(uint32_t));
+
+        pending = (((p_line->dirty | p_line->busy) & mask) != 0);
+    }
+    CRITICAL_REGION_EXIT();
+
+    return pending || flash_queue_is_pending(p_fs, addr, len);
+}
+
+
+bool flash_cache_is_busy(void)
+{
+    bool busy = false;
+
+    CRITICAL_REGION_ENTER();
+    for (uint32_t i = 0; i < FLASH_CACHE_LINE_COUNT; i++)
+    {
+        busy |= (m_lines[i].p_fs != NULL);
+    }
+    CRITICAL_REGION_EXIT();
+
+    return busy;
+}
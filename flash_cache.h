@@ -0,0 +1,138 @@
+#ifndef FLASH_CACHE_H__
+#define FLASH_CACHE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "nrf_fstorage.h"
+#include "flash_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup flash_cache Flash write-back cache
+ * @{
+ *
+ * @brief   RAM cache that coalesces small writes before they are handed to the flash queue.
+ *
+ * @details Writes are collected in cache lines of @ref FLASH_CACHE_LINE_SIZE bytes. Writing the
+ *          same line again, or the lines next to it, adds to the same flash operation, and a word
+ *          written several times is programmed only once. The cache is flushed to the flash
+ *          queue when @ref FLASH_CACHE_FLUSH_THRESHOLD bytes are waiting, when
+ *          @ref FLASH_CACHE_FLUSH_DELAY_MS milliseconds have passed since the first cached write,
+ *          or when @ref flash_cache_sync is called.
+ *
+ *          @ref flash_cache_read returns the contents of flash as they will be once every cached
+ *          write has been programmed, without waiting for the writes to complete. Cached data
+ *          is lost on reset; call @ref flash_cache_sync before data must persist.
+ *
+ *          Like flash itself, the cache can only clear bits: the data of overlapping writes is
+ *          combined with a bitwise AND.
+ */
+
+
+/**@brief   Function for initializing the cache. Must be called after app_timer_init(). */
+ret_code_t flash_cache_init(void);
+
+
+/**@brief   Function for writing data through the cache.
+ *
+ * The data is copied into the cache, so @p p_src does not need to remain valid after this
+ * function returns. Unlike @ref flash_queue_write, there are no alignment requirements.
+ *
+ * @param[in]   p_fs        The fstorage instance to write to.
+ * @param[in]   dest        Address in flash where to write the data.
+ * @param[in]   p_src       Data to be written.
+ * @param[in]   len         Length of the data, in bytes. At most @ref FLASH_CACHE_LINE_SIZE.
+ * @param[in]   evt_handler Handler to be called when the data has been written. Can be NULL.
+ *                          It is called with the event of the flash queue write that flushed the
+ *                          data, which may include data of other writes with the same handler
+ *                          and parameter.
+ * @param[in]   p_param     User-defined parameter passed to the event handler.
+ *
+ * @retval  NRF_SUCCESS             If the data was cached.
+ * @retval  NRF_ERROR_NULL          If @p p_fs or @p p_src is NULL.
+ * @retval  NRF_ERROR_INVALID_LENGTH If @p len is zero or larger than a cache line.
+ * @retval  NRF_ERROR_INVALID_ADDR  If the range is outside the boundaries of @p p_fs.
+ * @retval  NRF_ERROR_NO_MEM        If no cache line could be freed; try again later.
+ */
+ret_code_t flash_cache_write(nrf_fstorage_t      const * p_fs,
+                             uint32_t                    dest,
+                             void                const * p_src,
+                             uint32_t                    len,
+                             flash_queue_evt_handler_t   evt_handler,
+                             void                      * p_param);
+
+
+/**@brief   Function for writing data assembled from several segments through the cache.
+ *
+ * The segments are cached back to back, either completely or not at all.
+ *
+ * @param[in]   p_fs        The fstorage instance to write to.
+ * @param[in]   dest        Address in flash where to write the data.
+ * @param[in]   p_segs      Segments to be written, in order.
+ * @param[in]   seg_cnt     Number of segments.
+ * @param[in]   evt_handler Handler to be called when the data has been written. Can be NULL.
+ * @param[in]   p_param     User-defined parameter passed to the event handler.
+ *
+ * @return  See @ref flash_cache_write.
+ */
+ret_code_t flash_cache_write_gather(nrf_fstorage_t      const * p_fs,
+                                    uint32_t                    dest,
+                                    flash_queue_seg_t   const * p_segs,
+                                    uint32_t                    seg_cnt,
+                                    flash_queue_evt_handler_t   evt_handler,
+                                    void                      * p_param);
+
+
+/**@brief   Function for reading flash, including data still held in the cache.
+ *
+ * @param[in]   p_fs    The fstorage instance to read from.
+ * @param[in]   addr    Address to read from. Must be word-aligned.
+ * @param[out]  p_dest  Buffer to read the data into.
+ * @param[in]   len     Number of bytes to read.
+ *
+ * @return  See nrf_fstorage_read().
+ */
+ret_code_t flash_cache_read(nrf_fstorage_t const * p_fs, uint32_t addr, void * p_dest, uint32_t len);
+
+
+/**@brief   Function for handing all cached data to the flash queue.
+ *
+ * Data that is part of a flash queue write that has not completed yet is handed over once that
+ * write has completed.
+ *
+ * @retval  NRF_SUCCESS         If all cached data has been handed to the flash queue.
+ * @retval  NRF_ERROR_NO_MEM    If the flash queue is full. The remaining data is handed over
+ *                              later, as the queue drains.
+ */
+ret_code_t flash_cache_sync(void);
+
+
+/**@brief   Function for checking if data for a range has not been written yet.
+ *
+ * @param[in]   p_fs    The fstorage instance of the range.
+ * @param[in]   addr    Address of the range.
+ * @param[in]   len     Length of the range, in bytes.
+ *
+ * @retval  true    If the range is covered by cached data, or by an operation of the flash queue
+ *                  that has not completed. See @ref flash_queue_is_pending.
+ * @retval  false   Otherwise.
+ */
+bool flash_cache_is_pending(nrf_fstorage_t const * p_fs, uint32_t addr, uint32_t len);
+
+
+/**@brief   Function for checking if the cache holds data that has not been written yet. */
+bool flash_cache_is_busy(void);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_CACHE_H__
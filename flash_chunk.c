@@ -0,0 +1,191 @@
+#include "flash_chunk.h"
+
+#include <string.h>
+
+#include "nordic_common.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+
+#if FLASH_CHUNK_ENABLED && defined(SOFTDEVICE_PRESENT)
+
+#define CHUNK_MAX   NRF_FSTORAGE_SD_MAX_WRITE_SIZE
+
+STATIC_ASSERT((FLASH_CHUNK_MIN_SIZE % sizeof(uint32_t)) == 0);
+STATIC_ASSERT((FLASH_CHUNK_MIN_SIZE >= sizeof(uint32_t)) && (FLASH_CHUNK_MIN_SIZE <= CHUNK_MAX));
+
+
+static flash_chunk_stat_t m_stat;
+static uint32_t           m_clean;          //!< Chunks in a row that took the expected time.
+static uint32_t           m_limit;          //!< Size up to which it is doubled, then grown slowly.
+static uint32_t           m_interval_us;
+
+
+/**@brief   Round a size down to a word, within the bounds of the chunk size. */
+static uint32_t size_clamp(uint32_t size, uint32_t cap)
+{
+    size &= ~(sizeof(uint32_t) - 1);
+    return MAX(FLASH_CHUNK_MIN_SIZE, MIN(size, cap));
+}
+
+
+/**@brief   Set a new chunk size. Must be called with the critical region held. */
+static void size_set(uint32_t size)
+{
+    m_stat.size     = size_clamp(size, m_stat.cap);
+    m_stat.size_min = MIN(m_stat.size_min, m_stat.size);
+    m_clean         = 0;
+}
+
+
+void flash_chunk_init(void)
+{
+    CRITICAL_REGION_ENTER();
+    memset(&m_stat, 0x00, sizeof(m_stat));
+    m_stat.size     = CHUNK_MAX;
+    m_stat.cap      = CHUNK_MAX;
+    m_stat.size_min = CHUNK_MAX;
+    m_clean         = 0;
+    m_limit         = CHUNK_MAX;
+    m_interval_us   = 0;
+    CRITICAL_REGION_EXIT();
+}
+
+
+uint32_t flash_chunk_size_get(void)
+{
+    return m_stat.size;
+}
+
+
+void flash_chunk_result(uint32_t len, uint32_t us, ret_code_t result)
+{
+    /* The flash needs this long for the words alone. Waiting for a gap between connection events
+     * adds up to an interval; a retry by nrf_fstorage_sd adds at least one more. */
+    uint32_t const expected_us = (len / sizeof(uint32_t)) * FLASH_CHUNK_WORD_US;
+
+    CRITICAL_REGION_ENTER();
+
+    /* The size is cut from itself, not from the length of the chunk: the last part of a write is
+     * often much shorter, and cutting from it would drop the size far below what fits. */
+    if (result == NRF_ERROR_TIMEOUT)
+    {
+        m_stat.timeouts++;
+        m_limit = m_stat.size / 2;
+        size_set(m_stat.size / 2);
+    }
+    else if (result == NRF_SUCCESS)
+    {
+        m_stat.chunks++;
+        m_stat.bytes   += len;
+        m_stat.busy_us += us;
+
+        if (us > 2 * expected_us + m_interval_us)
+        {
+            m_stat.slow++;
+            m_limit = m_stat.size - m_stat.size / 4;
+            size_set(m_stat.size - m_stat.size / 4);
+        }
+        else if ((len >= m_stat.size) && (++m_clean >= FLASH_CHUNK_GROW_AFTER))
+        {
+            /* Only full chunks tell whether a larger one would fit. Near the size that last
+             * failed, a failure costs more than the larger chunks gain, so grow slowly there. */
+            size_set((m_stat.size * 2 <= m_limit) ? (m_stat.size * 2)
+                                                  : (m_stat.size + FLASH_CHUNK_MIN_SIZE));
+        }
+    }
+
+    CRITICAL_REGION_EXIT();
+}
+
+
+void flash_chunk_conn_set(uint32_t interval_us)
+{
+    uint32_t cap = CHUNK_MAX;
+
+    if (interval_us != 0)
+    {
+        uint32_t const free_us = (interval_us > FLASH_CHUNK_RADIO_US) ?
+                                 (interval_us - FLASH_CHUNK_RADIO_US) : 0;
+
+        cap = size_clamp((free_us / FLASH_CHUNK_WORD_US) * sizeof(uint32_t), CHUNK_MAX);
+    }
+
+    CRITICAL_REGION_ENTER();
+    /* What failed under the previous interval says nothing about this one. */
+    m_interval_us = interval_us;
+    m_limit       = cap;
+    m_stat.cap    = cap;
+    if (m_stat.size > cap)
+    {
+        size_set(cap);
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+
+ret_code_t flash_chunk_stat_get(flash_chunk_stat_t * p_stat)
+{
+    if (p_stat == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    CRITICAL_REGION_ENTER();
+    *p_stat = m_stat;
+    CRITICAL_REGION_EXIT();
+
+    return NRF_SUCCESS;
+}
+
+
+void flash_chunk_stat_reset(void)
+{
+    CRITICAL_REGION_ENTER();
+    m_stat.size_min = m_stat.size;
+    m_stat.chunks   = 0;
+    m_stat.slow     = 0;
+    m_stat.timeouts = 0;
+    m_stat.bytes    = 0;
+    m_stat.busy_us  = 0;
+    CRITICAL_REGION_EXIT();
+}
+
+#else
+
+void flash_chunk_init(void)
+{
+}
+
+
+uint32_t flash_chunk_size_get(void)
+{
+    return 0;
+}
+
+
+void flash_chunk_result(uint32_t len, uint32_t us, ret_code_t result)
+{
+    UNUSED_PARAMETER(len);
+    UNUSED_PARAMETER(us);
+    UNUSED_PARAMETER(result);
+}
+
+
+void flash_chunk_conn_set(uint32_t interval_us)
+{
+    UNUSED_PARAMETER(interval_us);
+}
+
+
+ret_code_t flash_chunk_stat_get(flash_chunk_stat_t * p_stat)
+{
+    UNUSED_PARAMETER(p_stat);
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+
+void flash_chunk_stat_reset(void)
+{
+}
+
+#endif // FLASH_CHUNK_ENABLED && defined(SOFTDEVICE_PRESENT)
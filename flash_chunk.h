@@ -0,0 +1,104 @@
+#ifndef FLASH_CHUNK_H__
+#define FLASH_CHUNK_H__
+
+#include <stdint.h>
+#include "sdk_config.h"
+#include "sdk_errors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup flash_chunk Adaptive write chunk size
+ * @{
+ *
+ * @brief   Size of the writes handed to the SoftDevice, adapted to how busy the radio is.
+ *
+ * @details The SoftDevice programs flash in the time the radio leaves free. A write that does
+ *          not fit in that time fails, and nrf_fstorage_sd tries it again, up to
+ *          NRF_FSTORAGE_SD_MAX_RETRIES times, after which it reports NRF_ERROR_TIMEOUT. Under a
+ *          short connection interval, large writes therefore keep failing; with the radio idle,
+ *          small writes waste time in events and scheduling.
+ *
+ *          The flash queue hands its writes to nrf_fstorage in chunks of the size returned by
+ *          @ref flash_chunk_size_get, and reports the outcome of each chunk with
+ *          @ref flash_chunk_result. The size is doubled after @ref FLASH_CHUNK_GROW_AFTER chunks
+ *          in a row that took about the time the flash needs, and only grown by
+ *          @ref FLASH_CHUNK_MIN_SIZE once it gets near the size that last failed. It is cut by a
+ *          quarter when a chunk took much longer, which means that nrf_fstorage_sd had to retry
+ *          it, and halved when a chunk timed out; the queue then writes that chunk again, split
+ *          at the new size once that is below its length.
+ *
+ *          While a link is up, the size is also capped to what can be programmed in one
+ *          connection interval, less @ref FLASH_CHUNK_RADIO_US of radio time. The application
+ *          gives the interval with @ref flash_chunk_conn_set.
+ *
+ *          Only the SoftDevice write path uses chunks. Without a SoftDevice, or if
+ *          @ref FLASH_CHUNK_ENABLED is not set, writes are handed over whole.
+ */
+
+
+/**@brief   Chunk statistics. */
+typedef struct
+{
+    uint32_t size;          //!< Current chunk size, in bytes.
+    uint32_t cap;           //!< Largest chunk size allowed by the connection interval.
+    uint32_t size_min;      //!< Smallest chunk size used.
+    uint32_t chunks;        //!< Chunks written.
+    uint32_t slow;          //!< Chunks that took much longer than the flash needs.
+    uint32_t timeouts;      //!< Chunks that timed out, and were written again.
+    uint32_t bytes;         //!< Bytes written.
+    uint32_t busy_us;       //!< Time spent writing them, in microseconds.
+} flash_chunk_stat_t;
+
+
+/**@brief   Function for initializing the chunk size to its largest value. */
+void flash_chunk_init(void);
+
+
+/**@brief   Function for retrieving the size of the next chunk.
+ *
+ * @return  The size, in bytes, a multiple of four. Zero if writes are not split.
+ */
+uint32_t flash_chunk_size_get(void);
+
+
+/**@brief   Function for adapting the chunk size to the outcome of a chunk.
+ *
+ * @param[in]   len     Length of the chunk, in bytes.
+ * @param[in]   us      Time from the submission of the chunk, or from the completion of the
+ *                      previous operation if that was later, to its result.
+ * @param[in]   result  Result reported by nrf_fstorage.
+ */
+void flash_chunk_result(uint32_t len, uint32_t us, ret_code_t result);
+
+
+/**@brief   Function for giving the interval of the current connection.
+ *
+ * @param[in]   interval_us Connection interval, in microseconds. Zero when no link is up.
+ */
+void flash_chunk_conn_set(uint32_t interval_us);
+
+
+/**@brief   Function for retrieving the statistics.
+ *
+ * @retval  NRF_SUCCESS             If the statistics were copied.
+ * @retval  NRF_ERROR_NULL          If @p p_stat is NULL.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If writes are not split.
+ */
+ret_code_t flash_chunk_stat_get(flash_chunk_stat_t * p_stat);
+
+
+/**@brief   Function for clearing the counters of the statistics. */
+void flash_chunk_stat_reset(void);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_CHUNK_H__
@@ -0,0 +1,43 @@
+#ifndef FLASH_CRC_H__
+#define FLASH_CRC_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup flash_crc CRC32 of flash contents
+ * @{
+ *
+ * @brief   CRC32 for checking data read back from flash.
+ *
+ * @details Computes the same CRC32 as the crc32 library (reflected polynomial 0xEDB88320), so
+ *          the two can be used interchangeably. If @ref FLASH_CRC_SLICING_ENABLED is set, the CRC
+ *          is computed four bytes at a time from four tables of 256 words held in flash.
+ *          Otherwise, the function falls back to the bitwise implementation of the crc32
+ *          library, which needs no tables but is several times slower.
+ */
+
+
+/**@brief   Function for computing the CRC32 of a block of data.
+ *
+ * @param[in]   p_data  The data. Can be anywhere in RAM or flash, with any alignment.
+ * @param[in]   size    Number of bytes.
+ * @param[in]   p_crc   CRC of the data before @p p_data, to continue a computation, or NULL to
+ *                      start a new one.
+ *
+ * @return  The CRC32 of the data.
+ */
+uint32_t flash_crc32(void const * p_data, uint32_t size, uint32_t const * p_crc);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_CRC_H__
@@ -0,0 +1,462 @@
+#include "flash_journal.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "sdk_config.h"
+#include "nordic_common.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+#include "flash_cache.h"
+
+
+static nrf_fstorage_t const * m_p_fs;
+
+#if FLASH_JOURNAL_ENABLED
+
+STATIC_ASSERT((FLASH_JOURNAL_SIZE & (FLASH_JOURNAL_SIZE - 1)) == 0);
+STATIC_ASSERT((FLASH_JOURNAL_SIZE >= 64) && (FLASH_JOURNAL_SIZE <= 32768));
+
+
+#define JOURNAL_MAGIC   0x4A524E4C  /* "JRNL" */
+#define ENTRY_ALIGN     8
+#define ENTRY_SIZE(len) (sizeof(entry_t) + ALIGN_NUM(ENTRY_ALIGN, (len)))
+
+
+/**@brief   Header of an entry of the ring. The data of the write follows it. */
+typedef struct
+{
+    uint16_t size;          //!< Bytes taken by the entry, a multiple of @ref ENTRY_ALIGN.
+    uint16_t len;           //!< Bytes of data. Zero for an entry that is skipped: the gap at the
+                            //!< end of the ring before a write that did not fit there, or a write
+                            //!< the flash queue refused.
+    uint32_t dest;
+} entry_t;
+
+
+/**@brief   Positions in the ring. They count bytes from the start of the journal and wrap
+ *          around at 2^32, so that @c head - @c tail is the number of bytes taken. */
+typedef struct
+{
+    uint32_t magic;         //!< @ref JOURNAL_MAGIC if the positions are valid.
+    uint32_t head;          //!< Where the next entry is added.
+    uint32_t sent;          //!< First entry not handed to the flash queue yet.
+    uint32_t tail;          //!< First entry not programmed yet.
+} journal_ctl_t;
+
+
+#if FLASH_JOURNAL_RETAINED
+#define JOURNAL_SECTION __attribute__((section(".non_init")))
+#else
+#define JOURNAL_SECTION
+#endif
+
+static uint32_t               m_ring[FLASH_JOURNAL_SIZE / sizeof(uint32_t)] JOURNAL_SECTION;
+static journal_ctl_t volatile m_ctl                                         JOURNAL_SECTION;
+
+static flash_queue_evt_handler_t m_evt_handler;
+static flash_journal_stat_t      m_stat;
+
+
+static entry_t * entry_at(uint32_t pos)
+{
+    return (entry_t *)((uint8_t *)m_ring + (pos & (FLASH_JOURNAL_SIZE - 1)));
+}
+
+
+static bool range_is_valid(uint32_t addr, uint32_t len)
+{
+    return (addr >= m_p_fs->start_addr) && (addr + len - 1 <= m_p_fs->end_addr);
+}
+
+
+/**@brief   Function for freeing the ring up to the @p cnt writes after the tail, and the skipped
+ *          entries around them. Must be called with interrupts disabled. */
+static void release(uint32_t cnt)
+{
+    while (m_ctl.tail != m_ctl.sent)
+    {
+        entry_t const * const p_entry = entry_at(m_ctl.tail);
+
+        if (p_entry->len != 0)
+        {
+            if (cnt == 0)
+            {
+                break;
+            }
+            cnt--;
+        }
+        m_ctl.tail += p_entry->size;
+    }
+}
+
+
+static void journal_evt_handler(flash_queue_evt_t const * p_evt)
+{
+    CRITICAL_REGION_ENTER();
+    release(p_evt->cnt);
+    if (p_evt->result != NRF_SUCCESS)
+    {
+        m_stat.failed += p_evt->cnt;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (m_evt_handler != NULL)
+    {
+        m_evt_handler(p_evt);
+    }
+}
+
+
+/**@brief   Function for checking that the positions and the entries kept over a reset are
+ *          consistent, and can be written again. */
+static bool retained_is_valid(void)
+{
+    if (   (m_ctl.magic != JOURNAL_MAGIC)
+        || (m_ctl.tail % ENTRY_ALIGN)
+        || (m_ctl.head - m_ctl.tail > FLASH_JOURNAL_SIZE))
+    {
+        return false;
+    }
+
+    for (uint32_t pos = m_ctl.tail; pos != m_ctl.head; )
+    {
+        entry_t const * const p_entry = entry_at(pos);
+        uint32_t        const room    = FLASH_JOURNAL_SIZE - (pos & (FLASH_JOURNAL_SIZE - 1));
+
+        if (   (p_entry->size == 0) || (p_entry->size % ENTRY_ALIGN)
+            || (p_entry->size > room) || (p_entry->size > m_ctl.head - pos))
+        {
+            return false;
+        }
+        if (   (p_entry->len != 0)
+            && (   (p_entry->size != ENTRY_SIZE(p_entry->len))
+                || (p_entry->dest % sizeof(uint32_t))
+                || !range_is_valid(p_entry->dest, p_entry->len)))
+        {
+            return false;
+        }
+        pos += p_entry->size;
+    }
+    return true;
+}
+
+
+ret_code_t flash_journal_init(nrf_fstorage_t const * p_fs, flash_queue_evt_handler_t evt_handler)
+{
+    if (p_fs == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    m_p_fs        = p_fs;
+    m_evt_handler = evt_handler;
+
+    memset(&m_stat, 0, sizeof(m_stat));
+    m_stat.size = FLASH_JOURNAL_SIZE;
+
+    if (FLASH_JOURNAL_RETAINED && retained_is_valid())
+    {
+        /* Whatever had been handed to the flash queue may not have been programmed. */
+        m_ctl.sent      = m_ctl.tail;
+        m_stat.used_max = m_ctl.head - m_ctl.tail;
+    }
+    else
+    {
+        m_ctl.head  = 0;
+        m_ctl.sent  = 0;
+        m_ctl.tail  = 0;
+        m_ctl.magic = JOURNAL_MAGIC;
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t flash_journal_write(uint32_t dest, void const * p_src, uint32_t len)
+{
+    if (p_src == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+    if (m_p_fs == NULL)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if (   (len == 0) || (len % m_p_fs->p_flash_info->program_unit)
+        || (len > FLASH_QUEUE_STAGING_SIZE) || (ENTRY_SIZE(len) > FLASH_JOURNAL_SIZE / 2))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    if ((dest % sizeof(uint32_t)) || !range_is_valid(dest, len))
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    uint32_t   const size = ENTRY_SIZE(len);
+    ret_code_t       rc   = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+
+    /* An entry does not wrap around, so that its data can be handed over in one piece. */
+    uint32_t const room = FLASH_JOURNAL_SIZE - (m_ctl.head & (FLASH_JOURNAL_SIZE - 1));
+    uint32_t const skip = (room < size) ? room : 0;
+
+    if (m_ctl.head - m_ctl.tail + skip + size > FLASH_JOURNAL_SIZE)
+    {
+        m_stat.dropped++;
+        m_stat.dropped_bytes += len;
+        rc = NRF_ERROR_NO_MEM;
+    }
+    else
+    {
+        if (skip != 0)
+        {
+            entry_t * const p_gap = entry_at(m_ctl.head);
+
+            p_gap->size = (uint16_t)skip;
+            p_gap->len  = 0;
+            p_gap->dest = 0;
+            m_ctl.head += skip;
+        }
+
+        entry_t * const p_entry = entry_at(m_ctl.head);
+
+        p_entry->size = (uint16_t)size;
+        p_entry->len  = (uint16_t)len;
+        p_entry->dest = dest;
+        memcpy(p_entry + 1, p_src, len);
+
+        m_ctl.head     += size;
+        m_stat.used_max = MAX(m_stat.used_max, m_ctl.head - m_ctl.tail);
+        m_stat.writes++;
+    }
+
+    CRITICAL_REGION_EXIT();
+
+    return rc;
+}
+
+
+bool flash_journal_process(void)
+{
+    bool handed = false;
+
+    if (m_p_fs == NULL)
+    {
+        return false;
+    }
+
+    /* Only this function moves the sent position, and only producers the head. */
+    while (m_ctl.sent != m_ctl.head)
+    {
+        uint32_t const  pos     = m_ctl.sent;
+        entry_t * const p_entry = entry_at(pos);
+
+        if (p_entry->len == 0)
+        {
+            m_ctl.sent += p_entry->size;
+            continue;
+        }
+
+        /* With nrf_fstorage_nvmc the write completes, and is released, before the call returns. */
+        m_ctl.sent += p_entry->size;
+
+        ret_code_t const rc = flash_queue_write(m_p_fs, p_entry->dest, p_entry + 1, p_entry->len,
+                                                journal_evt_handler, NULL);
+        if (rc == NRF_ERROR_NO_MEM)
+        {
+            m_ctl.sent = pos;
+            break;
+        }
+
+        handed = true;
+
+        if (rc != NRF_SUCCESS)
+        {
+            flash_queue_evt_t const evt =
+            {
+                .id      = FLASH_QUEUE_EVT_WRITE_RESULT,
+                .result  = rc,
+                .p_fs    = m_p_fs,
+                .addr    = p_entry->dest,
+                .len     = p_entry->len,
+                .cnt     = 1,
+                .p_param = NULL,
+            };
+
+            /* Writes handed over before may still be in flight: the entry is freed after them. */
+            CRITICAL_REGION_ENTER();
+            p_entry->len = 0;
+            release(0);
+            m_stat.failed++;
+            CRITICAL_REGION_EXIT();
+
+            if (m_evt_handler != NULL)
+            {
+                m_evt_handler(&evt);
+            }
+        }
+    }
+
+    return handed;
+}
+
+
+ret_code_t flash_journal_flush(uint32_t timeout_ms)
+{
+    if (m_p_fs == NULL)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    for (;;)
+    {
+        (void) flash_journal_process();
+
+        if (m_ctl.sent == m_ctl.head)
+        {
+            return NRF_SUCCESS;
+        }
+
+        /* The queue had no room for the write at the sent position. */
+        ret_code_t const rc = flash_queue_space_wait(1, entry_at(m_ctl.sent)->len, timeout_ms);
+
+        if (rc != NRF_SUCCESS)
+        {
+            return rc;
+        }
+    }
+}
+
+
+ret_code_t flash_journal_read(uint32_t addr, void * p_dest, uint32_t len)
+{
+    ret_code_t rc;
+
+    if (m_p_fs == NULL)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    /* Nothing may be released between reading flash and reading the journal, or a write that
+     * completes in between would be missed by both. */
+    CRITICAL_REGION_ENTER();
+
+    rc = flash_cache_read(m_p_fs, addr, p_dest, len);
+    if (rc == NRF_SUCCESS)
+    {
+        for (uint32_t pos = m_ctl.tail; pos != m_ctl.head; pos += entry_at(pos)->size)
+        {
+            entry_t const * const p_entry = entry_at(pos);
+            uint8_t const * const p_data  = (uint8_t const *)(p_entry + 1);
+            uint32_t        const first   = MAX(addr, p_entry->dest);
+            uint32_t        const end     = MIN(addr + len, p_entry->dest + p_entry->len);
+
+            /* Flash only clears bits, so the data of the writes is combined with a bitwise AND. */
+            for (uint32_t a = first; a < end; a++)
+            {
+                ((uint8_t *)p_dest)[a - addr] &= p_data[a - p_entry->dest];
+            }
+        }
+    }
+
+    CRITICAL_REGION_EXIT();
+
+    return rc;
+}
+
+
+bool flash_journal_is_busy(void)
+{
+    return m_ctl.head != m_ctl.tail;
+}
+
+
+ret_code_t flash_journal_stat_get(flash_journal_stat_t * p_stat)
+{
+    if (p_stat == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    CRITICAL_REGION_ENTER();
+    m_stat.used = m_ctl.head - m_ctl.tail;
+    *p_stat     = m_stat;
+    CRITICAL_REGION_EXIT();
+
+    return NRF_SUCCESS;
+}
+
+
+void flash_journal_stat_reset(void)
+{
+    CRITICAL_REGION_ENTER();
+    m_stat.used_max      = m_ctl.head - m_ctl.tail;
+    m_stat.writes        = 0;
+    m_stat.dropped       = 0;
+    m_stat.dropped_bytes = 0;
+    m_stat.failed        = 0;
+    CRITICAL_REGION_EXIT();
+}
+
+#else
+
+ret_code_t flash_journal_init(nrf_fstorage_t const * p_fs, flash_queue_evt_handler_t evt_handler)
+{
+    UNUSED_PARAMETER(evt_handler);
+    m_p_fs = p_fs;
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t flash_journal_write(uint32_t dest, void const * p_src, uint32_t len)
+{
+    UNUSED_PARAMETER(dest);
+    UNUSED_PARAMETER(p_src);
+    UNUSED_PARAMETER(len);
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+
+bool flash_journal_process(void)
+{
+    return false;
+}
+
+
+ret_code_t flash_journal_flush(uint32_t timeout_ms)
+{
+    UNUSED_PARAMETER(timeout_ms);
+    return (m_p_fs == NULL) ? NRF_ERROR_INVALID_STATE : NRF_SUCCESS;
+}
+
+
+ret_code_t flash_journal_read(uint32_t addr, void * p_dest, uint32_t len)
+{
+    if (m_p_fs == NULL)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    return flash_cache_read(m_p_fs, addr, p_dest, len);
+}
+
+
+bool flash_journal_is_busy(void)
+{
+    return false;
+}
+
+
+ret_code_t flash_journal_stat_get(flash_journal_stat_t * p_stat)
+{
+    UNUSED_PARAMETER(p_stat);
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+
+void flash_journal_stat_reset(void)
+{
+}
+
+#endif // FLASH_JOURNAL_ENABLED
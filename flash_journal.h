@@ -0,0 +1,157 @@
+#ifndef FLASH_JOURNAL_H__
+#define FLASH_JOURNAL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "nrf_fstorage.h"
+#include "flash_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup flash_journal RAM journal for bursts of flash writes
+ * @{
+ *
+ * @brief   RAM ring that takes writes faster than flash can program them.
+ *
+ * @details Writes are copied into a ring of @ref FLASH_JOURNAL_SIZE bytes and return right away.
+ *          @ref flash_journal_process hands them to the flash queue from the main loop, in
+ *          order, as fast as the queue takes them; writes that continue each other are merged
+ *          into single program operations there. A write stays in the journal until it has been
+ *          programmed, so the fill level tells how far flash is behind. A write that finds the
+ *          journal full fails right away and is counted as dropped.
+ *
+ *          If @ref FLASH_JOURNAL_RETAINED is set, the journal is kept in RAM that the startup code
+ *          does not clear, and writes still in it after a reset without power loss, e.g. by the
+ *          watchdog, are made again. Data that had already been programmed is then programmed a
+ *          second time with the same value, which the flash allows.
+ *
+ *          Since flash can only clear bits, the order in which writes to the same word are made
+ *          does not change the result. Writes can therefore go either through the journal or
+ *          through the write cache; @ref flash_journal_read includes both. The order of writes
+ *          and erases does matter: a write still in the journal when an erase of its page is
+ *          queued would be programmed after the erase, into the erased page. Call
+ *          @ref flash_journal_flush before queuing an erase, and after @ref flash_journal_init
+ *          when writes kept over a reset are to be made again.
+ */
+
+
+/**@brief   Journal statistics. */
+typedef struct
+{
+    uint32_t size;          //!< Bytes in the journal.
+    uint32_t used;          //!< Bytes taken by writes that have not been programmed yet.
+    uint32_t used_max;      //!< Most bytes taken at once.
+    uint32_t writes;        //!< Writes added to the journal.
+    uint32_t dropped;       //!< Writes refused because the journal was full.
+    uint32_t dropped_bytes; //!< Bytes of the writes refused.
+    uint32_t failed;        //!< Writes the flash queue refused, or that failed.
+} flash_journal_stat_t;
+
+
+/**@brief   Function for initializing the journal.
+ *
+ * If @ref FLASH_JOURNAL_RETAINED is set and the journal was kept over a reset, the writes left in
+ * it are made again. Must be called after @ref flash_queue_init.
+ *
+ * @param[in]   p_fs        The fstorage instance the journal writes to.
+ * @param[in]   evt_handler Handler to be called with the flash queue event of each write
+ *                          operation of the journal. Can be NULL.
+ *
+ * @retval  NRF_SUCCESS     If the journal was initialized.
+ * @retval  NRF_ERROR_NULL  If @p p_fs is NULL.
+ */
+ret_code_t flash_journal_init(nrf_fstorage_t const * p_fs, flash_queue_evt_handler_t evt_handler);
+
+
+/**@brief   Function for adding a write to the journal. Can be called from any context.
+ *
+ * The data is copied with interrupts disabled.
+ *
+ * @param[in]   dest    Address in flash where to write the data. Must be word-aligned.
+ * @param[in]   p_src   Data to be written.
+ * @param[in]   len     Length of the data, in bytes. Must be a multiple of the program unit, at
+ *                      most @ref FLASH_QUEUE_STAGING_SIZE, and at most half the journal less
+ *                      eight bytes.
+ *
+ * @retval  NRF_SUCCESS             If the write was added.
+ * @retval  NRF_ERROR_NULL          If @p p_src is NULL.
+ * @retval  NRF_ERROR_INVALID_STATE If the journal has not been initialized.
+ * @retval  NRF_ERROR_INVALID_LENGTH If @p len is zero, not a multiple of the program unit or too
+ *                                  large.
+ * @retval  NRF_ERROR_INVALID_ADDR  If the range is outside the boundaries of the fstorage
+ *                                  instance, or @p dest is not word-aligned.
+ * @retval  NRF_ERROR_NO_MEM        If the journal is full. The write is counted as dropped.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If @ref FLASH_JOURNAL_ENABLED is not set.
+ */
+ret_code_t flash_journal_write(uint32_t dest, void const * p_src, uint32_t len);
+
+
+/**@brief   Function for handing writes of the journal to the flash queue.
+ *
+ * Call this function from the main loop. Writes the queue cannot take yet are handed over by a
+ * later call.
+ *
+ * @retval  true    If writes were handed to the queue.
+ * @retval  false   If there were none, or the queue was full.
+ */
+bool flash_journal_process(void);
+
+
+/**@brief   Function for handing every write of the journal to the flash queue.
+ *
+ * Sleeps while the queue is full, see @ref flash_queue_space_wait, so it must be called from the
+ * main context. Once it returns, an operation queued on the fstorage instance of the journal is
+ * not made before the writes that were in the journal; writes added later are.
+ *
+ * @param[in]   timeout_ms  Longest time to wait for room in the queue, each time it is full.
+ *
+ * @retval  NRF_SUCCESS             If all writes were handed over, or
+ *                                  @ref FLASH_JOURNAL_ENABLED is not set.
+ * @retval  NRF_ERROR_INVALID_STATE If the journal has not been initialized.
+ * @return  Any error returned by @ref flash_queue_space_wait.
+ */
+ret_code_t flash_journal_flush(uint32_t timeout_ms);
+
+
+/**@brief   Function for reading flash, including data still in the journal or in the write cache.
+ *
+ * @param[in]   addr    Address to read from. Must be word-aligned.
+ * @param[out]  p_dest  Buffer to read the data into.
+ * @param[in]   len     Number of bytes to read.
+ *
+ * @return  See @ref flash_cache_read. If @ref FLASH_JOURNAL_ENABLED is not set, the data is read
+ *          with @ref flash_cache_read from the fstorage instance given to
+ *          @ref flash_journal_init.
+ */
+ret_code_t flash_journal_read(uint32_t addr, void * p_dest, uint32_t len);
+
+
+/**@brief   Function for checking if the journal holds writes that have not been programmed yet. */
+bool flash_journal_is_busy(void);
+
+
+/**@brief   Function for retrieving the statistics of the journal.
+ *
+ * @retval  NRF_SUCCESS             If the statistics were copied.
+ * @retval  NRF_ERROR_NULL          If @p p_stat is NULL.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If @ref FLASH_JOURNAL_ENABLED is not set.
+ */
+ret_code_t flash_journal_stat_get(flash_journal_stat_t * p_stat);
+
+
+/**@brief   Function for clearing the counters of the statistics, except @c used. */
+void flash_journal_stat_reset(void);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_JOURNAL_H__
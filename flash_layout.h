@@ -0,0 +1,70 @@
+#ifndef FLASH_LAYOUT_H__
+#define FLASH_LAYOUT_H__
+
+#include <stdint.h>
+#include "sdk_config.h"
+#include "app_util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup flash_layout Flash area layout
+ * @{
+ *
+ * @brief   Compile-time description of the flash area of the application.
+ *
+ * @details The area is @ref FLASH_LAYOUT_PAGES pages of @ref FLASH_LAYOUT_PAGE_SIZE bytes that end
+ *          at @ref FLASH_LAYOUT_END_ADDR, all set per target in sdk_config.h. Since they are
+ *          constants, the macros below fold to shifts and masks. The flash queue and the
+ *          record store count in pages of this size, on any fstorage instance whose erase unit
+ *          it is, within the area or not. Call
+ *          @ref FLASH_LAYOUT_IS_FREE at startup to check that the linked image and the bootloader
+ *          leave the area free; the end of the image comes from the FLASH1 segment of
+ *          flash_placement.xml, see CODE_END.
+ */
+
+
+/**@brief   Bytes in the area. */
+#define FLASH_LAYOUT_SIZE       (FLASH_LAYOUT_PAGES * FLASH_LAYOUT_PAGE_SIZE)
+
+/**@brief   First address of the area. */
+#define FLASH_LAYOUT_START_ADDR (FLASH_LAYOUT_END_ADDR - FLASH_LAYOUT_SIZE)
+
+/**@brief   Last address of the area, as in the end_addr field of nrf_fstorage_t. */
+#define FLASH_LAYOUT_LAST_ADDR  (FLASH_LAYOUT_END_ADDR - 1)
+
+/**@brief   log2 of @ref FLASH_LAYOUT_PAGE_SIZE. */
+#define FLASH_LAYOUT_PAGE_SHIFT ((FLASH_LAYOUT_PAGE_SIZE == 1024) ? 10 : \
+                                 (FLASH_LAYOUT_PAGE_SIZE == 2048) ? 11 : \
+                                 (FLASH_LAYOUT_PAGE_SIZE == 4096) ? 12 : \
+                                 (FLASH_LAYOUT_PAGE_SIZE == 8192) ? 13 : 0)
+
+STATIC_ASSERT((1u << FLASH_LAYOUT_PAGE_SHIFT) == FLASH_LAYOUT_PAGE_SIZE);
+STATIC_ASSERT(FLASH_LAYOUT_PAGES > 0);
+STATIC_ASSERT((FLASH_LAYOUT_END_ADDR & (FLASH_LAYOUT_PAGE_SIZE - 1)) == 0);
+STATIC_ASSERT(FLASH_LAYOUT_SIZE <= FLASH_LAYOUT_END_ADDR);
+
+
+/**@brief   Address of page @p page of the area. */
+#define FLASH_LAYOUT_PAGE_ADDR(page)                                                               \
+    (FLASH_LAYOUT_START_ADDR + ((uint32_t)(page) << FLASH_LAYOUT_PAGE_SHIFT))
+
+/**@brief   Offset of @p addr in its page. */
+#define FLASH_LAYOUT_PAGE_OFFSET(addr)  ((addr) & (FLASH_LAYOUT_PAGE_SIZE - 1))
+
+/**@brief   Whether the area lies between the end of the image, @p code_end, and the end of the
+ *          flash that is free for data, @p flash_end, e.g. the start of the bootloader. */
+#define FLASH_LAYOUT_IS_FREE(code_end, flash_end)                                                  \
+    (((code_end) <= FLASH_LAYOUT_START_ADDR) && (FLASH_LAYOUT_END_ADDR <= (flash_end)))
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_LAYOUT_H__
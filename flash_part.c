@@ -0,0 +1,463 @@
+#include "flash_part.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "nordic_common.h"
+#include "app_util.h"
+#include "record_store.h"
+
+
+#define LOG_HDR(len)        (((uint32_t)FLASH_PART_LOG_MAGIC << 16) | (len))
+#define LOG_PAGE_HDR(seq)   (((uint32_t)FLASH_PART_LOG_PAGE_MAGIC << 16) | (seq))
+#define LOG_ENTRY_SIZE(len) (sizeof(uint32_t) + ALIGN_NUM(sizeof(uint32_t), (len)))
+#define WORD_ERASED         0xFFFFFFFF
+
+
+/**@brief   End of a log partition: where the next entry goes. */
+typedef struct
+{
+    bool     mounted;
+    uint32_t page;      //!< Page of the partition new entries are added to.
+    uint32_t offset;    //!< Offset of the next entry in the page. Zero until the page header
+                        //!< has been written.
+    uint16_t seq;       //!< Sequence number of the page.
+} log_t;
+
+
+/**@brief   How a partition is kept in the persisted table. */
+typedef struct
+{
+    uint16_t first_page;
+    uint16_t pages;
+    uint8_t  policy;
+    uint8_t  rfu[3];
+} table_entry_t;
+
+
+static void part_evt_handler(nrf_fstorage_evt_t * p_evt)
+{
+    flash_queue_on_fstorage_evt(p_evt);
+}
+
+
+NRF_FSTORAGE_DEF(static nrf_fstorage_t m_config_fs) =
+{
+    .evt_handler = part_evt_handler,
+    .start_addr  = FLASH_PART_START_ADDR(FLASH_PART_CONFIG_FIRST),
+    .end_addr    = FLASH_PART_LAST_ADDR(FLASH_PART_CONFIG_FIRST, FLASH_PART_CONFIG_PAGES),
+};
+
+NRF_FSTORAGE_DEF(static nrf_fstorage_t m_log_fs) =
+{
+    .evt_handler = part_evt_handler,
+    .start_addr  = FLASH_PART_START_ADDR(FLASH_PART_LOG_FIRST),
+    .end_addr    = FLASH_PART_LAST_ADDR(FLASH_PART_LOG_FIRST, FLASH_PART_LOG_PAGES),
+};
+
+NRF_FSTORAGE_DEF(static nrf_fstorage_t m_dump_fs) =
+{
+    .evt_handler = part_evt_handler,
+    .start_addr  = FLASH_PART_START_ADDR(FLASH_PART_DUMP_FIRST),
+    .end_addr    = FLASH_PART_LAST_ADDR(FLASH_PART_DUMP_FIRST, FLASH_PART_DUMP_PAGES),
+};
+
+
+static flash_part_t const m_parts[FLASH_PART_COUNT] =
+{
+    [FLASH_PART_CONFIG] =
+    {
+        .p_name     = "config",
+        .p_fs       = &m_config_fs,
+        .policy     = FLASH_PART_POLICY_KV,
+        .first_page = FLASH_PART_CONFIG_FIRST,
+        .pages      = FLASH_PART_CONFIG_PAGES,
+    },
+    [FLASH_PART_LOG] =
+    {
+        .p_name     = "log",
+        .p_fs       = &m_log_fs,
+        .policy     = FLASH_PART_POLICY_LOG,
+        .first_page = FLASH_PART_LOG_FIRST,
+        .pages      = FLASH_PART_LOG_PAGES,
+    },
+    [FLASH_PART_DUMP] =
+    {
+        .p_name     = "dump",
+        .p_fs       = &m_dump_fs,
+        .policy     = FLASH_PART_POLICY_RAW,
+        .first_page = FLASH_PART_DUMP_FIRST,
+        .pages      = FLASH_PART_DUMP_PAGES,
+    },
+};
+
+static log_t m_log[FLASH_PART_COUNT];
+
+/* Fills log entries up to a whole number of words. */
+static uint8_t const m_pad[sizeof(uint32_t) - 1] = {0xFF, 0xFF, 0xFF};
+
+
+static uint32_t page_addr(flash_part_t const * p_part, uint32_t page)
+{
+    return p_part->p_fs->start_addr + page * FLASH_LAYOUT_PAGE_SIZE;
+}
+
+
+static uint32_t word_read(flash_part_t const * p_part, uint32_t addr)
+{
+    uint32_t word = WORD_ERASED;
+
+    (void) nrf_fstorage_read(p_part->p_fs, addr, &word, sizeof(word));
+    return word;
+}
+
+
+/**@brief   Offset of the first free word of a log page. A page with an entry that is not valid,
+ *          e.g. one that a reset cut short, counts as full. */
+static uint32_t log_page_end(flash_part_t const * p_part, uint32_t page)
+{
+    uint32_t const addr   = page_addr(p_part, page);
+    uint32_t       offset = sizeof(uint32_t);
+
+    while (offset + sizeof(uint32_t) <= FLASH_LAYOUT_PAGE_SIZE)
+    {
+        uint32_t const hdr = word_read(p_part, addr + offset);
+        uint32_t const len = hdr & 0xFFFF;
+
+        if (hdr == WORD_ERASED)
+        {
+            break;
+        }
+        if (   ((hdr >> 16) != FLASH_PART_LOG_MAGIC) || (len == 0)
+            || (offset + LOG_ENTRY_SIZE(len) > FLASH_LAYOUT_PAGE_SIZE))
+        {
+            return FLASH_LAYOUT_PAGE_SIZE;
+        }
+        offset += LOG_ENTRY_SIZE(len);
+    }
+
+    return offset;
+}
+
+
+/**@brief   Read the header of a log page.
+ *
+ * @param[out]  p_seq   Sequence number of the page.
+ *
+ * @retval  true    If the page starts with a page header.
+ * @retval  false   If it is erased, or holds something else.
+ */
+static bool log_page_seq(flash_part_t const * p_part, uint32_t page, uint16_t * p_seq)
+{
+    uint32_t const hdr = word_read(p_part, page_addr(p_part, page));
+
+    *p_seq = (uint16_t)hdr;
+    return (hdr >> 16) == FLASH_PART_LOG_PAGE_MAGIC;
+}
+
+
+/**@brief   Find the end of a log. Pages are numbered in the order they are written, so the newest
+ *          page is the one the next page does not follow in sequence. */
+static ret_code_t log_mount(flash_part_id_t id)
+{
+    flash_part_t const * const p_part = &m_parts[id];
+    log_t              * const p_log  = &m_log[id];
+    uint32_t                   erased = 0;
+
+    p_log->page   = 0;
+    p_log->offset = 0;
+    p_log->seq    = 0;
+
+    for (uint32_t page = 0; page < p_part->pages; page++)
+    {
+        uint16_t seq;
+        uint16_t next_seq;
+
+        if (!log_page_seq(p_part, page, &seq))
+        {
+            erased += (word_read(p_part, page_addr(p_part, page)) == WORD_ERASED) ? 1 : 0;
+            continue;
+        }
+        if (   !log_page_seq(p_part, (page + 1) % p_part->pages, &next_seq)
+            || (next_seq != (uint16_t)(seq + 1)))
+        {
+            p_log->page    = page;
+            p_log->offset  = log_page_end(p_part, page);
+            p_log->seq     = seq;
+            p_log->mounted = true;
+            return NRF_SUCCESS;
+        }
+    }
+
+    if (erased < p_part->pages)
+    {
+        /* Not a log: start over. */
+        ret_code_t const rc = flash_queue_erase(p_part->p_fs, p_part->p_fs->start_addr,
+                                                p_part->pages, NULL, NULL);
+        if (rc != NRF_SUCCESS)
+        {
+            return rc;
+        }
+    }
+
+    p_log->mounted = true;
+    return NRF_SUCCESS;
+}
+
+
+static void table_get(table_entry_t * p_table)
+{
+    memset(p_table, 0x00, FLASH_PART_COUNT * sizeof(table_entry_t));
+
+    for (uint32_t i = 0; i < FLASH_PART_COUNT; i++)
+    {
+        p_table[i].first_page = m_parts[i].first_page;
+        p_table[i].pages      = m_parts[i].pages;
+        p_table[i].policy     = (uint8_t)m_parts[i].policy;
+    }
+}
+
+
+ret_code_t flash_part_init(nrf_fstorage_api_t * p_api)
+{
+    for (uint32_t i = 0; i < FLASH_PART_COUNT; i++)
+    {
+        flash_part_t const * const p_part = &m_parts[i];
+        ret_code_t                 rc;
+
+        rc = nrf_fstorage_init(p_part->p_fs, p_api, NULL);
+        if (rc != NRF_SUCCESS)
+        {
+            return rc;
+        }
+
+        if (p_part->policy == FLASH_PART_POLICY_KV)
+        {
+            rc = flash_queue_share_set(p_part->p_fs, FLASH_PART_CONFIG_RESERVED_OPS,
+                                       FLASH_QUEUE_OP_COUNT, FLASH_QUEUE_STAGING_SIZE);
+        }
+        else
+        {
+            rc = flash_queue_share_set(p_part->p_fs, 0,
+                                       FLASH_PART_LOG_MAX_OPS, FLASH_PART_LOG_MAX_STAGE);
+        }
+        if (rc != NRF_SUCCESS)
+        {
+            return rc;
+        }
+
+        switch (p_part->policy)
+        {
+            case FLASH_PART_POLICY_KV:
+                rc = flash_queue_sched_set(p_part->p_fs, FLASH_QUEUE_PRIO_HIGH, 0);
+                break;
+
+            case FLASH_PART_POLICY_LOG:
+                rc = flash_queue_sched_set(p_part->p_fs, FLASH_QUEUE_PRIO_NORMAL,
+                                           FLASH_PART_LOG_DEADLINE_MS);
+                break;
+
+            default:
+                rc = flash_queue_sched_set(p_part->p_fs, FLASH_QUEUE_PRIO_LOW, 0);
+                break;
+        }
+        if (rc != NRF_SUCCESS)
+        {
+            return rc;
+        }
+
+        m_log[i].mounted = false;
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t flash_part_mount(void)
+{
+    table_entry_t table[FLASH_PART_COUNT];
+    table_entry_t kept[FLASH_PART_COUNT];
+    bool          found = false;
+    bool          moved = false;
+    ret_code_t    rc;
+
+    table_get(table);
+
+#if FLASH_PART_PERSIST_ENABLED
+    uint16_t len = sizeof(kept);
+
+    rc    = record_store_read(FLASH_PART_TABLE_KEY, kept, &len);
+    found = (rc == NRF_SUCCESS) && (len == sizeof(kept));
+#else
+    UNUSED_VARIABLE(kept);
+#endif
+
+    for (uint32_t i = 0; i < FLASH_PART_COUNT; i++)
+    {
+        flash_part_t const * const p_part = &m_parts[i];
+
+        if (p_part->policy == FLASH_PART_POLICY_KV)
+        {
+            continue;
+        }
+
+        if (FLASH_PART_PERSIST_ENABLED && (!found || memcmp(&kept[i], &table[i], sizeof(table[i]))))
+        {
+            /* The pages held something else before: drop it. */
+            rc = flash_queue_erase(p_part->p_fs, p_part->p_fs->start_addr, p_part->pages,
+                                   NULL, NULL);
+            if (rc != NRF_SUCCESS)
+            {
+                return rc;
+            }
+            m_log[i].page    = 0;
+            m_log[i].offset  = 0;
+            m_log[i].seq     = 0;
+            m_log[i].mounted = true;
+            moved            = true;
+        }
+        else if (p_part->policy == FLASH_PART_POLICY_LOG)
+        {
+            rc = log_mount((flash_part_id_t)i);
+            if (rc != NRF_SUCCESS)
+            {
+                return rc;
+            }
+        }
+    }
+
+    if (moved)
+    {
+        return record_store_write(FLASH_PART_TABLE_KEY, table, sizeof(table));
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+flash_part_t const * flash_part_get(flash_part_id_t id)
+{
+    return (id < FLASH_PART_COUNT) ? &m_parts[id] : NULL;
+}
+
+
+flash_part_t const * flash_part_find(char const * p_name)
+{
+    for (uint32_t i = 0; (p_name != NULL) && (i < FLASH_PART_COUNT); i++)
+    {
+        if (strcmp(m_parts[i].p_name, p_name) == 0)
+        {
+            return &m_parts[i];
+        }
+    }
+    return NULL;
+}
+
+
+ret_code_t flash_part_append(flash_part_id_t             id,
+                             void                const * p_data,
+                             uint32_t                    len,
+                             flash_queue_evt_handler_t   evt_handler,
+                             void                      * p_param)
+{
+    if (p_data == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+    if ((id >= FLASH_PART_COUNT) || (m_parts[id].policy != FLASH_PART_POLICY_LOG))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if (!m_log[id].mounted)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if ((len == 0) || (sizeof(uint32_t) + LOG_ENTRY_SIZE(len) > FLASH_LAYOUT_PAGE_SIZE))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    flash_part_t const * const p_part = &m_parts[id];
+    log_t              * const p_log  = &m_log[id];
+    ret_code_t                 rc;
+
+    if (MAX(p_log->offset, sizeof(uint32_t)) + LOG_ENTRY_SIZE(len) > FLASH_LAYOUT_PAGE_SIZE)
+    {
+        uint32_t const next = (p_log->page + 1) % p_part->pages;
+
+        /* The next page holds the oldest entries. Its erase is queued before the entry, so it
+         * is done by the time the entry is written. */
+        rc = flash_queue_erase(p_part->p_fs, page_addr(p_part, next), 1, NULL, NULL);
+        if (rc != NRF_SUCCESS)
+        {
+            return rc;
+        }
+        p_log->page   = next;
+        p_log->offset = 0;
+        p_log->seq++;
+    }
+
+    /* A new page starts with its header, written with the first entry. */
+    uint32_t          const page_hdr = LOG_PAGE_HDR(p_log->seq);
+    uint32_t          const hdr      = LOG_HDR(len);
+    uint32_t          const skip     = (p_log->offset == 0) ? 0 : 1;
+    flash_queue_seg_t const segs[]   =
+    {
+        { .p_data = &page_hdr, .len = sizeof(page_hdr) },
+        { .p_data = &hdr,      .len = sizeof(hdr) },
+        { .p_data = p_data,    .len = len },
+        { .p_data = m_pad,     .len = LOG_ENTRY_SIZE(len) - sizeof(hdr) - len },
+    };
+
+    rc = flash_queue_write_gather(p_part->p_fs, page_addr(p_part, p_log->page) + p_log->offset,
+                                  &segs[skip], ARRAY_SIZE(segs) - skip, evt_handler, p_param);
+    if (rc == NRF_SUCCESS)
+    {
+        p_log->offset += LOG_ENTRY_SIZE(len) + ((skip == 0) ? sizeof(page_hdr) : 0);
+    }
+
+    return rc;
+}
+
+
+ret_code_t flash_part_write(flash_part_id_t             id,
+                            uint32_t                    offset,
+                            void                const * p_src,
+                            uint32_t                    len,
+                            flash_queue_evt_handler_t   evt_handler,
+                            void                      * p_param)
+{
+    if ((id >= FLASH_PART_COUNT) || (m_parts[id].policy != FLASH_PART_POLICY_RAW))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    nrf_fstorage_t const * const p_fs = m_parts[id].p_fs;
+
+    if (offset > p_fs->end_addr - p_fs->start_addr)
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    return flash_queue_write(p_fs, p_fs->start_addr + offset, p_src, len, evt_handler, p_param);
+}
+
+
+ret_code_t flash_part_erase(flash_part_id_t             id,
+                            uint32_t                    page,
+                            uint32_t                    pages_cnt,
+                            flash_queue_evt_handler_t   evt_handler,
+                            void                      * p_param)
+{
+    if ((id >= FLASH_PART_COUNT) || (m_parts[id].policy != FLASH_PART_POLICY_RAW))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if (page >= m_parts[id].pages)
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    return flash_queue_erase(m_parts[id].p_fs, page_addr(&m_parts[id], page), pages_cnt,
+                             evt_handler, p_param);
+}
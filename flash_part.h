@@ -0,0 +1,197 @@
+#ifndef FLASH_PART_H__
+#define FLASH_PART_H__
+
+#include <stdint.h>
+#include "sdk_config.h"
+#include "sdk_errors.h"
+#include "nrf_fstorage.h"
+#include "flash_layout.h"
+#include "flash_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup flash_part Flash partitions
+ * @{
+ *
+ * @brief   Fixed partition table of the flash area, one fstorage instance per partition.
+ *
+ * @details The flash area of @ref flash_layout is split, in order, into the partitions below,
+ *          whose sizes are set per target in sdk_config.h. Each partition has its own fstorage
+ *          instance, whose bounds cannot be changed, and a policy that says how it may be
+ *          written:
+ *          - The config partition holds the record store. Only the record store writes it.
+ *          - The log partition is a circular log: @ref flash_part_append adds entries after the
+ *            newest one, and erases the oldest page when it moves onto it.
+ *          - The dump partition is raw flash, written and erased with @ref flash_part_write and
+ *            @ref flash_part_erase.
+ *
+ *          All partitions share the one flash queue in front of nrf_fstorage. Each gets its own
+ *          share of it (see @ref flash_queue_share_set): operations are kept free for the config
+ *          partition, and the log and dump partitions can only hold so many at once, so that
+ *          a stream of log entries cannot keep record store commits out of the queue. The config
+ *          partition is also scheduled first, the log next, with a deadline, and the dump last.
+ *
+ *          If @ref FLASH_PART_PERSIST_ENABLED is set, the table is kept in the record store.
+ *          @ref flash_part_mount compares it with the table of earlier firmware, and erases the
+ *          log and dump partitions if they moved.
+ *
+ *          A page of the log starts with a word holding @ref FLASH_PART_LOG_PAGE_MAGIC in its
+ *          upper half and the sequence number of the page in its lower half, one more than that
+ *          of the page before. An entry is a word holding @ref FLASH_PART_LOG_MAGIC in its upper
+ *          half and the length of the data in its lower half, followed by the data, padded with
+ *          0xFF to a whole number of words. Entries do not cross pages.
+ */
+
+
+/**@brief   Partitions, in the order they take the flash area. */
+typedef enum
+{
+    FLASH_PART_CONFIG,  //!< Record store.
+    FLASH_PART_LOG,     //!< Circular log.
+    FLASH_PART_DUMP,    //!< Raw pages, e.g. for crash dumps.
+    FLASH_PART_COUNT
+} flash_part_id_t;
+
+
+/**@brief   How a partition may be written. */
+typedef enum
+{
+    FLASH_PART_POLICY_KV,   //!< Owned by the record store.
+    FLASH_PART_POLICY_LOG,  //!< Appended to with @ref flash_part_append.
+    FLASH_PART_POLICY_RAW,  //!< Written and erased anywhere.
+} flash_part_policy_t;
+
+
+/**@brief   A partition. */
+typedef struct
+{
+    char                const * p_name;
+    nrf_fstorage_t            * p_fs;       //!< The fstorage instance of the partition.
+    flash_part_policy_t         policy;
+    uint16_t                    first_page; //!< First page, counted from the start of the area.
+    uint16_t                    pages;
+} flash_part_t;
+
+
+#define FLASH_PART_LOG_MAGIC      0x4C47    //!< Upper half of the header word of a log entry.
+#define FLASH_PART_LOG_PAGE_MAGIC 0x4C50    //!< Upper half of the header word of a log page.
+
+/**@brief   First page of each partition, counted from the start of the flash area. */
+#define FLASH_PART_CONFIG_FIRST 0
+#define FLASH_PART_LOG_FIRST    (FLASH_PART_CONFIG_FIRST + FLASH_PART_CONFIG_PAGES)
+#define FLASH_PART_DUMP_FIRST   (FLASH_PART_LOG_FIRST + FLASH_PART_LOG_PAGES)
+
+/**@brief   First and last address of the partition @p first_page, @p pages pages long, as in the
+ *          start_addr and end_addr fields of nrf_fstorage_t. */
+#define FLASH_PART_START_ADDR(first_page)       FLASH_LAYOUT_PAGE_ADDR(first_page)
+#define FLASH_PART_LAST_ADDR(first_page, pages) (FLASH_LAYOUT_PAGE_ADDR((first_page) + (pages)) - 1)
+
+STATIC_ASSERT(FLASH_PART_DUMP_FIRST + FLASH_PART_DUMP_PAGES <= FLASH_LAYOUT_PAGES);
+STATIC_ASSERT(FLASH_PART_CONFIG_PAGES > 0);
+STATIC_ASSERT(FLASH_PART_LOG_PAGES >= 2);
+STATIC_ASSERT(FLASH_PART_DUMP_PAGES > 0);
+
+
+/**@brief   Function for initializing the fstorage instances of the partitions, and their shares
+ *          and classes in the flash queue. Must be called after @ref flash_queue_init.
+ *
+ * @param[in]   p_api   The fstorage backend to use.
+ *
+ * @return  Any error returned by nrf_fstorage_init(), @ref flash_queue_share_set or
+ *          @ref flash_queue_sched_set.
+ */
+ret_code_t flash_part_init(nrf_fstorage_api_t * p_api);
+
+
+/**@brief   Function for checking the partitions against the table of earlier firmware, and for
+ *          finding the end of the log.
+ *
+ * Must be called after the record store has been initialized on the config partition. Erases
+ * of partitions that moved are queued before this function returns.
+ *
+ * @retval  NRF_SUCCESS     If the partitions are ready.
+ * @return  Any error returned by @ref flash_queue_erase, or by the record store when the table
+ *          is read or written.
+ */
+ret_code_t flash_part_mount(void);
+
+
+/**@brief   Function for retrieving a partition.
+ *
+ * @return  The partition, or NULL if @p id is not valid.
+ */
+flash_part_t const * flash_part_get(flash_part_id_t id);
+
+
+/**@brief   Function for finding a partition by name.
+ *
+ * @return  The partition, or NULL if there is none with that name.
+ */
+flash_part_t const * flash_part_find(char const * p_name);
+
+
+/**@brief   Function for appending an entry to a log partition.
+ *
+ * The data is copied into the flash queue. When the entry does not fit in the current page, the
+ * log moves to the next page, which holds the oldest entries, and erases it first.
+ *
+ * @param[in]   id          The partition.
+ * @param[in]   p_data      Data of the entry.
+ * @param[in]   len         Length of the data, in bytes. At most a page less eight bytes.
+ * @param[in]   evt_handler Handler to be called when the entry has been written. Can be NULL.
+ * @param[in]   p_param     User-defined parameter passed to the event handler.
+ *
+ * @retval  NRF_SUCCESS             If the entry was queued.
+ * @retval  NRF_ERROR_NULL          If @p p_data is NULL.
+ * @retval  NRF_ERROR_INVALID_PARAM If @p id is not a log partition.
+ * @retval  NRF_ERROR_INVALID_STATE If @ref flash_part_mount has not been called.
+ * @retval  NRF_ERROR_INVALID_LENGTH If @p len is zero or too large.
+ * @retval  NRF_ERROR_NO_MEM        If the share of the partition in the flash queue is full.
+ */
+ret_code_t flash_part_append(flash_part_id_t             id,
+                             void                const * p_data,
+                             uint32_t                    len,
+                             flash_queue_evt_handler_t   evt_handler,
+                             void                      * p_param);
+
+
+/**@brief   Function for writing to a raw partition. See @ref flash_queue_write.
+ *
+ * @param[in]   offset  Offset in the partition. Must be word-aligned.
+ *
+ * @retval  NRF_ERROR_INVALID_PARAM If @p id is not a raw partition.
+ * @return  Otherwise, see @ref flash_queue_write.
+ */
+ret_code_t flash_part_write(flash_part_id_t             id,
+                            uint32_t                    offset,
+                            void                const * p_src,
+                            uint32_t                    len,
+                            flash_queue_evt_handler_t   evt_handler,
+                            void                      * p_param);
+
+
+/**@brief   Function for erasing pages of a raw partition. See @ref flash_queue_erase.
+ *
+ * @param[in]   page    First page to erase, counted from the start of the partition.
+ *
+ * @retval  NRF_ERROR_INVALID_PARAM If @p id is not a raw partition.
+ * @return  Otherwise, see @ref flash_queue_erase.
+ */
+ret_code_t flash_part_erase(flash_part_id_t             id,
+                            uint32_t                    page,
+                            uint32_t                    pages_cnt,
+                            flash_queue_evt_handler_t   evt_handler,
+                            void                      * p_param);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_PART_H__
@@ -0,0 +1,127 @@
+#include "flash_power.h"
+
+#include "nordic_common.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "nrf_pwr_mgmt.h"
+
+
+static uint32_t m_last_ticks;   //!< When the time counts were last brought up to date.
+static uint64_t m_awake_ticks;
+static uint64_t m_asleep_ticks;
+static uint32_t m_wakeups;
+
+
+static uint32_t ticks_to_ms(uint64_t ticks)
+{
+    return (uint32_t)((ticks * 1000) / APP_TIMER_TICKS(1000));
+}
+
+
+ret_code_t flash_power_init(void)
+{
+    flash_power_stat_reset();
+    return nrf_pwr_mgmt_init();
+}
+
+
+void flash_power_sleep(void)
+{
+    uint32_t const before = app_timer_cnt_get();
+
+    nrf_pwr_mgmt_run();
+
+    uint32_t const after = app_timer_cnt_get();
+
+    /* The counter wraps around after a few minutes, and the RTC wakes the core before it does,
+     * so time is added up at every wakeup. */
+    m_awake_ticks  += app_timer_cnt_diff_compute(before, m_last_ticks);
+    m_asleep_ticks += app_timer_cnt_diff_compute(after, before);
+    m_last_ticks    = after;
+    m_wakeups++;
+}
+
+
+void flash_power_future_init(flash_power_future_t * p_future)
+{
+    p_future->result = NRF_SUCCESS;
+    p_future->done   = false;
+}
+
+
+void flash_power_future_set(flash_power_future_t * p_future, ret_code_t result)
+{
+    CRITICAL_REGION_ENTER();
+    if (p_future->result == NRF_SUCCESS)
+    {
+        p_future->result = result;
+    }
+    p_future->done = true;
+    CRITICAL_REGION_EXIT();
+}
+
+
+void flash_power_future_evt_handler(flash_queue_evt_t const * p_evt)
+{
+    flash_power_future_set((flash_power_future_t *)p_evt->p_param, p_evt->result);
+}
+
+
+ret_code_t flash_power_future_wait(flash_power_future_t * p_future)
+{
+    /* An event that sets the future between the check and the sleep also ends the sleep. */
+    while (!p_future->done)
+    {
+        flash_power_sleep();
+    }
+
+    return p_future->result;
+}
+
+
+ret_code_t flash_power_stat_get(flash_power_stat_t * p_stat)
+{
+    if (p_stat == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    flash_queue_stats_t queue = {0};
+    uint32_t const      now   = app_timer_cnt_get();
+
+    m_awake_ticks += app_timer_cnt_diff_compute(now, m_last_ticks);
+    m_last_ticks   = now;
+
+    /* Without queue statistics, only the time awake and asleep is accounted for. */
+    (void) flash_queue_stats_get(&queue);
+
+    p_stat->awake_ms  = ticks_to_ms(m_awake_ticks);
+    p_stat->asleep_ms = ticks_to_ms(m_asleep_ticks);
+    p_stat->wakeups   = m_wakeups;
+    p_stat->bytes     = queue.write.units;
+    p_stat->pages     = queue.erase.units;
+
+    /* Microamperes times milliseconds make nanocoulombs. The flash draws its current on top of
+     * that of the CPU, which waits for it or goes on with other work. */
+    uint64_t const nc =   (uint64_t)p_stat->awake_ms  * FLASH_POWER_CPU_UA
+                        + (uint64_t)p_stat->asleep_ms * FLASH_POWER_SLEEP_UA
+                        + (  (uint64_t)(p_stat->bytes / sizeof(uint32_t)) * FLASH_CHUNK_WORD_US
+                           / 1000
+                           + (uint64_t)p_stat->pages * FLASH_POWER_ERASE_MS) * FLASH_POWER_PROG_UA;
+    uint32_t const ms = p_stat->awake_ms + p_stat->asleep_ms;
+
+    p_stat->charge_uc = (uint32_t)(nc / 1000);
+    p_stat->avg_ua    = (ms > 0) ? (uint32_t)(nc / ms) : 0;
+    p_stat->uc_per_kb = (p_stat->bytes > 0) ? (uint32_t)((nc * 1024) / 1000 / p_stat->bytes) : 0;
+
+    return NRF_SUCCESS;
+}
+
+
+void flash_power_stat_reset(void)
+{
+    m_last_ticks   = app_timer_cnt_get();
+    m_awake_ticks  = 0;
+    m_asleep_ticks = 0;
+    m_wakeups      = 0;
+}
@@ -0,0 +1,111 @@
+#ifndef FLASH_POWER_H__
+#define FLASH_POWER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_config.h"
+#include "sdk_errors.h"
+#include "flash_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup flash_power Sleeping while waiting for flash
+ * @{
+ *
+ * @brief   Completion futures for flash operations, sleep through nrf_pwr_mgmt, and an estimate
+ *          of the energy spent storing data.
+ *
+ * @details A future is set once, from the event of the operation it waits for, and waited for
+ *          with @ref flash_power_future_wait. The wait sleeps in System ON through nrf_pwr_mgmt.
+ *          Other interrupts still wake the core, but it only checks the future before going back
+ *          to sleep, instead of polling the flash modules. Pass @ref flash_power_future_evt_handler
+ *          and the future to a flash queue request to wait for that request, or to
+ *          @ref flash_queue_space_notify to wait for the next operation to complete.
+ *
+ *          Every sleep goes through @ref flash_power_sleep, which counts the time spent asleep
+ *          and the wakeups. @ref flash_power_stat_get adds the bytes written and pages erased,
+ *          from the flash queue statistics, and estimates the charge drawn from the currents and
+ *          timings set in sdk_config.h. These come from the product specification, not from a
+ *          measurement; they are meant to compare configurations and workloads.
+ */
+
+
+/**@brief   Completion of a flash operation. */
+typedef struct
+{
+    volatile bool   done;   //!< The operation has completed.
+    ret_code_t      result; //!< The first error reported for it, or NRF_SUCCESS.
+} flash_power_future_t;
+
+
+/**@brief   Energy statistics, since initialization or the last reset. */
+typedef struct
+{
+    uint32_t awake_ms;      //!< Time spent awake.
+    uint32_t asleep_ms;     //!< Time spent asleep in @ref flash_power_sleep.
+    uint32_t wakeups;       //!< Times @ref flash_power_sleep returned.
+    uint32_t bytes;         //!< Bytes written through the flash queue.
+    uint32_t pages;         //!< Pages erased through the flash queue.
+    uint32_t charge_uc;     //!< Estimated charge drawn, in microcoulombs.
+    uint32_t avg_ua;        //!< Estimated average current, in microamperes.
+    uint32_t uc_per_kb;     //!< Estimated charge per KB written, erases included. Zero if nothing
+                            //!< was written.
+} flash_power_stat_t;
+
+
+/**@brief   Function for initializing nrf_pwr_mgmt and the statistics. Must be called after
+ *          app_timer_init().
+ *
+ * @return  Any error returned by nrf_pwr_mgmt_init().
+ */
+ret_code_t flash_power_init(void);
+
+
+/**@brief   Function for sleeping until an event is received. */
+void flash_power_sleep(void);
+
+
+/**@brief   Function for arming a future, before the operation it waits for is started. */
+void flash_power_future_init(flash_power_future_t * p_future);
+
+
+/**@brief   Function for setting a future. Can be called from interrupt handlers, and more than
+ *          once; the first error is kept. */
+void flash_power_future_set(flash_power_future_t * p_future, ret_code_t result);
+
+
+/**@brief   Flash queue event handler that sets the future given as p_param. */
+void flash_power_future_evt_handler(flash_queue_evt_t const * p_evt);
+
+
+/**@brief   Function for sleeping until a future is set.
+ *
+ * @return  The result the future was set with.
+ */
+ret_code_t flash_power_future_wait(flash_power_future_t * p_future);
+
+
+/**@brief   Function for retrieving the energy statistics.
+ *
+ * @retval  NRF_SUCCESS     If the statistics were copied.
+ * @retval  NRF_ERROR_NULL  If @p p_stat is NULL.
+ */
+ret_code_t flash_power_stat_get(flash_power_stat_t * p_stat);
+
+
+/**@brief   Function for restarting the time counts. The bytes and pages come from the flash
+ *          queue, so reset its statistics at the same time. */
+void flash_power_stat_reset(void);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_POWER_H__
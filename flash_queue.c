@@ -0,0 +1,1572 @@
+#include "flash_queue.h"
+
+#include <string.h>
+
+#include "sdk_config.h"
+#include "nordic_common.h"
+#include "app_util.h"
+#include "flash_layout.h"
+#include "app_util_platform.h"
+#include "app_timer.h"
+#include "nrf_assert.h"
+#include "flash_chunk.h"
+#include "flash_trace.h"
+
+#ifdef SOFTDEVICE_PRESENT
+#include "nrf_soc.h"
+#else
+#include "nrf.h"
+#endif
+
+#ifdef SOFTDEVICE_PRESENT
+/* Never hand more operations to nrf_fstorage_sd than its queue can hold. It executes them in
+ * order, so each one handed over ahead of need delays an urgent operation submitted after it. */
+#define FLASH_QUEUE_MAX_IN_FLIGHT   MIN(NRF_FSTORAGE_SD_QUEUE_SIZE, FLASH_QUEUE_SD_IN_FLIGHT)
+#define FLASH_QUEUE_MAX_MERGE_SIZE  MIN(FLASH_QUEUE_STAGING_SIZE, NRF_FSTORAGE_SD_MAX_WRITE_SIZE)
+#else
+/* nrf_fstorage_nvmc executes operations synchronously. */
+#define FLASH_QUEUE_MAX_IN_FLIGHT   1
+#define FLASH_QUEUE_MAX_MERGE_SIZE  FLASH_QUEUE_STAGING_SIZE
+#endif
+
+/* Deadlines are kept as values of the app_timer counter, which wraps around. */
+#define TICKS_MASK                  APP_TIMER_MAX_CNT_VAL
+
+STATIC_ASSERT((FLASH_QUEUE_STAGING_SIZE % sizeof(uint32_t)) == 0);
+STATIC_ASSERT(FLASH_QUEUE_PRIO_COUNT < 0x100);
+STATIC_ASSERT((FLASH_QUEUE_MAX_MERGE_SIZE < 0x10000) && (FLASH_BUF_SIZE < 0x10000));
+
+
+typedef enum
+{
+    OP_STATE_STAGED,        //!< Waiting to be handed to nrf_fstorage.
+    OP_STATE_SUBMITTED,     //!< Handed to nrf_fstorage, waiting for its event.
+    OP_STATE_FAILED,        //!< Rejected by nrf_fstorage, to be reported once it reaches the head.
+    OP_STATE_DONE,          //!< Reported, its slot to be freed once it reaches the head.
+} op_state_t;
+
+
+typedef struct
+{
+    nrf_fstorage_t      const * p_fs;
+    flash_queue_evt_handler_t   evt_handler;
+    void                      * p_param;
+    uint8_t             const * p_src;          //!< Data to write. NULL for erases.
+    flash_buf_t               * p_buf;          //!< Buffer holding the data, if it was not staged.
+    uint32_t                    addr;
+    uint32_t                    len;            //!< Bytes for writes, pages for erases.
+    uint32_t                    stage_bytes;    //!< Bytes held in the staging buffer, including wrap padding.
+    ret_code_t                  result;
+#if FLASH_QUEUE_STATS_ENABLED
+    uint32_t                    submit_ticks;   //!< app_timer counter when handed to nrf_fstorage.
+#endif
+    uint32_t                    deadline;       //!< app_timer counter by which it should be done.
+    uint32_t                    part_ticks;     //!< app_timer counter when the part was submitted.
+    uint16_t                    cnt;
+    uint16_t                    done;           //!< Bytes written, or pages erased, so far.
+    uint16_t                    part_len;       //!< Bytes, or pages, of the part submitted last.
+    uint8_t                     id;             //!< @ref flash_queue_evt_id_t
+    uint8_t                     state;          //!< @ref op_state_t
+    uint8_t                     prio;           //!< @ref flash_queue_prio_t
+    bool                        has_deadline;
+} flash_queue_op_t;
+
+
+typedef struct
+{
+    flash_queue_evt_handler_t   evt_handler;
+    void                      * p_param;
+} space_waiter_t;
+
+
+typedef struct
+{
+    nrf_fstorage_t const * p_fs;
+    uint32_t               reserved_ops;
+    uint32_t               max_ops;
+    uint32_t               max_stage_bytes;
+    uint32_t               ops;             //!< Operations of the instance in the queue.
+    uint32_t               stage_bytes;     //!< Staging bytes they hold.
+    uint32_t               deadline_ticks;  //!< Zero for no deadline.
+    uint32_t               gen;             //!< Writes and erases of the instance queued.
+    flash_queue_prio_t     prio;
+} share_t;
+
+
+/* Operations, in the order they were queued. The scheduler hands them to nrf_fstorage, m_in_flight
+ * at a time, in the order of their priority. An operation gives back its share as soon as it is
+ * done, but slots are freed from m_head, in queue order. */
+static flash_queue_op_t m_ops[FLASH_QUEUE_OP_COUNT];
+static uint32_t         m_head;
+static uint32_t         m_count;
+static uint32_t         m_in_flight;
+static bool             m_kick_active;
+
+/* Staging buffer, allocated as a ring in the same order as the operations, and emptied whenever
+ * only operations that are done hold bytes of it. */
+static uint32_t         m_stage_buf[FLASH_QUEUE_STAGING_SIZE / sizeof(uint32_t)];
+static uint32_t         m_stage_wr;
+static uint32_t         m_stage_rd;
+static uint32_t         m_stage_used;
+static uint32_t         m_stage_live;   //!< Bytes of operations that are not done yet.
+
+/* Handlers waiting for room to be freed. */
+static space_waiter_t   m_waiters[FLASH_QUEUE_NOTIFY_COUNT];
+static uint32_t         m_waiter_cnt;
+
+/* Shares of the queue given to fstorage instances. */
+static share_t          m_shares[FLASH_QUEUE_SHARE_COUNT];
+static uint32_t         m_share_cnt;
+
+/* Writes and erases queued for all instances, for the generation of those without a share. */
+static uint32_t         m_gen;
+
+static volatile bool    m_wait_expired;
+
+/* app_timer counter when nrf_fstorage last reported an operation. */
+static uint32_t         m_done_ticks;
+
+#if FLASH_QUEUE_STATS_ENABLED
+static flash_queue_stats_t m_stats;
+#endif
+
+APP_TIMER_DEF(m_wait_timer);
+
+
+static uint32_t op_idx(uint32_t offset)
+{
+    return (m_head + offset) % FLASH_QUEUE_OP_COUNT;
+}
+
+
+static bool range_is_valid(nrf_fstorage_t const * p_fs, uint32_t addr, uint32_t len)
+{
+    return (addr >= p_fs->start_addr) && (addr + len - 1 <= p_fs->end_addr);
+}
+
+
+static share_t * share_find(nrf_fstorage_t const * p_fs)
+{
+    for (uint32_t i = 0; i < m_share_cnt; i++)
+    {
+        if (m_shares[i].p_fs == p_fs)
+        {
+            return &m_shares[i];
+        }
+    }
+    return NULL;
+}
+
+
+/**@brief   Add a share for @p p_fs, which does not limit it, and count what the instance has
+ *          queued already. Must be called with the critical region held.
+ *
+ * @return  The share, or NULL if the table is full.
+ */
+static share_t * share_add(nrf_fstorage_t const * p_fs)
+{
+    if (m_share_cnt == FLASH_QUEUE_SHARE_COUNT)
+    {
+        return NULL;
+    }
+
+    share_t * const p_share = &m_shares[m_share_cnt++];
+
+    memset(p_share, 0x00, sizeof(*p_share));
+    p_share->p_fs            = p_fs;
+    p_share->max_ops         = FLASH_QUEUE_OP_COUNT;
+    p_share->max_stage_bytes = FLASH_QUEUE_STAGING_SIZE;
+    p_share->prio            = FLASH_QUEUE_PRIO_NORMAL;
+
+    /* The generation goes on from the one the instance had without a share, so that it does not
+     * come back to a value handed out before. */
+    p_share->gen             = m_gen;
+
+    /* What is counted here is taken off as it completes. */
+    for (uint32_t i = 0; i < m_count; i++)
+    {
+        flash_queue_op_t const * const p_op = &m_ops[op_idx(i)];
+
+        if ((p_op->p_fs == p_fs) && (p_op->state != OP_STATE_DONE))
+        {
+            p_share->ops++;
+            p_share->stage_bytes += p_op->stage_bytes;
+        }
+    }
+
+    return p_share;
+}
+
+
+/**@brief   Count a write or erase queued for the instance of @p p_share, which may be NULL. Must
+ *          be called with the critical region held. */
+static void gen_bump(share_t * p_share)
+{
+    m_gen++;
+    if (p_share != NULL)
+    {
+        p_share->gen++;
+    }
+}
+
+
+/**@brief   Set the scheduling fields of a new operation from the share of its instance. */
+static void op_sched_init(flash_queue_op_t * p_op, share_t const * p_share)
+{
+    p_op->done         = 0;
+    p_op->part_len     = 0;
+    p_op->prio         = FLASH_QUEUE_PRIO_NORMAL;
+    p_op->has_deadline = false;
+
+    if (p_share != NULL)
+    {
+        p_op->prio = (uint8_t)p_share->prio;
+        if (p_share->deadline_ticks != 0)
+        {
+            p_op->deadline     = (app_timer_cnt_get() + p_share->deadline_ticks) & TICKS_MASK;
+            p_op->has_deadline = true;
+        }
+    }
+}
+
+
+/**@brief   Check if a new operation of @p len staged bytes can be queued for @p p_share. A NULL
+ *          share stands for an instance without one. Must be called with the critical region
+ *          held. */
+static bool share_admits(share_t const * p_share, uint32_t len)
+{
+    uint32_t held = 0;
+
+    if (m_count == FLASH_QUEUE_OP_COUNT)
+    {
+        return false;
+    }
+    if (p_share != NULL)
+    {
+        if (   (p_share->ops >= p_share->max_ops)
+            || (p_share->stage_bytes + len > p_share->max_stage_bytes))
+        {
+            return false;
+        }
+        if (p_share->ops < p_share->reserved_ops)
+        {
+            /* The queue always has room for what other shares have reserved, and this one. */
+            return true;
+        }
+    }
+
+    for (uint32_t i = 0; i < m_share_cnt; i++)
+    {
+        if (m_shares[i].ops < m_shares[i].reserved_ops)
+        {
+            held += m_shares[i].reserved_ops - m_shares[i].ops;
+        }
+    }
+    return FLASH_QUEUE_OP_COUNT - m_count > held;
+}
+
+
+/**@brief   Update the high-water marks. Must be called with the critical region held. */
+static void stats_depth_update(void)
+{
+#if FLASH_QUEUE_STATS_ENABLED
+    m_stats.ops_max       = MAX(m_stats.ops_max, m_count);
+    m_stats.in_flight_max = MAX(m_stats.in_flight_max, m_in_flight);
+    m_stats.stage_max     = MAX(m_stats.stage_max, m_stage_used);
+#endif
+}
+
+
+/**@brief   Account for a request, queued or not. Must be called with the critical region held. */
+static void stats_request(ret_code_t rc)
+{
+#if FLASH_QUEUE_STATS_ENABLED
+    if (rc == NRF_SUCCESS)
+    {
+        m_stats.requests++;
+        stats_depth_update();
+    }
+    else if (rc == NRF_ERROR_NO_MEM)
+    {
+        m_stats.rejected++;
+    }
+#else
+    UNUSED_PARAMETER(rc);
+#endif
+}
+
+
+#if FLASH_QUEUE_STATS_ENABLED
+/**@brief   Histogram bucket of a latency. See @ref FLASH_QUEUE_STATS_BUCKETS. */
+static uint32_t stats_bucket(uint32_t ticks)
+{
+    uint32_t bucket = 0;
+
+    while ((ticks != 0) && (bucket < FLASH_QUEUE_STATS_BUCKETS - 1))
+    {
+        ticks >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+#endif
+
+
+/**@brief   Account for an operation leaving the queue. Must be called with the critical region
+ *          held. */
+static void stats_op_done(flash_queue_op_t const * p_op)
+{
+#if FLASH_QUEUE_STATS_ENABLED
+    flash_queue_op_stats_t * const p_stats = (p_op->id == FLASH_QUEUE_EVT_WRITE_RESULT) ?
+                                             &m_stats.write : &m_stats.erase;
+
+    if (p_op->result != NRF_SUCCESS)
+    {
+        p_stats->failed++;
+    }
+    if (p_op->state == OP_STATE_FAILED)
+    {
+        /* Never reached the flash, so there is no latency to account for. */
+        return;
+    }
+
+    uint32_t const ticks = app_timer_cnt_diff_compute(app_timer_cnt_get(), p_op->submit_ticks);
+
+    p_stats->count++;
+    p_stats->ticks_total += ticks;
+    p_stats->ticks_max    = MAX(p_stats->ticks_max, ticks);
+    p_stats->hist[stats_bucket(ticks)]++;
+    if (p_op->result == NRF_SUCCESS)
+    {
+        p_stats->units += p_op->len;
+    }
+    if (   p_op->has_deadline
+        && (app_timer_cnt_diff_compute(app_timer_cnt_get(), p_op->deadline) <= TICKS_MASK / 2))
+    {
+        m_stats.late++;
+    }
+#else
+    UNUSED_PARAMETER(p_op);
+#endif
+}
+
+
+/**@brief   Empty the staging ring, once no operation needs its bytes. Operations that are done
+ *          keep their slots until they reach the head, but give their bytes up. */
+static void stage_reset(void)
+{
+    for (uint32_t i = 0; i < m_count; i++)
+    {
+        m_ops[op_idx(i)].stage_bytes = 0;
+    }
+    m_stage_wr   = 0;
+    m_stage_rd   = 0;
+    m_stage_used = 0;
+}
+
+
+/**@brief   Allocate @p len bytes from the staging ring.
+ *
+ * @param[out]  p_bytes     Bytes consumed, including the padding skipped at the end of the ring.
+ *
+ * @return  Pointer to the allocated bytes, or NULL if there is no contiguous room.
+ */
+static uint8_t * stage_alloc(uint32_t len, uint32_t * p_bytes)
+{
+    uint8_t * const p_buf = (uint8_t *)m_stage_buf;
+
+    if (m_stage_live == 0)
+    {
+        stage_reset();
+    }
+
+    if ((m_stage_used == 0) || (m_stage_wr > m_stage_rd))
+    {
+        if (len <= sizeof(m_stage_buf) - m_stage_wr)
+        {
+            *p_bytes    = len;
+            m_stage_wr += len;
+            m_stage_used += len;
+            m_stage_live += len;
+            return &p_buf[m_stage_wr - len];
+        }
+        if (len <= m_stage_rd)
+        {
+            /* Skip the tail of the ring and wrap around. */
+            *p_bytes      = len + (sizeof(m_stage_buf) - m_stage_wr);
+            m_stage_wr    = len;
+            m_stage_used += *p_bytes;
+            m_stage_live += *p_bytes;
+            return p_buf;
+        }
+        return NULL;
+    }
+
+    if ((m_stage_wr < m_stage_rd) && (len <= m_stage_rd - m_stage_wr))
+    {
+        *p_bytes      = len;
+        m_stage_wr   += len;
+        m_stage_used += len;
+        m_stage_live += len;
+        return &p_buf[m_stage_wr - len];
+    }
+
+    return NULL;
+}
+
+
+/**@brief   Length of the largest allocation @ref stage_alloc can make. */
+static uint32_t stage_room(void)
+{
+    if (m_stage_live == 0)
+    {
+        return sizeof(m_stage_buf);
+    }
+    if (m_stage_wr > m_stage_rd)
+    {
+        return MAX(sizeof(m_stage_buf) - m_stage_wr, m_stage_rd);
+    }
+    return m_stage_rd - m_stage_wr;
+}
+
+
+/**@brief   Try to extend the last staged write by @p len bytes, in place. */
+static bool stage_extend(flash_queue_op_t * p_op, uint32_t len)
+{
+    uint8_t const * const p_buf = (uint8_t *)m_stage_buf;
+
+    /* The write must end exactly where the staging ring continues. */
+    if ((m_stage_used == sizeof(m_stage_buf)) || (p_op->p_src + p_op->len != &p_buf[m_stage_wr]))
+    {
+        return false;
+    }
+
+    uint32_t const room = (m_stage_wr >= m_stage_rd) ? (sizeof(m_stage_buf) - m_stage_wr)
+                                                     : (m_stage_rd - m_stage_wr);
+    if (len > room)
+    {
+        return false;
+    }
+
+    m_stage_wr        += len;
+    m_stage_used      += len;
+    m_stage_live      += len;
+    p_op->stage_bytes += len;
+    return true;
+}
+
+
+/**@brief   Find a staged write that the request can be appended to. */
+static flash_queue_op_t * merge_candidate_get(nrf_fstorage_t      const * p_fs,
+                                              uint32_t                    dest,
+                                              uint32_t                    len,
+                                              flash_queue_evt_handler_t   evt_handler,
+                                              void                      * p_param)
+{
+    if (m_count == 0)
+    {
+        return NULL;
+    }
+
+    flash_queue_op_t * const p_op = &m_ops[op_idx(m_count - 1)];
+
+    if (   (p_op->id          == FLASH_QUEUE_EVT_WRITE_RESULT)
+        && (p_op->state       == OP_STATE_STAGED)
+        && (p_op->stage_bytes != 0)
+        && (p_op->p_fs        == p_fs)
+        && (p_op->evt_handler == evt_handler)
+        && (p_op->p_param     == p_param)
+        && (p_op->addr + p_op->len == dest)
+        && (p_op->len + len   <= FLASH_QUEUE_MAX_MERGE_SIZE))
+    {
+        return p_op;
+    }
+
+    return NULL;
+}
+
+
+/**@brief   Copy out the event of an operation, for the caller to dispatch with
+ *          @ref evt_dispatch. The reference the queue held on its buffer goes with it. */
+static void evt_get(flash_queue_op_t          * p_op,
+                    flash_queue_evt_t         * p_evt,
+                    flash_queue_evt_handler_t * p_handler,
+                    flash_buf_t              ** pp_buf)
+{
+    p_evt->id      = (flash_queue_evt_id_t)p_op->id;
+    p_evt->result  = p_op->result;
+    p_evt->p_fs    = p_op->p_fs;
+    p_evt->addr    = p_op->addr;
+    p_evt->len     = p_op->len;
+    p_evt->cnt     = p_op->cnt;
+    p_evt->p_param = p_op->p_param;
+    *p_handler     = p_op->evt_handler;
+    *pp_buf        = p_op->p_buf;
+    p_op->p_buf    = NULL;
+}
+
+
+/**@brief   Give back the share of its instance and the staging bytes an operation held, once it
+ *          is over. Its slot, and the place of its bytes in the ring, are freed in queue order.
+ *          Must be called with the critical region held. */
+static void op_release(flash_queue_op_t const * p_op)
+{
+    share_t * const p_share = share_find(p_op->p_fs);
+    if (p_share != NULL)
+    {
+        p_share->ops--;
+        p_share->stage_bytes -= p_op->stage_bytes;
+    }
+    m_stage_live -= p_op->stage_bytes;
+}
+
+
+/**@brief   Free the slot at the head of the queue. Must be called with the critical region held. */
+static void head_free(void)
+{
+    flash_queue_op_t const * const p_op = &m_ops[m_head];
+
+    if (p_op->state != OP_STATE_DONE)
+    {
+        /* Rejected by nrf_fstorage, and reported only now. */
+        op_release(p_op);
+    }
+    if (p_op->stage_bytes != 0)
+    {
+        m_stage_rd    = (m_stage_rd + p_op->stage_bytes) % sizeof(m_stage_buf);
+        m_stage_used -= p_op->stage_bytes;
+    }
+
+    m_head = op_idx(1);
+    m_count--;
+}
+
+
+/**@brief   Free the slots at the head of the queue whose operations have been reported. Must be
+ *          called with the critical region held. */
+static void done_ops_free(void)
+{
+    while ((m_count != 0) && (m_ops[m_head].state == OP_STATE_DONE))
+    {
+        head_free();
+    }
+}
+
+
+/**@brief   Tell @ref flash_chunk how long a part of a write took. Must be called with the
+ *          critical region held.
+ *
+ * With several parts in flight, nrf_fstorage starts one when it has reported the previous one,
+ * so the time runs from the later of the submission of the part and that report.
+ */
+static void chunk_result(flash_queue_op_t const * p_op, ret_code_t result)
+{
+    uint32_t const now       = app_timer_cnt_get();
+    uint32_t const since_sub = app_timer_cnt_diff_compute(now, p_op->part_ticks);
+    uint32_t const ticks     = MIN(since_sub, app_timer_cnt_diff_compute(now, m_done_ticks));
+
+    flash_chunk_result(p_op->part_len,
+                       (uint32_t)(((uint64_t)ticks * 1000000) / APP_TIMER_TICKS(1000)),
+                       result);
+}
+
+
+/**@brief   Account for the result of a submission to nrf_fstorage. Must be called with the
+ *          critical region held.
+ *
+ * @retval  true    If the operation is over. Its event has been copied out, as with @ref evt_get.
+ * @retval  false   If parts of it are left to submit.
+ */
+static bool op_complete(flash_queue_op_t          * p_op,
+                        ret_code_t                  result,
+                        flash_queue_evt_t         * p_evt,
+                        flash_queue_evt_handler_t * p_handler,
+                        flash_buf_t              ** pp_buf)
+{
+    m_in_flight--;
+
+    if (p_op->id == FLASH_QUEUE_EVT_WRITE_RESULT)
+    {
+        chunk_result(p_op, result);
+    }
+    m_done_ticks = app_timer_cnt_get();
+
+    /* nrf_fstorage_sd gave up on a part of a write the radio left no time for. Write it again,
+     * at the smaller size flash_chunk has just picked. A part shorter than that is written again
+     * as it is, and split once the size has been cut below it; one of the smallest size fails. */
+    if (   (p_op->id == FLASH_QUEUE_EVT_WRITE_RESULT)
+        && (result   == NRF_ERROR_TIMEOUT)
+        && (flash_chunk_size_get() != 0)
+        && (p_op->part_len > FLASH_CHUNK_MIN_SIZE))
+    {
+        p_op->state = OP_STATE_STAGED;
+#if FLASH_QUEUE_STATS_ENABLED
+        m_stats.retries++;
+#endif
+        return false;
+    }
+
+    if ((result == NRF_SUCCESS) && (p_op->done + p_op->part_len < p_op->len))
+    {
+        /* Back to the scheduler, which may put other operations before the next part. */
+        p_op->done += p_op->part_len;
+        p_op->state = OP_STATE_STAGED;
+        return false;
+    }
+
+    p_op->result = result;
+    stats_op_done(p_op);
+    evt_get(p_op, p_evt, p_handler, pp_buf);
+    p_op->state = OP_STATE_DONE;
+    op_release(p_op);
+    done_ops_free();
+
+    return true;
+}
+
+
+/**@brief   Report an operation and drop the reference the queue held on its buffer. */
+static void evt_dispatch(flash_queue_evt_t         const * p_evt,
+                         flash_queue_evt_handler_t         evt_handler,
+                         flash_buf_t                     * p_buf)
+{
+    if (evt_handler != NULL)
+    {
+        evt_handler(p_evt);
+    }
+    if (p_buf != NULL)
+    {
+        flash_buf_release(p_buf);
+    }
+}
+
+
+/**@brief   Tell the handlers waiting for room that some has been freed. */
+static void space_notify(void)
+{
+    space_waiter_t waiters[FLASH_QUEUE_NOTIFY_COUNT];
+    uint32_t       cnt;
+
+    CRITICAL_REGION_ENTER();
+    cnt = m_waiter_cnt;
+    memcpy(waiters, m_waiters, cnt * sizeof(waiters[0]));
+    m_waiter_cnt = 0;
+    CRITICAL_REGION_EXIT();
+
+    /* Handlers may ask again, or queue requests. */
+    for (uint32_t i = 0; i < cnt; i++)
+    {
+        flash_queue_evt_t const evt =
+        {
+            .id      = FLASH_QUEUE_EVT_SPACE_AVAILABLE,
+            .result  = NRF_SUCCESS,
+            .p_param = waiters[i].p_param,
+        };
+
+        waiters[i].evt_handler(&evt);
+    }
+}
+
+
+/**@brief   Report operations at the head of the queue that were rejected by nrf_fstorage. */
+static void failed_ops_drain(void)
+{
+    for (;;)
+    {
+        flash_queue_evt_t         evt;
+        flash_queue_evt_handler_t evt_handler = NULL;
+        flash_buf_t             * p_buf       = NULL;
+        bool                      popped      = false;
+
+        CRITICAL_REGION_ENTER();
+        if ((m_count != 0) && (m_ops[m_head].state == OP_STATE_FAILED))
+        {
+            flash_queue_op_t * const p_op = &m_ops[m_head];
+
+            stats_op_done(p_op);
+            evt_get(p_op, &evt, &evt_handler, &p_buf);
+            head_free();
+            done_ops_free();
+            popped = true;
+        }
+        CRITICAL_REGION_EXIT();
+
+        if (!popped)
+        {
+            return;
+        }
+        evt_dispatch(&evt, evt_handler, p_buf);
+    }
+}
+
+
+/**@brief   End of the range of an operation. */
+static uint32_t op_end(flash_queue_op_t const * p_op)
+{
+    return (p_op->id == FLASH_QUEUE_EVT_ERASE_RESULT)
+           ? p_op->addr + (p_op->len << FLASH_LAYOUT_PAGE_SHIFT)
+           : p_op->addr + p_op->len;
+}
+
+
+/**@brief   Check if an operation still has to be handed to nrf_fstorage, in whole or in part. */
+static bool op_is_pending(flash_queue_op_t const * p_op)
+{
+    return    (p_op->state == OP_STATE_STAGED)
+           || ((p_op->state == OP_STATE_SUBMITTED) && (p_op->done + p_op->part_len < p_op->len));
+}
+
+
+/**@brief   Check if @p p_later, queued after @p p_earlier, must wait until @p p_earlier has been
+ *          handed to nrf_fstorage. */
+static bool op_blocks(flash_queue_op_t const * p_earlier, flash_queue_op_t const * p_later)
+{
+    if ((p_earlier->p_fs == p_later->p_fs) && (p_earlier->prio == p_later->prio))
+    {
+        return true;
+    }
+
+    /* Instances can overlap: compare the ranges whatever instance they belong to. */
+    return (p_earlier->addr < op_end(p_later)) && (p_later->addr < op_end(p_earlier));
+}
+
+
+/**@brief   Scheduling key of an operation; the higher key goes first.
+ *
+ * The class is in the upper byte, and the time left before the deadline, inverted, in the lower
+ * bytes. An operation due within @ref FLASH_QUEUE_DEADLINE_MARGIN_MS, or late, is put above every
+ * class.
+ */
+static uint32_t sched_key(flash_queue_op_t const * p_op, uint32_t now)
+{
+    uint32_t prio  = p_op->prio;
+    uint32_t slack = TICKS_MASK;
+
+    if (p_op->has_deadline)
+    {
+        slack = app_timer_cnt_diff_compute(p_op->deadline, now);
+        if (slack > TICKS_MASK / 2)
+        {
+            slack = 0;
+        }
+        if (slack <= APP_TIMER_TICKS(FLASH_QUEUE_DEADLINE_MARGIN_MS))
+        {
+            prio = FLASH_QUEUE_PRIO_COUNT;
+        }
+    }
+
+    return (prio << 24) | (TICKS_MASK - (slack & TICKS_MASK));
+}
+
+
+/**@brief   Pick the operation to hand to nrf_fstorage next. Must be called with the critical
+ *          region held.
+ *
+ * Operations that must wait for an earlier one lend it their key, so that an urgent write behind
+ * a write of the same instance pulls that write forward too.
+ *
+ * @return  The operation, or NULL if none can be submitted.
+ */
+static flash_queue_op_t * sched_pick(void)
+{
+    uint32_t           keys[FLASH_QUEUE_OP_COUNT];
+    uint32_t     const now     = app_timer_cnt_get();
+    flash_queue_op_t * p_pick  = NULL;
+    flash_queue_op_t * p_first = NULL;
+    uint32_t           best    = 0;
+
+    for (uint32_t i = 0; i < m_count; i++)
+    {
+        keys[i] = sched_key(&m_ops[op_idx(i)], now);
+    }
+
+    /* From the newest operation back, so that the key of each one is final when it is reached. */
+    for (uint32_t i = m_count; i-- > 0; )
+    {
+        flash_queue_op_t * const p_op    = &m_ops[op_idx(i)];
+        bool                     blocked = false;
+
+        if (!op_is_pending(p_op))
+        {
+            continue;
+        }
+
+        for (uint32_t j = i; j-- > 0; )
+        {
+            flash_queue_op_t const * const p_earlier = &m_ops[op_idx(j)];
+
+            if (op_is_pending(p_earlier) && op_blocks(p_earlier, p_op))
+            {
+                keys[j] = MAX(keys[j], keys[i]);
+                blocked = true;
+                break;
+            }
+        }
+
+        if (!blocked && (p_op->state == OP_STATE_STAGED))
+        {
+            p_first = p_op;
+            if (keys[i] >= best)
+            {
+                p_pick = p_op;
+                best   = keys[i];
+            }
+        }
+    }
+
+#if FLASH_QUEUE_STATS_ENABLED
+    if (p_pick != p_first)
+    {
+        m_stats.reordered++;
+    }
+#endif
+
+    return p_pick;
+}
+
+
+/**@brief   Address of the part of an operation submitted next. */
+static uint32_t op_part_addr(flash_queue_op_t const * p_op)
+{
+    return (p_op->id == FLASH_QUEUE_EVT_WRITE_RESULT)
+           ? p_op->addr + p_op->done
+           : p_op->addr + (p_op->done << FLASH_LAYOUT_PAGE_SHIFT);
+}
+
+
+/**@brief   Size the part of an operation submitted next: a chunk of a write, see
+ *          @ref flash_chunk, or a page of an erase. */
+static uint32_t op_part_len(flash_queue_op_t const * p_op)
+{
+    if (p_op->id == FLASH_QUEUE_EVT_ERASE_RESULT)
+    {
+        return 1;
+    }
+
+    uint32_t const left  = p_op->len - p_op->done;
+    uint32_t const chunk = flash_chunk_size_get();
+
+    return (chunk == 0) ? left : MIN(left, chunk);
+}
+
+
+static ret_code_t op_submit(flash_queue_op_t const * p_op)
+{
+    if (p_op->id == FLASH_QUEUE_EVT_WRITE_RESULT)
+    {
+        return nrf_fstorage_write(p_op->p_fs, op_part_addr(p_op), p_op->p_src + p_op->done,
+                                  p_op->part_len, (void *)p_op);
+    }
+
+    return nrf_fstorage_erase(p_op->p_fs, op_part_addr(p_op), p_op->part_len, (void *)p_op);
+}
+
+
+/**@brief   Hand staged operations to nrf_fstorage, as long as it has room for them, in the order
+ *          picked by @ref sched_pick.
+ *
+ * Safe to call from any context. nrf_fstorage_nvmc reports operations before returning, so this
+ * function can be re-entered from @ref flash_queue_on_fstorage_evt; the outer call then carries
+ * on with the submission.
+ */
+static void queue_kick(void)
+{
+    for (;;)
+    {
+        flash_queue_op_t * p_op = NULL;
+
+        CRITICAL_REGION_ENTER();
+        if (!m_kick_active && (m_in_flight < FLASH_QUEUE_MAX_IN_FLIGHT))
+        {
+            p_op = sched_pick();
+        }
+        if (p_op != NULL)
+        {
+#if FLASH_QUEUE_STATS_ENABLED
+            /* Taken before submitting, as nrf_fstorage_nvmc reports the result right away. The
+             * latency of an operation runs from its first part. */
+            if ((p_op->done == 0) && (p_op->part_len == 0))
+            {
+                p_op->submit_ticks = app_timer_cnt_get();
+            }
+#endif
+            p_op->state      = OP_STATE_SUBMITTED;
+            p_op->part_len   = (uint16_t)op_part_len(p_op);
+            p_op->part_ticks = app_timer_cnt_get();
+            m_in_flight++;
+            m_kick_active    = true;
+            stats_depth_update();
+        }
+        CRITICAL_REGION_EXIT();
+
+        if (p_op == NULL)
+        {
+            return;
+        }
+
+        FLASH_TRACE((p_op->id == FLASH_QUEUE_EVT_WRITE_RESULT) ? FLASH_TRACE_SUBMIT_WRITE :
+                                                                 FLASH_TRACE_SUBMIT_ERASE,
+                    op_part_addr(p_op), p_op->part_len);
+
+        ret_code_t const rc = op_submit(p_op);
+
+        CRITICAL_REGION_ENTER();
+        m_kick_active = false;
+        if (rc == NRF_ERROR_NO_MEM)
+        {
+            /* The backend queue is shared with other fstorage users; retry on the next event. */
+            p_op->state = OP_STATE_STAGED;
+            m_in_flight--;
+#if FLASH_QUEUE_STATS_ENABLED
+            m_stats.retries++;
+#endif
+            FLASH_TRACE(FLASH_TRACE_RETRY, p_op->addr, 0);
+        }
+        else if (rc != NRF_SUCCESS)
+        {
+            p_op->state  = OP_STATE_FAILED;
+            p_op->result = rc;
+            m_in_flight--;
+        }
+        CRITICAL_REGION_EXIT();
+
+        if (rc == NRF_ERROR_NO_MEM)
+        {
+            return;
+        }
+        if (rc != NRF_SUCCESS)
+        {
+            failed_ops_drain();
+            space_notify();
+        }
+    }
+}
+
+
+static void wait_timer_handler(void * p_context)
+{
+    UNUSED_PARAMETER(p_context);
+    m_wait_expired = true;
+}
+
+
+ret_code_t flash_queue_init(void)
+{
+    m_head        = 0;
+    m_count       = 0;
+    m_in_flight   = 0;
+    m_kick_active = false;
+    m_stage_wr    = 0;
+    m_stage_rd    = 0;
+    m_stage_used  = 0;
+    m_stage_live  = 0;
+    m_waiter_cnt  = 0;
+    m_share_cnt   = 0;
+    m_done_ticks  = app_timer_cnt_get();
+
+#if FLASH_QUEUE_STATS_ENABLED
+    memset(&m_stats, 0, sizeof(m_stats));
+#endif
+
+    return app_timer_create(&m_wait_timer, APP_TIMER_MODE_SINGLE_SHOT, wait_timer_handler);
+}
+
+
+/**@brief   Copy the segments of a gather write to consecutive staging memory. */
+static void segs_copy(uint8_t * p_dest, flash_queue_seg_t const * p_segs, uint32_t seg_cnt)
+{
+    for (uint32_t i = 0; i < seg_cnt; i++)
+    {
+        memcpy(p_dest, p_segs[i].p_data, p_segs[i].len);
+        p_dest += p_segs[i].len;
+    }
+}
+
+
+ret_code_t flash_queue_write(nrf_fstorage_t      const * p_fs,
+                             uint32_t                    dest,
+                             void                const * p_src,
+                             uint32_t                    len,
+                             flash_queue_evt_handler_t   evt_handler,
+                             void                      * p_param)
+{
+    flash_queue_seg_t const seg =
+    {
+        .p_data = p_src,
+        .len    = len,
+    };
+
+    return flash_queue_write_gather(p_fs, dest, &seg, 1, evt_handler, p_param);
+}
+
+
+ret_code_t flash_queue_write_gather(nrf_fstorage_t      const * p_fs,
+                                    uint32_t                    dest,
+                                    flash_queue_seg_t   const * p_segs,
+                                    uint32_t                    seg_cnt,
+                                    flash_queue_evt_handler_t   evt_handler,
+                                    void                      * p_param)
+{
+    uint32_t len = 0;
+
+    if ((p_fs == NULL) || (p_segs == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+    for (uint32_t i = 0; i < seg_cnt; i++)
+    {
+        if ((p_segs[i].p_data == NULL) && (p_segs[i].len != 0))
+        {
+            return NRF_ERROR_NULL;
+        }
+        len += p_segs[i].len;
+    }
+    if ((len == 0) || (len % p_fs->p_flash_info->program_unit) || (len > FLASH_QUEUE_MAX_MERGE_SIZE))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    if ((dest % sizeof(uint32_t)) || !range_is_valid(p_fs, dest, len))
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    ret_code_t rc = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+
+    flash_queue_op_t * p_op    = merge_candidate_get(p_fs, dest, len, evt_handler, p_param);
+    share_t          * p_share = share_find(p_fs);
+
+    if (   (p_op != NULL)
+        && ((p_share == NULL) || (p_share->stage_bytes + len <= p_share->max_stage_bytes))
+        && stage_extend(p_op, len))
+    {
+        segs_copy((uint8_t *)p_op->p_src + p_op->len, p_segs, seg_cnt);
+        p_op->len += len;
+        p_op->cnt++;
+        if (p_share != NULL)
+        {
+            p_share->stage_bytes += len;
+        }
+    }
+    else if (!share_admits(p_share, len))
+    {
+        rc = NRF_ERROR_NO_MEM;
+    }
+    else
+    {
+        uint32_t        stage_bytes;
+        uint8_t * const p_stage = stage_alloc(len, &stage_bytes);
+
+        if (p_stage == NULL)
+        {
+            rc = NRF_ERROR_NO_MEM;
+        }
+        else
+        {
+            segs_copy(p_stage, p_segs, seg_cnt);
+
+            p_op = &m_ops[op_idx(m_count)];
+
+            p_op->p_fs        = p_fs;
+            p_op->evt_handler = evt_handler;
+            p_op->p_param     = p_param;
+            p_op->p_src       = p_stage;
+            p_op->p_buf       = NULL;
+            p_op->addr        = dest;
+            p_op->len         = len;
+            p_op->stage_bytes = stage_bytes;
+            p_op->result      = NRF_SUCCESS;
+            p_op->cnt         = 1;
+            p_op->id          = FLASH_QUEUE_EVT_WRITE_RESULT;
+            p_op->state       = OP_STATE_STAGED;
+            op_sched_init(p_op, p_share);
+
+            m_count++;
+            if (p_share != NULL)
+            {
+                p_share->ops++;
+                p_share->stage_bytes += stage_bytes;
+            }
+        }
+    }
+
+    if (rc == NRF_SUCCESS)
+    {
+        gen_bump(p_share);
+    }
+
+    stats_request(rc);
+    CRITICAL_REGION_EXIT();
+
+    if (rc == NRF_SUCCESS)
+    {
+        queue_kick();
+    }
+
+    return rc;
+}
+
+
+ret_code_t flash_queue_write_buf(nrf_fstorage_t      const * p_fs,
+                                 uint32_t                    dest,
+                                 flash_buf_t               * p_buf,
+                                 uint32_t                    len,
+                                 flash_queue_evt_handler_t   evt_handler,
+                                 void                      * p_param)
+{
+    if ((p_fs == NULL) || (p_buf == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+    if ((len == 0) || (len % p_fs->p_flash_info->program_unit) || (len > sizeof(p_buf->data)))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    if ((dest % sizeof(uint32_t)) || !range_is_valid(p_fs, dest, len))
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    ret_code_t rc = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+
+    share_t * const p_share = share_find(p_fs);
+
+    if (!share_admits(p_share, 0))
+    {
+        rc = NRF_ERROR_NO_MEM;
+    }
+    else
+    {
+        flash_queue_op_t * const p_op = &m_ops[op_idx(m_count)];
+
+        flash_buf_ref(p_buf);
+
+        p_op->p_fs        = p_fs;
+        p_op->evt_handler = evt_handler;
+        p_op->p_param     = p_param;
+        p_op->p_src       = (uint8_t const *)p_buf->data;
+        p_op->p_buf       = p_buf;
+        p_op->addr        = dest;
+        p_op->len         = len;
+        p_op->stage_bytes = 0;
+        p_op->result      = NRF_SUCCESS;
+        p_op->cnt         = 1;
+        p_op->id          = FLASH_QUEUE_EVT_WRITE_RESULT;
+        p_op->state       = OP_STATE_STAGED;
+        op_sched_init(p_op, p_share);
+
+        m_count++;
+        if (p_share != NULL)
+        {
+            p_share->ops++;
+        }
+    }
+
+    if (rc == NRF_SUCCESS)
+    {
+        gen_bump(p_share);
+    }
+
+    stats_request(rc);
+    CRITICAL_REGION_EXIT();
+
+    if (rc == NRF_SUCCESS)
+    {
+        queue_kick();
+    }
+
+    return rc;
+}
+
+
+ret_code_t flash_queue_erase(nrf_fstorage_t      const * p_fs,
+                             uint32_t                    page_addr,
+                             uint32_t                    pages_cnt,
+                             flash_queue_evt_handler_t   evt_handler,
+                             void                      * p_param)
+{
+    if (p_fs == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+    if (pages_cnt == 0)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    /* Erases are counted in pages of the layout, so that their ranges are found with shifts. */
+    if (p_fs->p_flash_info->erase_unit != FLASH_LAYOUT_PAGE_SIZE)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if (   (FLASH_LAYOUT_PAGE_OFFSET(page_addr) != 0)
+        || !range_is_valid(p_fs, page_addr, pages_cnt << FLASH_LAYOUT_PAGE_SHIFT))
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    ret_code_t rc = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+
+    share_t * const p_share = share_find(p_fs);
+
+    if (!share_admits(p_share, 0))
+    {
+        rc = NRF_ERROR_NO_MEM;
+    }
+    else
+    {
+        flash_queue_op_t * const p_op = &m_ops[op_idx(m_count)];
+
+        p_op->p_fs        = p_fs;
+        p_op->evt_handler = evt_handler;
+        p_op->p_param     = p_param;
+        p_op->p_src       = NULL;
+        p_op->p_buf       = NULL;
+        p_op->addr        = page_addr;
+        p_op->len         = pages_cnt;
+        p_op->stage_bytes = 0;
+        p_op->result      = NRF_SUCCESS;
+        p_op->cnt         = 1;
+        p_op->id          = FLASH_QUEUE_EVT_ERASE_RESULT;
+        p_op->state       = OP_STATE_STAGED;
+        op_sched_init(p_op, p_share);
+
+        m_count++;
+        if (p_share != NULL)
+        {
+            p_share->ops++;
+        }
+    }
+
+    if (rc == NRF_SUCCESS)
+    {
+        gen_bump(p_share);
+    }
+
+    stats_request(rc);
+    CRITICAL_REGION_EXIT();
+
+    if (rc == NRF_SUCCESS)
+    {
+        queue_kick();
+    }
+
+    return rc;
+}
+
+
+ret_code_t flash_queue_share_set(nrf_fstorage_t const * p_fs,
+                                 uint32_t               reserved_ops,
+                                 uint32_t               max_ops,
+                                 uint32_t               max_stage_bytes)
+{
+    if (p_fs == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+    if (reserved_ops > max_ops)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    ret_code_t rc       = NRF_SUCCESS;
+    uint32_t   reserved = reserved_ops;
+
+    CRITICAL_REGION_ENTER();
+
+    share_t * p_share = share_find(p_fs);
+
+    for (uint32_t i = 0; i < m_share_cnt; i++)
+    {
+        if (&m_shares[i] != p_share)
+        {
+            reserved += m_shares[i].reserved_ops;
+        }
+    }
+
+    if (reserved >= FLASH_QUEUE_OP_COUNT)
+    {
+        rc = NRF_ERROR_INVALID_PARAM;
+    }
+    else
+    {
+        if (p_share == NULL)
+        {
+            p_share = share_add(p_fs);
+        }
+        if (p_share == NULL)
+        {
+            rc = NRF_ERROR_NO_MEM;
+        }
+        else
+        {
+            p_share->reserved_ops    = reserved_ops;
+            p_share->max_ops         = max_ops;
+            p_share->max_stage_bytes = max_stage_bytes;
+        }
+    }
+
+    CRITICAL_REGION_EXIT();
+
+    return rc;
+}
+
+
+ret_code_t flash_queue_sched_set(nrf_fstorage_t const * p_fs,
+                                 flash_queue_prio_t     prio,
+                                 uint32_t               deadline_ms)
+{
+    uint32_t const deadline_ticks = APP_TIMER_TICKS(deadline_ms);
+
+    if (p_fs == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+    if ((prio >= FLASH_QUEUE_PRIO_COUNT) || (deadline_ticks > TICKS_MASK / 2))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    ret_code_t rc = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+
+    share_t * p_share = share_find(p_fs);
+
+    if (p_share == NULL)
+    {
+        p_share = share_add(p_fs);
+    }
+    if (p_share == NULL)
+    {
+        rc = NRF_ERROR_NO_MEM;
+    }
+    else
+    {
+        p_share->prio           = prio;
+        p_share->deadline_ticks = deadline_ticks;
+    }
+
+    CRITICAL_REGION_EXIT();
+
+    return rc;
+}
+
+
+bool flash_queue_is_busy(void)
+{
+    return (m_count != 0);
+}
+
+
+bool flash_queue_is_pending(nrf_fstorage_t const * p_fs, uint32_t addr, uint32_t len)
+{
+    bool pending = false;
+
+    CRITICAL_REGION_ENTER();
+    for (uint32_t i = 0; (i < m_count) && !pending; i++)
+    {
+        flash_queue_op_t const * const p_op   = &m_ops[op_idx(i)];
+        uint32_t                 const op_len = (p_op->id == FLASH_QUEUE_EVT_ERASE_RESULT)
+                                                ? (p_op->len << FLASH_LAYOUT_PAGE_SHIFT)
+                                                : p_op->len;
+
+        pending =    (p_op->state != OP_STATE_DONE)
+                  && (p_op->p_fs == p_fs)
+                  && (p_op->addr < addr + len)
+                  && (addr < p_op->addr + op_len);
+    }
+    CRITICAL_REGION_EXIT();
+
+    return pending;
+}
+
+
+uint32_t flash_queue_gen_get(nrf_fstorage_t const * p_fs)
+{
+    uint32_t gen;
+
+    CRITICAL_REGION_ENTER();
+    share_t const * const p_share = share_find(p_fs);
+
+    gen = (p_share != NULL) ? p_share->gen : m_gen;
+    CRITICAL_REGION_EXIT();
+
+    return gen;
+}
+
+
+void flash_queue_space_get(flash_queue_space_t * p_space)
+{
+    CRITICAL_REGION_ENTER();
+    p_space->ops         = FLASH_QUEUE_OP_COUNT - m_count;
+    p_space->stage_bytes = stage_room();
+    CRITICAL_REGION_EXIT();
+}
+
+
+ret_code_t flash_queue_space_notify(flash_queue_evt_handler_t evt_handler, void * p_param)
+{
+    if (evt_handler == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    ret_code_t rc = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+    uint32_t i = 0;
+
+    while (   (i < m_waiter_cnt)
+           && ((m_waiters[i].evt_handler != evt_handler) || (m_waiters[i].p_param != p_param)))
+    {
+        i++;
+    }
+
+    if (i == FLASH_QUEUE_NOTIFY_COUNT)
+    {
+        rc = NRF_ERROR_NO_MEM;
+    }
+    else if (i == m_waiter_cnt)
+    {
+        m_waiters[i].evt_handler = evt_handler;
+        m_waiters[i].p_param     = p_param;
+        m_waiter_cnt++;
+    }
+    CRITICAL_REGION_EXIT();
+
+    return rc;
+}
+
+
+/**@brief   Sleep until an event is received. */
+static void event_wait(void)
+{
+#ifdef SOFTDEVICE_PRESENT
+    (void) sd_app_evt_wait();
+#else
+    __WFE();
+#endif
+}
+
+
+ret_code_t flash_queue_space_wait(uint32_t ops, uint32_t stage_bytes, uint32_t timeout_ms)
+{
+    if ((ops > FLASH_QUEUE_OP_COUNT) || (stage_bytes > FLASH_QUEUE_STAGING_SIZE))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    ret_code_t rc            = NRF_SUCCESS;
+    bool       timer_running = false;
+
+    m_wait_expired = (timeout_ms == 0);
+
+    for (;;)
+    {
+        flash_queue_space_t space;
+        flash_queue_space_get(&space);
+
+        if ((space.ops >= ops) && (space.stage_bytes >= stage_bytes))
+        {
+            break;
+        }
+        if (m_wait_expired)
+        {
+            rc = NRF_ERROR_TIMEOUT;
+            break;
+        }
+        if (!timer_running)
+        {
+            /* The timer also wakes the CPU up if no flash event comes. */
+            rc = app_timer_start(m_wait_timer,
+                                 MAX(APP_TIMER_TICKS(timeout_ms), APP_TIMER_MIN_TIMEOUT_TICKS),
+                                 NULL);
+            if (rc != NRF_SUCCESS)
+            {
+                return rc;
+            }
+            timer_running = true;
+        }
+
+        event_wait();
+    }
+
+    if (timer_running)
+    {
+        (void) app_timer_stop(m_wait_timer);
+    }
+
+    return rc;
+}
+
+
+ret_code_t flash_queue_stats_get(flash_queue_stats_t * p_stats)
+{
+#if FLASH_QUEUE_STATS_ENABLED
+    if (p_stats == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    CRITICAL_REGION_ENTER();
+    *p_stats = m_stats;
+    CRITICAL_REGION_EXIT();
+
+    return NRF_SUCCESS;
+#else
+    UNUSED_PARAMETER(p_stats);
+    return NRF_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+
+void flash_queue_stats_reset(void)
+{
+#if FLASH_QUEUE_STATS_ENABLED
+    CRITICAL_REGION_ENTER();
+    memset(&m_stats, 0, sizeof(m_stats));
+    stats_depth_update();
+    CRITICAL_REGION_EXIT();
+#endif
+}
+
+
+void flash_queue_on_fstorage_evt(nrf_fstorage_evt_t const * p_evt)
+{
+    flash_queue_op_t * const p_op = (flash_queue_op_t *)p_evt->p_param;
+
+    if ((p_op >= &m_ops[0]) && (p_op < &m_ops[FLASH_QUEUE_OP_COUNT]))
+    {
+        flash_queue_evt_t         evt;
+        flash_queue_evt_handler_t evt_handler;
+        flash_buf_t             * p_buf;
+        bool                      complete;
+
+        FLASH_TRACE((p_evt->id == NRF_FSTORAGE_EVT_WRITE_RESULT) ? FLASH_TRACE_WRITE_DONE :
+                                                                   FLASH_TRACE_ERASE_DONE,
+                    p_evt->addr, p_evt->result);
+
+        CRITICAL_REGION_ENTER();
+        ASSERT(p_op->state == OP_STATE_SUBMITTED);
+        complete = op_complete(p_op, p_evt->result, &evt, &evt_handler, &p_buf);
+        CRITICAL_REGION_EXIT();
+
+        if (complete)
+        {
+            evt_dispatch(&evt, evt_handler, p_buf);
+
+            failed_ops_drain();
+            space_notify();
+        }
+    }
+
+    /* A slot was freed in the backend queue, whoever the operation belonged to. */
+    queue_kick();
+}
@@ -0,0 +1,413 @@
+#ifndef FLASH_QUEUE_H__
+#define FLASH_QUEUE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "nrf_fstorage.h"
+#include "flash_buf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup flash_queue Batched flash write queue
+ * @{
+ *
+ * @brief   Non-blocking front-end for nrf_fstorage.
+ *
+ * @details Write requests are copied into a RAM staging buffer and return immediately. Requests
+ *          that continue exactly where the previous, not yet submitted, request ends are merged
+ *          into a single program operation. Larger payloads can instead be passed in a
+ *          @ref flash_buf buffer, which is written in place. Completion is reported through the
+ *          handler given with each request.
+ *
+ *          Operations are not handed to nrf_fstorage strictly in order. Each fstorage instance has
+ *          a priority class, and optionally a deadline by which its operations should be done,
+ *          set with @ref flash_queue_sched_set. When nrf_fstorage has room, the queue submits the
+ *          pending operation of the highest class; operations that are close to their deadline
+ *          go before all others. Erases are submitted one page at a time, so that an urgent write
+ *          waits for at most one page erase instead of the whole erase. An operation never
+ *          overtakes an earlier one of the same instance and class, nor an earlier one whose
+ *          range overlaps its own; it lends its priority to the earlier operation instead.
+ *          Operations of one instance and class are thus executed in the order they were queued,
+ *          and their events are reported in that order.
+ *
+ *          The application must forward every nrf_fstorage event to
+ *          @ref flash_queue_on_fstorage_evt from its fstorage event handler.
+ *
+ *          Requests fail with NRF_ERROR_NO_MEM when the queue is full. Producers can check the
+ *          room left with @ref flash_queue_space_get, ask to be told when room is freed with
+ *          @ref flash_queue_space_notify, or sleep until there is room with
+ *          @ref flash_queue_space_wait. Each fstorage instance can be given a share of the queue
+ *          with @ref flash_queue_share_set, so that one that writes a lot cannot fill it for the
+ *          others.
+ */
+
+
+/**@brief   Flash queue event IDs. */
+typedef enum
+{
+    FLASH_QUEUE_EVT_WRITE_RESULT,   //!< A write operation has completed.
+    FLASH_QUEUE_EVT_ERASE_RESULT,   //!< An erase operation has completed.
+    FLASH_QUEUE_EVT_SPACE_AVAILABLE,//!< Room has been freed in the queue. Only the p_param field
+                                    //!< is used. See @ref flash_queue_space_notify.
+} flash_queue_evt_id_t;
+
+
+/**@brief   Priority classes of operations. See @ref flash_queue_sched_set. */
+typedef enum
+{
+    FLASH_QUEUE_PRIO_LOW,       //!< Bulk transfers and erases typed by the user.
+    FLASH_QUEUE_PRIO_NORMAL,    //!< Default for instances that have not been given a class.
+    FLASH_QUEUE_PRIO_HIGH,      //!< Writes that other work waits for, such as record commits.
+    FLASH_QUEUE_PRIO_COUNT
+} flash_queue_prio_t;
+
+
+/**@brief   Flash queue event. */
+typedef struct
+{
+    flash_queue_evt_id_t    id;         //!< The event ID.
+    ret_code_t              result;     //!< Result of the operation.
+    nrf_fstorage_t const  * p_fs;       //!< The fstorage instance the operation was issued on.
+    uint32_t                addr;       //!< Address the operation was executed on.
+    uint32_t                len;        //!< Length of the operation: bytes for writes, pages for erases.
+    uint32_t                cnt;        //!< Number of requests merged into this operation.
+    void                  * p_param;    //!< User-defined parameter passed with the request(s).
+} flash_queue_evt_t;
+
+
+/**@brief   A segment of a gather write. */
+typedef struct
+{
+    void const * p_data;    //!< Data of the segment.
+    uint32_t     len;       //!< Length of the segment, in bytes. Need not be word-aligned.
+} flash_queue_seg_t;
+
+
+/**@brief   Room left in the queue. */
+typedef struct
+{
+    uint32_t ops;           //!< Requests that can be queued without being merged.
+    uint32_t stage_bytes;   //!< Length of the largest write that can be copied into the staging
+                            //!< buffer.
+} flash_queue_space_t;
+
+
+/**@brief   Number of buckets of the latency histograms.
+ *
+ * Bucket 0 counts operations that completed within the app_timer tick they were submitted in.
+ * Bucket i counts latencies from 2^(i-1) up to 2^i - 1 ticks, the last bucket all longer ones.
+ */
+#define FLASH_QUEUE_STATS_BUCKETS   16
+
+
+/**@brief   Statistics of one type of operation. Latencies are in app_timer ticks, measured from
+ *          the submission to nrf_fstorage to its result event. */
+typedef struct
+{
+    uint32_t count;                             //!< Operations completed by nrf_fstorage.
+    uint32_t failed;                            //!< Operations that failed, including the ones
+                                                //!< rejected by nrf_fstorage when submitted.
+    uint32_t units;                             //!< Bytes written, or pages erased.
+    uint32_t ticks_total;                       //!< Sum of the latencies.
+    uint32_t ticks_max;                         //!< Longest latency.
+    uint32_t hist[FLASH_QUEUE_STATS_BUCKETS];   //!< Latency histogram.
+} flash_queue_op_stats_t;
+
+
+/**@brief   Flash queue statistics, gathered if @ref FLASH_QUEUE_STATS_ENABLED is set. */
+typedef struct
+{
+    flash_queue_op_stats_t write;           //!< Write operations, merged requests counting once.
+    flash_queue_op_stats_t erase;           //!< Erase operations.
+    uint32_t               requests;        //!< Requests queued, before merging.
+    uint32_t               rejected;        //!< Requests refused because the queue was full.
+    uint32_t               retries;         //!< Submissions made again later: refused because
+                                            //!< the queue of nrf_fstorage was full, or parts of
+                                            //!< writes that timed out.
+    uint32_t               ops_max;         //!< Most operations queued at once.
+    uint32_t               in_flight_max;   //!< Most operations handed to nrf_fstorage at once.
+    uint32_t               stage_max;       //!< Most bytes used in the staging buffer at once.
+    uint32_t               reordered;       //!< Submissions made ahead of an earlier operation.
+    uint32_t               late;            //!< Operations that completed after their deadline.
+} flash_queue_stats_t;
+
+
+/**@brief   Flash queue event handler type. */
+typedef void (*flash_queue_evt_handler_t)(flash_queue_evt_t const * p_evt);
+
+
+/**@brief   Function for initializing the flash queue. Must be called after app_timer_init(). */
+ret_code_t flash_queue_init(void);
+
+
+/**@brief   Function for queueing a write.
+ *
+ * The data is copied into the staging buffer, so @p p_src does not need to remain valid after
+ * this function returns. Requests are merged with the previous one if they target the same
+ * instance, continue its address range and carry the same handler and parameter.
+ *
+ * @param[in]   p_fs        The fstorage instance to write to.
+ * @param[in]   dest        Address in flash where to write the data. Must be word-aligned.
+ * @param[in]   p_src       Data to be written.
+ * @param[in]   len         Length of the data, in bytes. Must be a multiple of the program unit.
+ * @param[in]   evt_handler Handler to be called when the write completes. Can be NULL.
+ * @param[in]   p_param     User-defined parameter passed to the event handler.
+ *
+ * @retval  NRF_SUCCESS             If the write was queued.
+ * @retval  NRF_ERROR_NULL          If @p p_fs or @p p_src is NULL.
+ * @retval  NRF_ERROR_INVALID_LENGTH If @p len is zero or not a multiple of the program unit.
+ * @retval  NRF_ERROR_INVALID_ADDR  If the range is outside the boundaries of @p p_fs.
+ * @retval  NRF_ERROR_NO_MEM        If there is no room in the queue or in the staging buffer.
+ */
+ret_code_t flash_queue_write(nrf_fstorage_t      const * p_fs,
+                             uint32_t                    dest,
+                             void                const * p_src,
+                             uint32_t                    len,
+                             flash_queue_evt_handler_t   evt_handler,
+                             void                      * p_param);
+
+
+/**@brief   Function for queueing a write assembled from several segments.
+ *
+ * The segments are copied back to back into the staging buffer and written as a single request,
+ * either completely or not at all. Only the total length must be a multiple of the program unit.
+ *
+ * @param[in]   p_fs        The fstorage instance to write to.
+ * @param[in]   dest        Address in flash where to write the data. Must be word-aligned.
+ * @param[in]   p_segs      Segments to be written, in order.
+ * @param[in]   seg_cnt     Number of segments.
+ * @param[in]   evt_handler Handler to be called when the write completes. Can be NULL.
+ * @param[in]   p_param     User-defined parameter passed to the event handler.
+ *
+ * @return  See @ref flash_queue_write.
+ */
+ret_code_t flash_queue_write_gather(nrf_fstorage_t      const * p_fs,
+                                    uint32_t                    dest,
+                                    flash_queue_seg_t   const * p_segs,
+                                    uint32_t                    seg_cnt,
+                                    flash_queue_evt_handler_t   evt_handler,
+                                    void                      * p_param);
+
+
+/**@brief   Function for queueing a write of a reference-counted buffer, without copying it.
+ *
+ * The queue takes a reference to @p p_buf and releases it after the write result has been
+ * reported, so the caller may release its own reference as soon as this function returns.
+ * The buffer contents must not be modified until then.
+ *
+ * @param[in]   p_fs        The fstorage instance to write to.
+ * @param[in]   dest        Address in flash where to write the data. Must be word-aligned.
+ * @param[in]   p_buf       Buffer holding the data, from @ref flash_buf_alloc.
+ * @param[in]   len         Number of bytes of @p p_buf to write. Must be a multiple of the
+ *                          program unit.
+ * @param[in]   evt_handler Handler to be called when the write completes. Can be NULL.
+ * @param[in]   p_param     User-defined parameter passed to the event handler.
+ *
+ * @retval  NRF_SUCCESS             If the write was queued.
+ * @retval  NRF_ERROR_NULL          If @p p_fs or @p p_buf is NULL.
+ * @retval  NRF_ERROR_INVALID_LENGTH If @p len is zero, not a multiple of the program unit or
+ *                                  larger than the buffer.
+ * @retval  NRF_ERROR_INVALID_ADDR  If the range is outside the boundaries of @p p_fs.
+ * @retval  NRF_ERROR_NO_MEM        If there is no room in the queue.
+ */
+ret_code_t flash_queue_write_buf(nrf_fstorage_t      const * p_fs,
+                                 uint32_t                    dest,
+                                 flash_buf_t               * p_buf,
+                                 uint32_t                    len,
+                                 flash_queue_evt_handler_t   evt_handler,
+                                 void                      * p_param);
+
+
+/**@brief   Function for queueing an erase.
+ *
+ * The erase is executed after the operations queued before it on the same instance, and after
+ * those whose range overlaps its own. Its pages are erased one at a time; other operations can
+ * be executed between them.
+ *
+ * @param[in]   p_fs        The fstorage instance to erase from.
+ * @param[in]   page_addr   Address of the first page to erase. Must be page-aligned.
+ * @param[in]   pages_cnt   Number of pages to erase.
+ * @param[in]   evt_handler Handler to be called when the erase completes. Can be NULL.
+ * @param[in]   p_param     User-defined parameter passed to the event handler.
+ *
+ * @retval  NRF_SUCCESS             If the erase was queued.
+ * @retval  NRF_ERROR_NULL          If @p p_fs is NULL.
+ * @retval  NRF_ERROR_INVALID_LENGTH If @p pages_cnt is zero.
+ * @retval  NRF_ERROR_INVALID_PARAM If the erase unit of @p p_fs is not
+ *                                  @ref FLASH_LAYOUT_PAGE_SIZE.
+ * @retval  NRF_ERROR_INVALID_ADDR  If the range is outside the boundaries of @p p_fs.
+ * @retval  NRF_ERROR_NO_MEM        If there is no room in the queue.
+ */
+ret_code_t flash_queue_erase(nrf_fstorage_t      const * p_fs,
+                             uint32_t                    page_addr,
+                             uint32_t                    pages_cnt,
+                             flash_queue_evt_handler_t   evt_handler,
+                             void                      * p_param);
+
+
+/**@brief   Function for checking if the queue has operations that have not completed yet. */
+bool flash_queue_is_busy(void);
+
+
+/**@brief   Function for checking if a write or erase of a range has not completed yet.
+ *
+ * @param[in]   p_fs    The fstorage instance of the range.
+ * @param[in]   addr    Address of the range.
+ * @param[in]   len     Length of the range, in bytes.
+ *
+ * @retval  true    If an operation queued on @p p_fs overlaps the range.
+ * @retval  false   Otherwise. Operations issued directly to nrf_fstorage are not seen.
+ */
+bool flash_queue_is_pending(nrf_fstorage_t const * p_fs, uint32_t addr, uint32_t len);
+
+
+/**@brief   Function for retrieving the modification generation of an fstorage instance.
+ *
+ * The generation changes whenever a write or erase of the instance is queued, including a write
+ * merged into an earlier one, and stays the same otherwise. If it has not changed between two
+ * calls, the flash of the instance has only been changed in between by operations that were
+ * already queued at the first call. The generation of an instance without a share, see
+ * @ref flash_queue_share_set, changes with the operations of every instance.
+ *
+ * @param[in]   p_fs    The fstorage instance.
+ *
+ * @return  The generation.
+ */
+uint32_t flash_queue_gen_get(nrf_fstorage_t const * p_fs);
+
+
+/**@brief   Function for retrieving the room left in the queue.
+ *
+ * A write that does not fit may still be accepted if it is merged into the previous write, and
+ * a write passed in a @ref flash_buf buffer only needs a free operation.
+ *
+ * @param[out]  p_space     The room left.
+ */
+void flash_queue_space_get(flash_queue_space_t * p_space);
+
+
+/**@brief   Function for asking to be told when room is freed in the queue.
+ *
+ * The handler is called once with @ref FLASH_QUEUE_EVT_SPACE_AVAILABLE, after the next operation
+ * has completed, and must ask again if the room is still not enough. Asking again with the same
+ * handler and parameter before then has no further effect.
+ *
+ * @param[in]   evt_handler Handler to be called.
+ * @param[in]   p_param     User-defined parameter passed to the event handler.
+ *
+ * @retval  NRF_SUCCESS     If the handler will be called.
+ * @retval  NRF_ERROR_NULL  If @p evt_handler is NULL.
+ * @retval  NRF_ERROR_NO_MEM If @ref FLASH_QUEUE_NOTIFY_COUNT handlers are already waiting.
+ */
+ret_code_t flash_queue_space_notify(flash_queue_evt_handler_t evt_handler, void * p_param);
+
+
+/**@brief   Function for waiting until there is room in the queue.
+ *
+ * Sleeps until at least @p ops operations and @p stage_bytes bytes of the staging buffer are
+ * free, or until the timeout expires. Must be called from the main context, as the room is freed
+ * by nrf_fstorage events.
+ *
+ * @param[in]   ops         Operations needed.
+ * @param[in]   stage_bytes Contiguous bytes of the staging buffer needed. Zero if only
+ *                          @ref flash_queue_write_buf or @ref flash_queue_erase will be used.
+ * @param[in]   timeout_ms  Longest time to wait, in milliseconds.
+ *
+ * @retval  NRF_SUCCESS             If there is room.
+ * @retval  NRF_ERROR_INVALID_PARAM If the queue can never have that much room.
+ * @retval  NRF_ERROR_TIMEOUT       If the timeout expired first.
+ * @return  Any error returned by app_timer_start().
+ */
+ret_code_t flash_queue_space_wait(uint32_t ops, uint32_t stage_bytes, uint32_t timeout_ms);
+
+
+/**@brief   Function for giving an fstorage instance its own share of the queue.
+ *
+ * Requests of the instance are refused while it holds @p max_ops operations, or while they would
+ * take it over @p max_stage_bytes bytes of the staging buffer. Its first @p reserved_ops
+ * operations are kept for it: requests of other instances are refused the free operations that
+ * shares have reserved and not used yet. Instances without a share only get operations that are
+ * not reserved.
+ *
+ * Setting the share of an instance again replaces it. It keeps the class set with
+ * @ref flash_queue_sched_set.
+ *
+ * @param[in]   p_fs            The fstorage instance.
+ * @param[in]   reserved_ops    Operations kept free for the instance.
+ * @param[in]   max_ops         Most operations the instance can hold at once.
+ * @param[in]   max_stage_bytes Most bytes of the staging buffer the instance can hold at once.
+ *
+ * @retval  NRF_SUCCESS             If the share was set.
+ * @retval  NRF_ERROR_NULL          If @p p_fs is NULL.
+ * @retval  NRF_ERROR_INVALID_PARAM If @p reserved_ops is larger than @p max_ops, or if the
+ *                                  reservations of all shares would leave no operation free.
+ * @retval  NRF_ERROR_NO_MEM        If @ref FLASH_QUEUE_SHARE_COUNT instances already have a share.
+ */
+ret_code_t flash_queue_share_set(nrf_fstorage_t const * p_fs,
+                                 uint32_t               reserved_ops,
+                                 uint32_t               max_ops,
+                                 uint32_t               max_stage_bytes);
+
+
+/**@brief   Function for setting how the operations of an fstorage instance are scheduled.
+ *
+ * The class and the deadline apply to the requests queued after this call. An operation whose
+ * deadline is less than @ref FLASH_QUEUE_DEADLINE_MARGIN_MS away is submitted before those of
+ * every class. Among operations of the same class, the one that is due first goes first.
+ * Instances that are given neither a share nor a class are scheduled as
+ * @ref FLASH_QUEUE_PRIO_NORMAL, without a deadline. The deadline is only a hint: operations are
+ * never dropped for missing it, but they are counted in the statistics.
+ *
+ * @param[in]   p_fs        The fstorage instance.
+ * @param[in]   prio        Priority class of its operations.
+ * @param[in]   deadline_ms Time after being queued by which its operations should be done. Zero
+ *                          for no deadline.
+ *
+ * @retval  NRF_SUCCESS             If the class was set.
+ * @retval  NRF_ERROR_NULL          If @p p_fs is NULL.
+ * @retval  NRF_ERROR_INVALID_PARAM If @p prio is not valid, or @p deadline_ms is longer than
+ *                                  half the range of the app_timer counter.
+ * @retval  NRF_ERROR_NO_MEM        If @ref FLASH_QUEUE_SHARE_COUNT instances already have a share
+ *                                  or a class.
+ */
+ret_code_t flash_queue_sched_set(nrf_fstorage_t const * p_fs,
+                                 flash_queue_prio_t     prio,
+                                 uint32_t               deadline_ms);
+
+
+/**@brief   Function for retrieving the statistics gathered since initialization or the last reset.
+ *
+ * @param[out]  p_stats     The statistics.
+ *
+ * @retval  NRF_SUCCESS             If the statistics were retrieved.
+ * @retval  NRF_ERROR_NULL          If @p p_stats is NULL.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If @ref FLASH_QUEUE_STATS_ENABLED is not set.
+ */
+ret_code_t flash_queue_stats_get(flash_queue_stats_t * p_stats);
+
+
+/**@brief   Function for clearing the statistics. The high-water marks restart from the current
+ *          state of the queue. */
+void flash_queue_stats_reset(void);
+
+
+/**@brief   Function for handling nrf_fstorage events.
+ *
+ * Must be called from the event handler of every fstorage instance used with the queue.
+ * Events for operations that were not issued through the queue are ignored.
+ */
+void flash_queue_on_fstorage_evt(nrf_fstorage_evt_t const * p_evt);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_QUEUE_H__
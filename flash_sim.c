@@ -0,0 +1,667 @@
+#include "flash_sim.h"
+
+#include <string.h>
+
+#include "nordic_common.h"
+#include "app_timer.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+
+#if FLASH_SIM_ENABLED
+
+#define SIM_SIZE    (FLASH_SIM_PAGES * FLASH_SIM_PAGE_SIZE)
+#define SIM_SEED    0x9E3779B9                  /**< Seed of the fault generator after a reset. */
+#define ERASE_US    (FLASH_POWER_ERASE_MS * 1000UL)
+
+STATIC_ASSERT((FLASH_SIM_PAGE_SIZE % sizeof(uint32_t)) == 0);
+STATIC_ASSERT(FLASH_SIM_PAGES > 0);
+STATIC_ASSERT(FLASH_SIM_QUEUE_SIZE > 0);
+
+
+/**@brief   An operation queued on the simulated flash. */
+typedef struct
+{
+    nrf_fstorage_t const  * p_fs;
+    nrf_fstorage_evt_id_t   id;
+    uint32_t                addr;
+    void const            * p_src;
+    uint32_t                len;        //!< Bytes for writes, pages for erases.
+    void                  * p_param;
+} sim_op_t;
+
+
+static ret_code_t      sim_init(nrf_fstorage_t * p_fs, void * p_param);
+static ret_code_t      sim_uninit(nrf_fstorage_t * p_fs, void * p_param);
+static ret_code_t      sim_read(nrf_fstorage_t const * p_fs,
+                                uint32_t               src,
+                                void                 * p_dest,
+                                uint32_t               len);
+static ret_code_t      sim_write(nrf_fstorage_t const * p_fs,
+                                 uint32_t               dest,
+                                 void const           * p_src,
+                                 uint32_t               len,
+                                 void                 * p_param);
+static ret_code_t      sim_erase(nrf_fstorage_t const * p_fs,
+                                 uint32_t               page_addr,
+                                 uint32_t               len,
+                                 void                 * p_param);
+static uint8_t const * sim_rmap(nrf_fstorage_t const * p_fs, uint32_t addr);
+static uint8_t       * sim_wmap(nrf_fstorage_t const * p_fs, uint32_t addr);
+static bool            sim_is_busy(nrf_fstorage_t const * p_fs);
+
+
+static nrf_fstorage_api_t m_api =
+{
+    .init    = sim_init,
+    .uninit  = sim_uninit,
+    .read    = sim_read,
+    .write   = sim_write,
+    .erase   = sim_erase,
+    .rmap    = sim_rmap,
+    .wmap    = sim_wmap,
+    .is_busy = sim_is_busy,
+};
+
+static nrf_fstorage_info_t m_flash_info =
+{
+    .erase_unit   = FLASH_SIM_PAGE_SIZE,
+    .program_unit = sizeof(uint32_t),
+    .rmap         = true,
+    .wmap         = false,
+};
+
+APP_TIMER_DEF(m_timer);
+
+static uint32_t             m_flash[SIM_SIZE / sizeof(uint32_t)];
+static uint32_t             m_wear[FLASH_SIM_PAGES];   //!< Erases of each page.
+static flash_sim_stat_t     m_stat;
+
+static sim_op_t             m_ops[FLASH_SIM_QUEUE_SIZE];
+static uint32_t             m_op_first;
+static uint32_t             m_op_cnt;
+static bool                 m_op_armed;     //!< The cut was set when the head operation started.
+static bool                 m_timer_created;
+
+static uint32_t             m_fault_one_in;
+static uint32_t             m_rand = SIM_SEED;
+static bool                 m_cut_armed;
+static uint32_t             m_cut_us;       //!< Busy time left before the cut.
+static bool                 m_off;
+
+static nrf_fstorage_t     * mp_fs;          //!< The attached instance.
+static nrf_fstorage_api_t * mp_saved_api;
+static uint32_t             m_saved_start;
+static uint32_t             m_saved_end;
+
+
+static uint32_t rand_next(void)
+{
+    /* xorshift32 */
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 17;
+    m_rand ^= m_rand << 5;
+    return m_rand;
+}
+
+
+static uint32_t op_us(sim_op_t const * p_op)
+{
+    return (p_op->id == NRF_FSTORAGE_EVT_WRITE_RESULT)
+           ? (p_op->len / sizeof(uint32_t)) * FLASH_CHUNK_WORD_US
+           : p_op->len * ERASE_US;
+}
+
+
+/**@brief   Program words. Bits can only be cleared. */
+static void words_program(uint32_t addr, void const * p_src, uint32_t cnt)
+{
+    uint32_t * const p_dest = &m_flash[addr / sizeof(uint32_t)];
+
+    for (uint32_t i = 0; i < cnt; i++)
+    {
+        uint32_t word;
+
+        memcpy(&word, (uint8_t const *)p_src + i * sizeof(uint32_t), sizeof(word));
+        if (word & ~p_dest[i])
+        {
+            m_stat.overwrites++;
+        }
+        p_dest[i] &= word;
+    }
+    m_stat.bytes += cnt * sizeof(uint32_t);
+}
+
+
+static void pages_erase(uint32_t addr, uint32_t cnt)
+{
+    memset((uint8_t *)m_flash + addr, 0xFF, cnt * FLASH_SIM_PAGE_SIZE);
+    for (uint32_t i = 0; i < cnt; i++)
+    {
+        m_wear[addr / FLASH_SIM_PAGE_SIZE + i]++;
+    }
+    m_stat.erases += cnt;
+}
+
+
+/**@brief   Apply the part of an operation done before the power was cut, @p us into it. */
+static void op_cut(sim_op_t const * p_op, uint32_t us)
+{
+    if (p_op->id == NRF_FSTORAGE_EVT_WRITE_RESULT)
+    {
+        uint32_t const done = us / FLASH_CHUNK_WORD_US;
+        uint32_t       word;
+
+        words_program(p_op->addr, p_op->p_src, done);
+
+        /* The word being programmed has only some of its bits cleared. */
+        memcpy(&word, (uint8_t const *)p_op->p_src + done * sizeof(uint32_t), sizeof(word));
+        m_flash[p_op->addr / sizeof(uint32_t) + done] &= word | rand_next();
+    }
+    else
+    {
+        uint32_t const done = us / ERASE_US;
+        uint32_t const addr = p_op->addr + done * FLASH_SIM_PAGE_SIZE;
+
+        pages_erase(p_op->addr, done);
+
+        /* The page being erased has only some of its bits set. */
+        for (uint32_t i = 0; i < FLASH_SIM_PAGE_SIZE / sizeof(uint32_t); i++)
+        {
+            m_flash[addr / sizeof(uint32_t) + i] |= rand_next() & rand_next();
+        }
+        m_wear[addr / FLASH_SIM_PAGE_SIZE]++;
+    }
+
+    m_stat.busy_us += us;
+    m_stat.cuts++;
+}
+
+
+/**@brief   Apply the operation at the head of the queue, whose time has elapsed.
+ *
+ * @return  The result to report.
+ */
+static ret_code_t op_apply(sim_op_t const * p_op)
+{
+    uint32_t const us = op_us(p_op);
+
+    if (m_op_armed && (m_cut_us < us))
+    {
+        op_cut(p_op, m_cut_us);
+        m_cut_armed = false;
+        m_off       = true;
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if (m_op_armed)
+    {
+        m_cut_us -= us;
+    }
+
+    m_stat.busy_us += us;
+
+    /* As the SoftDevice does when it finds no timeslot, after trying for about as long. */
+    if ((m_fault_one_in != 0) && ((rand_next() % m_fault_one_in) == 0))
+    {
+        m_stat.timeouts++;
+        return NRF_ERROR_TIMEOUT;
+    }
+
+    if (p_op->id == NRF_FSTORAGE_EVT_WRITE_RESULT)
+    {
+        words_program(p_op->addr, p_op->p_src, p_op->len / sizeof(uint32_t));
+        m_stat.writes++;
+    }
+    else
+    {
+        pages_erase(p_op->addr, p_op->len);
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+static void evt_send(sim_op_t const * p_op, ret_code_t result)
+{
+    nrf_fstorage_evt_t evt =
+    {
+        .id      = p_op->id,
+        .result  = result,
+        .addr    = p_op->addr,
+        .p_src   = p_op->p_src,
+        .len     = p_op->len,
+        .p_param = p_op->p_param,
+    };
+
+    if (p_op->p_fs->evt_handler != NULL)
+    {
+        p_op->p_fs->evt_handler(&evt);
+    }
+}
+
+
+static void timer_handler(void * p_context);
+
+
+/**@brief   Start the timer for the operation at the head of the queue. */
+static void op_start(void)
+{
+    sim_op_t const * const p_op = &m_ops[m_op_first];
+    uint32_t               us   = op_us(p_op);
+
+    m_op_armed = m_cut_armed;
+    if (m_op_armed)
+    {
+        us = MIN(us, m_cut_us);
+    }
+
+    uint32_t const ticks = (uint32_t)(((uint64_t)us * APP_TIMER_TICKS(1000)) / 1000000);
+
+    /* If the timer cannot be started, complete the operation at once rather than never. */
+    if (app_timer_start(m_timer, MAX(ticks, APP_TIMER_MIN_TIMEOUT_TICKS), NULL) != NRF_SUCCESS)
+    {
+        timer_handler(NULL);
+    }
+}
+
+
+static void timer_handler(void * p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    /* Only this handler takes operations off the queue, so the head stays in place. */
+    sim_op_t   const op     = m_ops[m_op_first];
+    ret_code_t const result = op_apply(&op);
+    bool             off;
+    bool             more;
+
+    CRITICAL_REGION_ENTER();
+    m_op_first = (m_op_first + 1) % FLASH_SIM_QUEUE_SIZE;
+    m_op_cnt--;
+    off  = m_off;
+    more = !off && (m_op_cnt != 0);
+    CRITICAL_REGION_EXIT();
+
+    if (more)
+    {
+        op_start();
+    }
+
+    evt_send(&op, result);
+
+    /* Without power, the operations queued behind fail as well. New ones are refused. */
+    while (off)
+    {
+        sim_op_t next;
+
+        CRITICAL_REGION_ENTER();
+        off = (m_op_cnt != 0);
+        if (off)
+        {
+            next       = m_ops[m_op_first];
+            m_op_first = (m_op_first + 1) % FLASH_SIM_QUEUE_SIZE;
+            m_op_cnt--;
+        }
+        CRITICAL_REGION_EXIT();
+
+        if (off)
+        {
+            evt_send(&next, NRF_ERROR_INVALID_STATE);
+        }
+    }
+}
+
+
+static ret_code_t op_push(nrf_fstorage_t const  * p_fs,
+                          nrf_fstorage_evt_id_t   id,
+                          uint32_t                addr,
+                          void const            * p_src,
+                          uint32_t                len,
+                          void                  * p_param)
+{
+    ret_code_t rc    = NRF_SUCCESS;
+    bool       start = false;
+
+    CRITICAL_REGION_ENTER();
+    if (m_off)
+    {
+        rc = NRF_ERROR_INVALID_STATE;
+    }
+    else if (m_op_cnt == FLASH_SIM_QUEUE_SIZE)
+    {
+        rc = NRF_ERROR_NO_MEM;
+    }
+    else
+    {
+        sim_op_t * const p_op = &m_ops[(m_op_first + m_op_cnt) % FLASH_SIM_QUEUE_SIZE];
+
+        p_op->p_fs    = p_fs;
+        p_op->id      = id;
+        p_op->addr    = addr;
+        p_op->p_src   = p_src;
+        p_op->len     = len;
+        p_op->p_param = p_param;
+        start = (m_op_cnt++ == 0);
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (start)
+    {
+        op_start();
+    }
+
+    return rc;
+}
+
+
+static ret_code_t sim_init(nrf_fstorage_t * p_fs, void * p_param)
+{
+    UNUSED_PARAMETER(p_param);
+
+    p_fs->p_flash_info = &m_flash_info;
+
+    if (!m_timer_created)
+    {
+        ret_code_t const rc = app_timer_create(&m_timer, APP_TIMER_MODE_SINGLE_SHOT,
+                                               timer_handler);
+        if (rc != NRF_SUCCESS)
+        {
+            return rc;
+        }
+        m_timer_created = true;
+        memset(m_flash, 0xFF, sizeof(m_flash));
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+static ret_code_t sim_uninit(nrf_fstorage_t * p_fs, void * p_param)
+{
+    UNUSED_PARAMETER(p_fs);
+    UNUSED_PARAMETER(p_param);
+    return NRF_SUCCESS;
+}
+
+
+static ret_code_t sim_read(nrf_fstorage_t const * p_fs,
+                           uint32_t               src,
+                           void                 * p_dest,
+                           uint32_t               len)
+{
+    UNUSED_PARAMETER(p_fs);
+
+    memcpy(p_dest, (uint8_t const *)m_flash + src, len);
+    return NRF_SUCCESS;
+}
+
+
+static ret_code_t sim_write(nrf_fstorage_t const * p_fs,
+                            uint32_t               dest,
+                            void const           * p_src,
+                            uint32_t               len,
+                            void                 * p_param)
+{
+    return op_push(p_fs, NRF_FSTORAGE_EVT_WRITE_RESULT, dest, p_src, len, p_param);
+}
+
+
+static ret_code_t sim_erase(nrf_fstorage_t const * p_fs,
+                            uint32_t               page_addr,
+                            uint32_t               len,
+                            void                 * p_param)
+{
+    return op_push(p_fs, NRF_FSTORAGE_EVT_ERASE_RESULT, page_addr, NULL, len, p_param);
+}
+
+
+static uint8_t const * sim_rmap(nrf_fstorage_t const * p_fs, uint32_t addr)
+{
+    UNUSED_PARAMETER(p_fs);
+    return (uint8_t const *)m_flash + addr;
+}
+
+
+static uint8_t * sim_wmap(nrf_fstorage_t const * p_fs, uint32_t addr)
+{
+    UNUSED_PARAMETER(p_fs);
+    UNUSED_PARAMETER(addr);
+    return NULL;
+}
+
+
+static bool sim_is_busy(nrf_fstorage_t const * p_fs)
+{
+    UNUSED_PARAMETER(p_fs);
+    return (m_op_cnt != 0);
+}
+
+
+ret_code_t flash_sim_attach(nrf_fstorage_t * p_fs)
+{
+    if (p_fs == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+    if (mp_fs != NULL)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if (nrf_fstorage_is_busy(p_fs))
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    mp_saved_api  = (nrf_fstorage_api_t *)p_fs->p_api;
+    m_saved_start = p_fs->start_addr;
+    m_saved_end   = p_fs->end_addr;
+
+    p_fs->start_addr = 0;
+    p_fs->end_addr   = SIM_SIZE - 1;
+
+    ret_code_t const rc = nrf_fstorage_init(p_fs, &m_api, NULL);
+    if (rc != NRF_SUCCESS)
+    {
+        p_fs->start_addr = m_saved_start;
+        p_fs->end_addr   = m_saved_end;
+        p_fs->p_api      = mp_saved_api;
+        return rc;
+    }
+
+    mp_fs = p_fs;
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t flash_sim_detach(void)
+{
+    if (mp_fs == NULL)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if (m_op_cnt != 0)
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    nrf_fstorage_t * const p_fs = mp_fs;
+
+    mp_fs            = NULL;
+    p_fs->start_addr = m_saved_start;
+    p_fs->end_addr   = m_saved_end;
+
+    /* Initializing a backend again has no effect, beyond setting the flash information. */
+    return nrf_fstorage_init(p_fs, mp_saved_api, NULL);
+}
+
+
+bool flash_sim_is_attached(void)
+{
+    return (mp_fs != NULL);
+}
+
+
+ret_code_t flash_sim_reset(void)
+{
+    if (m_op_cnt != 0)
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    memset(m_flash, 0xFF, sizeof(m_flash));
+    memset(m_wear, 0x00, sizeof(m_wear));
+    memset(&m_stat, 0x00, sizeof(m_stat));
+
+    CRITICAL_REGION_ENTER();
+    m_rand      = SIM_SEED;
+    m_cut_armed = false;
+    m_off       = false;
+    CRITICAL_REGION_EXIT();
+
+    return NRF_SUCCESS;
+}
+
+
+void flash_sim_fault_set(uint32_t one_in, uint32_t seed)
+{
+    CRITICAL_REGION_ENTER();
+    m_fault_one_in = one_in;
+    if (seed != 0)
+    {
+        m_rand = seed;
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+
+ret_code_t flash_sim_cut(uint32_t us)
+{
+    ret_code_t rc = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+    if (m_off)
+    {
+        rc = NRF_ERROR_INVALID_STATE;
+    }
+    else
+    {
+        m_cut_armed = true;
+        m_cut_us    = us;
+    }
+    CRITICAL_REGION_EXIT();
+
+    return rc;
+}
+
+
+void flash_sim_restore(void)
+{
+    CRITICAL_REGION_ENTER();
+    m_cut_armed = false;
+    m_off       = false;
+    CRITICAL_REGION_EXIT();
+}
+
+
+bool flash_sim_is_off(void)
+{
+    return m_off;
+}
+
+
+ret_code_t flash_sim_stat_get(flash_sim_stat_t * p_stat)
+{
+    if (p_stat == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    CRITICAL_REGION_ENTER();
+    *p_stat = m_stat;
+    CRITICAL_REGION_EXIT();
+
+    p_stat->wear_min   = UINT32_MAX;
+    p_stat->wear_max   = 0;
+    p_stat->wear_total = 0;
+
+    for (uint32_t i = 0; i < FLASH_SIM_PAGES; i++)
+    {
+        p_stat->wear_min    = MIN(p_stat->wear_min, m_wear[i]);
+        p_stat->wear_max    = MAX(p_stat->wear_max, m_wear[i]);
+        p_stat->wear_total += m_wear[i];
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t flash_sim_wear_get(uint32_t page)
+{
+    return (page < FLASH_SIM_PAGES) ? m_wear[page] : 0;
+}
+
+#else
+
+ret_code_t flash_sim_attach(nrf_fstorage_t * p_fs)
+{
+    UNUSED_PARAMETER(p_fs);
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+
+ret_code_t flash_sim_detach(void)
+{
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+
+bool flash_sim_is_attached(void)
+{
+    return false;
+}
+
+
+ret_code_t flash_sim_reset(void)
+{
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+
+void flash_sim_fault_set(uint32_t one_in, uint32_t seed)
+{
+    UNUSED_PARAMETER(one_in);
+    UNUSED_PARAMETER(seed);
+}
+
+
+ret_code_t flash_sim_cut(uint32_t us)
+{
+    UNUSED_PARAMETER(us);
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+
+void flash_sim_restore(void)
+{
+}
+
+
+bool flash_sim_is_off(void)
+{
+    return false;
+}
+
+
+ret_code_t flash_sim_stat_get(flash_sim_stat_t * p_stat)
+{
+    UNUSED_PARAMETER(p_stat);
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+
+uint32_t flash_sim_wear_get(uint32_t page)
+{
+    UNUSED_PARAMETER(page);
+    return 0;
+}
+
+#endif // FLASH_SIM_ENABLED
@@ -0,0 +1,156 @@
+#ifndef FLASH_SIM_H__
+#define FLASH_SIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_config.h"
+#include "sdk_errors.h"
+#include "nrf_fstorage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup flash_sim Simulated flash
+ * @{
+ *
+ * @brief   An nrf_fstorage backend over RAM that models the timing and the failures of the flash.
+ *
+ * @details The simulated flash has @ref FLASH_SIM_PAGES pages of @ref FLASH_SIM_PAGE_SIZE bytes,
+ *          starting at address zero. Like nrf_fstorage_sd, it queues up to
+ *          @ref FLASH_SIM_QUEUE_SIZE operations and runs them one at a time. Each operation takes
+ *          the time the product specification gives, @ref FLASH_CHUNK_WORD_US per word written
+ *          and @ref FLASH_POWER_ERASE_MS per page erased, counted with app_timer. Its result is
+ *          then applied and reported from the app_timer interrupt, so the source buffer of a
+ *          write must stay valid until the event. Writes can only clear bits, as on the real
+ *          flash; words that would need bits set are counted.
+ *
+ *          Faults are injected on demand:
+ *          - @ref flash_sim_fault_set makes operations fail with NRF_ERROR_TIMEOUT, as the
+ *            SoftDevice does when it finds no timeslot; the flash is left untouched.
+ *          - @ref flash_sim_cut cuts the power after the flash has been busy for a given time.
+ *            The operation in progress stops there, with the word or page it was on left with
+ *            random bits, and that operation and later ones fail with NRF_ERROR_INVALID_STATE
+ *            until @ref flash_sim_restore.
+ *          Both draw from a generator with a given seed, so that a run can be repeated.
+ *
+ *          Attach an fstorage instance with @ref flash_sim_attach to run the users of that
+ *          instance, and the benchmarks, against the simulated flash. The erase counts of each
+ *          page are kept, to show how the wear is spread. The flash queue only erases pages of
+ *          @ref FLASH_LAYOUT_PAGE_SIZE bytes, which @ref FLASH_SIM_PAGE_SIZE must then match.
+ */
+
+
+/**@brief   Counters of the simulated flash, since the last reset. */
+typedef struct
+{
+    uint32_t writes;        //!< Writes completed.
+    uint32_t bytes;         //!< Bytes written.
+    uint32_t erases;        //!< Pages erased.
+    uint32_t overwrites;    //!< Words written with bits that were already cleared set.
+    uint32_t timeouts;      //!< Operations failed by @ref flash_sim_fault_set.
+    uint32_t cuts;          //!< Times the power was cut.
+    uint32_t busy_us;       //!< Time the flash was busy.
+    uint32_t wear_min;      //!< Fewest erases of a page.
+    uint32_t wear_max;      //!< Most erases of a page.
+    uint32_t wear_total;    //!< Erases of all pages; divide by @ref FLASH_SIM_PAGES for the mean.
+} flash_sim_stat_t;
+
+
+/**@brief   Function for running an fstorage instance on the simulated flash.
+ *
+ * Its backend and its bounds are saved, and replaced by those of the simulated flash, which it
+ * covers entirely. Only one instance can be attached at a time.
+ *
+ * @retval  NRF_SUCCESS             If the instance was attached.
+ * @retval  NRF_ERROR_NULL          If @p p_fs is NULL.
+ * @retval  NRF_ERROR_INVALID_STATE If an instance is already attached.
+ * @retval  NRF_ERROR_BUSY          If operations of @p p_fs are pending.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If @ref FLASH_SIM_ENABLED is not set.
+ */
+ret_code_t flash_sim_attach(nrf_fstorage_t * p_fs);
+
+
+/**@brief   Function for giving the attached instance back its backend and bounds.
+ *
+ * @retval  NRF_SUCCESS             If the instance was detached.
+ * @retval  NRF_ERROR_INVALID_STATE If no instance is attached.
+ * @retval  NRF_ERROR_BUSY          If operations are pending on the simulated flash.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If @ref FLASH_SIM_ENABLED is not set.
+ * @return  Any error returned by nrf_fstorage_init() for the saved backend.
+ */
+ret_code_t flash_sim_detach(void);
+
+
+/**@brief   Function for checking whether an instance is attached. */
+bool flash_sim_is_attached(void);
+
+
+/**@brief   Function for erasing the simulated flash, clearing the counters and the erase counts,
+ *          and switching the power back on.
+ *
+ * @retval  NRF_SUCCESS             If the flash was reset.
+ * @retval  NRF_ERROR_BUSY          If operations are pending.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If @ref FLASH_SIM_ENABLED is not set.
+ */
+ret_code_t flash_sim_reset(void);
+
+
+/**@brief   Function for making one operation in @p one_in fail with NRF_ERROR_TIMEOUT.
+ *
+ * @param[in]   one_in  Average number of operations per failure. Zero to stop.
+ * @param[in]   seed    Seed of the generator that picks the operations. Zero keeps the current
+ *                      one.
+ */
+void flash_sim_fault_set(uint32_t one_in, uint32_t seed);
+
+
+/**@brief   Function for cutting the power once the flash has been busy for @p us microseconds.
+ *
+ * The time counts from the start of the next operation; the one in progress, if any, completes
+ * normally.
+ *
+ * @param[in]   us  Busy time before the cut. Zero cuts the power as the next operation starts.
+ *
+ * @retval  NRF_SUCCESS             If the cut was set.
+ * @retval  NRF_ERROR_INVALID_STATE If the power is already off.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If @ref FLASH_SIM_ENABLED is not set.
+ */
+ret_code_t flash_sim_cut(uint32_t us);
+
+
+/**@brief   Function for switching the power back on, after a cut. The flash keeps what was
+ *          written before the cut. Does nothing if the power is on, but cancels a pending cut.
+ */
+void flash_sim_restore(void);
+
+
+/**@brief   Function for checking whether the power has been cut. */
+bool flash_sim_is_off(void);
+
+
+/**@brief   Function for retrieving the counters.
+ *
+ * @retval  NRF_SUCCESS             If the counters were copied.
+ * @retval  NRF_ERROR_NULL          If @p p_stat is NULL.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If @ref FLASH_SIM_ENABLED is not set.
+ */
+ret_code_t flash_sim_stat_get(flash_sim_stat_t * p_stat);
+
+
+/**@brief   Function for retrieving the erase count of a page.
+ *
+ * @return  The erase count, or zero if @p page is not below @ref FLASH_SIM_PAGES.
+ */
+uint32_t flash_sim_wear_get(uint32_t page);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_SIM_H__
@@ -0,0 +1,51 @@
+#include "flash_span.h"
+
+#include <stddef.h>
+
+#include "flash_cache.h"
+#include "flash_queue.h"
+
+
+ret_code_t flash_span_get(nrf_fstorage_t const * p_fs,
+                          uint32_t               addr,
+                          uint32_t               len,
+                          flash_span_t         * p_span)
+{
+    if ((p_fs == NULL) || (p_span == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+    if (len == 0)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    /* Written so that no sum can overflow. */
+    if ((addr < p_fs->start_addr) || (addr > p_fs->end_addr) || (len - 1 > p_fs->end_addr - addr))
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    /* Taken before the check, so that an operation queued after it changes the generation. */
+    uint32_t const gen = flash_queue_gen_get(p_fs);
+
+    if (flash_cache_is_pending(p_fs, addr, len))
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    p_span->p_fs   = p_fs;
+    p_span->p_data = nrf_fstorage_rmap(p_fs, addr);
+    p_span->addr   = addr;
+    p_span->len    = len;
+    p_span->gen    = gen;
+
+    return NRF_SUCCESS;
+}
+
+
+bool flash_span_is_pending(flash_span_t const * p_span)
+{
+    /* Writes still in the cache have not reached the queue, and have no generation yet. */
+    return    (flash_queue_gen_get(p_span->p_fs) != p_span->gen)
+           || flash_cache_is_pending(p_span->p_fs, p_span->addr, p_span->len);
+}
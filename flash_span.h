@@ -0,0 +1,82 @@
+#ifndef FLASH_SPAN_H__
+#define FLASH_SPAN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "nrf_fstorage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup flash_span Zero-copy flash reads
+ * @{
+ *
+ * @brief   Bounds-checked pointers into the flash area of an fstorage instance.
+ *
+ * @details Internal flash is memory mapped, so data can be parsed in place instead of being
+ *          copied with nrf_fstorage_read(). A span is only handed out for a range that lies
+ *          within the flash area and that no write or erase queued through @ref flash_cache or
+ *          @ref flash_queue is about to change. Data that is still cached is not in flash yet;
+ *          read it with @ref flash_cache_read instead.
+ *
+ *          A span stays readable, but its contents may change as soon as a write or erase of
+ *          the range is queued, and have changed if that operation has completed since. Code
+ *          that cannot rule this out, e.g. because event handlers write to the same range,
+ *          checks @ref flash_span_is_pending once it is done with the data: if it returns false,
+ *          the data was stable throughout. The span keeps the generation of
+ *          @ref flash_queue_gen_get for this, so any write or erase of the instance queued in the
+ *          meantime counts, even one of another range.
+ */
+
+
+/**@brief   A range of flash, read in place. */
+typedef struct
+{
+    nrf_fstorage_t const * p_fs;    //!< The fstorage instance the range belongs to.
+    uint8_t        const * p_data;  //!< The first byte of the range.
+    uint32_t               addr;    //!< Address of the first byte.
+    uint32_t               len;     //!< Number of bytes.
+    uint32_t               gen;     //!< Generation of the instance when the span was set.
+} flash_span_t;
+
+
+/**@brief   Function for getting a span of flash.
+ *
+ * @param[in]   p_fs    The fstorage instance to read from.
+ * @param[in]   addr    Address of the first byte. Need not be aligned.
+ * @param[in]   len     Number of bytes.
+ * @param[out]  p_span  The span.
+ *
+ * @retval  NRF_SUCCESS             If the span was set.
+ * @retval  NRF_ERROR_NULL          If @p p_fs or @p p_span is NULL.
+ * @retval  NRF_ERROR_INVALID_LENGTH If @p len is zero.
+ * @retval  NRF_ERROR_INVALID_ADDR  If the range is outside the boundaries of @p p_fs.
+ * @retval  NRF_ERROR_BUSY          If a write or erase of the range has not completed yet.
+ */
+ret_code_t flash_span_get(nrf_fstorage_t const * p_fs,
+                          uint32_t               addr,
+                          uint32_t               len,
+                          flash_span_t         * p_span);
+
+
+/**@brief   Function for checking if a write or erase of a span has been queued since it was set.
+ *
+ * @retval  true    If a write or erase of the instance has been queued since the span was set,
+ *                  completed or not, or if one of the range is pending. The data read from the
+ *                  span since it was retrieved may be stale or torn.
+ * @retval  false   Otherwise. Operations issued directly to nrf_fstorage are not seen.
+ */
+bool flash_span_is_pending(flash_span_t const * p_span);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_SPAN_H__
@@ -0,0 +1,133 @@
+#include "flash_submit.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "sdk_config.h"
+#include "app_util.h"
+#include "nrf_atfifo.h"
+#include "nrf_atomic.h"
+#include "flash_cache.h"
+#include "flash_trace.h"
+
+STATIC_ASSERT(FLASH_SUBMIT_DATA_SIZE <= FLASH_CACHE_LINE_SIZE);
+
+
+typedef struct
+{
+    nrf_fstorage_t      const * p_fs;
+    flash_queue_evt_handler_t   evt_handler;
+    void                      * p_param;
+    uint32_t                    dest;
+    uint32_t                    len;
+    uint32_t                    data[CEIL_DIV(FLASH_SUBMIT_DATA_SIZE, sizeof(uint32_t))];
+} request_t;
+
+
+NRF_ATFIFO_DEF(m_fifo, request_t, FLASH_SUBMIT_QUEUE_SIZE);
+
+static nrf_atomic_u32_t      m_dropped;
+static request_t           * m_p_held;      //!< Request taken from the queue, not handed over yet.
+static nrf_atfifo_item_get_t m_held_ctx;
+
+
+ret_code_t flash_submit_init(void)
+{
+    m_p_held  = NULL;
+    m_dropped = 0;
+
+    return NRF_ATFIFO_INIT(m_fifo);
+}
+
+
+ret_code_t flash_submit_write(nrf_fstorage_t      const * p_fs,
+                              uint32_t                    dest,
+                              void                const * p_src,
+                              uint32_t                    len,
+                              flash_queue_evt_handler_t   evt_handler,
+                              void                      * p_param)
+{
+    nrf_atfifo_item_put_t ctx;
+
+    if ((p_fs == NULL) || (p_src == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+    if ((len == 0) || (len > FLASH_SUBMIT_DATA_SIZE))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    request_t * const p_req = nrf_atfifo_item_alloc(m_fifo, &ctx);
+    if (p_req == NULL)
+    {
+        (void) nrf_atomic_u32_add(&m_dropped, 1);
+        FLASH_TRACE(FLASH_TRACE_SUBMIT_DROP, dest, len);
+        return NRF_ERROR_NO_MEM;
+    }
+
+    p_req->p_fs        = p_fs;
+    p_req->evt_handler = evt_handler;
+    p_req->p_param     = p_param;
+    p_req->dest        = dest;
+    p_req->len         = len;
+    memcpy(p_req->data, p_src, len);
+
+    /* Becomes visible to the main loop once the producers it interrupted have put theirs. */
+    (void) nrf_atfifo_item_put(m_fifo, &ctx);
+
+    return NRF_SUCCESS;
+}
+
+
+bool flash_submit_process(void)
+{
+    bool handed = false;
+
+    for (;;)
+    {
+        if (m_p_held == NULL)
+        {
+            m_p_held = nrf_atfifo_item_get(m_fifo, &m_held_ctx);
+            if (m_p_held == NULL)
+            {
+                return handed;
+            }
+        }
+
+        request_t const * const p_req = m_p_held;
+
+        ret_code_t const rc = flash_cache_write(p_req->p_fs, p_req->dest, p_req->data, p_req->len,
+                                                p_req->evt_handler, p_req->p_param);
+        if (rc == NRF_ERROR_NO_MEM)
+        {
+            /* The cache frees lines as the flash queue drains; keep the request until then. */
+            return handed;
+        }
+        if ((rc != NRF_SUCCESS) && (p_req->evt_handler != NULL))
+        {
+            flash_queue_evt_t const evt =
+            {
+                .id      = FLASH_QUEUE_EVT_WRITE_RESULT,
+                .result  = rc,
+                .p_fs    = p_req->p_fs,
+                .addr    = p_req->dest,
+                .len     = p_req->len,
+                .cnt     = 1,
+                .p_param = p_req->p_param,
+            };
+
+            p_req->evt_handler(&evt);
+        }
+
+        (void) nrf_atfifo_item_free(m_fifo, &m_held_ctx);
+        m_p_held = NULL;
+        handed   = true;
+    }
+}
+
+
+uint32_t flash_submit_dropped_get(void)
+{
+    return m_dropped;
+}
@@ -0,0 +1,86 @@
+#ifndef FLASH_SUBMIT_H__
+#define FLASH_SUBMIT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "nrf_fstorage.h"
+#include "flash_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup flash_submit Flash writes from interrupt handlers
+ * @{
+ *
+ * @brief   Lock-free queue for flash writes requested at any interrupt priority.
+ *
+ * @details The write cache and the flash queue protect their state with critical regions, and
+ *          nrf_fstorage_sd makes SoftDevice calls, which cannot be made from interrupt handlers
+ *          of a higher priority than the SoftDevice allows. Interrupt handlers that sample data,
+ *          e.g. on a timer or a GPIOTE event, put their writes in this queue instead.
+ *
+ *          The queue is an nrf_atfifo of @ref FLASH_SUBMIT_QUEUE_SIZE requests of up to
+ *          @ref FLASH_SUBMIT_DATA_SIZE bytes each. Any number of producers can add requests
+ *          without disabling interrupts, and @ref flash_submit_process hands them to the write
+ *          cache (@ref flash_cache) from the main loop, in the order they were added. A producer
+ *          that finds the queue full gets an error right away, and the request is counted as
+ *          dropped.
+ */
+
+
+/**@brief   Function for initializing the queue. */
+ret_code_t flash_submit_init(void);
+
+
+/**@brief   Function for requesting a write. Can be called from any context.
+ *
+ * The data is copied into the queue. The address is only checked when the request is handed to
+ * the write cache: if it is refused then, @p evt_handler gets an event with the error.
+ *
+ * @param[in]   p_fs        The fstorage instance to write to.
+ * @param[in]   dest        Address in flash where to write the data.
+ * @param[in]   p_src       Data to be written.
+ * @param[in]   len         Length of the data, in bytes. At most @ref FLASH_SUBMIT_DATA_SIZE.
+ * @param[in]   evt_handler Handler to be called when the data has been written. Can be NULL.
+ *                          Called from the context the write cache reports writes in.
+ * @param[in]   p_param     User-defined parameter passed to the event handler.
+ *
+ * @retval  NRF_SUCCESS             If the request was queued.
+ * @retval  NRF_ERROR_NULL          If @p p_fs or @p p_src is NULL.
+ * @retval  NRF_ERROR_INVALID_LENGTH If @p len is zero or larger than @ref FLASH_SUBMIT_DATA_SIZE.
+ * @retval  NRF_ERROR_NO_MEM        If the queue is full. The request is counted as dropped.
+ */
+ret_code_t flash_submit_write(nrf_fstorage_t      const * p_fs,
+                              uint32_t                    dest,
+                              void                const * p_src,
+                              uint32_t                    len,
+                              flash_queue_evt_handler_t   evt_handler,
+                              void                      * p_param);
+
+
+/**@brief   Function for handing queued requests to the write cache.
+ *
+ * Call this function from the main loop. Requests the cache cannot take yet stay queued until
+ * the next call.
+ *
+ * @retval  true    If requests were handed to the cache.
+ * @retval  false   If there were none, or the cache was full.
+ */
+bool flash_submit_process(void);
+
+
+/**@brief   Function for retrieving the number of requests dropped because the queue was full. */
+uint32_t flash_submit_dropped_get(void);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_SUBMIT_H__
@@ -0,0 +1,105 @@
+#include "flash_trace.h"
+
+#include <stddef.h>
+
+#include "nordic_common.h"
+#include "app_util.h"
+#include "app_timer.h"
+#include "nrf_atomic.h"
+
+#if FLASH_TRACE_ENABLED
+
+STATIC_ASSERT((FLASH_TRACE_SIZE & (FLASH_TRACE_SIZE - 1)) == 0);
+
+
+static flash_trace_entry_t volatile m_ring[FLASH_TRACE_SIZE];
+static nrf_atomic_u32_t             m_next;     //!< Sequence number of the next entry.
+
+
+void flash_trace_put(flash_trace_id_t id, uint32_t arg0, uint32_t arg1)
+{
+    uint32_t                     const seq     = nrf_atomic_u32_fetch_add(&m_next, 1);
+    flash_trace_entry_t volatile * const p_entry = &m_ring[seq % FLASH_TRACE_SIZE];
+
+    /* The sequence number goes in last, so that a read that was interrupted by this call sees
+     * that the entry has changed. */
+    p_entry->stamp  = (app_timer_cnt_get() << 8) | (uint8_t)id;
+    p_entry->arg[0] = arg0;
+    p_entry->arg[1] = arg1;
+    p_entry->seq    = seq;
+}
+
+
+uint32_t flash_trace_next(void)
+{
+    return m_next;
+}
+
+
+ret_code_t flash_trace_read(uint32_t * p_seq, flash_trace_entry_t * p_entry)
+{
+    if ((p_seq == NULL) || (p_entry == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    for (;;)
+    {
+        uint32_t const next = m_next;
+
+        if (*p_seq == next)
+        {
+            return NRF_ERROR_NOT_FOUND;
+        }
+        if (next - *p_seq > FLASH_TRACE_SIZE)
+        {
+            /* Overwritten: resume with the oldest entry left. */
+            *p_seq = next - FLASH_TRACE_SIZE;
+        }
+
+        flash_trace_entry_t volatile const * const p_slot = &m_ring[*p_seq % FLASH_TRACE_SIZE];
+
+        p_entry->seq    = p_slot->seq;
+        p_entry->stamp  = p_slot->stamp;
+        p_entry->arg[0] = p_slot->arg[0];
+        p_entry->arg[1] = p_slot->arg[1];
+
+        /* Calls that interrupt this one complete before it resumes, so a slot that changed while
+         * it was copied has been overwritten, and is skipped. */
+        if ((p_entry->seq == *p_seq) && (p_slot->seq == *p_seq))
+        {
+            (*p_seq)++;
+            return NRF_SUCCESS;
+        }
+        if ((int32_t)(p_entry->seq - *p_seq) < 0)
+        {
+            /* Claimed, but not written yet: called from an interrupt handler after all. */
+            return NRF_ERROR_NOT_FOUND;
+        }
+    }
+}
+
+#else
+
+void flash_trace_put(flash_trace_id_t id, uint32_t arg0, uint32_t arg1)
+{
+    UNUSED_PARAMETER(id);
+    UNUSED_PARAMETER(arg0);
+    UNUSED_PARAMETER(arg1);
+}
+
+
+uint32_t flash_trace_next(void)
+{
+    return 0;
+}
+
+
+ret_code_t flash_trace_read(uint32_t * p_seq, flash_trace_entry_t * p_entry)
+{
+    UNUSED_PARAMETER(p_seq);
+    UNUSED_PARAMETER(p_entry);
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+#endif // FLASH_TRACE_ENABLED
@@ -0,0 +1,103 @@
+#ifndef FLASH_TRACE_H__
+#define FLASH_TRACE_H__
+
+#include <stdint.h>
+#include "sdk_config.h"
+#include "sdk_errors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup flash_trace Binary trace of flash operations
+ * @{
+ *
+ * @brief   Compact trace of the storage paths, decoded off the target.
+ *
+ * @details Instead of formatting a message, each trace point stores an event ID, two arguments
+ *          and a timestamp in a RAM ring of @ref FLASH_TRACE_SIZE entries, which takes a few
+ *          dozen cycles and never blocks. Entries can be added from any interrupt priority:
+ *          a slot is claimed with an atomic increment, so there is no critical region. Once the
+ *          ring is full, the oldest entries are overwritten.
+ *
+ *          The ring is read from thread level, by the CLI command that dumps it as hexadecimal
+ *          words. trace_decode.py turns the dump into text on the host, using the names and the
+ *          descriptions of the event IDs below, so that the two cannot get out of sync.
+ *
+ *          If @ref FLASH_TRACE_ENABLED is not set, trace points compile to nothing.
+ */
+
+
+/**@brief   Trace event IDs. The description of each ID names its two arguments. */
+typedef enum
+{
+    FLASH_TRACE_WRITE,          //!< Write requested by the application: address, data.
+    FLASH_TRACE_READ,           //!< Read requested by the application: address, length.
+    FLASH_TRACE_SUBMIT_WRITE,   //!< Write handed to nrf_fstorage: address, length.
+    FLASH_TRACE_SUBMIT_ERASE,   //!< Erase handed to nrf_fstorage: address, pages.
+    FLASH_TRACE_RETRY,          //!< nrf_fstorage queue full, submission retried later: address, 0.
+    FLASH_TRACE_WRITE_DONE,     //!< Write reported by nrf_fstorage: address, result.
+    FLASH_TRACE_ERASE_DONE,     //!< Erase reported by nrf_fstorage: address, result.
+    FLASH_TRACE_CACHE_FLUSH,    //!< Write cache line handed to the flash queue: address, length.
+    FLASH_TRACE_RECORD_APPEND,  //!< Record queued: key, address.
+    FLASH_TRACE_RECORD_DONE,    //!< Record written: key, result.
+    FLASH_TRACE_COMMIT_DONE,    //!< Transaction committed: records, result.
+    FLASH_TRACE_COMPACT_ERASE,  //!< Compaction erasing the oldest page: address, 0.
+    FLASH_TRACE_SUBMIT_DROP,    //!< Interrupt-time write dropped, queue full: address, length.
+    FLASH_TRACE_RECORD_DATA,    //!< Record queued by the application, uncompressed: key, length.
+} flash_trace_id_t;
+
+
+/**@brief   An entry of the trace. */
+typedef struct
+{
+    uint32_t seq;       //!< Sequence number of the entry, counting from zero at reset.
+    uint32_t stamp;     //!< app_timer ticks in bits 31 to 8, @ref flash_trace_id_t in bits 7 to 0.
+    uint32_t arg[2];
+} flash_trace_entry_t;
+
+
+#if FLASH_TRACE_ENABLED
+#define FLASH_TRACE(id, arg0, arg1) flash_trace_put((id), (uint32_t)(arg0), (uint32_t)(arg1))
+#else
+#define FLASH_TRACE(id, arg0, arg1) ((void)0)
+#endif
+
+
+/**@brief   Function for adding an entry to the trace. Use @ref FLASH_TRACE instead.
+ *
+ * Can be called from any context.
+ */
+void flash_trace_put(flash_trace_id_t id, uint32_t arg0, uint32_t arg1);
+
+
+/**@brief   Function for retrieving the sequence number the next entry will get. */
+uint32_t flash_trace_next(void);
+
+
+/**@brief   Function for reading an entry of the trace.
+ *
+ * Must be called from thread level. Entries that have been overwritten are skipped; the gap in
+ * the sequence numbers tells how many were lost.
+ *
+ * @param[in,out]   p_seq   In: sequence number of the entry to read. Out: sequence number of
+ *                          the entry after the one read.
+ * @param[out]      p_entry The entry.
+ *
+ * @retval  NRF_SUCCESS             If an entry was read.
+ * @retval  NRF_ERROR_NULL          If @p p_seq or @p p_entry is NULL.
+ * @retval  NRF_ERROR_NOT_FOUND     If there are no entries from @p p_seq on yet.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If @ref FLASH_TRACE_ENABLED is not set.
+ */
+ret_code_t flash_trace_read(uint32_t * p_seq, flash_trace_entry_t * p_entry);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_TRACE_H__
@@ -0,0 +1,178 @@
+#include "app_timer.h"
+
+#include <stddef.h>
+#include "nrf.h"
+
+
+static app_timer_t * mp_timers;     //!< Created timers.
+static uint64_t      m_now;
+
+
+/**@brief   Return the active timer that expires first, or NULL. */
+static app_timer_t * timer_next(void)
+{
+    app_timer_t * p_next = NULL;
+
+    for (app_timer_t * p_timer = mp_timers; p_timer != NULL; p_timer = p_timer->p_next)
+    {
+        if (p_timer->active && ((p_next == NULL) || (p_timer->expiry < p_next->expiry)))
+        {
+            p_next = p_timer;
+        }
+    }
+
+    return p_next;
+}
+
+
+ret_code_t app_timer_init(void)
+{
+    m_now = 0;
+    app_timer_host_stop_all();
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t app_timer_create(app_timer_id_t const      * p_timer_id,
+                            app_timer_mode_t            mode,
+                            app_timer_timeout_handler_t timeout_handler)
+{
+    if ((p_timer_id == NULL) || (*p_timer_id == NULL) || (timeout_handler == NULL))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    app_timer_t * const p_timer = *p_timer_id;
+
+    /* Creating a timer again, as a module does when it is initialized again, stops it. */
+    p_timer->handler  = timeout_handler;
+    p_timer->repeated = (mode == APP_TIMER_MODE_REPEATED);
+    p_timer->active   = false;
+
+    if (!p_timer->linked)
+    {
+        p_timer->p_next = mp_timers;
+        p_timer->linked = true;
+        mp_timers       = p_timer;
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context)
+{
+    if ((timer_id == NULL) || (timer_id->handler == NULL))
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if ((timeout_ticks < APP_TIMER_MIN_TIMEOUT_TICKS) || (timeout_ticks > APP_TIMER_MAX_CNT_VAL))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    /* As with app_timer, starting a running timer does not restart it. */
+    if (!timer_id->active)
+    {
+        timer_id->p_context = p_context;
+        timer_id->expiry    = m_now + timeout_ticks;
+        timer_id->period    = timeout_ticks;
+        timer_id->active    = true;
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t app_timer_stop(app_timer_id_t timer_id)
+{
+    if (timer_id == NULL)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    timer_id->active = false;
+    return NRF_SUCCESS;
+}
+
+
+uint32_t app_timer_cnt_get(void)
+{
+    return (uint32_t)m_now & APP_TIMER_MAX_CNT_VAL;
+}
+
+
+uint32_t app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from)
+{
+    return (ticks_to - ticks_from) & APP_TIMER_MAX_CNT_VAL;
+}
+
+
+void app_timer_host_run(uint32_t ticks)
+{
+    uint64_t const end = m_now + ticks;
+
+    /* Handlers may start timers, so look for the next one again after each. */
+    for (;;)
+    {
+        app_timer_t * const p_timer = timer_next();
+
+        if ((p_timer == NULL) || (p_timer->expiry > end))
+        {
+            break;
+        }
+
+        m_now = p_timer->expiry;
+        if (p_timer->repeated)
+        {
+            p_timer->expiry += p_timer->period;
+        }
+        else
+        {
+            p_timer->active = false;
+        }
+        p_timer->handler(p_timer->p_context);
+    }
+
+    m_now = end;
+}
+
+
+bool app_timer_host_next(uint32_t * p_ticks)
+{
+    app_timer_t const * const p_timer = timer_next();
+
+    if (p_timer == NULL)
+    {
+        return false;
+    }
+
+    *p_ticks = (uint32_t)(p_timer->expiry - m_now);
+    return true;
+}
+
+
+void app_timer_host_stop_all(void)
+{
+    for (app_timer_t * p_timer = mp_timers; p_timer != NULL; p_timer = p_timer->p_next)
+    {
+        p_timer->active = false;
+    }
+}
+
+
+uint64_t app_timer_host_now(void)
+{
+    return m_now;
+}
+
+
+void __WFE(void)
+{
+    uint32_t ticks;
+
+    if (app_timer_host_next(&ticks))
+    {
+        app_timer_host_run(ticks);
+    }
+}
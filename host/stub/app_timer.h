@@ -0,0 +1,102 @@
+#ifndef APP_TIMER_H__
+#define APP_TIMER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_config.h"
+#include "sdk_errors.h"
+#include "app_util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @brief   Host stand-in for app_timer, over a virtual clock.
+ *
+ * @details The counter has the width and the frequency of the RTC behind app_timer, set by
+ *          APP_TIMER_CONFIG_RTC_FREQUENCY in sdk_config.h, but it only moves when
+ *          @ref app_timer_host_run or __WFE() advance it. Timeouts are handled on the calling
+ *          thread, in the order of their expiry, with the counter at the tick they expire on.
+ */
+
+#define APP_TIMER_CLOCK_FREQ            32768
+#define APP_TIMER_MIN_TIMEOUT_TICKS     5
+#define APP_TIMER_MAX_CNT_VAL           0x00FFFFFF
+
+#define APP_TIMER_TICKS(MS)                                 \
+            ((uint32_t)ROUNDED_DIV(                         \
+            (MS) * (uint64_t)APP_TIMER_CLOCK_FREQ,          \
+            1000 * (APP_TIMER_CONFIG_RTC_FREQUENCY + 1)))
+
+
+typedef void (*app_timer_timeout_handler_t)(void * p_context);
+
+typedef enum
+{
+    APP_TIMER_MODE_SINGLE_SHOT,
+    APP_TIMER_MODE_REPEATED,
+} app_timer_mode_t;
+
+
+/**@brief   A timer. Define them with @ref APP_TIMER_DEF. */
+typedef struct app_timer_s
+{
+    struct app_timer_s        * p_next;     //!< Next created timer.
+    app_timer_timeout_handler_t handler;
+    void                      * p_context;
+    uint64_t                    expiry;     //!< Tick of the timeout, if active.
+    uint32_t                    period;     //!< Ticks between timeouts, if repeated.
+    bool                        repeated;
+    bool                        active;
+    bool                        linked;     //!< In the list of created timers.
+} app_timer_t;
+
+typedef app_timer_t * app_timer_id_t;
+
+#define APP_TIMER_DEF(timer_id)                                     \
+    static app_timer_t CONCAT_2(timer_id, _data) = { 0 };           \
+    static app_timer_id_t const timer_id = &CONCAT_2(timer_id, _data)
+
+
+ret_code_t app_timer_init(void);
+
+ret_code_t app_timer_create(app_timer_id_t const      * p_timer_id,
+                            app_timer_mode_t            mode,
+                            app_timer_timeout_handler_t timeout_handler);
+
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context);
+
+ret_code_t app_timer_stop(app_timer_id_t timer_id);
+
+uint32_t app_timer_cnt_get(void);
+
+uint32_t app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from);
+
+
+/**@brief   Host only: advance the counter by @p ticks, handling the timeouts on the way. */
+void app_timer_host_run(uint32_t ticks);
+
+
+/**@brief   Host only: retrieve the ticks left to the next timeout.
+ *
+ * @retval  true    If a timer is running; @p p_ticks is set.
+ * @retval  false   If no timer is running.
+ */
+bool app_timer_host_next(uint32_t * p_ticks);
+
+
+/**@brief   Host only: stop all timers, as a reset would. */
+void app_timer_host_stop_all(void);
+
+
+/**@brief   Host only: retrieve the ticks since initialization, without wrapping. */
+uint64_t app_timer_host_now(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // APP_TIMER_H__
@@ -0,0 +1,19 @@
+#ifndef APP_UTIL_H__
+#define APP_UTIL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nordic_common.h"
+
+/**@file
+ *
+ * @brief   Host stand-in for the utility macros of the SDK.
+ */
+
+#define STATIC_ASSERT(EXPR)             _Static_assert((EXPR), #EXPR)
+
+#define ROUNDED_DIV(A, B)               (((A) + ((B) / 2)) / (B))
+#define CEIL_DIV(A, B)                  (((A) + (B) - 1) / (B))
+#define ALIGN_NUM(alignment, number)    ((number - 1) + alignment - ((number - 1) % alignment))
+
+#endif // APP_UTIL_H__
@@ -0,0 +1,18 @@
+#ifndef APP_UTIL_PLATFORM_H__
+#define APP_UTIL_PLATFORM_H__
+
+#include "app_util.h"
+
+/**@file
+ *
+ * @brief   Host stand-in for the critical regions of the SDK.
+ *
+ * @details The host has no interrupts: the app_timer handlers only run from
+ *          @ref app_timer_host_run and __WFE(), on the thread that called them. A critical region
+ *          is then a plain block, which keeps the scoping of the real macros.
+ */
+
+#define CRITICAL_REGION_ENTER()     {
+#define CRITICAL_REGION_EXIT()      }
+
+#endif // APP_UTIL_PLATFORM_H__
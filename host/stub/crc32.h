@@ -0,0 +1,16 @@
+#ifndef CRC32_H__
+#define CRC32_H__
+
+#include <stdint.h>
+
+/**@file
+ *
+ * @brief   Host stand-in for the CRC-32 module of the SDK, computing the same values.
+ */
+
+/**@brief   Compute the CRC-32 of @p size bytes, continuing from @p p_crc, or from the start if
+ *          it is NULL.
+ */
+uint32_t crc32_compute(uint8_t const * p_data, uint32_t size, uint32_t const * p_crc);
+
+#endif // CRC32_H__
@@ -0,0 +1,21 @@
+#ifndef NORDIC_COMMON_H__
+#define NORDIC_COMMON_H__
+
+/**@file
+ *
+ * @brief   Host stand-in for the common macros of the SDK.
+ */
+
+#define CONCAT_2(p1, p2)        CONCAT_2_(p1, p2)
+#define CONCAT_2_(p1, p2)       p1##p2
+
+#define MIN(a, b)               ((a) < (b) ? (a) : (b))
+#define MAX(a, b)               ((a) < (b) ? (b) : (a))
+
+#define ARRAY_SIZE(arr)         (sizeof(arr) / sizeof((arr)[0]))
+
+#define UNUSED_VARIABLE(X)      ((void)(X))
+#define UNUSED_PARAMETER(X)     UNUSED_VARIABLE(X)
+#define UNUSED_RETURN_VALUE(X)  UNUSED_VARIABLE(X)
+
+#endif // NORDIC_COMMON_H__
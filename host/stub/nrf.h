@@ -0,0 +1,14 @@
+#ifndef NRF_H
+#define NRF_H
+
+/**@file
+ *
+ * @brief   Host stand-in for the device header. Only __WFE() is provided.
+ */
+
+/**@brief   Wait for an event: run the app_timer up to the next timeout, and its handler.
+ *          Returns at once if no timer is running. Implemented next to the app_timer stand-in.
+ */
+void __WFE(void);
+
+#endif // NRF_H
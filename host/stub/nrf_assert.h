@@ -0,0 +1,13 @@
+#ifndef NRF_ASSERT_H_
+#define NRF_ASSERT_H_
+
+#include <assert.h>
+
+/**@file
+ *
+ * @brief   Host stand-in for the SDK assertions. They stop the run, as with DEBUG set.
+ */
+
+#define ASSERT(expr)    assert(expr)
+
+#endif // NRF_ASSERT_H_
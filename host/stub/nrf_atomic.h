@@ -0,0 +1,38 @@
+#ifndef NRF_ATOMIC_H__
+#define NRF_ATOMIC_H__
+
+#include <stdint.h>
+
+/**@file
+ *
+ * @brief   Host stand-in for the atomic operations of the SDK, for a single thread.
+ */
+
+typedef volatile uint32_t nrf_atomic_u32_t;
+
+
+/**@brief   Add @p value and return the new value. */
+static inline uint32_t nrf_atomic_u32_add(nrf_atomic_u32_t * p_data, uint32_t value)
+{
+    *p_data += value;
+    return *p_data;
+}
+
+
+/**@brief   Subtract @p value and return the new value. */
+static inline uint32_t nrf_atomic_u32_sub(nrf_atomic_u32_t * p_data, uint32_t value)
+{
+    *p_data -= value;
+    return *p_data;
+}
+
+
+/**@brief   Add @p value and return the old value. */
+static inline uint32_t nrf_atomic_u32_fetch_add(nrf_atomic_u32_t * p_data, uint32_t value)
+{
+    uint32_t const old = *p_data;
+    *p_data = old + value;
+    return old;
+}
+
+#endif // NRF_ATOMIC_H__
@@ -0,0 +1,44 @@
+#include "nrf_balloc.h"
+
+#include <string.h>
+#include "nrf_assert.h"
+
+
+ret_code_t nrf_balloc_init(nrf_balloc_t const * p_pool)
+{
+    if (p_pool == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    memset(p_pool->p_used, 0, p_pool->block_cnt * sizeof(p_pool->p_used[0]));
+    return NRF_SUCCESS;
+}
+
+
+void * nrf_balloc_alloc(nrf_balloc_t const * p_pool)
+{
+    for (uint32_t i = 0; i < p_pool->block_cnt; i++)
+    {
+        if (!p_pool->p_used[i])
+        {
+            p_pool->p_used[i] = true;
+            return p_pool->p_memory + i * p_pool->block_size;
+        }
+    }
+
+    return NULL;
+}
+
+
+void nrf_balloc_free(nrf_balloc_t const * p_pool, void * p_element)
+{
+    size_t const offset = (size_t)((uint8_t *)p_element - p_pool->p_memory);
+
+    /* As with DEBUG set in the SDK, freeing a foreign or a free block is caught. */
+    ASSERT((offset % p_pool->block_size) == 0);
+    ASSERT(offset / p_pool->block_size < p_pool->block_cnt);
+    ASSERT(p_pool->p_used[offset / p_pool->block_size]);
+
+    p_pool->p_used[offset / p_pool->block_size] = false;
+}
@@ -0,0 +1,57 @@
+#ifndef NRF_BALLOC_H__
+#define NRF_BALLOC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sdk_errors.h"
+#include "nordic_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @brief   Host stand-in for the block allocator of the SDK.
+ */
+
+/**@brief   A pool of blocks. Define them with @ref NRF_BALLOC_DEF. */
+typedef struct
+{
+    uint8_t  * p_memory;    //!< The blocks, back to back.
+    bool     * p_used;      //!< Whether each block is allocated.
+    size_t     block_size;
+    uint32_t   block_cnt;
+} nrf_balloc_t;
+
+
+/* The blocks are rounded up to, and aligned on, 64 bits, for the pointers they may hold. */
+#define NRF_BALLOC_DEF(_name, _element_size, _pool_size)                                        \
+    static uint64_t CONCAT_2(_name, _memory)[(_pool_size)]                                      \
+                                            [((_element_size) + 7) / sizeof(uint64_t)];         \
+    static bool     CONCAT_2(_name, _used)[(_pool_size)];                                       \
+    static nrf_balloc_t const _name =                                                           \
+    {                                                                                           \
+        .p_memory   = (uint8_t *)CONCAT_2(_name, _memory),                                      \
+        .p_used     = CONCAT_2(_name, _used),                                                   \
+        .block_size = sizeof(CONCAT_2(_name, _memory)[0]),                                      \
+        .block_cnt  = (_pool_size),                                                             \
+    }
+
+
+/**@brief   Free all the blocks of the pool. */
+ret_code_t nrf_balloc_init(nrf_balloc_t const * p_pool);
+
+/**@brief   Allocate a block. Returns NULL if none is left. */
+void * nrf_balloc_alloc(nrf_balloc_t const * p_pool);
+
+/**@brief   Free a block allocated from the pool. */
+void nrf_balloc_free(nrf_balloc_t const * p_pool, void * p_element);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NRF_BALLOC_H__
@@ -0,0 +1,159 @@
+#include "nrf_fstorage.h"
+
+#include <stddef.h>
+
+
+static bool addr_is_aligned32(uintptr_t addr)
+{
+    return !(addr & 0x03);
+}
+
+
+static bool addr_is_page_aligned(nrf_fstorage_t const * p_fs, uint32_t addr)
+{
+    return (addr & (p_fs->p_flash_info->erase_unit - 1)) == 0;
+}
+
+
+static bool addr_is_within_bounds(nrf_fstorage_t const * p_fs, uint32_t addr, uint32_t len)
+{
+    return (   (addr           >= p_fs->start_addr)
+            && (addr + len - 1 <= p_fs->end_addr));
+}
+
+
+ret_code_t nrf_fstorage_init(nrf_fstorage_t * p_fs, nrf_fstorage_api_t * p_api, void * p_param)
+{
+    if ((p_fs == NULL) || (p_api == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    p_fs->p_api = p_api;
+
+    return (p_fs->p_api)->init(p_fs, p_param);
+}
+
+
+ret_code_t nrf_fstorage_uninit(nrf_fstorage_t * p_fs, void * p_param)
+{
+    if (p_fs == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+    if (p_fs->p_api == NULL)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    ret_code_t const rc = (p_fs->p_api)->uninit(p_fs, p_param);
+
+    p_fs->p_api        = NULL;
+    p_fs->p_flash_info = NULL;
+
+    return rc;
+}
+
+
+ret_code_t nrf_fstorage_read(nrf_fstorage_t const * p_fs,
+                             uint32_t               addr,
+                             void                 * p_dest,
+                             uint32_t               len)
+{
+    if ((p_fs == NULL) || (p_dest == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+    if (p_fs->p_api == NULL)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if (len == 0)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    if (!addr_is_aligned32(addr) || !addr_is_within_bounds(p_fs, addr, len))
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    return (p_fs->p_api)->read(p_fs, addr, p_dest, len);
+}
+
+
+ret_code_t nrf_fstorage_write(nrf_fstorage_t const * p_fs,
+                              uint32_t               dest,
+                              void const           * p_src,
+                              uint32_t               len,
+                              void                 * p_param)
+{
+    if ((p_fs == NULL) || (p_src == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+    if (p_fs->p_api == NULL)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if ((len == 0) || ((len % p_fs->p_flash_info->program_unit) != 0))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    if (   !addr_is_aligned32(dest) || !addr_is_aligned32((uintptr_t)p_src)
+        || !addr_is_within_bounds(p_fs, dest, len))
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    return (p_fs->p_api)->write(p_fs, dest, p_src, len, p_param);
+}
+
+
+ret_code_t nrf_fstorage_erase(nrf_fstorage_t const * p_fs,
+                              uint32_t               page_addr,
+                              uint32_t               len,
+                              void                 * p_param)
+{
+    if (p_fs == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+    if (p_fs->p_api == NULL)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if (len == 0)
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    if (   !addr_is_page_aligned(p_fs, page_addr)
+        || !addr_is_within_bounds(p_fs, page_addr, len * p_fs->p_flash_info->erase_unit))
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    return (p_fs->p_api)->erase(p_fs, page_addr, len, p_param);
+}
+
+
+uint8_t const * nrf_fstorage_rmap(nrf_fstorage_t const * p_fs, uint32_t addr)
+{
+    if ((p_fs == NULL) || (p_fs->p_api == NULL))
+    {
+        return NULL;
+    }
+
+    return (p_fs->p_api)->rmap(p_fs, addr);
+}
+
+
+bool nrf_fstorage_is_busy(nrf_fstorage_t const * p_fs)
+{
+    /* An instance without a backend has nothing in progress. */
+    if ((p_fs == NULL) || (p_fs->p_api == NULL))
+    {
+        return false;
+    }
+
+    return (p_fs->p_api)->is_busy(p_fs);
+}
@@ -0,0 +1,110 @@
+#ifndef NRF_FSTORAGE_H__
+#define NRF_FSTORAGE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @brief   Host stand-in for the frontend of nrf_fstorage, with the types and the parameter
+ *          checks of the SDK. There is no backend; attach the instances to the simulated flash.
+ */
+
+typedef enum
+{
+    NRF_FSTORAGE_EVT_READ_RESULT,
+    NRF_FSTORAGE_EVT_WRITE_RESULT,
+    NRF_FSTORAGE_EVT_ERASE_RESULT,
+} nrf_fstorage_evt_id_t;
+
+
+typedef struct
+{
+    nrf_fstorage_evt_id_t   id;         //!< The event ID.
+    ret_code_t              result;     //!< Result of the operation.
+    uint32_t                addr;       //!< Address at which the operation was performed.
+    void const            * p_src;      //!< Buffer written to flash.
+    uint32_t                len;        //!< Length of the operation.
+    void                  * p_param;    //!< User-defined parameter passed to the event handler.
+} nrf_fstorage_evt_t;
+
+
+typedef void (*nrf_fstorage_evt_handler_t)(nrf_fstorage_evt_t * p_evt);
+
+
+typedef struct
+{
+    uint32_t erase_unit;    //!< Size of a flash page, the smallest unit that can be erased.
+    uint32_t program_unit;  //!< Size of the smallest unit that can be programmed.
+    bool     rmap;          //!< The device address space is memory mapped to the MCU.
+    bool     wmap;          //!< The device address space is memory mapped to a writable MCU area.
+} nrf_fstorage_info_t;
+
+
+struct nrf_fstorage_api_s;
+
+typedef struct
+{
+    struct nrf_fstorage_api_s const * p_api;        //!< The backend.
+    nrf_fstorage_info_t             * p_flash_info; //!< Set by the backend on initialization.
+    nrf_fstorage_evt_handler_t        evt_handler;
+    uint32_t                          start_addr;
+    uint32_t                          end_addr;
+} nrf_fstorage_t;
+
+
+typedef struct nrf_fstorage_api_s
+{
+    ret_code_t (*init)(nrf_fstorage_t * p_fs, void * p_param);
+    ret_code_t (*uninit)(nrf_fstorage_t * p_fs, void * p_param);
+    ret_code_t (*read)(nrf_fstorage_t const * p_fs, uint32_t src, void * p_dest, uint32_t len);
+    ret_code_t (*write)(nrf_fstorage_t const * p_fs,
+                        uint32_t               dest,
+                        void const           * p_src,
+                        uint32_t               len,
+                        void                 * p_param);
+    ret_code_t (*erase)(nrf_fstorage_t const * p_fs,
+                        uint32_t               page_addr,
+                        uint32_t               len,
+                        void                 * p_param);
+    uint8_t const * (*rmap)(nrf_fstorage_t const * p_fs, uint32_t addr);
+    uint8_t       * (*wmap)(nrf_fstorage_t const * p_fs, uint32_t addr);
+    bool (*is_busy)(nrf_fstorage_t const * p_fs);
+} nrf_fstorage_api_t;
+
+
+ret_code_t nrf_fstorage_init(nrf_fstorage_t * p_fs, nrf_fstorage_api_t * p_api, void * p_param);
+
+ret_code_t nrf_fstorage_uninit(nrf_fstorage_t * p_fs, void * p_param);
+
+ret_code_t nrf_fstorage_read(nrf_fstorage_t const * p_fs,
+                             uint32_t               addr,
+                             void                 * p_dest,
+                             uint32_t               len);
+
+ret_code_t nrf_fstorage_write(nrf_fstorage_t const * p_fs,
+                              uint32_t               dest,
+                              void const           * p_src,
+                              uint32_t               len,
+                              void                 * p_param);
+
+ret_code_t nrf_fstorage_erase(nrf_fstorage_t const * p_fs,
+                              uint32_t               page_addr,
+                              uint32_t               len,
+                              void                 * p_param);
+
+uint8_t const * nrf_fstorage_rmap(nrf_fstorage_t const * p_fs, uint32_t addr);
+
+bool nrf_fstorage_is_busy(nrf_fstorage_t const * p_fs);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NRF_FSTORAGE_H__
@@ -0,0 +1,34 @@
+#ifndef SDK_ERRORS_H__
+#define SDK_ERRORS_H__
+
+#include <stdint.h>
+
+/**@file
+ *
+ * @brief   Host stand-in for the SDK error codes, with the values of nrf_error.h.
+ */
+
+typedef uint32_t ret_code_t;
+
+#define NRF_SUCCESS                 0
+#define NRF_ERROR_SVC_HANDLER_MISSING 1
+#define NRF_ERROR_SOFTDEVICE_NOT_ENABLED 2
+#define NRF_ERROR_INTERNAL          3
+#define NRF_ERROR_NO_MEM            4
+#define NRF_ERROR_NOT_FOUND         5
+#define NRF_ERROR_NOT_SUPPORTED     6
+#define NRF_ERROR_INVALID_PARAM     7
+#define NRF_ERROR_INVALID_STATE     8
+#define NRF_ERROR_INVALID_LENGTH    9
+#define NRF_ERROR_INVALID_FLAGS     10
+#define NRF_ERROR_INVALID_DATA      11
+#define NRF_ERROR_DATA_SIZE         12
+#define NRF_ERROR_TIMEOUT           13
+#define NRF_ERROR_NULL              14
+#define NRF_ERROR_FORBIDDEN         15
+#define NRF_ERROR_INVALID_ADDR      16
+#define NRF_ERROR_BUSY              17
+#define NRF_ERROR_CONN_COUNT        18
+#define NRF_ERROR_RESOURCES         19
+
+#endif // SDK_ERRORS_H__
@@ -0,0 +1,725 @@
+/**@file
+ *
+ * @brief   Replay of the output of the "trace dump" CLI command through the storage layers, on
+ *          the simulated flash.
+ *
+ * usage: trace_sim [-s seed] [-f one_in] [-c us] [-n loops] [-r pages] [dump.txt]
+ *
+ * Reads the dump from the file, or from standard input, and replays what the application asked
+ * for at the times it was traced: each WRITE goes through flash_write(), with the write cache and
+ * the journal as in main.c, and each RECORD_DATA through record_store_write(), with data of the
+ * traced length. Everything else, submissions, erases and garbage collection included, is left to
+ * the flash queue and the record store, so the figures are those of this tree rather than of the
+ * firmware that was traced. Reads do not reach the flash and are not replayed.
+ *
+ * The simulated flash has FLASH_SIM_PAGES pages. The record store gets the first ones, half of
+ * them unless -r gives another count; the words of the WRITE events land in the others, at their
+ * traced address modulo the size of that area. A word written again without an erase counts as
+ * an overwrite, as the flash would take it.
+ *
+ * Options:
+ * - -s seed    seed of the faults and of the cuts, 1 by default, so that a run can be repeated;
+ * - -f one_in  make one flash operation in one_in fail with NRF_ERROR_TIMEOUT;
+ * - -c us      cut the power after the flash has been busy for a random time of up to us
+ *              microseconds, and again after each restart. On a restart, the layers are
+ *              initialized again as on a reset, and every record whose write was reported must
+ *              read back with the data of that write or of a later one;
+ * - -n loops   replay the trace that many times, one after the other.
+ *
+ * Prints the counters of the simulated flash and the wear of each page, and exits with a failure
+ * if a reported record was lost or read back corrupt.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sdk_config.h"
+#include "nordic_common.h"
+#include "app_timer.h"
+#include "nrf_fstorage.h"
+#include "flash_layout.h"
+#include "flash_sim.h"
+#include "flash_queue.h"
+#include "flash_buf.h"
+#include "flash_cache.h"
+#include "flash_journal.h"
+#include "flash_trace.h"
+#include "record_store.h"
+
+
+#define WRITE_TIMEOUT_MS    500     /* Longest time flash_write() waits for the queue, as in main.c. */
+#define RECORD_RETRY_MS     5000    /* Longest time a record waits for garbage collection. */
+#define DRAIN_MS            60000   /* Longest time the flash gets to settle after the replay. */
+#define PENDING_MAX         256     /* Records queued and not reported yet. */
+#define ERRORS_PRINTED      8       /* Failed checks printed, before they are only counted. */
+#define PAGES_PER_LINE      8
+
+#define TRACE_CNT_MASK      0x00FFFFFF  /* Width of the app_timer counter in the timestamps. */
+#define TRACE_HZ_DEFAULT    32768
+
+STATIC_ASSERT(FLASH_SIM_PAGE_SIZE == FLASH_LAYOUT_PAGE_SIZE);
+
+
+/**@brief   An entry of the trace, with its time in ticks of the trace since the first one. */
+typedef struct
+{
+    uint64_t            ticks;
+    flash_trace_entry_t entry;
+} replay_entry_t;
+
+
+/**@brief   A record queued in the store, waiting for its event. */
+typedef struct
+{
+    uint16_t key;
+    uint32_t serial;
+} pending_t;
+
+
+/**@brief   Counters of the replay. */
+typedef struct
+{
+    uint32_t entries;           //!< Entries of the trace.
+    uint32_t lost;              //!< Entries missing from the trace, from the gaps in the sequence.
+    uint32_t words;             //!< Words handed to flash_write().
+    uint32_t words_failed;      //!< Words flash_write() gave up on.
+    uint32_t records;           //!< Records queued.
+    uint32_t record_bytes;      //!< Bytes of the records queued.
+    uint32_t records_skipped;   //!< Records the store refused, for their key or their length.
+    uint32_t records_dropped;   //!< Records that found no room in time.
+    uint32_t records_failed;    //!< Records reported as failed.
+    uint32_t restarts;
+    uint32_t checks;            //!< Keys read back.
+    uint32_t check_lost;        //!< Keys reported as written that could not be read back.
+    uint32_t check_corrupt;     //!< Keys read back with data no write had.
+} replay_stat_t;
+
+
+static void fs_evt_handler(nrf_fstorage_evt_t * p_evt);
+
+
+static nrf_fstorage_t m_sim_fs =        //!< Covers the whole simulated flash.
+{
+    .evt_handler = fs_evt_handler,
+};
+static nrf_fstorage_t m_store_fs =      //!< The area of the record store.
+{
+    .evt_handler = fs_evt_handler,
+};
+static nrf_fstorage_t m_raw_fs =        //!< The area of the words written with flash_write().
+{
+    .evt_handler = fs_evt_handler,
+};
+
+static replay_entry_t * mp_entries;
+static uint32_t         m_entry_cnt;
+static uint32_t         m_trace_hz = TRACE_HZ_DEFAULT;
+
+static uint32_t         m_cut_us;
+static uint32_t         m_rand;         //!< Generator of the cut times.
+
+static uint32_t         m_serial;       //!< Serial of the last record queued.
+static uint32_t         m_acked[RECORD_STORE_KEY_MAX + 1];  //!< Serial of the last record reported.
+static pending_t        m_pending[PENDING_MAX];
+static uint32_t         m_pending_first;
+static uint32_t         m_pending_cnt;
+
+static uint8_t          m_data[FLASH_LAYOUT_PAGE_SIZE];     //!< Record being written.
+static uint8_t          m_read[FLASH_LAYOUT_PAGE_SIZE];     //!< Record read back on a restart.
+static replay_stat_t    m_stat;
+
+
+static void fs_evt_handler(nrf_fstorage_evt_t * p_evt)
+{
+    flash_queue_on_fstorage_evt(p_evt);
+}
+
+
+static void write_evt_handler(flash_queue_evt_t const * p_evt)
+{
+    if (p_evt->result != NRF_SUCCESS)
+    {
+        m_stat.words_failed += p_evt->cnt;
+    }
+}
+
+
+/**@brief   Match the result of a record with the oldest queued. The store reports records in the
+ *          order they were queued. */
+static void record_store_evt_handler(record_store_evt_t const * p_evt)
+{
+    if ((p_evt->id != RECORD_STORE_EVT_WRITE) || (m_pending_cnt == 0))
+    {
+        return;
+    }
+
+    pending_t const pending = m_pending[m_pending_first];
+
+    m_pending_first = (m_pending_first + 1) % PENDING_MAX;
+    m_pending_cnt--;
+
+    if (pending.key != p_evt->key)
+    {
+        fprintf(stderr, "record 0x%04x reported in place of 0x%04x\n", p_evt->key, pending.key);
+        m_stat.check_corrupt++;
+    }
+    else if (p_evt->result == NRF_SUCCESS)
+    {
+        m_acked[pending.key] = pending.serial;
+    }
+    else
+    {
+        m_stat.records_failed++;
+    }
+}
+
+
+static uint32_t rand_next(void)
+{
+    /* xorshift32 */
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 17;
+    m_rand ^= m_rand << 5;
+    return m_rand;
+}
+
+
+/**@brief   Fill the data of a record: its serial, then bytes that depend on the key only, which
+ *          compress about as well as the values of a configuration do. */
+static void record_fill(uint16_t key, uint32_t serial, uint16_t len)
+{
+    for (uint32_t i = 0; i < len; i++)
+    {
+        m_data[i] = (i < sizeof(serial)) ? (uint8_t)(serial >> (8 * i)) : (uint8_t)(key ^ (i >> 3));
+    }
+}
+
+
+/**@brief   Arm the next power cut, if cuts were asked for. */
+static void cut_arm(void)
+{
+    if (m_cut_us != 0)
+    {
+        (void) flash_sim_cut(1 + rand_next() % m_cut_us);
+    }
+}
+
+
+/**@brief   Initialize the storage layers, in the order main() does. */
+static ret_code_t layers_init(void)
+{
+    ret_code_t rc = flash_queue_init();
+
+    if (rc == NRF_SUCCESS)
+    {
+        rc = flash_cache_init();
+    }
+    if (rc == NRF_SUCCESS)
+    {
+        rc = flash_journal_init(&m_raw_fs, write_evt_handler);
+    }
+    if (rc == NRF_SUCCESS)
+    {
+        rc = flash_journal_flush(WRITE_TIMEOUT_MS);
+    }
+    if (rc == NRF_SUCCESS)
+    {
+        rc = flash_buf_init();
+    }
+    if (rc == NRF_SUCCESS)
+    {
+        rc = record_store_init(&m_store_fs, record_store_evt_handler);
+    }
+
+    return rc;
+}
+
+
+/**@brief   Read back every record reported as written, and count those that are missing or do
+ *          not hold the data of that write or of a later one. */
+static void records_check(void)
+{
+    for (uint32_t key = RECORD_STORE_KEY_MIN; key <= RECORD_STORE_KEY_MAX; key++)
+    {
+        if (m_acked[key] == 0)
+        {
+            continue;
+        }
+
+        uint32_t   serial = 0;
+        uint16_t   len    = sizeof(m_read);
+        ret_code_t rc     = record_store_read((uint16_t)key, m_read, &len);
+        bool       ok     = (rc == NRF_SUCCESS);
+
+        m_stat.checks++;
+
+        memcpy(&serial, m_read, MIN(len, sizeof(serial)));
+        if (ok && (len >= sizeof(serial)))
+        {
+            ok = (serial >= m_acked[key]) && (serial <= m_serial);
+        }
+        for (uint32_t i = sizeof(serial); ok && (i < len); i++)
+        {
+            ok = (m_read[i] == (uint8_t)(key ^ (i >> 3)));
+        }
+
+        if (!ok)
+        {
+            uint32_t const errors = m_stat.check_lost + m_stat.check_corrupt;
+
+            if ((errors < ERRORS_PRINTED) && (rc == NRF_SUCCESS))
+            {
+                fprintf(stderr, "record 0x%04x, written with serial %u: read with serial %u\n",
+                        (unsigned)key, (unsigned)m_acked[key], (unsigned)serial);
+            }
+            else if (errors < ERRORS_PRINTED)
+            {
+                fprintf(stderr, "record 0x%04x, written with serial %u: read failed: %u\n",
+                        (unsigned)key, (unsigned)m_acked[key], (unsigned)rc);
+            }
+            if (rc == NRF_SUCCESS)
+            {
+                m_stat.check_corrupt++;
+            }
+            else
+            {
+                m_stat.check_lost++;
+            }
+
+            /* Count each loss once. */
+            m_acked[key] = 0;
+        }
+    }
+}
+
+
+/**@brief   Restart after a power cut. The RAM state of every layer is lost, as on a reset; only
+ *          the flash and what this replay knows were reported remain. */
+static void restart(void)
+{
+    /* The simulated flash has failed the operations it held by the time it reports the cut. */
+    app_timer_host_stop_all();
+    flash_sim_restore();
+
+    m_pending_first = 0;
+    m_pending_cnt   = 0;
+    m_stat.restarts++;
+
+    ret_code_t const rc = layers_init();
+    if (rc != NRF_SUCCESS)
+    {
+        fprintf(stderr, "restart %u: initialization failed: %u\n",
+                (unsigned)m_stat.restarts, (unsigned)rc);
+        exit(EXIT_FAILURE);
+    }
+
+    records_check();
+    cut_arm();
+}
+
+
+/**@brief   Run one pass of the main loop of the application: hand the journal over and collect
+ *          garbage or, with nothing to do, sleep until the next timeout, but not past @p until.
+ *
+ * @return  Whether there was anything to do, or a timeout before @p until.
+ */
+static bool step(uint64_t until)
+{
+    bool busy = flash_journal_process() || record_store_gc_step();
+
+    if (!busy)
+    {
+        uint64_t const now = app_timer_host_now();
+        uint32_t       ticks;
+
+        busy = app_timer_host_next(&ticks) && (now + ticks <= until);
+        if (!busy)
+        {
+            ticks = (until > now) ? (uint32_t)MIN(until - now, UINT32_MAX) : 0;
+        }
+        app_timer_host_run(ticks);
+    }
+
+    if (flash_sim_is_off())
+    {
+        restart();
+        busy = true;
+    }
+
+    return busy;
+}
+
+
+static uint64_t ticks_after_ms(uint32_t ms)
+{
+    return app_timer_host_now() + APP_TIMER_TICKS(ms);
+}
+
+
+/**@brief   Write a word through the write cache, like flash_write() in main.c. While the cache is
+ *          full, aligned words go to the journal, and only wait for the queue if it is full too. */
+static void flash_write(uint32_t addr, uint32_t data)
+{
+    uint32_t const size = m_raw_fs.end_addr + 1 - m_raw_fs.start_addr;
+    uint32_t       dest = addr % size;
+    ret_code_t     rc;
+
+    /* Keep an unaligned word from running past the end of the area. */
+    if (dest > size - sizeof(data))
+    {
+        dest -= sizeof(data);
+    }
+    dest += m_raw_fs.start_addr;
+
+    m_stat.words++;
+
+    rc = flash_cache_write(&m_raw_fs, dest, &data, sizeof(data), write_evt_handler, NULL);
+    if ((rc == NRF_ERROR_NO_MEM) && (flash_journal_write(dest, &data, sizeof(data)) == NRF_SUCCESS))
+    {
+        rc = NRF_SUCCESS;
+    }
+    if (rc == NRF_ERROR_NO_MEM)
+    {
+        rc = flash_queue_space_wait(1, sizeof(uint32_t), WRITE_TIMEOUT_MS);
+        if (rc == NRF_SUCCESS)
+        {
+            rc = flash_cache_write(&m_raw_fs, dest, &data, sizeof(data), write_evt_handler, NULL);
+        }
+    }
+    if (rc != NRF_SUCCESS)
+    {
+        m_stat.words_failed++;
+    }
+}
+
+
+/**@brief   Queue a record of @p len bytes, taking garbage collection steps while the store is
+ *          full, as the CLI does. */
+static void record_write(uint32_t key, uint32_t len)
+{
+    if (   (key < RECORD_STORE_KEY_MIN) || (key > RECORD_STORE_KEY_MAX)
+        || (len == 0) || (len > sizeof(m_data)))
+    {
+        m_stat.records_skipped++;
+        return;
+    }
+
+    uint64_t const until = ticks_after_ms(RECORD_RETRY_MS);
+    ret_code_t     rc;
+
+    m_stat.records++;
+    m_stat.record_bytes += len;
+    record_fill((uint16_t)key, ++m_serial, (uint16_t)len);
+
+    do
+    {
+        if (m_pending_cnt == PENDING_MAX)
+        {
+            fprintf(stderr, "more than %u records queued\n", PENDING_MAX);
+            exit(EXIT_FAILURE);
+        }
+
+        /* Noted first, in case the result comes before the call returns. */
+        m_pending[(m_pending_first + m_pending_cnt) % PENDING_MAX] =
+            (pending_t){ .key = (uint16_t)key, .serial = m_serial };
+        m_pending_cnt++;
+
+        rc = record_store_write((uint16_t)key, m_data, (uint16_t)len);
+        if (rc != NRF_SUCCESS)
+        {
+            m_pending_cnt--;
+        }
+    } while ((rc == NRF_ERROR_NO_MEM) && step(until));
+
+    if (rc == NRF_ERROR_NO_MEM)
+    {
+        m_stat.records_dropped++;
+    }
+    else if (rc != NRF_SUCCESS)
+    {
+        m_stat.records_skipped++;
+    }
+}
+
+
+/**@brief   Let the layers hand everything over and the flash complete it, and garbage collection
+ *          catch up. */
+static void drain(void)
+{
+    uint64_t const until = ticks_after_ms(DRAIN_MS);
+
+    do
+    {
+        (void) flash_cache_sync();
+    } while (   (   flash_journal_is_busy() || flash_cache_is_busy() || flash_queue_is_busy()
+                 || nrf_fstorage_is_busy(&m_sim_fs) || (m_pending_cnt != 0))
+             && step(until));
+
+    while (step(app_timer_host_now()))
+    {
+    }
+}
+
+
+/**@brief   Parse a line of four words of eight hexadecimal digits. */
+static bool entry_parse(char const * p_line, flash_trace_entry_t * p_entry)
+{
+    uint32_t words[4];
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(words); i++)
+    {
+        p_line += strspn(p_line, " \t");
+        if (strspn(p_line, "0123456789abcdefABCDEF") != 8)
+        {
+            return false;
+        }
+        words[i] = (uint32_t)strtoul(p_line, NULL, 16);
+        p_line  += 8;
+    }
+    if (p_line[strspn(p_line, " \t\r\n")] != '\0')
+    {
+        return false;
+    }
+
+    p_entry->seq    = words[0];
+    p_entry->stamp  = words[1];
+    p_entry->arg[0] = words[2];
+    p_entry->arg[1] = words[3];
+    return true;
+}
+
+
+/**@brief   Read the entries of a dump, and their time from the counter in their timestamps. */
+static void trace_load(FILE * p_src)
+{
+    char     line[256];
+    uint32_t cap      = 0;
+    uint64_t ticks    = 0;
+    uint32_t prev_cnt = 0;
+    uint32_t next_seq = 0;
+
+    while (fgets(line, sizeof(line), p_src) != NULL)
+    {
+        flash_trace_entry_t entry;
+        unsigned            hz;
+
+        if (sscanf(line, " # flash_trace %u Hz", &hz) == 1)
+        {
+            m_trace_hz = hz;
+            continue;
+        }
+        if (!entry_parse(line, &entry))
+        {
+            continue;
+        }
+
+        /* The counter wraps around; entries are in order, so each step is taken forward. */
+        uint32_t const cnt = entry.stamp >> 8;
+        if (m_entry_cnt != 0)
+        {
+            ticks          += (cnt - prev_cnt) & TRACE_CNT_MASK;
+            m_stat.lost += entry.seq - next_seq;
+        }
+        prev_cnt = cnt;
+        next_seq = entry.seq + 1;
+
+        if (m_entry_cnt == cap)
+        {
+            cap        = MAX(2 * cap, 256);
+            mp_entries = realloc(mp_entries, cap * sizeof(mp_entries[0]));
+            if (mp_entries == NULL)
+            {
+                fprintf(stderr, "out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        mp_entries[m_entry_cnt++] = (replay_entry_t){ .ticks = ticks, .entry = entry };
+    }
+
+    m_stat.entries = m_entry_cnt;
+}
+
+
+/**@brief   Replay the trace once, from the current time. */
+static void trace_replay(void)
+{
+    uint64_t const start = app_timer_host_now();
+
+    for (uint32_t i = 0; i < m_entry_cnt; i++)
+    {
+        flash_trace_entry_t const * const p_entry = &mp_entries[i].entry;
+
+        /* Convert to ticks of the host counter, which runs at the frequency of this board. */
+        uint64_t const at = start + (mp_entries[i].ticks * APP_TIMER_TICKS(1000)) / m_trace_hz;
+
+        while (app_timer_host_now() < at)
+        {
+            (void) step(at);
+        }
+
+        switch (p_entry->stamp & 0xFF)
+        {
+            case FLASH_TRACE_WRITE:
+                flash_write(p_entry->arg[0], p_entry->arg[1]);
+                break;
+
+            case FLASH_TRACE_RECORD_DATA:
+                record_write(p_entry->arg[0], p_entry->arg[1]);
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+
+static void report(void)
+{
+    flash_sim_stat_t sim;
+    uint32_t const   app_bytes = m_stat.words * sizeof(uint32_t) + m_stat.record_bytes;
+
+    (void) flash_sim_stat_get(&sim);
+
+    printf("trace: %u entries over %.3f s, %u lost\n", (unsigned)m_stat.entries,
+           m_entry_cnt ? (double)mp_entries[m_entry_cnt - 1].ticks / m_trace_hz : 0.0,
+           (unsigned)m_stat.lost);
+    printf("application: %u words, %u failed; %u records of %u bytes, "
+           "%u skipped, %u dropped, %u failed\n",
+           (unsigned)m_stat.words, (unsigned)m_stat.words_failed, (unsigned)m_stat.records,
+           (unsigned)m_stat.record_bytes, (unsigned)m_stat.records_skipped,
+           (unsigned)m_stat.records_dropped, (unsigned)m_stat.records_failed);
+    printf("flash: %u bytes in %u writes, %u pages erased, %u overwrites, %u timeouts, "
+           "%u cuts, busy %.3f s of %.3f s\n",
+           (unsigned)sim.bytes, (unsigned)sim.writes, (unsigned)sim.erases,
+           (unsigned)sim.overwrites, (unsigned)sim.timeouts, (unsigned)sim.cuts,
+           sim.busy_us / 1e6, (double)app_timer_host_now() / APP_TIMER_TICKS(1000));
+    if (app_bytes != 0)
+    {
+        printf("write amplification: %.2f (%.2f with the erased bytes)\n",
+               (double)sim.bytes / app_bytes,
+               (sim.bytes + (double)sim.erases * FLASH_SIM_PAGE_SIZE) / app_bytes);
+    }
+    printf("erases per page: %u min, %.2f mean, %u max, over %u pages\n",
+           (unsigned)sim.wear_min, (double)sim.wear_total / FLASH_SIM_PAGES,
+           (unsigned)sim.wear_max, FLASH_SIM_PAGES);
+    for (uint32_t page = 0; page < FLASH_SIM_PAGES; page++)
+    {
+        printf("%s%05x:%u", (page % PAGES_PER_LINE) ? " " : "  ",
+               (unsigned)(page * FLASH_SIM_PAGE_SIZE), (unsigned)flash_sim_wear_get(page));
+        if (((page + 1) % PAGES_PER_LINE == 0) || (page + 1 == FLASH_SIM_PAGES))
+        {
+            printf("\n");
+        }
+    }
+    printf("check: %u restarts, %u records read back, %u lost, %u corrupt\n",
+           (unsigned)m_stat.restarts, (unsigned)m_stat.checks, (unsigned)m_stat.check_lost,
+           (unsigned)m_stat.check_corrupt);
+}
+
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: trace_sim [-s seed] [-f one_in] [-c us] [-n loops] [-r pages] [dump.txt]\n");
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char ** argv)
+{
+    uint32_t seed        = 1;
+    uint32_t fault       = 0;
+    uint32_t loops       = 1;
+    uint32_t store_pages = FLASH_SIM_PAGES / 2;
+    FILE   * p_src       = stdin;
+    int      opt;
+
+    while ((opt = getopt(argc, argv, "s:f:c:n:r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': seed        = strtoul(optarg, NULL, 0); break;
+            case 'f': fault       = strtoul(optarg, NULL, 0); break;
+            case 'c': m_cut_us    = strtoul(optarg, NULL, 0); break;
+            case 'n': loops       = strtoul(optarg, NULL, 0); break;
+            case 'r': store_pages = strtoul(optarg, NULL, 0); break;
+            default:  usage();
+        }
+    }
+    if ((optind < argc - 1) || (seed == 0) || (store_pages >= FLASH_SIM_PAGES))
+    {
+        usage();
+    }
+    if ((optind == argc - 1) && ((p_src = fopen(argv[optind], "r")) == NULL))
+    {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    trace_load(p_src);
+    if (m_entry_cnt == 0)
+    {
+        fprintf(stderr, "no trace entries found\n");
+        return EXIT_FAILURE;
+    }
+
+    /* All instances share the backend of the simulated flash, as partitions do. */
+    nrf_fstorage_api_t * p_api;
+    ret_code_t           rc = app_timer_init();
+
+    if (rc == NRF_SUCCESS)
+    {
+        rc = flash_sim_attach(&m_sim_fs);
+    }
+    p_api = (nrf_fstorage_api_t *)m_sim_fs.p_api;
+
+    m_store_fs.start_addr = 0;
+    m_store_fs.end_addr   = store_pages * FLASH_SIM_PAGE_SIZE - 1;
+    m_raw_fs.start_addr   = store_pages * FLASH_SIM_PAGE_SIZE;
+    m_raw_fs.end_addr     = m_sim_fs.end_addr;
+
+    if (rc == NRF_SUCCESS)
+    {
+        rc = nrf_fstorage_init(&m_store_fs, p_api, NULL);
+    }
+    if (rc == NRF_SUCCESS)
+    {
+        rc = nrf_fstorage_init(&m_raw_fs, p_api, NULL);
+    }
+    if (rc == NRF_SUCCESS)
+    {
+        rc = layers_init();
+    }
+    if (rc != NRF_SUCCESS)
+    {
+        fprintf(stderr, "initialization failed: %u\n", (unsigned)rc);
+        return EXIT_FAILURE;
+    }
+
+    m_rand = seed;
+    flash_sim_fault_set(fault, seed);
+    cut_arm();
+
+    for (uint32_t loop = 0; loop < loops; loop++)
+    {
+        trace_replay();
+    }
+
+    /* Stop cutting and faulting so that the last check sees the flash settled. */
+    flash_sim_fault_set(0, 0);
+    m_cut_us = 0;
+    if (flash_sim_is_off())
+    {
+        restart();
+    }
+    flash_sim_restore();
+    drain();
+    records_check();
+
+    report();
+
+    return ((m_stat.check_lost + m_stat.check_corrupt) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
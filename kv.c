@@ -0,0 +1,128 @@
+#include "kv.h"
+
+#include <string.h>
+
+#include "record_store.h"
+
+
+ret_code_t kv_put_u32(uint16_t key, uint32_t value)
+{
+    return record_store_write_u32(key, value);
+}
+
+
+ret_code_t kv_get_u32(uint16_t key, uint32_t * p_value)
+{
+    return record_store_read_u32(key, p_value);
+}
+
+
+ret_code_t kv_put_i32(uint16_t key, int32_t value)
+{
+    return record_store_write_u32(key, (uint32_t)value);
+}
+
+
+ret_code_t kv_get_i32(uint16_t key, int32_t * p_value)
+{
+    return record_store_read_u32(key, (uint32_t *)p_value);
+}
+
+
+ret_code_t kv_put_bool(uint16_t key, bool value)
+{
+    return record_store_write_u32(key, value ? 1 : 0);
+}
+
+
+ret_code_t kv_get_bool(uint16_t key, bool * p_value)
+{
+    if (p_value == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    uint32_t         value;
+    ret_code_t const rc = record_store_read_u32(key, &value);
+
+    if (rc == NRF_SUCCESS)
+    {
+        *p_value = (value != 0);
+    }
+    return rc;
+}
+
+
+ret_code_t kv_put_blob(uint16_t key, void const * p_data, uint16_t len)
+{
+    return record_store_write(key, p_data, len);
+}
+
+
+ret_code_t kv_get_blob(uint16_t key, void * p_dest, uint16_t * p_len)
+{
+    if ((p_dest == NULL) || (p_len == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    uint16_t const size = *p_len;
+    ret_code_t     rc   = record_store_read(key, p_dest, p_len);
+
+    if ((rc == NRF_SUCCESS) && (*p_len > size))
+    {
+        rc = NRF_ERROR_DATA_SIZE;
+    }
+    return rc;
+}
+
+
+ret_code_t kv_put_str(uint16_t key, char const * p_str)
+{
+    if (p_str == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    size_t const len = strlen(p_str);
+
+    return (len <= UINT16_MAX) ? record_store_write(key, p_str, (uint16_t)len)
+                               : NRF_ERROR_INVALID_LENGTH;
+}
+
+
+ret_code_t kv_get_str(uint16_t key, char * p_str, uint16_t size)
+{
+    if (p_str == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+    if (size == 0)
+    {
+        return NRF_ERROR_DATA_SIZE;
+    }
+
+    uint16_t         len = size - 1;
+    ret_code_t const rc  = record_store_read(key, p_str, &len);
+
+    if (rc != NRF_SUCCESS)
+    {
+        p_str[0] = '\0';
+        return rc;
+    }
+    if (len > size - 1)
+    {
+        /* Only the beginning was read. */
+        p_str[size - 1] = '\0';
+        return NRF_ERROR_DATA_SIZE;
+    }
+
+    p_str[len] = '\0';
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t kv_delete(uint16_t key)
+{
+    return record_store_delete(key);
+}
@@ -0,0 +1,113 @@
+#ifndef KV_H__
+#define KV_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup kv Typed key-value API
+ * @{
+ *
+ * @brief   Typed values on top of the record store.
+ *
+ * @details Scalars, i.e. 32-bit integers and booleans, are stored as scalar records of the
+ *          record store (see @ref record_store_write_u32): eight bytes of flash each, read from
+ *          the index without parsing a header. Blobs and strings are stored as ordinary records,
+ *          and may be compressed. Strings are stored without their terminating NUL.
+ *
+ *          Records do not carry their type: reading a key as another type than it was written
+ *          with succeeds if the lengths match, e.g. a u32 read as a four-byte blob.
+ *
+ *          Writes return as soon as the record is queued; @ref RECORD_STORE_EVT_WRITE reports
+ *          the result. The errors are those of @ref record_store_write and
+ *          @ref record_store_read.
+ */
+
+
+/**@brief   Function for writing an unsigned 32-bit integer. */
+ret_code_t kv_put_u32(uint16_t key, uint32_t value);
+
+
+/**@brief   Function for reading an unsigned 32-bit integer.
+ *
+ * @retval  NRF_ERROR_INVALID_LENGTH    If the record does not hold four bytes.
+ */
+ret_code_t kv_get_u32(uint16_t key, uint32_t * p_value);
+
+
+/**@brief   Function for writing a signed 32-bit integer. */
+ret_code_t kv_put_i32(uint16_t key, int32_t value);
+
+
+/**@brief   Function for reading a signed 32-bit integer.
+ *
+ * @retval  NRF_ERROR_INVALID_LENGTH    If the record does not hold four bytes.
+ */
+ret_code_t kv_get_i32(uint16_t key, int32_t * p_value);
+
+
+/**@brief   Function for writing a boolean. */
+ret_code_t kv_put_bool(uint16_t key, bool value);
+
+
+/**@brief   Function for reading a boolean. Any value other than zero reads as true.
+ *
+ * @retval  NRF_ERROR_INVALID_LENGTH    If the record does not hold four bytes.
+ */
+ret_code_t kv_get_bool(uint16_t key, bool * p_value);
+
+
+/**@brief   Function for writing a blob.
+ *
+ * @param[in]   p_data  Data of the blob. Copied before the function returns.
+ * @param[in]   len     Length of the blob, in bytes. Must not be zero.
+ */
+ret_code_t kv_put_blob(uint16_t key, void const * p_data, uint16_t len);
+
+
+/**@brief   Function for reading a blob.
+ *
+ * @param[out]      p_dest  Buffer to read the blob into.
+ * @param[in,out]   p_len   In: size of @p p_dest. Out: length of the blob.
+ *
+ * @retval  NRF_ERROR_DATA_SIZE If the blob is larger than the buffer. The buffer holds its
+ *                              beginning.
+ */
+ret_code_t kv_get_blob(uint16_t key, void * p_dest, uint16_t * p_len);
+
+
+/**@brief   Function for writing a string.
+ *
+ * @param[in]   p_str   The string. Must not be empty.
+ */
+ret_code_t kv_put_str(uint16_t key, char const * p_str);
+
+
+/**@brief   Function for reading a string.
+ *
+ * @param[out]  p_str   Buffer to read the string into. It is always NUL-terminated.
+ * @param[in]   size    Size of @p p_str, in bytes, the NUL included.
+ *
+ * @retval  NRF_ERROR_DATA_SIZE If the string is longer than the buffer. The buffer holds its
+ *                              beginning.
+ */
+ret_code_t kv_get_str(uint16_t key, char * p_str, uint16_t size);
+
+
+/**@brief   Function for deleting a key, whatever its type. */
+ret_code_t kv_delete(uint16_t key);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KV_H__
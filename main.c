@@ -9,16 +9,30 @@
 #include "app_timer.h"
 #include "app_util.h"
 #include "nrf_fstorage.h"
+#include "flash_queue.h"
+#include "flash_cache.h"
+#include "flash_chunk.h"
+#include "flash_journal.h"
+#include "flash_layout.h"
+#include "flash_part.h"
+#include "flash_power.h"
+#include "flash_submit.h"
+#include "flash_trace.h"
+#include "kv.h"
+#include "record_store.h"
 
 #ifdef SOFTDEVICE_PRESENT
 #include "nrf_sdh.h"
 #include "nrf_sdh_ble.h"
 #include "nrf_fstorage_sd.h"
+#include "ble_advdata.h"
+#include "ble_xfer.h"
 #else
 #include "nrf_drv_clock.h"
 #include "nrf_fstorage_nvmc.h"
 #endif
 
+#include "nrf_strerror.h"
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
@@ -26,6 +40,16 @@
 
 #define BUTTON_DETECTION_DELAY  APP_TIMER_TICKS(50)
 #define APP_BLE_CONN_CFG_TAG    1
+#define APP_BLE_OBSERVER_PRIO   3
+#define DEVICE_NAME             "fstorage"
+#define APP_ADV_INTERVAL        MSEC_TO_UNITS(100, UNIT_0_625_MS)
+#define MIN_CONN_INTERVAL       MSEC_TO_UNITS(7.5, UNIT_1_25_MS)
+#define MAX_CONN_INTERVAL       MSEC_TO_UNITS(15, UNIT_1_25_MS)    /* At most the event length, so that whole intervals carry data. */
+#define SLAVE_LATENCY           0
+#define CONN_SUP_TIMEOUT        MSEC_TO_UNITS(4000, UNIT_10_MS)
+#define FLASH_WRITE_TIMEOUT_MS  500     /* Longest time flash_write() waits for the queue to drain. */
+#define SEC_MIN_KEY_SIZE        7
+#define SEC_MAX_KEY_SIZE        16
 
 
 /* Defined in cli.c */
@@ -44,21 +68,25 @@ NRF_FSTORAGE_DEF(nrf_fstorage_t fstorage) =
     .evt_handler = fstorage_evt_handler,
 
     /* These below are the boundaries of the flash space assigned to this instance of fstorage.
-     * You must set these manually, even at runtime, before nrf_fstorage_init() is called.
-     * The function nrf5_flash_end_addr_get() can be used to retrieve the last address on the
-     * last page of flash available to write data. */
-    .start_addr = 0x3e000,
-    .end_addr   = 0x410FD,
+     * They come from the partitions set for the target in sdk_config.h; the whole area is
+     * checked against the end of the image and nrf5_flash_end_addr_get() at startup.
+     *
+     * The record store has its own instance, on the config partition. This one is the raw view
+     * of the CLI, the benchmark and the transfer services: the dump partition, unless the
+     * flasharea command moves it to the log. */
+    .start_addr = FLASH_PART_START_ADDR(FLASH_PART_DUMP_FIRST),
+    .end_addr   = FLASH_PART_LAST_ADDR(FLASH_PART_DUMP_FIRST, FLASH_PART_DUMP_PAGES),
 };
 
-/* Dummy data to write to flash. */
-static uint32_t m_data          = 0x00;
-static char     m_hello_world[] = "hello world";
-static uint32_t m_data2          = 0xBADC0FFE;
+STATIC_ASSERT(FLASH_PART_CONFIG_PAGES <= RECORD_STORE_MAX_PAGES + RECORD_STORE_CHECKPOINT_ENABLED);
+
+/* Set by the flash queue when it completes an operation, while wait_for_flash_ready() sleeps. */
+static flash_power_future_t m_flash_done;
 
-#define F_ADDR1 0x3e000
-#define F_ADDR2 0x3e100
-#define F_ADDR3 0x3f000
+/* Keys of the demo records. */
+#define RECORD_KEY_BSON_1   0x0001
+#define RECORD_KEY_BSON_2   0x0002
+#define RECORD_KEY_BSON_3   0x0003
 
 
 /**@brief   Helper function to obtain the last address on the last page of the on-chip flash that
@@ -76,6 +104,164 @@ static uint32_t nrf5_flash_end_addr_get()
 
 
 #ifdef SOFTDEVICE_PRESENT
+static uint8_t m_adv_handle = BLE_GAP_ADV_SET_HANDLE_NOT_SET;
+static uint8_t m_adv_data[BLE_GAP_ADV_SET_DATA_SIZE_MAX];
+static uint8_t m_sr_data[BLE_GAP_ADV_SET_DATA_SIZE_MAX];
+static bool volatile m_advertising;
+static bool          m_advertising_off;  /* Advertising was stopped with advertising_set(). */
+
+
+static void advertising_start(void)
+{
+    ret_code_t rc = sd_ble_gap_adv_start(m_adv_handle, APP_BLE_CONN_CFG_TAG);
+    APP_ERROR_CHECK(rc);
+
+    m_advertising = true;
+}
+
+
+/**@brief   Function for stopping or resuming advertising, e.g. to measure flash operations with
+ *          and without radio activity. Advertising resumes by itself after a link is lost only
+ *          if it was not stopped.
+ *
+ * @return  Whether advertising was running.
+ */
+bool advertising_set(bool enable)
+{
+    bool const was_on = m_advertising;
+
+    m_advertising_off = !enable;
+
+    if (enable && !m_advertising)
+    {
+        /* Fails while a link is up, as a single link is supported. */
+        m_advertising = (sd_ble_gap_adv_start(m_adv_handle, APP_BLE_CONN_CFG_TAG) == NRF_SUCCESS);
+    }
+    else if (!enable && m_advertising)
+    {
+        (void) sd_ble_gap_adv_stop(m_adv_handle);
+        m_advertising = false;
+    }
+
+    return was_on;
+}
+
+
+/**@brief   Function for checking whether advertising is running. */
+bool advertising_is_on(void)
+{
+    return m_advertising;
+}
+
+
+/**@brief   Function for showing the passkey the central must enter, the display of this device
+ *          being its log. */
+static void passkey_show(uint8_t const * p_passkey)
+{
+    static char passkey[BLE_GAP_PASSKEY_LEN + 1];
+
+    memcpy(passkey, p_passkey, BLE_GAP_PASSKEY_LEN);
+    NRF_LOG_INFO("Passkey: %s", NRF_LOG_PUSH(passkey));
+}
+
+
+/**@brief   Function for answering a pairing request. Only the flash transfer service needs
+ *          pairing: the central enters the passkey of this device, and nothing is bonded. */
+static void sec_params_reply(uint16_t conn_handle)
+{
+#if BLE_XFER_ENABLED
+    ble_gap_sec_params_t const sec_params =
+    {
+        .bond         = 0,
+        .mitm         = 1,
+        .io_caps      = BLE_GAP_IO_CAPS_DISPLAY_ONLY,
+        .min_key_size = SEC_MIN_KEY_SIZE,
+        .max_key_size = SEC_MAX_KEY_SIZE,
+    };
+    ble_gap_sec_keyset_t keyset;
+
+    memset(&keyset, 0x00, sizeof(keyset));
+    (void) sd_ble_gap_sec_params_reply(conn_handle, BLE_GAP_SEC_STATUS_SUCCESS, &sec_params,
+                                       &keyset);
+#else
+    (void) sd_ble_gap_sec_params_reply(conn_handle, BLE_GAP_SEC_STATUS_PAIRING_NOT_SUPP,
+                                       NULL, NULL);
+#endif
+}
+
+
+/**@brief   Function for handling BLE events. Garbage collection of the record store backs off
+ *          while links are up, as flash operations then compete with the radio for time, and
+ *          writes are cut to what fits in the connection interval. */
+static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
+{
+    static uint32_t m_conn_cnt;
+
+    uint16_t const conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GAP_EVT_CONNECTED:
+            m_conn_cnt++;
+            m_advertising = false;
+            flash_chunk_conn_set(
+                p_ble_evt->evt.gap_evt.params.connected.conn_params.max_conn_interval * 1250);
+            break;
+
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+            flash_chunk_conn_set(
+                p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params.max_conn_interval
+                * 1250);
+            return;
+
+        case BLE_GAP_EVT_DISCONNECTED:
+            m_conn_cnt--;
+            if (m_conn_cnt == 0)
+            {
+                flash_chunk_conn_set(0);
+            }
+            if (!m_advertising_off)
+            {
+                advertising_start();
+            }
+            break;
+
+        case BLE_GAP_EVT_SEC_PARAMS_REQUEST:
+            sec_params_reply(conn_handle);
+            return;
+
+        case BLE_GAP_EVT_PASSKEY_DISPLAY:
+            passkey_show(p_ble_evt->evt.gap_evt.params.passkey_display.passkey);
+            return;
+
+        case BLE_GAP_EVT_AUTH_STATUS:
+            if (p_ble_evt->evt.gap_evt.params.auth_status.auth_status != BLE_GAP_SEC_STATUS_SUCCESS)
+            {
+                NRF_LOG_WARNING("Pairing failed: 0x%x",
+                                p_ble_evt->evt.gap_evt.params.auth_status.auth_status);
+            }
+            return;
+
+        case BLE_GATTS_EVT_SYS_ATTR_MISSING:
+            (void) sd_ble_gatts_sys_attr_set(conn_handle, NULL, 0, 0);
+            return;
+
+        case BLE_GATTC_EVT_TIMEOUT:
+        case BLE_GATTS_EVT_TIMEOUT:
+            (void) sd_ble_gap_disconnect(conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+            return;
+
+        default:
+            return;
+    }
+
+    record_store_gc_hint_set((m_conn_cnt > 0) ? RECORD_STORE_GC_HINT_BACKOFF :
+                                                RECORD_STORE_GC_HINT_IDLE);
+}
+
+NRF_SDH_BLE_OBSERVER(m_ble_observer, APP_BLE_OBSERVER_PRIO, ble_evt_handler, NULL);
+
+
 /**@brief   Function for initializing the SoftDevice and enabling the BLE stack. */
 static void ble_stack_init(void)
 {
@@ -89,8 +275,94 @@ static void ble_stack_init(void)
     rc = nrf_sdh_ble_default_cfg_set(APP_BLE_CONN_CFG_TAG, &ram_start);
     APP_ERROR_CHECK(rc);
 
+    /* Queue enough notifications of the flash transfer service to fill connection events. */
+    ble_cfg_t ble_cfg;
+    memset(&ble_cfg, 0x00, sizeof(ble_cfg));
+    ble_cfg.conn_cfg.conn_cfg_tag                            = APP_BLE_CONN_CFG_TAG;
+    ble_cfg.conn_cfg.params.gatts_conn_cfg.hvn_tx_queue_size = BLE_XFER_HVN_QUEUE_SIZE;
+
+    rc = sd_ble_cfg_set(BLE_CONN_CFG_GATTS, &ble_cfg, ram_start);
+    APP_ERROR_CHECK(rc);
+
     rc = nrf_sdh_ble_enable(&ram_start);
     APP_ERROR_CHECK(rc);
+
+    /* Let connection events run past the event length while there is data to send. */
+    ble_opt_t opt;
+    memset(&opt, 0x00, sizeof(opt));
+    opt.common_opt.conn_evt_ext.enable = 1;
+
+    rc = sd_ble_opt_set(BLE_COMMON_OPT_CONN_EVT_EXT, &opt);
+    APP_ERROR_CHECK(rc);
+}
+
+
+/**@brief   Function for setting the device name and the preferred connection parameters. */
+static void gap_params_init(void)
+{
+    ret_code_t              rc;
+    ble_gap_conn_params_t   gap_conn_params;
+    ble_gap_conn_sec_mode_t sec_mode;
+
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&sec_mode);
+
+    rc = sd_ble_gap_device_name_set(&sec_mode, (uint8_t const *)DEVICE_NAME, strlen(DEVICE_NAME));
+    APP_ERROR_CHECK(rc);
+
+    memset(&gap_conn_params, 0x00, sizeof(gap_conn_params));
+    gap_conn_params.min_conn_interval = MIN_CONN_INTERVAL;
+    gap_conn_params.max_conn_interval = MAX_CONN_INTERVAL;
+    gap_conn_params.slave_latency     = SLAVE_LATENCY;
+    gap_conn_params.conn_sup_timeout  = CONN_SUP_TIMEOUT;
+
+    rc = sd_ble_gap_ppcp_set(&gap_conn_params);
+    APP_ERROR_CHECK(rc);
+}
+
+
+/**@brief   Function for advertising the name, and the flash transfer service, if it is enabled, in
+ *          scan responses. */
+static void advertising_init(void)
+{
+    ret_code_t           rc;
+    ble_uuid_t           uuid;
+    ble_advdata_t        advdata;
+    ble_advdata_t        srdata;
+    ble_gap_adv_params_t adv_params;
+    ble_gap_adv_data_t   adv_data =
+    {
+        .adv_data      = { .p_data = m_adv_data, .len = sizeof(m_adv_data) },
+        .scan_rsp_data = { .p_data = m_sr_data,  .len = sizeof(m_sr_data)  },
+    };
+
+    ble_xfer_uuid_get(&uuid);
+
+    memset(&advdata, 0x00, sizeof(advdata));
+    advdata.name_type = BLE_ADVDATA_FULL_NAME;
+    advdata.flags     = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+
+    memset(&srdata, 0x00, sizeof(srdata));
+    if (BLE_XFER_ENABLED)
+    {
+        srdata.uuids_complete.uuid_cnt = 1;
+        srdata.uuids_complete.p_uuids  = &uuid;
+    }
+
+    rc = ble_advdata_encode(&advdata, adv_data.adv_data.p_data, &adv_data.adv_data.len);
+    APP_ERROR_CHECK(rc);
+
+    rc = ble_advdata_encode(&srdata, adv_data.scan_rsp_data.p_data, &adv_data.scan_rsp_data.len);
+    APP_ERROR_CHECK(rc);
+
+    memset(&adv_params, 0x00, sizeof(adv_params));
+    adv_params.properties.type = BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED;
+    adv_params.primary_phy     = BLE_GAP_PHY_1MBPS;
+    adv_params.filter_policy   = BLE_GAP_ADV_FP_ANY;
+    adv_params.interval        = APP_ADV_INTERVAL;
+    adv_params.duration        = BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED;
+
+    rc = sd_ble_gap_adv_set_configure(&m_adv_handle, &adv_data, &adv_params);
+    APP_ERROR_CHECK(rc);
 }
 #else
 static void clock_init(void)
@@ -112,44 +384,22 @@ static void timer_init(void)
 {
     ret_code_t err_code = app_timer_init();
     APP_ERROR_CHECK(err_code);
-}
 
-
-/**@brief   Sleep until an event is received. */
-static void power_manage(void)
-{
-#ifdef SOFTDEVICE_PRESENT
-    (void) sd_app_evt_wait();
-#else
-    __WFE();
-#endif
+    /* Sleep goes through nrf_pwr_mgmt, which counts on the timer to measure it. */
+    err_code = flash_power_init();
+    APP_ERROR_CHECK(err_code);
 }
 
 
 static void fstorage_evt_handler(nrf_fstorage_evt_t * p_evt)
 {
+    /* Let the queue retire the operation and submit the next one. The queue traces every
+     * completion; only failures are logged. */
+    flash_queue_on_fstorage_evt(p_evt);
+
     if (p_evt->result != NRF_SUCCESS)
     {
         NRF_LOG_INFO("--> Event received: ERROR while executing an fstorage operation.");
-        return;
-    }
-
-    switch (p_evt->id)
-    {
-        case NRF_FSTORAGE_EVT_WRITE_RESULT:
-        {
-            NRF_LOG_INFO("--> Event received: wrote %d bytes at address 0x%x.",
-                         p_evt->len, p_evt->addr);
-        } break;
-
-        case NRF_FSTORAGE_EVT_ERASE_RESULT:
-        {
-            NRF_LOG_INFO("--> Event received: erased %d page from address 0x%x.",
-                         p_evt->len, p_evt->addr);
-        } break;
-
-        default:
-            break;
     }
 }
 
@@ -159,16 +409,51 @@ static void print_flash_info(nrf_fstorage_t * p_fstorage)
     printf("========| flash info |========\n");
     printf("erase unit: \t%d bytes\n",      p_fstorage->p_flash_info->erase_unit);
     printf("program unit: \t%d bytes\n",    p_fstorage->p_flash_info->program_unit);
+    printf("area: \t\t%x-%x, %d pages\n",   p_fstorage->start_addr, p_fstorage->end_addr,
+           (p_fstorage->end_addr + 1 - p_fstorage->start_addr)
+           / p_fstorage->p_flash_info->erase_unit);
+    for (uint32_t i = 0; i < FLASH_PART_COUNT; i++)
+    {
+        flash_part_t const * const p_part = flash_part_get((flash_part_id_t)i);
+
+        printf("partition: \t%-6s %x-%x, %d pages\n", p_part->p_name,
+               p_part->p_fs->start_addr, p_part->p_fs->end_addr, p_part->pages);
+    }
     printf("==============================\n\n");
 }
 
 
 void wait_for_flash_ready(nrf_fstorage_t const * p_fstorage)
 {
-    /* While fstorage is busy, sleep and wait for an event. */
-    while (nrf_fstorage_is_busy(p_fstorage))
+    /* Hand writes queued by interrupt handlers and cached writes over now instead of waiting for
+     * the main loop and the flush timer. */
+    (void) flash_submit_process();
+    (void) flash_cache_sync();
+
+    /* While fstorage or the queue, cache and journal in front of it are busy, sleep and wait for
+     * an event. The journal is handed over as the queue drains. */
+    while (   flash_journal_is_busy() || flash_cache_is_busy() || flash_queue_is_busy()
+           || nrf_fstorage_is_busy(p_fstorage))
     {
-        power_manage();
+        if (flash_journal_process())
+        {
+            continue;
+        }
+
+        /* Sleep until the queue completes an operation, rather than checking all of the above
+         * at every interrupt. If the last one completed before the handler was registered, it
+         * will not be called: check again. */
+        flash_power_future_init(&m_flash_done);
+        if (   (flash_queue_space_notify(flash_power_future_evt_handler, &m_flash_done)
+                == NRF_SUCCESS)
+            && flash_queue_is_busy())
+        {
+            (void) flash_power_future_wait(&m_flash_done);
+        }
+        else
+        {
+            flash_power_sleep();
+        }
     }
 }
 
@@ -179,20 +464,68 @@ static void log_init(void)
     APP_ERROR_CHECK(rc);
 }
 
-void flash_write(uint32_t addr, void const * data) {
+static void flash_write_evt_handler(flash_queue_evt_t const * p_evt)
+{
+    if (p_evt->result != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Write of %d records at 0x%x failed: %s",
+                      p_evt->cnt, p_evt->addr, nrf_strerror_get(p_evt->result));
+    }
+}
+
+/**@brief   Write a word through the write cache. Returns as soon as the data is cached; completion
+ *          is reported to @ref flash_write_evt_handler. While the cache is full, aligned words go
+ *          to the RAM journal, and only wait for the flash queue if the journal is full too. */
+void flash_write(uint32_t addr, uint32_t data) {
     ret_code_t rc;
-    printf("Writing to addr: %x\n", addr);
-    printf("DATA: %x\n", data);
-    printf("LEN: %d\n\n", sizeof(data));
+    FLASH_TRACE(FLASH_TRACE_WRITE, addr, data);
 
-    rc = nrf_fstorage_write(&fstorage, addr, &data, sizeof(data), NULL);
-    APP_ERROR_CHECK(rc);
+    rc = flash_cache_write(&fstorage, addr, &data, sizeof(data), flash_write_evt_handler, NULL);
+    if ((rc == NRF_ERROR_NO_MEM) && (flash_journal_write(addr, &data, sizeof(data)) == NRF_SUCCESS))
+    {
+        /* The journal takes bursts at memory speed, and flash_read() sees its data too. */
+        rc = NRF_SUCCESS;
+    }
+    if (rc == NRF_ERROR_NO_MEM)
+    {
+        /* Every cache line is waiting for the flash queue. The lines are freed as it drains, so
+         * room for one word is enough to go on; there is no need for the whole queue to empty. */
+        rc = flash_queue_space_wait(1, sizeof(uint32_t), FLASH_WRITE_TIMEOUT_MS);
+        if (rc == NRF_SUCCESS)
+        {
+            rc = flash_cache_write(&fstorage, addr, &data, sizeof(data), flash_write_evt_handler, NULL);
+        }
+    }
+    if (rc != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("flash_cache_write() returned: %s", nrf_strerror_get(rc));
+    }
+}
 
-    wait_for_flash_ready(&fstorage);
+static void record_store_evt_handler(record_store_evt_t const * p_evt)
+{
+    if (p_evt->result != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Record store event %d for key 0x%x failed: %s",
+                      p_evt->id, p_evt->key, nrf_strerror_get(p_evt->result));
+    }
+}
+
+static void record_read(uint16_t key) {
+    printf("Reading record: %x\r\n", key);
+    uint32_t value;
+
+    ret_code_t rc = kv_get_u32(key, &value);
+    if (rc != NRF_SUCCESS) {
+      printf("kv_get_u32() returned: %s\r\n", nrf_strerror_get(rc));
+      return;
+    }
+
+    printf("\nHEX DATA: 0x%x\n\n\n", value);
 }
 
 void flash_read(uint32_t addr, uint32_t len) {
-    printf("Reading addr: %x\r\n", addr);
+    FLASH_TRACE(FLASH_TRACE_READ, addr, len);
     ret_code_t rc;
     uint8_t    data[256] = {0};
 
@@ -200,7 +533,8 @@ void flash_read(uint32_t addr, uint32_t len) {
     {
         len = sizeof(data);
     }
-    rc = nrf_fstorage_read(&fstorage, addr, data, len);
+    /* Includes data that is still in the write cache or in the journal. */
+    rc = flash_journal_read(addr, data, len);
     if (rc != NRF_SUCCESS) {
       printf("unsuccessful\r\n");
     }
@@ -250,58 +584,132 @@ int main(void)
     rc = nrf_fstorage_init(&fstorage, p_fs_api, NULL);
     APP_ERROR_CHECK(rc);
 
+    /* The layout is fixed at compile time. Make sure that the image has not grown into it before
+     * the record store erases any of it. */
+    APP_ERROR_CHECK_BOOL(FLASH_LAYOUT_IS_FREE(CODE_END, nrf5_flash_end_addr_get()));
+    APP_ERROR_CHECK_BOOL(fstorage.p_flash_info->erase_unit == FLASH_LAYOUT_PAGE_SIZE);
+
+    flash_chunk_init();
+
+    rc = flash_queue_init();
+    APP_ERROR_CHECK(rc);
+
+    rc = flash_part_init(p_fs_api);
+    APP_ERROR_CHECK(rc);
+
+    /* Erases typed in the CLI and bulk transfers give way to record store writes. */
+    rc = flash_queue_sched_set(&fstorage, FLASH_QUEUE_PRIO_LOW, 0);
+    APP_ERROR_CHECK(rc);
+
+    rc = flash_cache_init();
+    APP_ERROR_CHECK(rc);
+
+    rc = flash_journal_init(&fstorage, flash_write_evt_handler);
+    APP_ERROR_CHECK(rc);
+
+    /* Writes kept in the journal over a reset are queued before anything can erase their pages. */
+    rc = flash_journal_flush(FLASH_WRITE_TIMEOUT_MS);
+    APP_ERROR_CHECK(rc);
+
+    rc = flash_submit_init();
+    APP_ERROR_CHECK(rc);
+
+    rc = flash_buf_init();
+    APP_ERROR_CHECK(rc);
+
+    rc = record_store_init(flash_part_get(FLASH_PART_CONFIG)->p_fs, record_store_evt_handler);
+    APP_ERROR_CHECK(rc);
+
+    /* Pages left over by older firmware are erased before records can be appended. Only the
+     * first one is erased here; garbage collection erases the others from the main loop. */
+    wait_for_flash_ready(&fstorage);
+
+    /* The log and dump partitions are erased if earlier firmware laid them out differently. */
+    rc = flash_part_mount();
+    if (rc != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("flash_part_mount() returned: %s", nrf_strerror_get(rc));
+    }
+
     print_flash_info(&fstorage);
-    
-    (void) nrf5_flash_end_addr_get();
 
 
 #ifdef SOFTDEVICE_PRESENT
-    /* Enable the SoftDevice and the BLE stack. */
+    /* Enable the SoftDevice and the BLE stack, and let hosts that pair connect to read and write
+     * flash, if the transfer service is enabled. */
     ble_stack_init();
+    gap_params_init();
 
+#if BLE_XFER_ENABLED
+    rc = ble_xfer_init(&fstorage);
+    APP_ERROR_CHECK(rc);
 #endif
 
-    uint32_t bson_s_1 = strtoul("0x64a65009", NULL, 16);
-    uint32_t bson_s_2 = strtoul("0xfee0844a", NULL, 16);
-    uint32_t bson_s_3 = strtoul("0xd77da995", NULL, 16);
+    advertising_init();
+    advertising_start();
+#endif
+
+    uint32_t const bson_s_1 = 0x64a65009;
+    uint32_t const bson_s_2 = 0xfee0844a;
+    uint32_t const bson_s_3 = 0xd77da995;
 
     printf("=============================\n");
     printf("STARTING WRITE OPERATIONS\n");
     printf("=============================\n\n");
 
-    flash_write(F_ADDR1, bson_s_1);
-    flash_write(F_ADDR2, bson_s_2);
-    flash_write(F_ADDR3, bson_s_3);
+    /* Updating a value appends a new copy of its record instead of erasing a page. The three
+     * values belong together: write them as one transaction, so that a reset halfway through
+     * leaves the previous ones in place. Each one takes a scalar record. */
+    rc = record_store_txn_begin();
+    APP_ERROR_CHECK(rc);
+    rc = record_store_txn_write_u32(RECORD_KEY_BSON_1, bson_s_1);
+    APP_ERROR_CHECK(rc);
+    rc = record_store_txn_write_u32(RECORD_KEY_BSON_2, bson_s_2);
+    APP_ERROR_CHECK(rc);
+    rc = record_store_txn_write_u32(RECORD_KEY_BSON_3, bson_s_3);
+    APP_ERROR_CHECK(rc);
+    rc = record_store_txn_commit();
+    APP_ERROR_CHECK(rc);
 
     cli_start();
 
+    /* The transaction above is only staged; let it reach flash before reading it back. */
+    wait_for_flash_ready(&fstorage);
+
     printf("=============================\n");
     printf("STARTING READ OPERATIONS\n");
     printf("=============================\n\n");
 
-    flash_read(F_ADDR1, 4);
-    flash_read(F_ADDR2, 4);
-    flash_read(F_ADDR3, 4);
+    record_read(RECORD_KEY_BSON_1);
+    record_read(RECORD_KEY_BSON_2);
+    record_read(RECORD_KEY_BSON_3);
 
     printf("=============================\n");
-    printf("STARTING ERASURE OPERATIONS\n");
+    printf("STARTING DELETE OPERATIONS\n");
     printf("=============================\n\n");
 
-    rc = nrf_fstorage_erase(&fstorage, F_ADDR1, 1, NULL);
+    rc = kv_delete(RECORD_KEY_BSON_1);
     if (rc != NRF_SUCCESS)
     {
-        printf("nrf_fstorage_erase() returned: %s\n",
+        printf("kv_delete() returned: %s\n",
                         nrf_strerror_get(rc));
     } else {
-        printf("Flash erased\n");
+        printf("Record deleted\n");
     }
 
-    /* Enter main loop. */
+    /* Enter main loop. Garbage collection of the record store runs when there is nothing else
+     * to do, before going to sleep. */
     for (;;)
     {
-        if (!NRF_LOG_PROCESS())
+        bool busy = NRF_LOG_PROCESS();
+        busy = flash_submit_process() || busy;
+        busy = flash_journal_process()  || busy;
+#ifdef SOFTDEVICE_PRESENT
+        busy = ble_xfer_process() || busy;
+#endif
+        if (!busy && !record_store_gc_step())
         {
-            power_manage();
+            flash_power_sleep();
         }
         cli_process();
     }
@@ -46,6 +46,527 @@
 #ifdef USE_APP_CONFIG
 #include "app_config.h"
 #endif
+// <h> Application 
+
+//==========================================================
+// <h> flash_queue - Batched asynchronous flash write queue
+
+//==========================================================
+// <o> FLASH_QUEUE_OP_COUNT - Number of operations that can be queued 
+// <i> Writes that continue the previous queued write are merged into it and do not take a new slot.
+
+#ifndef FLASH_QUEUE_OP_COUNT
+#define FLASH_QUEUE_OP_COUNT 16
+#endif
+
+// <o> FLASH_QUEUE_STAGING_SIZE - Size of the RAM staging buffer, in bytes 
+// <i> Data of queued writes is copied here until the write completes. Must be a multiple of four.
+// <i> It also bounds the size of a merged program operation.
+
+#ifndef FLASH_QUEUE_STAGING_SIZE
+#define FLASH_QUEUE_STAGING_SIZE 1024
+#endif
+
+// <o> FLASH_QUEUE_NOTIFY_COUNT - Number of handlers that can wait for room in the queue 
+// <i> See flash_queue_space_notify().
+
+#ifndef FLASH_QUEUE_NOTIFY_COUNT
+#define FLASH_QUEUE_NOTIFY_COUNT 4
+#endif
+
+// <q> FLASH_QUEUE_STATS_ENABLED  - Gather latency histograms and queue statistics
+// <i> See flash_queue_stats_get() and the stats CLI command. Latencies are measured with the app_timer counter.
+ 
+
+#ifndef FLASH_QUEUE_STATS_ENABLED
+#define FLASH_QUEUE_STATS_ENABLED 1
+#endif
+
+// <o> FLASH_QUEUE_SHARE_COUNT - Number of fstorage instances that can have a share of the queue or a class 
+// <i> See flash_queue_share_set() and flash_queue_sched_set(). The flash partitions take one each,
+// <i> the raw window of the CLI another.
+
+#ifndef FLASH_QUEUE_SHARE_COUNT
+#define FLASH_QUEUE_SHARE_COUNT 4
+#endif
+
+// <o> FLASH_QUEUE_SD_IN_FLIGHT - Most operations handed to the SoftDevice at once 
+// <i> The SoftDevice executes them in order, so an urgent operation can wait for this many others.
+// <i> Fewer let the scheduler reorder more; more keep the SoftDevice busy between events.
+// <i> Capped by NRF_FSTORAGE_SD_QUEUE_SIZE. Not used without a SoftDevice.
+
+#ifndef FLASH_QUEUE_SD_IN_FLIGHT
+#define FLASH_QUEUE_SD_IN_FLIGHT 2
+#endif
+
+// <o> FLASH_QUEUE_DEADLINE_MARGIN_MS - Time before a deadline at which an operation goes first, in ms 
+// <i> See flash_queue_sched_set(). About the time of a page erase.
+
+#ifndef FLASH_QUEUE_DEADLINE_MARGIN_MS
+#define FLASH_QUEUE_DEADLINE_MARGIN_MS 100
+#endif
+
+// </h> 
+//==========================================================
+
+// <h> flash_buf - Reference-counted flash write buffers
+
+//==========================================================
+// <o> FLASH_BUF_SIZE - Size of a buffer, in bytes 
+// <i> Must be a multiple of four.
+
+#ifndef FLASH_BUF_SIZE
+#define FLASH_BUF_SIZE 256
+#endif
+
+// <o> FLASH_BUF_COUNT - Number of buffers in the pool 
+// <i> Set to NRF_FSTORAGE_SD_QUEUE_SIZE to be able to keep the SoftDevice queue full.
+
+#ifndef FLASH_BUF_COUNT
+#define FLASH_BUF_COUNT 4
+#endif
+
+// </h> 
+//==========================================================
+
+// <h> record_store - Log-structured record store
+
+//==========================================================
+// <o> RECORD_STORE_MAX_PAGES - Maximum number of flash pages managed by the store 
+// <i> The flash area of the fstorage instance must not have more pages than this.
+
+#ifndef RECORD_STORE_MAX_PAGES
+#define RECORD_STORE_MAX_PAGES 32
+#endif
+
+// <o> RECORD_STORE_PENDING_SIZE - Number of records that can be waiting to be written 
+
+#ifndef RECORD_STORE_PENDING_SIZE
+#define RECORD_STORE_PENDING_SIZE 16
+#endif
+
+// <o> RECORD_INDEX_SIZE - Number of slots in the RAM record index 
+// <i> Each slot takes eight bytes. Must be a power of two; one slot always stays empty.
+// <i> If there are more keys than the index can hold, lookups of keys missing from it fall back to scanning the flash area.
+
+#ifndef RECORD_INDEX_SIZE
+#define RECORD_INDEX_SIZE 64
+#endif
+
+// <q> RECORD_STORE_CHECKPOINT_ENABLED  - Persist the record index to shorten initialization
+// <i> The last page of the flash area is reserved for a snapshot of the record index. At initialization, only records appended after the snapshot are scanned.
+ 
+
+#ifndef RECORD_STORE_CHECKPOINT_ENABLED
+#define RECORD_STORE_CHECKPOINT_ENABLED 1
+#endif
+
+// <o> RECORD_STORE_SPARE_PAGES - Erased pages kept ready for new records 
+// <i> Not counting the page reserved for compaction. Garbage collection refills the pool from record_store_gc_step(), called when the application is idle. At most the number of record pages minus two.
+
+#ifndef RECORD_STORE_SPARE_PAGES
+#define RECORD_STORE_SPARE_PAGES 1
+#endif
+
+// <o> RECORD_STORE_GC_STEP_SIZE - Bytes of records garbage collection copies per step 
+// <i> A step that erases a page or writes a checkpoint does nothing else.
+
+#ifndef RECORD_STORE_GC_STEP_SIZE
+#define RECORD_STORE_GC_STEP_SIZE 256
+#endif
+
+// <e> RECORD_STORE_COMPRESS_ENABLED - Compress the data of records before writing them
+// <i> Records are stored compressed only if that saves at least a word of flash. Compressed records are read back whatever this option is set to.
+//==========================================================
+#ifndef RECORD_STORE_COMPRESS_ENABLED
+#define RECORD_STORE_COMPRESS_ENABLED 1
+#endif
+// <o> RECORD_STORE_COMPRESS_BUF_SIZE - Size of the compression buffer, in bytes 
+// <i> Bounds the compressed size of a record. Records that do not compress to this size are stored as they are. The hash table of the compressor takes another 512 bytes.
+
+#ifndef RECORD_STORE_COMPRESS_BUF_SIZE
+#define RECORD_STORE_COMPRESS_BUF_SIZE 256
+#endif
+
+// </e>
+
+// <o> RECORD_STORE_TXN_MAX - Maximum number of records in a transaction 
+// <i> Replaying the log, at initialization or to look up keys missing from the index, holds this many record headers on the stack, twelve bytes each.
+
+#ifndef RECORD_STORE_TXN_MAX
+#define RECORD_STORE_TXN_MAX 8
+#endif
+
+// </h> 
+//==========================================================
+
+// <h> flash_cache - Write-back cache for small flash writes
+
+//==========================================================
+// <o> FLASH_CACHE_LINE_SIZE - Size of a write cache line, in bytes 
+// <i> Must be a multiple of four, and at most 128. Records of the record store that fit in a line are written through the cache.
+
+#ifndef FLASH_CACHE_LINE_SIZE
+#define FLASH_CACHE_LINE_SIZE 64
+#endif
+
+// <o> FLASH_CACHE_LINE_COUNT - Number of write cache lines 
+
+#ifndef FLASH_CACHE_LINE_COUNT
+#define FLASH_CACHE_LINE_COUNT 4
+#endif
+
+// <o> FLASH_CACHE_FLUSH_THRESHOLD - Cached bytes that trigger a flush 
+
+#ifndef FLASH_CACHE_FLUSH_THRESHOLD
+#define FLASH_CACHE_FLUSH_THRESHOLD 128
+#endif
+
+// <o> FLASH_CACHE_FLUSH_DELAY_MS - Time after which cached data is flushed, in milliseconds 
+
+#ifndef FLASH_CACHE_FLUSH_DELAY_MS
+#define FLASH_CACHE_FLUSH_DELAY_MS 100
+#endif
+
+// </h> 
+//==========================================================
+
+// <h> xfer - Framed binary transfer
+
+//==========================================================
+// <o> XFER_PAYLOAD_SIZE - Largest payload of a frame, in bytes 
+// <i> Must be a multiple of four, at least 8 and at most FLASH_QUEUE_STAGING_SIZE.
+
+#ifndef XFER_PAYLOAD_SIZE
+#define XFER_PAYLOAD_SIZE 128
+#endif
+
+// <o> XFER_WINDOW - Frames the host may send ahead over the CLI 
+// <i> The CLI UART receive buffer must hold this many frames of XFER_PAYLOAD_SIZE + 8 bytes.
+
+#ifndef XFER_WINDOW
+#define XFER_WINDOW 2
+#endif
+
+// </h> 
+//==========================================================
+
+// <h> bench - On-target flash benchmark
+
+//==========================================================
+// <o> BENCH_BUF_SIZE - Size of the data buffer, in bytes 
+// <i> Bounds the size of the writes and reads of a workload. Must be a multiple of four, and at least 256.
+
+#ifndef BENCH_BUF_SIZE
+#define BENCH_BUF_SIZE 4096
+#endif
+
+// <o> BENCH_LATENCY_SAMPLES - Latencies kept to compute percentiles 
+// <i> Workloads with more operations are sampled. Two sets are kept, for the mixed workload.
+
+#ifndef BENCH_LATENCY_SAMPLES
+#define BENCH_LATENCY_SAMPLES 256
+#endif
+
+// <o> BENCH_TIMER_INSTANCE - TIMER instance measuring latencies 
+// <i> Runs at 1 MHz during a workload. TIMER0 is used by the SoftDevice.
+
+#ifndef BENCH_TIMER_INSTANCE
+#define BENCH_TIMER_INSTANCE 1
+#endif
+
+// </h> 
+//==========================================================
+
+// <h> flash_crc - CRC32 of flash contents
+
+//==========================================================
+// <q> FLASH_CRC_SLICING_ENABLED  - Compute the CRC32 four bytes at a time
+// <i> Uses 4 kB of tables in flash, and is several times faster than the bitwise CRC32 of the crc32 library used otherwise.
+ 
+
+#ifndef FLASH_CRC_SLICING_ENABLED
+#define FLASH_CRC_SLICING_ENABLED 1
+#endif
+
+// </h> 
+//==========================================================
+
+// <h> flash_layout - Flash area of the application
+
+//==========================================================
+// <o> FLASH_LAYOUT_END_ADDR - Address right after the flash area 
+// <i> Exclusive. The default keeps the start of the area of earlier firmware, 0x3E000, and ends at 0x45FFF.
+
+#ifndef FLASH_LAYOUT_END_ADDR
+#define FLASH_LAYOUT_END_ADDR 0x46000
+#endif
+
+// <o> FLASH_LAYOUT_PAGES - Number of pages in the flash area 
+// <i> The area ends at FLASH_LAYOUT_END_ADDR. It is split into the partitions of the flash_part group, in order.
+
+#ifndef FLASH_LAYOUT_PAGES
+#define FLASH_LAYOUT_PAGES 8
+#endif
+
+// <o> FLASH_LAYOUT_PAGE_SIZE - Size of a flash page, in bytes 
+// <i> The erase unit of the chip: 4096 on the nRF52832 and the nRF52840. Must be a power of two.
+
+#ifndef FLASH_LAYOUT_PAGE_SIZE
+#define FLASH_LAYOUT_PAGE_SIZE 4096
+#endif
+
+// </h> 
+//==========================================================
+
+// <h> flash_trace - Binary trace of flash operations
+
+//==========================================================
+// <e> FLASH_TRACE_ENABLED - Record storage events in a RAM ring
+// <i> Each trace point takes a few dozen cycles instead of formatting a log message. The ring is dumped with the trace CLI command and decoded on the host with trace_decode.py.
+//==========================================================
+#ifndef FLASH_TRACE_ENABLED
+#define FLASH_TRACE_ENABLED 1
+#endif
+// <o> FLASH_TRACE_SIZE - Number of entries in the ring 
+// <i> Each entry takes 16 bytes. Must be a power of two.
+
+#ifndef FLASH_TRACE_SIZE
+#define FLASH_TRACE_SIZE 128
+#endif
+
+// </e>
+
+// </h> 
+//==========================================================
+
+// <h> flash_submit - Flash writes from interrupt handlers
+
+//==========================================================
+// <o> FLASH_SUBMIT_QUEUE_SIZE - Number of writes that can wait for the main loop 
+// <i> Writes requested while the queue is full are dropped and counted.
+
+#ifndef FLASH_SUBMIT_QUEUE_SIZE
+#define FLASH_SUBMIT_QUEUE_SIZE 16
+#endif
+
+// <o> FLASH_SUBMIT_DATA_SIZE - Largest write, in bytes 
+// <i> Every slot of the queue holds this many bytes of data, plus 20 bytes. At most FLASH_CACHE_LINE_SIZE.
+
+#ifndef FLASH_SUBMIT_DATA_SIZE
+#define FLASH_SUBMIT_DATA_SIZE 16
+#endif
+
+// </h> 
+//==========================================================
+
+// <h> flash_journal - RAM journal for bursts of flash writes
+
+//==========================================================
+// <e> FLASH_JOURNAL_ENABLED - Absorb bursts of writes in RAM and drain them to flash from the main loop
+//==========================================================
+#ifndef FLASH_JOURNAL_ENABLED
+#define FLASH_JOURNAL_ENABLED 1
+#endif
+// <o> FLASH_JOURNAL_SIZE - Size of the journal, in bytes 
+// <i> Each write takes its length rounded up to eight bytes, plus eight bytes. Must be a power of two, at most 32768.
+
+#ifndef FLASH_JOURNAL_SIZE
+#define FLASH_JOURNAL_SIZE 4096
+#endif
+
+// <q> FLASH_JOURNAL_RETAINED  - Keep the journal over a reset
+// <i> Places the journal in the .non_init section of flash_placement.xml, which the startup code does not clear.
+// <i> Writes that had not completed when the device reset without losing power are made again after the reset.
+
+#ifndef FLASH_JOURNAL_RETAINED
+#define FLASH_JOURNAL_RETAINED 0
+#endif
+
+// </e>
+
+// </h> 
+//==========================================================
+
+// <h> flash_part - Flash partitions
+
+//==========================================================
+// <o> FLASH_PART_CONFIG_PAGES - Pages of the config partition 
+// <i> The first pages of the flash area, used by the record store: at most RECORD_STORE_MAX_PAGES, plus one for the checkpoint if RECORD_STORE_CHECKPOINT_ENABLED is set.
+
+#ifndef FLASH_PART_CONFIG_PAGES
+#define FLASH_PART_CONFIG_PAGES 4
+#endif
+
+// <o> FLASH_PART_LOG_PAGES - Pages of the log partition 
+// <i> Follows the config partition. A circular log of appended entries; at least two pages.
+
+#ifndef FLASH_PART_LOG_PAGES
+#define FLASH_PART_LOG_PAGES 2
+#endif
+
+// <o> FLASH_PART_DUMP_PAGES - Pages of the dump partition 
+// <i> Follows the log partition. Raw pages for crash dumps; the CLI read, write and erase commands and the benchmark work here.
+
+#ifndef FLASH_PART_DUMP_PAGES
+#define FLASH_PART_DUMP_PAGES 2
+#endif
+
+// <o> FLASH_PART_CONFIG_RESERVED_OPS - Flash queue operations kept free for the config partition 
+// <i> Record store commits always find room in the flash queue, whatever the other partitions have queued.
+
+#ifndef FLASH_PART_CONFIG_RESERVED_OPS
+#define FLASH_PART_CONFIG_RESERVED_OPS 4
+#endif
+
+// <o> FLASH_PART_LOG_MAX_OPS - Most flash queue operations the log and the dump partitions can each hold 
+
+#ifndef FLASH_PART_LOG_MAX_OPS
+#define FLASH_PART_LOG_MAX_OPS 8
+#endif
+
+// <o> FLASH_PART_LOG_MAX_STAGE - Most bytes of the flash queue staging buffer the log and the dump partitions can each hold 
+
+#ifndef FLASH_PART_LOG_MAX_STAGE
+#define FLASH_PART_LOG_MAX_STAGE 512
+#endif
+
+// <o> FLASH_PART_LOG_DEADLINE_MS - Time by which log entries should be written, in ms 
+// <i> The config partition is scheduled first, the log next and the dump last. Log entries due
+// <i> within FLASH_QUEUE_DEADLINE_MARGIN_MS go before record store writes. Zero for no deadline.
+
+#ifndef FLASH_PART_LOG_DEADLINE_MS
+#define FLASH_PART_LOG_DEADLINE_MS 500
+#endif
+
+// <q> FLASH_PART_PERSIST_ENABLED  - Keep the partition table in the record store
+// <i> At startup, the log and dump partitions are erased if their place or their policy differs from the table kept by earlier firmware.
+
+#ifndef FLASH_PART_PERSIST_ENABLED
+#define FLASH_PART_PERSIST_ENABLED 1
+#endif
+
+// <o> FLASH_PART_TABLE_KEY - Record key of the partition table <0x0001-0xFFFE>
+
+#ifndef FLASH_PART_TABLE_KEY
+#define FLASH_PART_TABLE_KEY 0xFFFE
+#endif
+
+// </h> 
+//==========================================================
+
+// <h> flash_chunk - Adaptive size of SoftDevice writes
+
+//==========================================================
+// <e> FLASH_CHUNK_ENABLED - Size writes to the SoftDevice from how long earlier ones took and from the connection interval
+// <i> Not used without a SoftDevice.
+//==========================================================
+#ifndef FLASH_CHUNK_ENABLED
+#define FLASH_CHUNK_ENABLED 1
+#endif
+// <o> FLASH_CHUNK_MIN_SIZE - Smallest chunk, in bytes 
+// <i> Must be a multiple of four. A chunk of this size that times out fails the write.
+
+#ifndef FLASH_CHUNK_MIN_SIZE
+#define FLASH_CHUNK_MIN_SIZE 64
+#endif
+
+// <o> FLASH_CHUNK_GROW_AFTER - Chunks in a row that must be quick before the size is doubled 
+
+#ifndef FLASH_CHUNK_GROW_AFTER
+#define FLASH_CHUNK_GROW_AFTER 4
+#endif
+
+// <o> FLASH_CHUNK_RADIO_US - Radio time assumed in each connection interval, in microseconds 
+// <i> The rest of the interval bounds the chunk size while a link is up.
+
+#ifndef FLASH_CHUNK_RADIO_US
+#define FLASH_CHUNK_RADIO_US 2500
+#endif
+
+// <o> FLASH_CHUNK_WORD_US - Time to program a word, in microseconds 
+// <i> The longest time given in the product specification: 68 on nRF52832, 41 on nRF52840.
+
+#ifndef FLASH_CHUNK_WORD_US
+#define FLASH_CHUNK_WORD_US 68
+#endif
+
+// </e>
+
+// </h> 
+//==========================================================
+
+// <h> flash_power - Sleep while waiting for flash, and energy estimates
+
+//==========================================================
+// <o> FLASH_POWER_CPU_UA - Current drawn while the CPU runs, in microamperes 
+// <i> From the product specification of the nRF52832: CPU running from flash, cache enabled, DC/DC off.
+
+#ifndef FLASH_POWER_CPU_UA
+#define FLASH_POWER_CPU_UA 7400
+#endif
+
+// <o> FLASH_POWER_SLEEP_UA - Current drawn in System ON sleep, in microamperes 
+// <i> From the product specification of the nRF52832: RTC running, full RAM retention.
+
+#ifndef FLASH_POWER_SLEEP_UA
+#define FLASH_POWER_SLEEP_UA 2
+#endif
+
+// <o> FLASH_POWER_PROG_UA - Current drawn by the flash while writing or erasing, in microamperes 
+// <i> From the product specification of the nRF52832. Added to the CPU or sleep current.
+
+#ifndef FLASH_POWER_PROG_UA
+#define FLASH_POWER_PROG_UA 7400
+#endif
+
+// <o> FLASH_POWER_ERASE_MS - Time to erase a page, in milliseconds 
+// <i> The longest time given in the product specification.
+
+#ifndef FLASH_POWER_ERASE_MS
+#define FLASH_POWER_ERASE_MS 85
+#endif
+
+// </h> 
+//==========================================================
+
+// <h> flash_sim - Simulated flash for benchmarks and fault injection
+
+//==========================================================
+// <e> FLASH_SIM_ENABLED - Model the flash in RAM, for the sim CLI commands
+// <i> Takes FLASH_SIM_PAGES times FLASH_SIM_PAGE_SIZE bytes of RAM. The timings are FLASH_CHUNK_WORD_US and FLASH_POWER_ERASE_MS.
+//==========================================================
+#ifndef FLASH_SIM_ENABLED
+#define FLASH_SIM_ENABLED 0
+#endif
+// <o> FLASH_SIM_PAGES - Number of pages of the simulated flash 
+
+#ifndef FLASH_SIM_PAGES
+#define FLASH_SIM_PAGES 2
+#endif
+
+// <o> FLASH_SIM_PAGE_SIZE - Size of a page, in bytes 
+// <i> 4096 on nRF52 devices. Must be a multiple of four; other sizes model other parts.
+
+#ifndef FLASH_SIM_PAGE_SIZE
+#define FLASH_SIM_PAGE_SIZE 4096
+#endif
+
+// <o> FLASH_SIM_QUEUE_SIZE - Operations queued before NRF_ERROR_NO_MEM is returned 
+// <i> As NRF_FSTORAGE_SD_QUEUE_SIZE for the SoftDevice backend.
+
+#ifndef FLASH_SIM_QUEUE_SIZE
+#define FLASH_SIM_QUEUE_SIZE 4
+#endif
+
+// </e>
+
+// </h> 
+//==========================================================
+
+// </h> 
+//==========================================================
+
 // <h> nRF_Drivers 
 
 //==========================================================
@@ -727,6 +1248,13 @@
 
 // </e>
 
+// <q> CRC32_ENABLED  - crc32 - CRC32 calculation routines
+ 
+
+#ifndef CRC32_ENABLED
+#define CRC32_ENABLED 1
+#endif
+
 // <e> NRF_BALLOC_ENABLED - nrf_balloc - Block allocator module
 //==========================================================
 #ifndef NRF_BALLOC_ENABLED
@@ -857,7 +1385,7 @@
 // <e> NRF_PWR_MGMT_ENABLED - nrf_pwr_mgmt - Power management module
 //==========================================================
 #ifndef NRF_PWR_MGMT_ENABLED
-#define NRF_PWR_MGMT_ENABLED 0
+#define NRF_PWR_MGMT_ENABLED 1
 #endif
 // <e> NRF_PWR_MGMT_CONFIG_DEBUG_PIN_ENABLED - Enables pin debug in the module.
 
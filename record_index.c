@@ -0,0 +1,198 @@
+#include "record_index.h"
+
+#include <string.h>
+
+#include "sdk_config.h"
+#include "app_util.h"
+
+
+#define KEY_EMPTY       0xFFFF  /* Not a valid record key. */
+#define FLAG_VERIFIED   0x0001  /* The record at the address has passed its integrity check. */
+
+/* Probing relies on a power-of-two table size, and on at least one slot staying empty. */
+STATIC_ASSERT((RECORD_INDEX_SIZE & (RECORD_INDEX_SIZE - 1)) == 0);
+STATIC_ASSERT(RECORD_INDEX_SIZE >= 2);
+
+
+typedef struct
+{
+    uint16_t key;
+    uint16_t flags;
+    uint32_t addr;
+} slot_t;
+
+
+static slot_t   m_slots[RECORD_INDEX_SIZE];
+static uint32_t m_count;
+
+
+static uint32_t slot_home(uint16_t key)
+{
+    /* Fibonacci hashing spreads the mostly sequential keys over the table. */
+    return ((key * 2654435761u) >> 16) & (RECORD_INDEX_SIZE - 1);
+}
+
+
+/**@brief   Find the slot holding @p key, or the empty slot that ends its probe sequence. */
+static uint32_t slot_find(uint16_t key)
+{
+    uint32_t i = slot_home(key);
+
+    while ((m_slots[i].key != key) && (m_slots[i].key != KEY_EMPTY))
+    {
+        i = (i + 1) & (RECORD_INDEX_SIZE - 1);
+    }
+
+    return i;
+}
+
+
+void record_index_clear(void)
+{
+    memset(m_slots, 0xFF, sizeof(m_slots));
+    m_count = 0;
+}
+
+
+bool record_index_put(uint16_t key, uint32_t addr)
+{
+    uint32_t const i = slot_find(key);
+
+    if (m_slots[i].key == KEY_EMPTY)
+    {
+        /* Keep one slot empty so that lookups of missing keys terminate. */
+        if (m_count == RECORD_INDEX_SIZE - 1)
+        {
+            return false;
+        }
+        m_slots[i].key = key;
+        m_count++;
+    }
+
+    m_slots[i].flags = 0;
+    m_slots[i].addr  = addr;
+    return true;
+}
+
+
+bool record_index_get(uint16_t key, uint32_t * p_addr)
+{
+    uint32_t const i = slot_find(key);
+
+    if (m_slots[i].key == KEY_EMPTY)
+    {
+        return false;
+    }
+
+    *p_addr = m_slots[i].addr;
+    return true;
+}
+
+
+bool record_index_verified(uint16_t key)
+{
+    uint32_t const i = slot_find(key);
+
+    return (m_slots[i].key != KEY_EMPTY) && ((m_slots[i].flags & FLAG_VERIFIED) != 0);
+}
+
+
+void record_index_verified_set(uint16_t key)
+{
+    uint32_t const i = slot_find(key);
+
+    if (m_slots[i].key != KEY_EMPTY)
+    {
+        m_slots[i].flags |= FLAG_VERIFIED;
+    }
+}
+
+
+void record_index_remove(uint16_t key)
+{
+    uint32_t i = slot_find(key);
+
+    if (m_slots[i].key == KEY_EMPTY)
+    {
+        return;
+    }
+
+    /* Backward-shift deletion: move later entries of the probe run into the hole, so that no
+     * tombstones are needed. */
+    uint32_t j = i;
+    for (;;)
+    {
+        m_slots[i].key = KEY_EMPTY;
+
+        for (;;)
+        {
+            j = (j + 1) & (RECORD_INDEX_SIZE - 1);
+            if (m_slots[j].key == KEY_EMPTY)
+            {
+                m_count--;
+                return;
+            }
+
+            uint32_t const home = slot_home(m_slots[j].key);
+
+            /* Leave the entry if its home lies cyclically in (i, j]. */
+            bool const stays = (i <= j) ? ((i < home) && (home <= j))
+                                        : ((i < home) || (home <= j));
+            if (!stays)
+            {
+                break;
+            }
+        }
+
+        m_slots[i] = m_slots[j];
+        i          = j;
+    }
+}
+
+
+bool record_index_next(uint16_t first, uint16_t last, uint16_t * p_key, uint32_t * p_addr)
+{
+    bool found = false;
+
+    /* The table is small, and keys are not kept in order, so look at every slot. */
+    for (uint32_t i = 0; i < RECORD_INDEX_SIZE; i++)
+    {
+        uint16_t const key = m_slots[i].key;
+
+        if (   (key != KEY_EMPTY) && (key >= first) && (key <= last)
+            && (!found || (key < *p_key)))
+        {
+            *p_key  = key;
+            *p_addr = m_slots[i].addr;
+            found   = true;
+        }
+    }
+
+    return found;
+}
+
+
+uint32_t record_index_count(void)
+{
+    return m_count;
+}
+
+
+void const * record_index_table(uint32_t * p_size)
+{
+    *p_size = sizeof(m_slots);
+    return m_slots;
+}
+
+
+void record_index_restore(void const * p_table, uint32_t count)
+{
+    memcpy(m_slots, p_table, sizeof(m_slots));
+    m_count = count;
+
+    /* Records are checked again after every boot. */
+    for (uint32_t i = 0; i < RECORD_INDEX_SIZE; i++)
+    {
+        m_slots[i].flags = 0;
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef RECORD_INDEX_H__
+#define RECORD_INDEX_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup record_index Record index
+ * @{
+ *
+ * @brief   RAM hash table mapping record keys to the flash address of their current copy.
+ *
+ * @details Open addressing with linear probing over @ref RECORD_INDEX_SIZE slots. The table
+ *          uses eight bytes per slot and never allocates, so @ref RECORD_INDEX_SIZE is its whole
+ *          memory budget. The functions are not reentrant; the record store calls them with
+ *          the critical region held.
+ */
+
+
+/**@brief   Function for removing all keys from the index. */
+void record_index_clear(void);
+
+
+/**@brief   Function for setting the address of a key.
+ *
+ * @retval  true    If the key was added or updated.
+ * @retval  false   If the key is new and the index is full.
+ */
+bool record_index_put(uint16_t key, uint32_t addr);
+
+
+/**@brief   Function for looking up the address of a key.
+ *
+ * @retval  true    If the key was found; @p p_addr holds its address.
+ * @retval  false   If the key is not in the index.
+ */
+bool record_index_get(uint16_t key, uint32_t * p_addr);
+
+
+/**@brief   Function for checking whether the record of a key has passed its integrity check.
+ *
+ * @retval  true    If @ref record_index_verified_set was called since the address of the key was
+ *                  last set.
+ * @retval  false   Otherwise, or if the key is not in the index.
+ */
+bool record_index_verified(uint16_t key);
+
+
+/**@brief   Function for marking the record of a key as checked, until its address is set again.
+ *          Does nothing if the key is not in the index.
+ */
+void record_index_verified_set(uint16_t key);
+
+
+/**@brief   Function for removing a key. Does nothing if the key is not in the index. */
+void record_index_remove(uint16_t key);
+
+
+/**@brief   Function for finding the smallest key of the index in a range.
+ *
+ * @param[in]   first   Smallest key of the range.
+ * @param[in]   last    Largest key of the range.
+ * @param[out]  p_key   The key found.
+ * @param[out]  p_addr  Its address.
+ *
+ * @retval  true    If a key was found.
+ * @retval  false   If the index holds no key in the range.
+ */
+bool record_index_next(uint16_t first, uint16_t last, uint16_t * p_key, uint32_t * p_addr);
+
+
+/**@brief   Function for retrieving the number of keys in the index. */
+uint32_t record_index_count(void);
+
+
+/**@brief   Function for retrieving the slot table, so that it can be persisted as is.
+ *
+ * @param[out]  p_size  Size of the table, in bytes.
+ *
+ * @return  The slot table.
+ */
+void const * record_index_table(uint32_t * p_size);
+
+
+/**@brief   Function for restoring a slot table retrieved with @ref record_index_table.
+ *
+ * No record is marked as checked in the restored index.
+ *
+ * @param[in]   p_table The slot table. Must be as large as the one of this index.
+ * @param[in]   count   Number of keys in the table.
+ */
+void record_index_restore(void const * p_table, uint32_t count);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RECORD_INDEX_H__
@@ -0,0 +1,164 @@
+#include "record_lz.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "nordic_common.h"
+#include "app_util.h"
+
+
+#define MATCH_MIN       3
+#define MATCH_MAX       (0x7F + MATCH_MIN)
+#define LITERALS_MAX    0x80
+#define WINDOW_SIZE     256
+#define TOKEN_MATCH     0x80
+#define POS_NONE        0xFFFF
+
+/* The hash function yields eight bits. */
+STATIC_ASSERT(RECORD_LZ_TABLE_SIZE == 256);
+
+
+static uint32_t hash(uint8_t const * p)
+{
+    uint32_t const v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+
+    /* Fibonacci hashing, keeping the top eight bits. */
+    return (v * 2654435761u) >> 24;
+}
+
+
+/**@brief   Emit the literals from @p p_src, in runs of at most @ref LITERALS_MAX bytes.
+ *
+ * @return  false if they do not fit.
+ */
+static bool literals_put(uint8_t const * p_src, uint32_t cnt,
+                         uint8_t * p_dest, uint32_t size, uint32_t * p_out)
+{
+    while (cnt > 0)
+    {
+        uint32_t const run = MIN(cnt, LITERALS_MAX);
+
+        if (*p_out + 1 + run > size)
+        {
+            return false;
+        }
+
+        p_dest[(*p_out)++] = (uint8_t)(run - 1);
+        memcpy(&p_dest[*p_out], p_src, run);
+        *p_out += run;
+        p_src  += run;
+        cnt    -= run;
+    }
+    return true;
+}
+
+
+uint32_t record_lz_compress(uint8_t const * p_src,
+                            uint32_t        len,
+                            uint8_t       * p_dest,
+                            uint32_t        size,
+                            uint16_t      * p_table)
+{
+    uint32_t in  = 0;
+    uint32_t out = 0;
+    uint32_t lit = 0;   /* Start of the literals not emitted yet. */
+
+    memset(p_table, 0xFF, RECORD_LZ_TABLE_SIZE * sizeof(uint16_t));
+
+    while (in + MATCH_MIN <= len)
+    {
+        uint32_t const h     = hash(&p_src[in]);
+        uint32_t const cand  = p_table[h];
+        uint32_t       match = 0;
+
+        p_table[h] = (uint16_t)in;
+
+        if ((cand != POS_NONE) && (in - cand <= WINDOW_SIZE))
+        {
+            while (   (in + match < len) && (match < MATCH_MAX)
+                   && (p_src[cand + match] == p_src[in + match]))
+            {
+                match++;
+            }
+        }
+
+        if (match < MATCH_MIN)
+        {
+            in++;
+            continue;
+        }
+
+        if (   !literals_put(&p_src[lit], in - lit, p_dest, size, &out)
+            || (out + 2 > size))
+        {
+            return 0;
+        }
+
+        p_dest[out++] = (uint8_t)(TOKEN_MATCH | (match - MATCH_MIN));
+        p_dest[out++] = (uint8_t)(in - cand - 1);
+
+        in += match;
+        lit = in;
+    }
+
+    if (!literals_put(&p_src[lit], len - lit, p_dest, size, &out))
+    {
+        return 0;
+    }
+
+    return out;
+}
+
+
+ret_code_t record_lz_decompress(uint8_t const * p_src,
+                                uint32_t        len,
+                                uint8_t       * p_dest,
+                                uint32_t      * p_len)
+{
+    uint32_t const size = *p_len;
+    uint32_t       in   = 0;
+    uint32_t       out  = 0;
+
+    while ((in < len) && (out < size))
+    {
+        uint8_t const token = p_src[in++];
+
+        if (token & TOKEN_MATCH)
+        {
+            if (in == len)
+            {
+                return NRF_ERROR_INVALID_DATA;
+            }
+
+            uint32_t const dist = p_src[in++] + 1;
+            uint32_t       cnt  = (token & ~TOKEN_MATCH) + MATCH_MIN;
+
+            if (dist > out)
+            {
+                return NRF_ERROR_INVALID_DATA;
+            }
+
+            /* Byte by byte: the match may overlap the bytes it produces. */
+            for (; (cnt > 0) && (out < size); cnt--, out++)
+            {
+                p_dest[out] = p_dest[out - dist];
+            }
+        }
+        else
+        {
+            uint32_t const cnt = token + 1;
+
+            if (cnt > len - in)
+            {
+                return NRF_ERROR_INVALID_DATA;
+            }
+
+            memcpy(&p_dest[out], &p_src[in], MIN(cnt, size - out));
+            out += MIN(cnt, size - out);
+            in  += cnt;
+        }
+    }
+
+    *p_len = out;
+    return NRF_SUCCESS;
+}
@@ -0,0 +1,75 @@
+#ifndef RECORD_LZ_H__
+#define RECORD_LZ_H__
+
+#include <stdint.h>
+#include "sdk_errors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup record_lz Record compression
+ * @{
+ *
+ * @brief   Small LZ77 codec for the data of records.
+ *
+ * @details The compressed stream is a sequence of tokens. A token byte below 0x80 is followed by
+ *          that many literal bytes plus one. A token byte of 0x80 or more is a match of its low
+ *          seven bits plus three bytes, and is followed by one byte holding the distance back
+ *          to the match minus one, so matches reach at most 256 bytes back.
+ *
+ *          The compressor finds matches with a hash table of @ref RECORD_LZ_TABLE_SIZE entries
+ *          provided by the caller, and uses no other memory. The decompressor needs no memory
+ *          besides its output.
+ */
+
+
+#define RECORD_LZ_TABLE_SIZE    256     //!< Entries of the hash table of @ref record_lz_compress.
+
+
+/**@brief   Function for compressing data.
+ *
+ * @param[in]   p_src       Data to compress.
+ * @param[in]   len         Length of the data, in bytes. At most 0xFFFF.
+ * @param[out]  p_dest      Buffer for the compressed data.
+ * @param[in]   size        Size of @p p_dest.
+ * @param[in]   p_table     Hash table of @ref RECORD_LZ_TABLE_SIZE entries. Its contents on
+ *                          entry do not matter.
+ *
+ * @return  Length of the compressed data, or zero if it does not fit in @p size bytes.
+ */
+uint32_t record_lz_compress(uint8_t const * p_src,
+                            uint32_t        len,
+                            uint8_t       * p_dest,
+                            uint32_t        size,
+                            uint16_t      * p_table);
+
+
+/**@brief   Function for decompressing data.
+ *
+ * Decompression stops once @p p_len bytes have been produced, so the beginning of the data can
+ * be read into a small buffer.
+ *
+ * @param[in]       p_src   Compressed data.
+ * @param[in]       len     Length of the compressed data, in bytes.
+ * @param[out]      p_dest  Buffer for the data.
+ * @param[in,out]   p_len   In: size of @p p_dest. Out: number of bytes produced.
+ *
+ * @retval  NRF_SUCCESS             If the data was decompressed.
+ * @retval  NRF_ERROR_INVALID_DATA  If the compressed data is malformed.
+ */
+ret_code_t record_lz_decompress(uint8_t const * p_src,
+                                uint32_t        len,
+                                uint8_t       * p_dest,
+                                uint32_t      * p_len);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RECORD_LZ_H__
@@ -0,0 +1,2589 @@
+#include "record_store.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "sdk_config.h"
+#include "nordic_common.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+#include "flash_queue.h"
+#include "flash_cache.h"
+#include "record_index.h"
+#include "record_lz.h"
+#include "flash_crc.h"
+#include "flash_trace.h"
+#include "flash_layout.h"
+
+
+#define PAGE_MAGIC          0x33545352  /* "RST3" */
+#define CHECKPOINT_MAGIC    0x314B4352  /* "RCK1" */
+#define KEY_BLANK           0xFFFF      /* Key of an unwritten header. */
+#define KEY_COMMIT          0x0000      /* Key of a transaction commit marker. */
+#define LEN_PACKED          0x8000      /* Set in the length of a compressed record. */
+#define LEN_TXN             0x4000      /* Set in the length of a record of a transaction. */
+#define LEN_FLAGS           (LEN_PACKED | LEN_TXN)
+#define LEN_SCALAR          0x2000      /* Set in the length of a scalar record. */
+#define LEN_CHECK           0x1FFF      /* Check bits in the length of a scalar record. */
+#define WORD_BLANK          0xFFFFFFFF
+
+/* Pages that only compaction may open. */
+#define RESERVED_PAGES      1
+
+/* Pages at the end of the flash area that hold the index checkpoint. */
+#if RECORD_STORE_CHECKPOINT_ENABLED
+#define CHECKPOINT_PAGES    1
+#else
+#define CHECKPOINT_PAGES    0
+#endif
+
+STATIC_ASSERT(RECORD_STORE_MAX_PAGES <= UINT8_MAX);
+STATIC_ASSERT(RECORD_STORE_GC_STEP_SIZE > 0);
+STATIC_ASSERT(RECORD_STORE_KEY_MIN > KEY_COMMIT);
+STATIC_ASSERT((RECORD_STORE_TXN_MAX > 0) && (RECORD_STORE_TXN_MAX < RECORD_STORE_PENDING_SIZE));
+
+
+/**@brief   Header at the start of every page. The erase count is written right after the page
+ *          is erased, the other fields when the page is opened. */
+typedef struct
+{
+    uint32_t erase_cnt; //!< Number of times the page has been erased.
+    uint32_t magic;
+    uint32_t seq;       //!< Incremented for every page opened. Orders the pages in the log.
+} page_hdr_t;
+
+
+/**@brief   Header preceding every record. The data follows, padded to a word boundary.
+ *
+ * A scalar record, whose data is a single word, is only a header: @ref LEN_SCALAR is set in the
+ * length, the word takes the place of the CRC, and the rest of the length holds a check of the
+ * key and the word (see @ref scalar_check).
+ */
+typedef struct
+{
+    uint16_t key;
+    uint16_t len;       //!< Length of the data in flash in bytes, with @ref LEN_PACKED set if it is
+                        //!< compressed and @ref LEN_TXN set if it is part of a transaction. Zero
+                        //!< marks a deleted key.
+    uint32_t crc;       //!< CRC32 of the key, the length without @ref LEN_TXN, and the data. The
+                        //!< data of a scalar record.
+} record_hdr_t;
+
+
+/**@brief   Data of a commit marker, the record that makes a transaction visible.
+ *
+ * The records of a transaction are appended with @ref LEN_TXN set, and the marker is only
+ * appended once they have all been written. When the log is replayed, they take effect when the
+ * marker is reached, and are ignored if there is no marker or its CRC does not match, e.g. after
+ * a torn write. Compaction copies them without the flag, after the marker.
+ */
+typedef struct
+{
+    uint16_t count;     //!< Records in the transaction: the last ones flagged before the marker.
+    uint16_t rfu;
+} commit_t;
+
+
+/**@brief   Header of the data of a compressed record. The output of @ref record_lz_compress
+ *          follows. */
+typedef struct
+{
+    uint16_t len;       //!< Length of the data once decompressed.
+} packed_hdr_t;
+
+
+/**@brief   Header of an index checkpoint. The slot table of the record index follows.
+ *
+ * The checkpoint page starts with its erase count, followed by as many checkpoints as fit. New
+ * checkpoints are appended, and the page is only erased once it is full.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t first_seq; //!< Sequence number of the oldest page when the checkpoint was taken.
+    uint32_t head_seq;  //!< Sequence number of the newest page when the checkpoint was taken.
+    uint32_t head_off;  //!< Records of the newest page before this offset are in the checkpoint.
+    uint16_t slots;     //!< Number of slots in the table.
+    uint16_t count;     //!< Number of keys in the table.
+    uint32_t crc;       //!< CRC32 of the header up to this field, and of the table.
+} checkpoint_hdr_t;
+
+/* A checkpoint, and the erase count before the first one, is written as one request through the
+ * staging buffer of the flash queue. */
+STATIC_ASSERT(sizeof(uint32_t) + sizeof(checkpoint_hdr_t) + 8 * RECORD_INDEX_SIZE
+              <= FLASH_QUEUE_STAGING_SIZE);
+
+
+typedef enum
+{
+    PAGE_FREE,          //!< Erased.
+    PAGE_DIRTY,         //!< Not erased, and not part of the store.
+    PAGE_ERASING,       //!< Dirty, and being erased.
+    PAGE_USED,          //!< Holds records.
+} page_state_t;
+
+
+typedef enum
+{
+    CKPT_IDLE,
+    CKPT_WANTED,        //!< A checkpoint is written once no records are pending.
+    CKPT_WRITING,       //!< The checkpoint page is being erased and written.
+} ckpt_state_t;
+
+
+typedef enum
+{
+    FILL_IDLE,
+    FILL_WRITING,       //!< The header of a record that failed is being filled in.
+    FILL_DONE,          //!< The log can be read past the record that failed.
+    FILL_FAILED,        //!< The log of the page ends at the record that failed.
+} fill_state_t;
+
+
+typedef enum
+{
+    TXN_IDLE,
+    TXN_OPEN,           //!< Records are being added to a transaction.
+    TXN_COMMITTING,     //!< The commit marker is written once the records have been.
+} txn_state_t;
+
+
+/**@brief   A record queued for writing, waiting for its flash queue events. */
+typedef struct
+{
+    uint32_t     addr;    //!< Address of the record header.
+    ret_code_t   result;  //!< Result of the writes reported so far.
+    uint16_t     key;
+    uint16_t     size;    //!< Size of the record in flash, header included.
+    uint16_t     written; //!< Bytes of the record reported written so far.
+    record_hdr_t hdr;     //!< Filled in with a check that fails if the record cannot be written.
+    uint32_t     seq;     //!< Sequence number of the page the record opened, if it did.
+    bool         open;    //!< The record opened its page.
+    bool         deleted; //!< The record is a deletion.
+    bool         copy;    //!< The record is a compaction copy.
+    bool         cached;  //!< The record is held in the write cache until it is written.
+    bool         txn;     //!< The record is part of a transaction.
+    bool         commit;  //!< The record is a commit marker.
+} pending_t;
+
+
+/**@brief   A record of the open transaction that has been written. */
+typedef struct
+{
+    uint32_t addr;
+    uint16_t key;
+    bool     deleted;
+} txn_entry_t;
+
+
+static struct
+{
+    nrf_fstorage_t      const * p_fs;
+    record_store_evt_handler_t  evt_handler;
+    uint32_t                    page_cnt;
+    uint32_t                    free_cnt;
+    uint32_t                    dirty_cnt;      //!< Dirty pages, including those being erased.
+    uint32_t                    erasing_cnt;    //!< Dirty pages being erased.
+    uint32_t                    next_seq;
+    uint32_t                    head_off;       //!< Where the next record goes in the newest page.
+
+    uint8_t                     page_state[RECORD_STORE_MAX_PAGES];
+    uint32_t                    erase_cnt[RECORD_STORE_MAX_PAGES + CHECKPOINT_PAGES];
+    uint8_t                     used[RECORD_STORE_MAX_PAGES];   //!< Used pages, oldest first.
+    uint32_t                    used_first;
+    uint32_t                    used_cnt;
+
+    pending_t                   pending[RECORD_STORE_PENDING_SIZE];
+    uint32_t                    pending_first;
+    uint32_t                    pending_cnt;
+    uint32_t                    copies_pending; //!< Compaction copies among the pending records.
+    bool                        copy_failed;    //!< A compaction copy of this pass failed.
+    uint8_t                     fill_state;     //!< Of the first pending record, if it failed.
+    uint32_t                    hole_addr;      //!< Header left blank in a used page, or zero.
+
+    bool                        index_complete; //!< Every key in flash is in the record index.
+    uint32_t                    ckpt_addr;      //!< Address of the checkpoint page.
+    uint32_t                    ckpt_stride;    //!< Size of a checkpoint in flash.
+    uint32_t                    ckpt_slots;     //!< Checkpoints that fit in the page.
+    uint32_t                    ckpt_next;      //!< Where the next checkpoint goes.
+    uint8_t                     ckpt_state;
+    bool                        ckpt_again;     //!< Requested again while being written.
+
+    bool                        append_active;  //!< An append is in progress.
+    bool                        compact_active; //!< A compaction pass is in progress.
+    bool                        compact_paced;  //!< The pass was started by garbage collection.
+    uint32_t                    gc_budget;      //!< Bytes garbage collection may still copy in this step.
+    uint8_t                     gc_hint;
+    bool                        gc_futile;      //!< The last pass started early freed no page.
+    uint32_t                    gc_used_start;  //!< Used pages when the pass started.
+    bool                        bg_running;
+    bool                        bg_pending;
+    bool                        victim_erasing;
+    uint8_t                     victim;
+    uint32_t                    victim_off;
+    uint32_t                    corrupt_cnt;    //!< Reads that failed the integrity check.
+    uint32_t                    bytes_saved;    //!< Flash bytes saved by compression.
+
+    uint8_t                     txn_state;
+    bool                        commit_queued;  //!< The commit marker has been queued.
+    uint32_t                    txn_cnt;        //!< Records queued in the transaction.
+    uint32_t                    txn_done;       //!< Records of the transaction written so far.
+    uint32_t                    txn_orphans;    //!< Records of aborted transactions still pending.
+    ret_code_t                  txn_result;     //!< First error reported for a record.
+    txn_entry_t                 txn[RECORD_STORE_TXN_MAX];
+} m_store;
+
+#if RECORD_STORE_COMPRESS_ENABLED
+/* Records are compressed one at a time, before the critical region is entered. */
+static struct
+{
+    uint16_t table[RECORD_LZ_TABLE_SIZE];
+    uint8_t  buf[RECORD_STORE_COMPRESS_BUF_SIZE];
+    bool     busy;
+} m_lz;
+#endif
+
+
+static void flash_evt_handler(flash_queue_evt_t const * p_evt);
+static void fill_evt_handler(flash_queue_evt_t const * p_evt);
+static void pending_pop(void);
+static void checkpoint_request(void);
+static void background_run(void);
+
+
+static uint32_t page_addr(uint32_t page)
+{
+    return m_store.p_fs->start_addr + (page << FLASH_LAYOUT_PAGE_SHIFT);
+}
+
+
+static uint32_t page_of(uint32_t addr)
+{
+    return (addr - m_store.p_fs->start_addr) >> FLASH_LAYOUT_PAGE_SHIFT;
+}
+
+
+static uint32_t used_page(uint32_t i)
+{
+    return m_store.used[(m_store.used_first + i) % RECORD_STORE_MAX_PAGES];
+}
+
+
+static uint32_t head_page(void)
+{
+    return used_page(m_store.used_cnt - 1);
+}
+
+
+static bool record_is_scalar(uint16_t len)
+{
+    return (len & LEN_SCALAR) != 0;
+}
+
+
+/**@brief   Length of the data of a record in flash, from the length in its header. */
+static uint16_t record_len(uint16_t len)
+{
+    return record_is_scalar(len) ? sizeof(uint32_t) : (len & ~LEN_FLAGS);
+}
+
+
+/**@brief   Size of a record in flash, from the length in its header. */
+static uint32_t record_size(uint16_t len)
+{
+    if (record_is_scalar(len))
+    {
+        return sizeof(record_hdr_t);
+    }
+
+    len = record_len(len);
+    return sizeof(record_hdr_t) + CEIL_DIV(len, sizeof(uint32_t)) * sizeof(uint32_t);
+}
+
+
+/**@brief   Offset of the data of a record from its header, from the length in the header. */
+static uint32_t record_data_off(uint16_t len)
+{
+    return record_is_scalar(len) ? offsetof(record_hdr_t, crc) : sizeof(record_hdr_t);
+}
+
+
+/**@brief   Compute the check bits of a scalar record. They are the low bits of the CRC32 of the
+ *          key and the value, which is enough to catch a torn write of the value. */
+static uint16_t scalar_check(uint16_t key, uint32_t value)
+{
+    record_hdr_t const hdr = { .key = key, .len = LEN_SCALAR, .crc = value };
+
+    return flash_crc32(&hdr, sizeof(hdr), NULL) & LEN_CHECK;
+}
+
+
+/**@brief   Compute the CRC32 of a record, from its key and length and from its data. The
+ *          transaction flag is left out, so that compaction copies can clear it. */
+static uint32_t record_crc(record_hdr_t const * p_hdr, void const * p_data)
+{
+    record_hdr_t const hdr = { .key = p_hdr->key, .len = p_hdr->len & ~LEN_TXN };
+    uint32_t     const crc = flash_crc32(&hdr, offsetof(record_hdr_t, crc), NULL);
+
+    return flash_crc32(p_data, record_len(p_hdr->len), &crc);
+}
+
+
+/**@brief   Check a record against its CRC, or its check bits if it is a scalar record. */
+static bool record_check(record_hdr_t const * p_hdr, void const * p_data)
+{
+    return record_is_scalar(p_hdr->len)
+           ? (scalar_check(p_hdr->key, p_hdr->crc) == (p_hdr->len & LEN_CHECK))
+           : (record_crc(p_hdr, p_data) == p_hdr->crc);
+}
+
+
+static uint32_t const * flash_ptr(uint32_t addr)
+{
+    return (uint32_t const *)nrf_fstorage_rmap(m_store.p_fs, addr);
+}
+
+
+/**@brief   Read the header of the record at @p addr.
+ *
+ * @return  false if there is no record at @p addr: the rest of the page is blank, or the header
+ *          does not describe a record that fits in the page.
+ */
+static bool record_hdr_get(uint32_t page_end, uint32_t addr, record_hdr_t * p_hdr)
+{
+    if (addr + sizeof(record_hdr_t) > page_end)
+    {
+        return false;
+    }
+
+    memcpy(p_hdr, flash_ptr(addr), sizeof(record_hdr_t));
+
+    return (p_hdr->key != KEY_BLANK) && (addr + record_size(p_hdr->len) <= page_end);
+}
+
+
+/**@brief   Check if the record at @p addr is an intact commit marker, and read it. */
+static bool commit_get(uint32_t addr, record_hdr_t const * p_hdr, commit_t * p_commit)
+{
+    void const * const p_data = flash_ptr(addr + sizeof(record_hdr_t));
+
+    if ((p_hdr->len != sizeof(commit_t)) || (record_crc(p_hdr, p_data) != p_hdr->crc))
+    {
+        return false;
+    }
+
+    memcpy(p_commit, p_data, sizeof(commit_t));
+    return (p_commit->count > 0) && (p_commit->count <= RECORD_STORE_TXN_MAX);
+}
+
+
+/**@brief   Function for visiting a record of the log. */
+typedef void (*record_visit_t)(uint32_t addr, record_hdr_t const * p_hdr, void * p_ctx);
+
+
+/**@brief   Visit the records of the log in the order they took effect, starting at offset
+ *          @p first_off of used page @p first.
+ *
+ * Records of a transaction are held back until its commit marker, and skipped if there is none.
+ * The records of a transaction that precede the oldest page were copied by compaction, and are
+ * visited as ordinary records after the marker. Commit markers are not visited.
+ */
+static void log_walk(uint32_t first, uint32_t first_off, record_visit_t visit, void * p_ctx)
+{
+    struct
+    {
+        uint32_t     addr;
+        record_hdr_t hdr;
+    } held[RECORD_STORE_TXN_MAX];
+
+    uint32_t held_cnt = 0;  /* Flagged records since the last marker. The last ones are kept. */
+
+    for (uint32_t i = first; i < m_store.used_cnt; i++)
+    {
+        uint32_t const base = page_addr(used_page(i));
+        uint32_t const end  = base + FLASH_LAYOUT_PAGE_SIZE;
+        record_hdr_t   hdr;
+
+        for (uint32_t addr = base + ((i == first) ? first_off : sizeof(page_hdr_t));
+             record_hdr_get(end, addr, &hdr);
+             addr += record_size(hdr.len))
+        {
+            commit_t commit;
+
+            if (hdr.key == KEY_COMMIT)
+            {
+                if (commit_get(addr, &hdr, &commit))
+                {
+                    for (uint32_t j = held_cnt - MIN(held_cnt, commit.count); j < held_cnt; j++)
+                    {
+                        visit(held[j % RECORD_STORE_TXN_MAX].addr,
+                              &held[j % RECORD_STORE_TXN_MAX].hdr, p_ctx);
+                    }
+                }
+                /* Records left over were from transactions that were aborted. */
+                held_cnt = 0;
+            }
+            else if (hdr.len & LEN_TXN)
+            {
+                held[held_cnt % RECORD_STORE_TXN_MAX].addr = addr;
+                held[held_cnt % RECORD_STORE_TXN_MAX].hdr  = hdr;
+                held_cnt++;
+            }
+            else
+            {
+                visit(addr, &hdr, p_ctx);
+            }
+        }
+    }
+}
+
+
+typedef struct
+{
+    uint16_t     key;
+    bool         found;
+    uint32_t     addr;
+    record_hdr_t hdr;
+} scan_ctx_t;
+
+
+static void scan_visit(uint32_t addr, record_hdr_t const * p_hdr, void * p_ctx)
+{
+    scan_ctx_t * const p_scan = p_ctx;
+
+    /* Records that could not be written, or were torn, do not hide the ones before them. */
+    if (   (p_hdr->key == p_scan->key)
+        && record_check(p_hdr, flash_ptr(addr + record_data_off(p_hdr->len))))
+    {
+        p_scan->addr  = addr;
+        p_scan->hdr   = *p_hdr;
+        p_scan->found = true;
+    }
+}
+
+
+/**@brief   Find the newest record with the given key that has reached flash and taken effect, by
+ *          scanning. */
+static bool record_scan(uint16_t key, uint32_t * p_addr, record_hdr_t * p_hdr)
+{
+    scan_ctx_t scan = { .key = key };
+
+    log_walk(0, sizeof(page_hdr_t), scan_visit, &scan);
+
+    if (scan.found)
+    {
+        *p_addr = scan.addr;
+        *p_hdr  = scan.hdr;
+    }
+    return scan.found;
+}
+
+
+/**@brief   Record that @p addr holds the current copy of @p key. */
+static void index_update(uint16_t key, uint32_t addr, bool deleted)
+{
+    if (deleted)
+    {
+        record_index_remove(key);
+    }
+    else if (!record_index_put(key, addr))
+    {
+        m_store.index_complete = false;
+    }
+}
+
+
+/**@brief   Find the current copy of a record. Deleted keys are reported with a length of zero if
+ *          the index has overflowed, and not found otherwise. Must be called with the critical
+ *          region held. */
+static bool record_locate(uint16_t key, uint32_t * p_addr, record_hdr_t * p_hdr)
+{
+    if (record_index_get(key, p_addr))
+    {
+        memcpy(p_hdr, flash_ptr(*p_addr), sizeof(record_hdr_t));
+        return true;
+    }
+
+    return !m_store.index_complete && record_scan(key, p_addr, p_hdr);
+}
+
+
+/**@brief   Check the CRC of the current copy of a record, unless it has already passed since it
+ *          was written or the store was initialized. The index keeps the result until the key
+ *          moves, so keys missing from it are checked every time. Must be called with the
+ *          critical region held. */
+static bool record_is_intact(uint16_t key, record_hdr_t const * p_hdr, void const * p_data)
+{
+    if (record_index_verified(key))
+    {
+        return true;
+    }
+    if (!record_check(p_hdr, p_data))
+    {
+        m_store.corrupt_cnt++;
+        return false;
+    }
+
+    record_index_verified_set(key);
+    return true;
+}
+
+
+/**@brief   Copy the data of a record, decompressing it if needed.
+ *
+ * @param[in]       p_hdr   Header of the record.
+ * @param[in]       p_data  Data of the record, as in flash.
+ * @param[out]      p_dest  Buffer to copy the data into.
+ * @param[in,out]   p_len   In: size of @p p_dest. Out: length of the record.
+ */
+static ret_code_t record_data_get(record_hdr_t const * p_hdr,
+                                  uint8_t      const * p_data,
+                                  void               * p_dest,
+                                  uint16_t           * p_len)
+{
+    uint16_t const stored = record_len(p_hdr->len);
+
+    if ((p_hdr->len & LEN_PACKED) == 0)
+    {
+        memcpy(p_dest, p_data, MIN(*p_len, stored));
+        *p_len = stored;
+        return NRF_SUCCESS;
+    }
+
+    packed_hdr_t   packed;
+
+    if (stored < sizeof(packed))
+    {
+        return NRF_ERROR_INVALID_DATA;
+    }
+    memcpy(&packed, p_data, sizeof(packed));
+
+    uint32_t const want = MIN(*p_len, packed.len);
+    uint32_t       got  = want;
+    ret_code_t     rc   = record_lz_decompress(p_data + sizeof(packed), stored - sizeof(packed),
+                                               p_dest, &got);
+
+    if ((rc == NRF_SUCCESS) && (got != want))
+    {
+        rc = NRF_ERROR_INVALID_DATA;
+    }
+    if (rc == NRF_SUCCESS)
+    {
+        *p_len = packed.len;
+    }
+    return rc;
+}
+
+
+/**@brief   Find the newest pending record with the given key. Records of transactions only take
+ *          effect once committed, and are left out. */
+static pending_t const * pending_find(uint16_t key)
+{
+    for (uint32_t i = m_store.pending_cnt; i > 0; i--)
+    {
+        pending_t const * const p_pending =
+            &m_store.pending[(m_store.pending_first + i - 1) % RECORD_STORE_PENDING_SIZE];
+
+        if ((p_pending->key == key) && !p_pending->txn)
+        {
+            return p_pending;
+        }
+    }
+    return NULL;
+}
+
+
+static void evt_send(record_store_evt_id_t id, ret_code_t result, uint16_t key)
+{
+    if (m_store.evt_handler != NULL)
+    {
+        record_store_evt_t const evt =
+        {
+            .id     = id,
+            .result = result,
+            .key    = key,
+        };
+
+        m_store.evt_handler(&evt);
+    }
+}
+
+
+/**@brief   Pick the erased page to open next: the least worn one, or of those the first one after
+ *          the newest page. Callers check m_store.free_cnt first. */
+static uint32_t free_page_get(void)
+{
+    uint32_t const first = (m_store.used_cnt > 0) ? (head_page() + 1) : 0;
+    uint32_t       best  = m_store.page_cnt;
+
+    for (uint32_t i = 0; i < m_store.page_cnt; i++)
+    {
+        uint32_t const page = (first + i) % m_store.page_cnt;
+        if (   (m_store.page_state[page] == PAGE_FREE)
+            && ((best == m_store.page_cnt) || (m_store.erase_cnt[page] < m_store.erase_cnt[best])))
+        {
+            best = page;
+        }
+    }
+
+    return (best < m_store.page_cnt) ? best : 0;
+}
+
+
+/**@brief   Queue a record for writing. Must be called with the critical region held. */
+static ret_code_t record_append_locked(record_hdr_t const * p_hdr, void const * p_data, bool copy)
+{
+    static uint32_t const pad = WORD_BLANK;
+
+    uint16_t const key    = p_hdr->key;
+    bool     const scalar = record_is_scalar(p_hdr->len);
+    uint16_t const len    = scalar ? 0 : record_len(p_hdr->len);    /* The header holds scalars. */
+    uint32_t const size   = record_size(p_hdr->len);
+    bool     const txn    = (p_hdr->len & LEN_TXN) != 0;
+    bool     const commit = (key == KEY_COMMIT);
+
+    if (txn && (m_store.txn_state != TXN_OPEN))
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if (   (m_store.pending_cnt == RECORD_STORE_PENDING_SIZE)
+        || (txn && (m_store.txn_cnt == RECORD_STORE_TXN_MAX)))
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    bool const open = (m_store.used_cnt == 0) || (m_store.head_off + size > FLASH_LAYOUT_PAGE_SIZE);
+
+    /* Compaction does not run while a transaction is open, so its commit marker may take the
+     * reserved page. */
+    if (open && (m_store.free_cnt <= ((copy || commit) ? 0 : RESERVED_PAGES)))
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    uint32_t     const page     = open ? free_page_get() : head_page();
+    uint32_t     const off      = open ? sizeof(page_hdr_t) : m_store.head_off;
+    uint32_t     const head_off = m_store.head_off;
+    page_hdr_t   const page_hdr = { .magic = PAGE_MAGIC, .seq = m_store.next_seq };
+
+    /* The erase count of the page is already in flash. */
+    uint32_t const hdr_skip = offsetof(page_hdr_t, magic);
+
+    flash_queue_seg_t segs[4];
+    uint32_t          seg_cnt = 0;
+
+    if (open)
+    {
+        segs[seg_cnt++] = (flash_queue_seg_t){ .p_data = &page_hdr.magic,
+                                               .len    = sizeof(page_hdr) - hdr_skip };
+    }
+    segs[seg_cnt++] = (flash_queue_seg_t){ .p_data = p_hdr, .len = sizeof(record_hdr_t) };
+    if (len > 0)
+    {
+        segs[seg_cnt++] = (flash_queue_seg_t){ .p_data = p_data, .len = len };
+    }
+    if (size - sizeof(record_hdr_t) > len)
+    {
+        segs[seg_cnt++] = (flash_queue_seg_t){ .p_data = &pad,
+                                               .len    = size - sizeof(record_hdr_t) - len };
+    }
+
+    /* Small records are coalesced in the write cache, where reads find them right away. */
+    uint32_t const wlen   = size + (open ? sizeof(page_hdr) - hdr_skip : 0);
+    bool     const cached = (wlen <= FLASH_CACHE_LINE_SIZE);
+
+    /* Update the bookkeeping first: nrf_fstorage_nvmc reports the write before returning. */
+    pending_t * const p_pending =
+        &m_store.pending[(m_store.pending_first + m_store.pending_cnt) % RECORD_STORE_PENDING_SIZE];
+
+    p_pending->addr    = page_addr(page) + off;
+    p_pending->key     = key;
+    p_pending->size    = size;
+    p_pending->deleted = !scalar && (len == 0);
+    p_pending->copy    = copy;
+    p_pending->cached  = cached;
+    p_pending->txn     = txn;
+    p_pending->commit  = commit;
+    p_pending->written = 0;
+    p_pending->hdr     = *p_hdr;
+    p_pending->seq     = page_hdr.seq;
+    p_pending->open    = open;
+    p_pending->result  = NRF_SUCCESS;
+    m_store.pending_cnt++;
+    m_store.copies_pending += copy ? 1 : 0;
+    m_store.txn_cnt        += txn ? 1 : 0;
+
+    if (open)
+    {
+        m_store.page_state[page] = PAGE_USED;
+        m_store.used[(m_store.used_first + m_store.used_cnt) % RECORD_STORE_MAX_PAGES] = page;
+        m_store.used_cnt++;
+        m_store.free_cnt--;
+        m_store.next_seq++;
+    }
+    m_store.head_off = off + size;
+
+    if (open)
+    {
+        /* Keep the part of the log replayed at initialization within about a page. */
+        checkpoint_request();
+    }
+
+    uint32_t const dest = page_addr(page) + (open ? hdr_skip : off);
+
+    FLASH_TRACE(FLASH_TRACE_RECORD_APPEND, key, p_pending->addr);
+
+    ret_code_t rc;
+
+    if (cached)
+    {
+        rc = flash_cache_write_gather(m_store.p_fs, dest, segs, seg_cnt, flash_evt_handler, NULL);
+    }
+    else
+    {
+        /* Records still in the cache must be written first, to keep the log in order. */
+        rc = flash_cache_sync();
+        if (rc == NRF_SUCCESS)
+        {
+            rc = flash_queue_write_gather(m_store.p_fs, dest, segs, seg_cnt, flash_evt_handler, NULL);
+        }
+    }
+
+    if ((rc == NRF_SUCCESS) && !copy)
+    {
+        /* The record may supersede older ones, which a pass could then drop. */
+        m_store.gc_futile = false;
+    }
+    if (rc != NRF_SUCCESS)
+    {
+        m_store.pending_cnt--;
+        m_store.copies_pending -= copy ? 1 : 0;
+        m_store.txn_cnt        -= txn ? 1 : 0;
+        if (open)
+        {
+            m_store.page_state[page] = PAGE_FREE;
+            m_store.used_cnt--;
+            m_store.free_cnt++;
+            m_store.next_seq--;
+        }
+        m_store.head_off = head_off;
+    }
+
+    return rc;
+}
+
+
+/**@brief   Queue a record for writing. The CRC of new records is computed here, outside the
+ *          critical region; compaction copies keep the one they were written with, so that
+ *          corruption of the original is still detected in the copy. The same goes for the
+ *          check bits of scalar records, whose value @p p_data points to. */
+static ret_code_t record_append(uint16_t         key,
+                                void     const * p_data,
+                                uint16_t         len,
+                                uint32_t const * p_crc)
+{
+    ret_code_t   rc;
+    record_hdr_t hdr  = { .key = key, .len = len };
+    bool const   copy = (p_crc != NULL);
+
+    if (record_size(len) > FLASH_LAYOUT_PAGE_SIZE - sizeof(page_hdr_t))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    if (record_is_scalar(len))
+    {
+        memcpy(&hdr.crc, p_data, sizeof(hdr.crc));
+        if (!copy)
+        {
+            hdr.len |= scalar_check(key, hdr.crc);
+        }
+    }
+    else
+    {
+        hdr.crc = copy ? *p_crc : record_crc(&hdr, p_data);
+    }
+
+    CRITICAL_REGION_ENTER();
+    if (m_store.append_active)
+    {
+        /* Called from an event handler while an append is already in progress. */
+        rc = NRF_ERROR_BUSY;
+    }
+    else
+    {
+        m_store.append_active = true;
+        rc = record_append_locked(&hdr, p_data, copy);
+        m_store.append_active = false;
+    }
+    CRITICAL_REGION_EXIT();
+
+    return rc;
+}
+
+
+/**@brief   Check if garbage collection has a step to itself, and take it. Erasing a page and
+ *          writing a checkpoint each take a whole step. */
+static bool gc_step_take(void)
+{
+    if (m_store.gc_budget < RECORD_STORE_GC_STEP_SIZE)
+    {
+        return false;
+    }
+    m_store.gc_budget = 0;
+    return true;
+}
+
+
+/**@brief   Give back a step taken for an operation that could not be queued. */
+static void gc_step_give_back(void)
+{
+    m_store.gc_budget = RECORD_STORE_GC_STEP_SIZE;
+}
+
+
+/**@brief   Erase a dirty page, to add it to the pool of erased pages. Takes a whole step. */
+static void dirty_steps(void)
+{
+    uint32_t page = 0;
+
+    if ((m_store.dirty_cnt == m_store.erasing_cnt) || (m_store.erasing_cnt > 0) || !gc_step_take())
+    {
+        return;
+    }
+
+    while (m_store.page_state[page] != PAGE_DIRTY)
+    {
+        page++;
+    }
+
+    m_store.page_state[page] = PAGE_ERASING;
+    m_store.erasing_cnt++;
+
+    ret_code_t const rc = flash_queue_erase(m_store.p_fs, page_addr(page), 1, flash_evt_handler, NULL);
+    if (rc != NRF_SUCCESS)
+    {
+        m_store.page_state[page] = PAGE_DIRTY;
+        m_store.erasing_cnt--;
+        gc_step_give_back();
+    }
+}
+
+
+/**@brief   Advance the compaction pass as far as the queues allow, and for passes started by
+ *          garbage collection, as far as the budget of the current step allows. The pass waits
+ *          while a transaction is open: its records could be erased with the victim, or a copy
+ *          could supersede them. */
+static void compact_steps(void)
+{
+    while (m_store.compact_active && !m_store.victim_erasing && (m_store.txn_state == TXN_IDLE))
+    {
+        uint32_t const base = page_addr(m_store.victim);
+        uint32_t const addr = base + m_store.victim_off;
+        record_hdr_t   hdr;
+
+        if (!record_hdr_get(base + FLASH_LAYOUT_PAGE_SIZE, addr, &hdr))
+        {
+            /* Erase only once every copy is known to have reached flash. */
+            if (m_store.copies_pending > 0)
+            {
+                (void) flash_cache_sync();
+                return;
+            }
+            if (m_store.copy_failed)
+            {
+                m_store.compact_active = false;
+                evt_send(RECORD_STORE_EVT_COMPACT, NRF_ERROR_INTERNAL, 0);
+                return;
+            }
+            if (m_store.compact_paced && !gc_step_take())
+            {
+                return;
+            }
+
+            m_store.victim_erasing = true;
+
+            FLASH_TRACE(FLASH_TRACE_COMPACT_ERASE, base, 0);
+
+            ret_code_t const rc = flash_queue_erase(m_store.p_fs, base, 1, flash_evt_handler, NULL);
+            if (rc != NRF_SUCCESS)
+            {
+                m_store.victim_erasing = false;
+                if (m_store.compact_paced)
+                {
+                    gc_step_give_back();
+                }
+                if (rc != NRF_ERROR_NO_MEM)
+                {
+                    m_store.compact_active = false;
+                    evt_send(RECORD_STORE_EVT_COMPACT, rc, 0);
+                }
+            }
+            return;
+        }
+
+        uint32_t     cur_addr;
+        record_hdr_t cur_hdr;
+        bool         current;
+        bool         superseded;
+
+        /* Copy the record only if it is the current copy of a key that was not deleted. */
+        CRITICAL_REGION_ENTER();
+        current =    (hdr.key != KEY_COMMIT)
+                  && (record_len(hdr.len) != 0)
+                  && record_locate(hdr.key, &cur_addr, &cur_hdr)
+                  && (cur_addr == addr);
+        superseded = current && (pending_find(hdr.key) != NULL);
+        CRITICAL_REGION_EXIT();
+
+        if (superseded)
+        {
+            /* A newer write of the key is queued, but it can still fail: the current copy may
+             * only be left behind once that write has reached flash. A copy made now would be
+             * appended after it and win. Resumed on the next flash queue event. */
+            (void) flash_cache_sync();
+            return;
+        }
+
+        if (current && m_store.compact_paced && (m_store.gc_budget == 0))
+        {
+            /* Hand this step's copies to the flash queue, and resume in the next step. */
+            (void) flash_cache_sync();
+            return;
+        }
+
+        if (current)
+        {
+            /* The transaction of the record, if any, is committed: the copy takes effect as is. */
+            ret_code_t const rc = record_append(hdr.key,
+                                                flash_ptr(addr + record_data_off(hdr.len)),
+                                                hdr.len & ~LEN_TXN, &hdr.crc);
+            if ((rc == NRF_ERROR_NO_MEM) || (rc == NRF_ERROR_BUSY))
+            {
+                /* Resumed on the next flash queue event. */
+                return;
+            }
+            if (rc != NRF_SUCCESS)
+            {
+                m_store.compact_active = false;
+                evt_send(RECORD_STORE_EVT_COMPACT, rc, 0);
+                return;
+            }
+            m_store.gc_budget -= MIN(m_store.gc_budget, record_size(hdr.len));
+        }
+
+        m_store.victim_off += record_size(hdr.len);
+    }
+}
+
+
+#if RECORD_STORE_CHECKPOINT_ENABLED
+
+static void checkpoint_evt_handler(flash_queue_evt_t const * p_evt)
+{
+    if (p_evt->id == FLASH_QUEUE_EVT_ERASE_RESULT)
+    {
+        /* The checkpoint is written in the next step, or the erase is tried again: writing over
+         * the checkpoints of a page that failed to erase would program words twice. */
+        CRITICAL_REGION_ENTER();
+        if (p_evt->result == NRF_SUCCESS)
+        {
+            m_store.ckpt_next = 0;
+            m_store.erase_cnt[m_store.page_cnt]++;
+        }
+        m_store.ckpt_state = CKPT_WANTED;
+        m_store.ckpt_again = false;
+        CRITICAL_REGION_EXIT();
+    }
+    else
+    {
+        /* The checkpoint just written may predate the records of a later request. */
+        CRITICAL_REGION_ENTER();
+        m_store.ckpt_state = m_store.ckpt_again ? CKPT_WANTED : CKPT_IDLE;
+        m_store.ckpt_again = false;
+        CRITICAL_REGION_EXIT();
+        evt_send(RECORD_STORE_EVT_CHECKPOINT, p_evt->result, 0);
+    }
+
+    background_run();
+}
+
+
+static uint32_t checkpoint_addr(uint32_t slot)
+{
+    return m_store.ckpt_addr + sizeof(uint32_t) + slot * m_store.ckpt_stride;
+}
+
+
+static void checkpoint_request(void)
+{
+    if (m_store.ckpt_state == CKPT_IDLE)
+    {
+        m_store.ckpt_state = CKPT_WANTED;
+    }
+    else if (m_store.ckpt_state == CKPT_WRITING)
+    {
+        m_store.ckpt_again = true;
+    }
+}
+
+
+/**@brief   Write the requested checkpoint once the index matches the log. */
+static void checkpoint_steps(void)
+{
+    ret_code_t rc;
+
+    if (m_store.ckpt_state != CKPT_WANTED)
+    {
+        return;
+    }
+    if (!m_store.index_complete)
+    {
+        /* A checkpoint without every key would hide records from lookups. */
+        m_store.ckpt_state = CKPT_IDLE;
+        evt_send(RECORD_STORE_EVT_CHECKPOINT, NRF_ERROR_NO_MEM, 0);
+        return;
+    }
+    if (   (m_store.pending_cnt > 0) || m_store.compact_active || (m_store.used_cnt == 0)
+        || (m_store.txn_state != TXN_IDLE) || !gc_step_take())
+    {
+        /* Resumed in a later garbage collection step. */
+        return;
+    }
+
+    /* Append to the checkpoint page, and erase it only once there is no room left. */
+    uint32_t const slot = m_store.ckpt_next;
+
+    m_store.ckpt_state = CKPT_WRITING;
+
+    if (slot == m_store.ckpt_slots)
+    {
+        rc = flash_queue_erase(m_store.p_fs, m_store.ckpt_addr, 1, checkpoint_evt_handler, NULL);
+        if (rc != NRF_SUCCESS)
+        {
+            m_store.ckpt_state = (rc == NRF_ERROR_NO_MEM) ? CKPT_WANTED : CKPT_IDLE;
+            gc_step_give_back();
+        }
+        return;
+    }
+    m_store.ckpt_next = slot + 1;
+
+    /* The erase count goes in with the first checkpoint, unless it is already in flash. */
+    bool const with_cnt = (slot == 0) && (*flash_ptr(m_store.ckpt_addr) == WORD_BLANK);
+
+    uint32_t           size;
+    void const * const p_table = record_index_table(&size);
+
+    CRITICAL_REGION_ENTER();
+    checkpoint_hdr_t hdr =
+    {
+        .magic     = CHECKPOINT_MAGIC,
+        .first_seq = ((page_hdr_t const *)flash_ptr(page_addr(used_page(0))))->seq,
+        .head_seq  = ((page_hdr_t const *)flash_ptr(page_addr(head_page())))->seq,
+        .head_off  = m_store.head_off,
+        .slots     = RECORD_INDEX_SIZE,
+        .count     = record_index_count(),
+    };
+
+    hdr.crc = flash_crc32((uint8_t const *)&hdr, offsetof(checkpoint_hdr_t, crc), NULL);
+    hdr.crc = flash_crc32(p_table, size, &hdr.crc);
+
+    flash_queue_seg_t const segs[] =
+    {
+        { .p_data = &m_store.erase_cnt[m_store.page_cnt], .len = sizeof(uint32_t) },
+        { .p_data = &hdr,                                 .len = sizeof(hdr)      },
+        { .p_data = p_table,                              .len = size             },
+    };
+
+    rc = flash_queue_write_gather(m_store.p_fs,
+                                  with_cnt ? m_store.ckpt_addr : checkpoint_addr(slot),
+                                  with_cnt ? segs : &segs[1],
+                                  with_cnt ? ARRAY_SIZE(segs) : ARRAY_SIZE(segs) - 1,
+                                  checkpoint_evt_handler, NULL);
+    CRITICAL_REGION_EXIT();
+
+    if (rc != NRF_SUCCESS)
+    {
+        m_store.ckpt_next  = slot;
+        m_store.ckpt_state = (rc == NRF_ERROR_NO_MEM) ? CKPT_WANTED : CKPT_IDLE;
+        gc_step_give_back();
+    }
+}
+
+
+/**@brief   Restore the index from a checkpoint, if it is valid for the log found in flash.
+ *
+ * @param[in]   addr    Address of the checkpoint.
+ * @param[in]   p_seq   Sequence numbers of the used pages, oldest first.
+ * @param[out]  p_page  Position in the used pages where replay must start.
+ * @param[out]  p_off   Offset in that page where replay must start.
+ */
+/**@brief   Read the header of the checkpoint at @p addr, if the checkpoint is intact. */
+static bool checkpoint_hdr_get(uint32_t addr, checkpoint_hdr_t * p_hdr)
+{
+    uint32_t size;
+    uint32_t crc;
+
+    (void) record_index_table(&size);
+    memcpy(p_hdr, flash_ptr(addr), sizeof(*p_hdr));
+
+    if (   (p_hdr->magic != CHECKPOINT_MAGIC)
+        || (p_hdr->slots != RECORD_INDEX_SIZE)
+        || (p_hdr->head_off > FLASH_LAYOUT_PAGE_SIZE))
+    {
+        return false;
+    }
+
+    crc = flash_crc32((uint8_t const *)p_hdr, offsetof(checkpoint_hdr_t, crc), NULL);
+    crc = flash_crc32(flash_ptr(addr + sizeof(*p_hdr)), size, &crc);
+
+    return (crc == p_hdr->crc);
+}
+
+
+static bool checkpoint_slot_load(uint32_t addr, uint32_t const * p_seq, uint32_t * p_page,
+                                 uint32_t * p_off)
+{
+    checkpoint_hdr_t hdr;
+    uint32_t         page = 0;
+
+    if ((m_store.used_cnt == 0) || !checkpoint_hdr_get(addr, &hdr))
+    {
+        return false;
+    }
+
+    /* A page compacted since the checkpoint was taken may be referenced by it. */
+    if (p_seq[0] != hdr.first_seq)
+    {
+        return false;
+    }
+    while ((page < m_store.used_cnt) && (p_seq[page] != hdr.head_seq))
+    {
+        page++;
+    }
+    if (page == m_store.used_cnt)
+    {
+        return false;
+    }
+
+    record_index_restore(flash_ptr(addr + sizeof(hdr)), hdr.count);
+    *p_page = page;
+    *p_off  = hdr.head_off;
+
+    return true;
+}
+
+
+/**@brief   Restore the index from the newest checkpoint that is valid for the log found in flash.
+ *          Falls back to older checkpoints if the newest one was torn. */
+static bool checkpoint_load(uint32_t const * p_seq, uint32_t * p_page, uint32_t * p_off)
+{
+    for (uint32_t slot = m_store.ckpt_next; slot > 0; slot--)
+    {
+        if (checkpoint_slot_load(checkpoint_addr(slot - 1), p_seq, p_page, p_off))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+#else
+
+static void checkpoint_request(void)
+{
+}
+
+
+static void checkpoint_steps(void)
+{
+}
+
+#endif // RECORD_STORE_CHECKPOINT_ENABLED
+
+
+/**@brief   End the transaction being committed, and report the result. */
+static void txn_finish(ret_code_t result)
+{
+    FLASH_TRACE(FLASH_TRACE_COMMIT_DONE, m_store.txn_cnt, result);
+
+    CRITICAL_REGION_ENTER();
+    m_store.txn_state     = TXN_IDLE;
+    m_store.commit_queued = false;
+    CRITICAL_REGION_EXIT();
+
+    evt_send(RECORD_STORE_EVT_COMMIT, result, 0);
+}
+
+
+/**@brief   Queue the commit marker of the transaction being committed, once all of its records
+ *          have been written. */
+static void txn_steps(void)
+{
+    ret_code_t rc;
+    commit_t   commit = { .rfu = 0xFFFF };
+    bool       ready;
+
+    CRITICAL_REGION_ENTER();
+    ready        =    (m_store.txn_state == TXN_COMMITTING) && !m_store.commit_queued
+                   && (m_store.txn_done == m_store.txn_cnt);
+    rc           = m_store.txn_result;
+    commit.count = (uint16_t)m_store.txn_cnt;
+    CRITICAL_REGION_EXIT();
+
+    if (!ready)
+    {
+        return;
+    }
+    if ((rc != NRF_SUCCESS) || (commit.count == 0))
+    {
+        /* Without a marker, the records written are ignored. */
+        txn_finish(rc);
+        return;
+    }
+
+    /* Set first: nrf_fstorage_nvmc reports the write before returning. */
+    m_store.commit_queued = true;
+
+    rc = record_append(KEY_COMMIT, &commit, sizeof(commit), NULL);
+    if (rc == NRF_SUCCESS)
+    {
+        /* Do not wait for the cache to be flushed. */
+        (void) flash_cache_sync();
+    }
+    else
+    {
+        m_store.commit_queued = false;
+        if ((rc != NRF_ERROR_NO_MEM) || (m_store.pending_cnt == 0))
+        {
+            txn_finish(rc);
+        }
+        /* Otherwise, retried on the next flash queue event. */
+    }
+}
+
+
+/**@brief   Run compaction and checkpointing as far as they can go. Calls made while running
+ *          are deferred until the current run is over. */
+static void background_run(void)
+{
+    bool run = false;
+
+    CRITICAL_REGION_ENTER();
+    if (m_store.bg_running || m_store.append_active)
+    {
+        m_store.bg_pending = true;
+    }
+    else
+    {
+        m_store.bg_running = true;
+        run = true;
+    }
+    CRITICAL_REGION_EXIT();
+
+    while (run)
+    {
+        m_store.bg_pending = false;
+        txn_steps();
+        dirty_steps();
+        compact_steps();
+        checkpoint_steps();
+
+        CRITICAL_REGION_ENTER();
+        run = m_store.bg_pending;
+        if (!run)
+        {
+            m_store.bg_running = false;
+        }
+        CRITICAL_REGION_EXIT();
+    }
+}
+
+
+static void on_write_result(flash_queue_evt_t const * p_evt)
+{
+    uint32_t const end = p_evt->addr + p_evt->len;
+
+    /* Credit the range to the records it covers. A record coalesced in the write cache can be
+     * written by more than one operation. */
+    CRITICAL_REGION_ENTER();
+    for (uint32_t i = 0; i < m_store.pending_cnt; i++)
+    {
+        pending_t * const p_pending =
+            &m_store.pending[(m_store.pending_first + i) % RECORD_STORE_PENDING_SIZE];
+
+        uint32_t const lo = MAX(p_evt->addr, p_pending->addr);
+        uint32_t const hi = MIN(end, p_pending->addr + p_pending->size);
+
+        if (lo < hi)
+        {
+            p_pending->written += hi - lo;
+            if (p_evt->result != NRF_SUCCESS)
+            {
+                p_pending->result = p_evt->result;
+            }
+        }
+    }
+    CRITICAL_REGION_EXIT();
+
+    pending_pop();
+}
+
+
+/**@brief   Write the header of a record that could not be written again, with a check that
+ *          fails, along with the one of its page if it opened the page. The log of a page is read
+ *          up to the first blank header, and the records written after it would be lost
+ *          otherwise. Must be called with the critical region held.
+ */
+static void fill_start(pending_t const * p_pending)
+{
+    record_hdr_t hdr = p_pending->hdr;
+
+    if (record_is_scalar(hdr.len))
+    {
+        hdr.len ^= LEN_CHECK;
+    }
+    else
+    {
+        hdr.crc = ~hdr.crc;
+    }
+
+    uint32_t words[4];
+    uint32_t cnt  = 0;
+    uint32_t dest = p_pending->addr;
+
+    if (p_pending->open)
+    {
+        dest        -= sizeof(page_hdr_t) - offsetof(page_hdr_t, magic);
+        words[cnt++] = PAGE_MAGIC;
+        words[cnt++] = p_pending->seq;
+    }
+    memcpy(&words[cnt], &hdr, sizeof(hdr));
+    cnt += sizeof(hdr) / sizeof(uint32_t);
+
+    /* Words that were written need no filling. */
+    uint32_t first = 0;
+    while ((first < cnt) && (*flash_ptr(dest + first * sizeof(uint32_t)) != WORD_BLANK))
+    {
+        first++;
+    }
+    if (first == cnt)
+    {
+        m_store.fill_state = FILL_DONE;
+        return;
+    }
+
+    ret_code_t const rc = flash_queue_write(m_store.p_fs, dest + first * sizeof(uint32_t),
+                                            &words[first], (cnt - first) * sizeof(uint32_t),
+                                            fill_evt_handler, NULL);
+    if (rc == NRF_SUCCESS)
+    {
+        m_store.fill_state = FILL_WRITING;
+    }
+    else if (rc == NRF_ERROR_NO_MEM)
+    {
+        (void) flash_queue_space_notify(fill_evt_handler, NULL);
+    }
+    else
+    {
+        m_store.fill_state = FILL_FAILED;
+    }
+}
+
+
+static void fill_evt_handler(flash_queue_evt_t const * p_evt)
+{
+    if (p_evt->id == FLASH_QUEUE_EVT_WRITE_RESULT)
+    {
+        /* The records after the failed one wait for the header: timeouts are retried. */
+        CRITICAL_REGION_ENTER();
+        m_store.fill_state = (p_evt->result == NRF_SUCCESS)       ? FILL_DONE
+                           : (p_evt->result == NRF_ERROR_TIMEOUT) ? FILL_IDLE
+                                                                  : FILL_FAILED;
+        CRITICAL_REGION_EXIT();
+    }
+
+    pending_pop();
+    background_run();
+}
+
+
+/**@brief   Take the records that have been written off the list of pending records, in order. A
+ *          record that failed is only taken off once its header has been filled in. */
+static void pending_pop(void)
+{
+    for (;;)
+    {
+        pending_t entry;
+        bool      popped = false;
+
+        CRITICAL_REGION_ENTER();
+        if (m_store.pending_cnt > 0)
+        {
+            pending_t const * const p_first = &m_store.pending[m_store.pending_first];
+            bool              const done    = (p_first->written == p_first->size);
+
+            if (done && (p_first->result != NRF_SUCCESS) && (m_store.fill_state == FILL_IDLE))
+            {
+                fill_start(p_first);
+            }
+            if (done && (   (p_first->result == NRF_SUCCESS)
+                         || (m_store.fill_state == FILL_DONE)
+                         || (m_store.fill_state == FILL_FAILED)))
+            {
+                entry                 = *p_first;
+                m_store.pending_first = (m_store.pending_first + 1) % RECORD_STORE_PENDING_SIZE;
+                m_store.pending_cnt--;
+                popped                = true;
+
+                if (m_store.fill_state == FILL_FAILED)
+                {
+                    /* The records written after it in the page would be lost on reset. No more
+                     * are appended to it. */
+                    m_store.hole_addr = entry.addr;
+                    if ((m_store.used_cnt > 0) && (page_of(entry.addr) == head_page()))
+                    {
+                        m_store.head_off = FLASH_LAYOUT_PAGE_SIZE;
+                    }
+                }
+                else if (   (m_store.hole_addr != 0) && (entry.addr > m_store.hole_addr)
+                         && (page_of(entry.addr) == page_of(m_store.hole_addr)))
+                {
+                    entry.result = NRF_ERROR_INTERNAL;
+                }
+                m_store.fill_state = FILL_IDLE;
+
+                if (entry.copy)
+                {
+                    m_store.copies_pending--;
+                    m_store.copy_failed |= (entry.result != NRF_SUCCESS);
+                }
+                if (entry.txn && (m_store.txn_orphans > 0))
+                {
+                    /* Written for a transaction that was aborted since. */
+                    m_store.txn_orphans--;
+                }
+                else if (entry.txn)
+                {
+                    /* Takes effect once the commit marker has been written. */
+                    m_store.txn[m_store.txn_done++] = (txn_entry_t){ .addr    = entry.addr,
+                                                                     .key     = entry.key,
+                                                                     .deleted = entry.deleted };
+                    if (m_store.txn_result == NRF_SUCCESS)
+                    {
+                        m_store.txn_result = entry.result;
+                    }
+                }
+                else if (entry.commit && (entry.result == NRF_SUCCESS))
+                {
+                    for (uint32_t i = 0; i < m_store.txn_done; i++)
+                    {
+                        index_update(m_store.txn[i].key, m_store.txn[i].addr,
+                                     m_store.txn[i].deleted);
+                    }
+                }
+                else if (entry.result == NRF_SUCCESS)
+                {
+                    index_update(entry.key, entry.addr, entry.deleted);
+                }
+            }
+        }
+        CRITICAL_REGION_EXIT();
+
+        if (!popped)
+        {
+            return;
+        }
+
+        FLASH_TRACE(FLASH_TRACE_RECORD_DONE, entry.key, entry.result);
+
+        if (entry.commit)
+        {
+            txn_finish(entry.result);
+        }
+        else if (!entry.copy && !entry.txn)
+        {
+            evt_send(entry.deleted ? RECORD_STORE_EVT_DELETE : RECORD_STORE_EVT_WRITE,
+                     entry.result, entry.key);
+        }
+    }
+}
+
+
+static void on_erase_result(flash_queue_evt_t const * p_evt)
+{
+    uint32_t const page     = page_of(p_evt->addr);
+    bool           finished = false;
+    bool           erased   = false;
+
+    CRITICAL_REGION_ENTER();
+    if ((m_store.hole_addr != 0) && (page_of(m_store.hole_addr) == page))
+    {
+        m_store.hole_addr = 0;
+    }
+    if (m_store.compact_active && m_store.victim_erasing && (page == m_store.victim))
+    {
+        if (p_evt->result == NRF_SUCCESS)
+        {
+            /* The victim is the oldest page. */
+            m_store.used_first = (m_store.used_first + 1) % RECORD_STORE_MAX_PAGES;
+            m_store.used_cnt--;
+            m_store.page_state[page] = PAGE_FREE;
+            m_store.free_cnt++;
+            erased                   = true;
+        }
+        m_store.compact_active = false;
+        m_store.victim_erasing = false;
+        finished               = true;
+        if (m_store.compact_paced)
+        {
+            m_store.gc_futile = (m_store.used_cnt >= m_store.gc_used_start);
+        }
+
+        /* The checkpoint is no longer valid once the oldest page has been erased. */
+        checkpoint_request();
+    }
+    else if (m_store.page_state[page] == PAGE_ERASING)
+    {
+        m_store.erasing_cnt--;
+        if (p_evt->result == NRF_SUCCESS)
+        {
+            m_store.page_state[page] = PAGE_FREE;
+            m_store.free_cnt++;
+            m_store.dirty_cnt--;
+            erased                   = true;
+        }
+        else
+        {
+            /* Retried by garbage collection. */
+            m_store.page_state[page] = PAGE_DIRTY;
+        }
+    }
+    if (erased)
+    {
+        m_store.erase_cnt[page]++;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (erased)
+    {
+        /* Best effort: if the count cannot be written, initialization treats the page as one of
+         * the most worn. The page can be opened meanwhile, as that writes other words. */
+        (void) flash_queue_write(m_store.p_fs, page_addr(page), &m_store.erase_cnt[page],
+                                 sizeof(uint32_t), NULL, NULL);
+    }
+
+    if (finished)
+    {
+        evt_send(RECORD_STORE_EVT_COMPACT, p_evt->result, 0);
+    }
+}
+
+
+static void flash_evt_handler(flash_queue_evt_t const * p_evt)
+{
+    if (p_evt->id == FLASH_QUEUE_EVT_WRITE_RESULT)
+    {
+        on_write_result(p_evt);
+    }
+    else
+    {
+        on_erase_result(p_evt);
+    }
+
+    background_run();
+}
+
+
+/**@brief   Take a record replayed at initialization into the index, unless it fails its check.
+ *
+ * The records after the checkpoint include those that were being written when the device was
+ * reset, and a torn copy must not hide the one before it, which was reported written: compaction
+ * would then drop that one. The replay is kept within about a page, so checking it all costs
+ * little, and the records that pass are not checked again when they are first read.
+ */
+static void replay_visit(uint32_t addr, record_hdr_t const * p_hdr, void * p_ctx)
+{
+    bool const deleted = (record_len(p_hdr->len) == 0);
+
+    UNUSED_PARAMETER(p_ctx);
+
+    if (!record_check(p_hdr, flash_ptr(addr + record_data_off(p_hdr->len))))
+    {
+        return;
+    }
+
+    index_update(p_hdr->key, addr, deleted);
+    if (!deleted)
+    {
+        record_index_verified_set(p_hdr->key);
+    }
+}
+
+
+/**@brief   Check if a word-aligned area of flash is blank. Eight words are combined before each
+ *          comparison, so that scanning the flash area at initialization stays fast. */
+static bool area_is_blank(uint32_t addr, uint32_t len)
+{
+    uint32_t const *       p_word = flash_ptr(addr);
+    uint32_t const * const p_end  = p_word + len / sizeof(uint32_t);
+
+    for (; p_end - p_word >= 8; p_word += 8)
+    {
+        if ((p_word[0] & p_word[1] & p_word[2] & p_word[3] &
+             p_word[4] & p_word[5] & p_word[6] & p_word[7]) != WORD_BLANK)
+        {
+            return false;
+        }
+    }
+    for (; p_word < p_end; p_word++)
+    {
+        if (*p_word != WORD_BLANK)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**@brief   Check if a page is erased, apart from its erase count. */
+static bool page_is_free(uint32_t page)
+{
+    return area_is_blank(page_addr(page) + sizeof(uint32_t),
+                         FLASH_LAYOUT_PAGE_SIZE - sizeof(uint32_t));
+}
+
+
+ret_code_t record_store_init(nrf_fstorage_t const * p_fs, record_store_evt_handler_t evt_handler)
+{
+    if (p_fs == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    /* The geometry is that of the layout, so that page arithmetic is done with shifts. */
+    uint32_t const pages    = (p_fs->end_addr - p_fs->start_addr + 1) >> FLASH_LAYOUT_PAGE_SHIFT;
+    uint32_t const page_cnt = pages - CHECKPOINT_PAGES;
+
+    if (p_fs->p_flash_info->erase_unit != FLASH_LAYOUT_PAGE_SIZE)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if (FLASH_LAYOUT_PAGE_OFFSET(p_fs->start_addr) != 0)
+    {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+    if ((pages < RESERVED_PAGES + CHECKPOINT_PAGES + 1) || (page_cnt > RECORD_STORE_MAX_PAGES))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    memset(&m_store, 0x00, sizeof(m_store));
+
+    m_store.p_fs        = p_fs;
+    m_store.evt_handler = evt_handler;
+    m_store.page_cnt    = page_cnt;
+    m_store.ckpt_addr   = page_addr(page_cnt);
+
+    uint32_t seq[RECORD_STORE_MAX_PAGES];
+    bool     cnt_known[RECORD_STORE_MAX_PAGES + CHECKPOINT_PAGES];
+    uint32_t cnt_max = 0;
+
+    for (uint32_t page = 0; page < page_cnt; page++)
+    {
+        page_hdr_t hdr;
+        memcpy(&hdr, flash_ptr(page_addr(page)), sizeof(hdr));
+
+        /* The erase count can only be trusted on pages in a known state. */
+        m_store.erase_cnt[page] = hdr.erase_cnt;
+        cnt_known[page]         = (hdr.erase_cnt != WORD_BLANK);
+
+        if (hdr.magic == PAGE_MAGIC)
+        {
+            /* Insert into the list of used pages, ordered by sequence number. */
+            uint32_t i = m_store.used_cnt++;
+            for (; (i > 0) && (seq[i - 1] > hdr.seq); i--)
+            {
+                seq[i]          = seq[i - 1];
+                m_store.used[i] = m_store.used[i - 1];
+            }
+            seq[i]                   = hdr.seq;
+            m_store.used[i]          = page;
+            m_store.page_state[page] = PAGE_USED;
+            m_store.next_seq         = MAX(m_store.next_seq, hdr.seq + 1);
+        }
+        else if (page_is_free(page))
+        {
+            m_store.page_state[page] = PAGE_FREE;
+            m_store.free_cnt++;
+        }
+        else
+        {
+            m_store.page_state[page] = PAGE_DIRTY;
+            m_store.dirty_cnt++;
+            cnt_known[page]          = false;
+        }
+    }
+
+#if RECORD_STORE_CHECKPOINT_ENABLED
+    uint32_t table_size;
+    (void) record_index_table(&table_size);
+
+    m_store.ckpt_stride = sizeof(checkpoint_hdr_t) + table_size;
+    m_store.ckpt_slots  = (FLASH_LAYOUT_PAGE_SIZE - sizeof(uint32_t)) / m_store.ckpt_stride;
+
+    /* New checkpoints are appended after the last one that was started. */
+    for (uint32_t slot = 0; slot < m_store.ckpt_slots; slot++)
+    {
+        if (!area_is_blank(checkpoint_addr(slot), m_store.ckpt_stride))
+        {
+            m_store.ckpt_next = slot + 1;
+        }
+    }
+
+    /* A page lost since a checkpoint was taken, e.g. to a reset as it was opened, must not have
+     * its sequence number taken by the next page opened: the checkpoint would describe it. */
+    for (uint32_t slot = 0; slot < m_store.ckpt_next; slot++)
+    {
+        checkpoint_hdr_t hdr;
+
+        if (checkpoint_hdr_get(checkpoint_addr(slot), &hdr))
+        {
+            m_store.next_seq = MAX(m_store.next_seq, hdr.head_seq + 1);
+        }
+    }
+
+    m_store.erase_cnt[page_cnt] = *flash_ptr(m_store.ckpt_addr);
+    cnt_known[page_cnt]         =    (m_store.erase_cnt[page_cnt] != WORD_BLANK)
+                                  && (   (m_store.ckpt_next == 0)
+                                      || (*flash_ptr(checkpoint_addr(0)) == CHECKPOINT_MAGIC));
+#endif
+
+    /* Pages whose erase count was lost are assumed to be as worn as the most worn page. */
+    for (uint32_t page = 0; page < page_cnt + CHECKPOINT_PAGES; page++)
+    {
+        if (cnt_known[page])
+        {
+            cnt_max = MAX(cnt_max, m_store.erase_cnt[page]);
+        }
+    }
+    for (uint32_t page = 0; page < page_cnt + CHECKPOINT_PAGES; page++)
+    {
+        if (!cnt_known[page])
+        {
+            m_store.erase_cnt[page] = cnt_max;
+        }
+    }
+
+    /* Build the index by replaying the log, oldest record first, or only the part of it that
+     * was appended after the checkpoint. */
+    uint32_t replay_page = 0;
+    uint32_t replay_off  = sizeof(page_hdr_t);
+
+    record_index_clear();
+    m_store.index_complete = true;
+
+#if RECORD_STORE_CHECKPOINT_ENABLED
+    if (!checkpoint_load(seq, &replay_page, &replay_off) || (replay_page + 1 < m_store.used_cnt))
+    {
+        checkpoint_request();
+    }
+#endif
+
+    /* Transactions that were not committed are rolled back here, by leaving their records out. */
+    log_walk(replay_page, replay_off, replay_visit, NULL);
+
+    if (m_store.used_cnt > 0)
+    {
+        uint32_t const base = page_addr(head_page());
+        uint32_t const end  = base + FLASH_LAYOUT_PAGE_SIZE;
+        uint32_t       addr = base + sizeof(page_hdr_t);
+        record_hdr_t   hdr;
+
+        while (record_hdr_get(end, addr, &hdr))
+        {
+            addr += record_size(hdr.len);
+        }
+
+        /* Never append over a header that is not blank, e.g. after a torn write, nor over
+         * records written past a blank one. */
+        if ((addr < end) && !area_is_blank(addr, end - addr))
+        {
+            addr = end;
+        }
+        m_store.head_off = addr - base;
+    }
+
+    /* Erase only as many dirty pages as records need to be appended right away. Garbage
+     * collection erases the others. */
+    for (uint32_t page = 0; page < page_cnt; page++)
+    {
+        if (   (m_store.page_state[page] == PAGE_DIRTY)
+            && (m_store.free_cnt + m_store.erasing_cnt <= RESERVED_PAGES))
+        {
+            m_store.page_state[page] = PAGE_ERASING;
+            m_store.erasing_cnt++;
+
+            ret_code_t const rc = flash_queue_erase(p_fs, page_addr(page), 1, flash_evt_handler, NULL);
+            if (rc != NRF_SUCCESS)
+            {
+                return rc;
+            }
+        }
+    }
+
+    /* A checkpoint that was missing or out of date is written by garbage collection. */
+    return NRF_SUCCESS;
+}
+
+
+#if RECORD_STORE_COMPRESS_ENABLED
+/**@brief   Compress the data of a record into the compression buffer.
+ *
+ * @return  The length of the record in flash with @ref LEN_PACKED set, or zero if compressing it
+ *          would not save a word of flash.
+ */
+static uint16_t record_pack(void const * p_data, uint16_t len)
+{
+    uint32_t const room = record_size(len) - sizeof(record_hdr_t) - sizeof(uint32_t);
+
+    if (room <= sizeof(packed_hdr_t))
+    {
+        return 0;
+    }
+
+    uint32_t const cnt = record_lz_compress(p_data, len,
+                                            &m_lz.buf[sizeof(packed_hdr_t)],
+                                            MIN(room, sizeof(m_lz.buf)) - sizeof(packed_hdr_t),
+                                            m_lz.table);
+    if (cnt == 0)
+    {
+        return 0;
+    }
+
+    packed_hdr_t const packed = { .len = len };
+    memcpy(m_lz.buf, &packed, sizeof(packed));
+
+    return (uint16_t)((sizeof(packed) + cnt) | LEN_PACKED);
+}
+#endif
+
+
+/**@brief   Compress and queue a record.
+ *
+ * @param[in]   flags   @ref LEN_TXN if the record is part of a transaction, zero otherwise.
+ */
+static ret_code_t record_write(uint16_t key, void const * p_data, uint16_t len, uint16_t flags)
+{
+    if (p_data == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+    if ((key < RECORD_STORE_KEY_MIN) || (key > RECORD_STORE_KEY_MAX))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if ((len == 0) || (len & (LEN_FLAGS | LEN_SCALAR)))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    FLASH_TRACE(FLASH_TRACE_RECORD_DATA, key, len);
+
+#if RECORD_STORE_COMPRESS_ENABLED
+    bool claimed;
+
+    /* A write from an event handler that interrupts another one is stored as is. */
+    CRITICAL_REGION_ENTER();
+    claimed    = !m_lz.busy;
+    m_lz.busy  = true;
+    CRITICAL_REGION_EXIT();
+
+    if (claimed)
+    {
+        uint16_t   const packed = record_pack(p_data, len);
+        ret_code_t const rc     =
+            (packed != 0) ? record_append(key, m_lz.buf, packed | flags, NULL)
+                          : record_append(key, p_data, len | flags, NULL);
+
+        if ((rc == NRF_SUCCESS) && (packed != 0))
+        {
+            CRITICAL_REGION_ENTER();
+            m_store.bytes_saved += record_size(len) - record_size(packed);
+            CRITICAL_REGION_EXIT();
+        }
+
+        m_lz.busy = false;
+        return rc;
+    }
+#endif
+
+    /* When out of pages, the next garbage collection step reclaims one. */
+    return record_append(key, p_data, len | flags, NULL);
+}
+
+
+ret_code_t record_store_write(uint16_t key, void const * p_data, uint16_t len)
+{
+    return record_write(key, p_data, len, 0);
+}
+
+
+ret_code_t record_store_read(uint16_t key, void * p_dest, uint16_t * p_len)
+{
+    if ((p_dest == NULL) || (p_len == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    ret_code_t   rc = NRF_ERROR_NOT_FOUND;
+    uint32_t     addr;
+    record_hdr_t hdr;
+
+    CRITICAL_REGION_ENTER();
+    pending_t const * const p_pending = pending_find(key);
+
+    if ((p_pending != NULL) && p_pending->cached)
+    {
+        /* Not written yet: read the record through the write cache. */
+        if (   !p_pending->deleted
+            && (flash_cache_read(m_store.p_fs, p_pending->addr, &hdr, sizeof(hdr)) == NRF_SUCCESS))
+        {
+            if (record_is_scalar(hdr.len))
+            {
+                rc = record_data_get(&hdr, (uint8_t const *)&hdr.crc, p_dest, p_len);
+            }
+            else if (hdr.len & LEN_PACKED)
+            {
+                /* Cached records fit in a line. */
+                uint32_t data[FLASH_CACHE_LINE_SIZE / sizeof(uint32_t)];
+
+                rc = flash_cache_read(m_store.p_fs, p_pending->addr + sizeof(hdr), data,
+                                      MIN(hdr.len & ~LEN_PACKED, sizeof(data)));
+                if (rc == NRF_SUCCESS)
+                {
+                    rc = record_data_get(&hdr, (uint8_t const *)data, p_dest, p_len);
+                }
+            }
+            else
+            {
+                rc = (MIN(*p_len, hdr.len) == 0) ? NRF_SUCCESS :
+                     flash_cache_read(m_store.p_fs, p_pending->addr + sizeof(hdr),
+                                      p_dest, MIN(*p_len, hdr.len));
+                if (rc == NRF_SUCCESS)
+                {
+                    *p_len = hdr.len;
+                }
+            }
+        }
+    }
+    else if (record_locate(key, &addr, &hdr) && (record_len(hdr.len) != 0))
+    {
+        void const * const p_data = flash_ptr(addr + record_data_off(hdr.len));
+
+        if (record_is_intact(key, &hdr, p_data))
+        {
+            rc = record_data_get(&hdr, p_data, p_dest, p_len);
+        }
+        else
+        {
+            rc = NRF_ERROR_INVALID_DATA;
+        }
+    }
+    CRITICAL_REGION_EXIT();
+
+    return rc;
+}
+
+
+ret_code_t record_store_read_span(uint16_t key, flash_span_t * p_span)
+{
+    if (p_span == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    ret_code_t   rc = NRF_ERROR_NOT_FOUND;
+    uint32_t     addr;
+    record_hdr_t hdr;
+
+    CRITICAL_REGION_ENTER();
+    pending_t const * const p_pending = pending_find(key);
+
+    if ((p_pending != NULL) && p_pending->cached)
+    {
+        rc = p_pending->deleted ? NRF_ERROR_NOT_FOUND : NRF_ERROR_BUSY;
+    }
+    else if (record_locate(key, &addr, &hdr) && (record_len(hdr.len) != 0))
+    {
+        if (hdr.len & LEN_PACKED)
+        {
+            rc = NRF_ERROR_NOT_SUPPORTED;
+        }
+        else if (record_is_intact(key, &hdr, flash_ptr(addr + record_data_off(hdr.len))))
+        {
+            rc = flash_span_get(m_store.p_fs, addr + record_data_off(hdr.len),
+                                record_len(hdr.len), p_span);
+        }
+        else
+        {
+            rc = NRF_ERROR_INVALID_DATA;
+        }
+    }
+    CRITICAL_REGION_EXIT();
+
+    return rc;
+}
+
+
+/**@brief   Check a record visited by a cursor, and set the span of its data. Must be called with
+ *          the critical region held. */
+static ret_code_t cursor_record_get(uint32_t             addr,
+                                    record_hdr_t const * p_hdr,
+                                    flash_span_t       * p_span)
+{
+    uint32_t const data = addr + record_data_off(p_hdr->len);
+
+    if (p_hdr->len & LEN_PACKED)
+    {
+        return NRF_ERROR_NOT_SUPPORTED;
+    }
+    if (!record_is_intact(p_hdr->key, p_hdr, flash_ptr(data)))
+    {
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    return flash_span_get(m_store.p_fs, data, record_len(p_hdr->len), p_span);
+}
+
+
+/**@brief   Visit the next record of a cursor in key order. The keys come from the index, so the
+ *          iteration ends if some keys no longer fit in it: finding the next key would then take
+ *          a scan of the whole log, with interrupts disabled, at every step. */
+static ret_code_t cursor_next_key(record_store_cursor_t * p_cursor,
+                                  uint16_t              * p_key,
+                                  flash_span_t          * p_span)
+{
+    while (p_cursor->next_key <= p_cursor->key_max)
+    {
+        ret_code_t   rc = NRF_ERROR_NOT_FOUND;
+        uint32_t     addr;
+        uint16_t     key;
+        record_hdr_t hdr;
+
+        CRITICAL_REGION_ENTER();
+        if (!m_store.index_complete)
+        {
+            p_cursor->next_key = p_cursor->key_max + 1;
+            rc                 = NRF_ERROR_INVALID_STATE;
+        }
+        else if (!record_index_next(p_cursor->next_key, p_cursor->key_max, &key, &addr))
+        {
+            p_cursor->next_key = p_cursor->key_max + 1;
+        }
+        else
+        {
+            p_cursor->next_key = key + 1;
+            if (record_locate(key, &addr, &hdr) && (record_len(hdr.len) != 0))
+            {
+                *p_key = key;
+                rc     = cursor_record_get(addr, &hdr, p_span);
+            }
+        }
+        CRITICAL_REGION_EXIT();
+
+        if (rc != NRF_ERROR_NOT_FOUND)
+        {
+            return rc;
+        }
+    }
+
+    return NRF_ERROR_NOT_FOUND;
+}
+
+
+/**@brief   Sequence number of used page @p i. The header of the newest page may not have been
+ *          written yet. */
+static uint32_t used_page_seq(uint32_t i)
+{
+    uint32_t const seq = *flash_ptr(page_addr(used_page(i)) + offsetof(page_hdr_t, seq));
+
+    return (seq == WORD_BLANK) ? (m_store.next_seq - 1) : seq;
+}
+
+
+/**@brief   Visit the next record of a cursor in log order. Each record of the log is looked at in
+ *          a critical region of its own, and only returned if the index has it as current. */
+static ret_code_t cursor_next_log(record_store_cursor_t * p_cursor,
+                                  uint16_t              * p_key,
+                                  flash_span_t          * p_span)
+{
+    for (;;)
+    {
+        ret_code_t rc  = NRF_ERROR_NOT_FOUND;
+        bool       end = false;
+
+        CRITICAL_REGION_ENTER();
+        /* Compaction may have erased the page of the cursor since the last step; the records that
+         * were still current in it have been copied to the newest page, and are visited there. */
+        uint32_t i = 0;
+
+        while ((i < m_store.used_cnt) && (used_page_seq(i) < p_cursor->seq))
+        {
+            i++;
+        }
+
+        if (i == m_store.used_cnt)
+        {
+            end = true;
+        }
+        else
+        {
+            uint32_t const base = page_addr(used_page(i));
+            uint32_t       addr;
+            uint32_t       cur_addr;
+            record_hdr_t   hdr;
+            record_hdr_t   cur_hdr;
+
+            if (used_page_seq(i) != p_cursor->seq)
+            {
+                p_cursor->seq = used_page_seq(i);
+                p_cursor->off = sizeof(page_hdr_t);
+            }
+
+            addr = base + p_cursor->off;
+            if (!record_hdr_get(base + FLASH_LAYOUT_PAGE_SIZE, addr, &hdr))
+            {
+                p_cursor->seq++;
+                p_cursor->off = sizeof(page_hdr_t);
+            }
+            else
+            {
+                p_cursor->off += record_size(hdr.len);
+
+                if (   (hdr.key >= p_cursor->key_min) && (hdr.key <= p_cursor->key_max)
+                    && (record_len(hdr.len) != 0)
+                    && record_locate(hdr.key, &cur_addr, &cur_hdr)
+                    && (cur_addr == addr))
+                {
+                    *p_key = hdr.key;
+                    rc     = cursor_record_get(addr, &hdr, p_span);
+                }
+            }
+        }
+        CRITICAL_REGION_EXIT();
+
+        if (end || (rc != NRF_ERROR_NOT_FOUND))
+        {
+            return rc;
+        }
+    }
+}
+
+
+ret_code_t record_store_cursor_init(record_store_cursor_t * p_cursor,
+                                    record_store_order_t    order,
+                                    uint16_t                key_min,
+                                    uint16_t                key_max)
+{
+    if (p_cursor == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    key_min = MAX(key_min, RECORD_STORE_KEY_MIN);
+    key_max = MIN(key_max, RECORD_STORE_KEY_MAX);
+
+    if (   ((order != RECORD_STORE_ORDER_KEY) && (order != RECORD_STORE_ORDER_LOG))
+        || (key_min > key_max))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if ((order == RECORD_STORE_ORDER_KEY) && !m_store.index_complete)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    memset(p_cursor, 0x00, sizeof(*p_cursor));
+    p_cursor->order    = order;
+    p_cursor->key_min  = key_min;
+    p_cursor->key_max  = key_max;
+    p_cursor->next_key = key_min;
+    p_cursor->off      = sizeof(page_hdr_t);
+
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t record_store_cursor_prefix_init(record_store_cursor_t * p_cursor,
+                                           record_store_order_t    order,
+                                           uint16_t                prefix,
+                                           uint8_t                 bits)
+{
+    if ((bits > 16) || ((bits < 16) && (prefix >> bits)))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    uint32_t const key_min = (uint32_t)prefix << (16 - bits);
+    uint32_t const key_max = key_min | ((1u << (16 - bits)) - 1);
+
+    return record_store_cursor_init(p_cursor, order, (uint16_t)key_min, (uint16_t)key_max);
+}
+
+
+ret_code_t record_store_cursor_next(record_store_cursor_t * p_cursor,
+                                    uint16_t              * p_key,
+                                    flash_span_t          * p_span)
+{
+    if ((p_cursor == NULL) || (p_key == NULL) || (p_span == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    return (p_cursor->order == RECORD_STORE_ORDER_KEY) ? cursor_next_key(p_cursor, p_key, p_span)
+                                                       : cursor_next_log(p_cursor, p_key, p_span);
+}
+
+
+/**@brief   Queue a scalar record.
+ *
+ * @param[in]   flags   @ref LEN_TXN if the record is part of a transaction, zero otherwise.
+ */
+static ret_code_t scalar_write(uint16_t key, uint32_t value, uint16_t flags)
+{
+    if ((key < RECORD_STORE_KEY_MIN) || (key > RECORD_STORE_KEY_MAX))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    FLASH_TRACE(FLASH_TRACE_RECORD_DATA, key, sizeof(value));
+
+    return record_append(key, &value, LEN_SCALAR | flags, NULL);
+}
+
+
+ret_code_t record_store_write_u32(uint16_t key, uint32_t value)
+{
+    return scalar_write(key, value, 0);
+}
+
+
+ret_code_t record_store_read_u32(uint16_t key, uint32_t * p_value)
+{
+    if (p_value == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    ret_code_t rc   = NRF_SUCCESS;
+    bool       done = false;
+    uint32_t   addr;
+
+    CRITICAL_REGION_ENTER();
+    /* A scalar record in flash: the index gives its header, which holds the value. */
+    if ((pending_find(key) == NULL) && record_index_get(key, &addr))
+    {
+        record_hdr_t const * const p_hdr = (record_hdr_t const *)flash_ptr(addr);
+
+        if (record_is_scalar(p_hdr->len))
+        {
+            done = true;
+            if (record_is_intact(key, p_hdr, NULL))
+            {
+                *p_value = p_hdr->crc;
+            }
+            else
+            {
+                rc = NRF_ERROR_INVALID_DATA;
+            }
+        }
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (!done)
+    {
+        /* Records in the write cache, records missing from the index, and words written with
+         * record_store_write(). */
+        uint16_t len = sizeof(*p_value);
+
+        rc = record_store_read(key, p_value, &len);
+        if ((rc == NRF_SUCCESS) && (len != sizeof(*p_value)))
+        {
+            rc = NRF_ERROR_INVALID_LENGTH;
+        }
+    }
+
+    return rc;
+}
+
+
+ret_code_t record_store_delete(uint16_t key)
+{
+    if ((key < RECORD_STORE_KEY_MIN) || (key > RECORD_STORE_KEY_MAX))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    return record_append(key, NULL, 0, NULL);
+}
+
+
+ret_code_t record_store_txn_begin(void)
+{
+    ret_code_t rc = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+    if (m_store.txn_state != TXN_IDLE)
+    {
+        rc = NRF_ERROR_BUSY;
+    }
+    else
+    {
+        m_store.txn_state  = TXN_OPEN;
+        m_store.txn_cnt    = 0;
+        m_store.txn_done   = 0;
+        m_store.txn_result = NRF_SUCCESS;
+    }
+    CRITICAL_REGION_EXIT();
+
+    return rc;
+}
+
+
+ret_code_t record_store_txn_write(uint16_t key, void const * p_data, uint16_t len)
+{
+    return record_write(key, p_data, len, LEN_TXN);
+}
+
+
+ret_code_t record_store_txn_write_u32(uint16_t key, uint32_t value)
+{
+    return scalar_write(key, value, LEN_TXN);
+}
+
+
+ret_code_t record_store_txn_delete(uint16_t key)
+{
+    if ((key < RECORD_STORE_KEY_MIN) || (key > RECORD_STORE_KEY_MAX))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    return record_append(key, NULL, LEN_TXN, NULL);
+}
+
+
+ret_code_t record_store_txn_commit(void)
+{
+    ret_code_t rc = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+    if (m_store.txn_state != TXN_OPEN)
+    {
+        rc = NRF_ERROR_INVALID_STATE;
+    }
+    else
+    {
+        m_store.txn_state = TXN_COMMITTING;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (rc == NRF_SUCCESS)
+    {
+        /* Hand the records of the transaction to the flash queue right away. */
+        (void) flash_cache_sync();
+        background_run();
+    }
+
+    return rc;
+}
+
+
+ret_code_t record_store_txn_abort(void)
+{
+    ret_code_t rc = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+    if (m_store.txn_state != TXN_OPEN)
+    {
+        rc = NRF_ERROR_INVALID_STATE;
+    }
+    else
+    {
+        /* Records still pending are skipped when their write completes. */
+        m_store.txn_orphans += m_store.txn_cnt - m_store.txn_done;
+        m_store.txn_state    = TXN_IDLE;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (rc == NRF_SUCCESS)
+    {
+        /* Resume compaction and checkpoints. */
+        background_run();
+    }
+
+    return rc;
+}
+
+
+/**@brief   Start a compaction pass. Must be called with the critical region held. */
+static ret_code_t compact_start(bool paced)
+{
+    if (m_store.used_cnt < 2)
+    {
+        /* The newest page cannot be compacted into itself. */
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    m_store.compact_active = true;
+    m_store.compact_paced  = paced;
+    m_store.victim_erasing = false;
+    m_store.victim         = used_page(0);
+    m_store.victim_off     = sizeof(page_hdr_t);
+    m_store.copy_failed    = false;
+
+    return NRF_SUCCESS;
+}
+
+
+ret_code_t record_store_compact(void)
+{
+    ret_code_t rc = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+    if (m_store.compact_active && m_store.compact_paced)
+    {
+        /* Finish the pass started by garbage collection right away. */
+        m_store.compact_paced = false;
+    }
+    else if (m_store.compact_active)
+    {
+        rc = NRF_ERROR_BUSY;
+    }
+    else
+    {
+        rc = compact_start(false);
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (rc == NRF_SUCCESS)
+    {
+        background_run();
+    }
+
+    return rc;
+}
+
+
+ret_code_t record_store_checkpoint(void)
+{
+#if RECORD_STORE_CHECKPOINT_ENABLED
+    if (!m_store.index_complete)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    CRITICAL_REGION_ENTER();
+    checkpoint_request();
+    CRITICAL_REGION_EXIT();
+
+    background_run();
+
+    return NRF_SUCCESS;
+#else
+    return NRF_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+
+bool record_store_gc_step(void)
+{
+    bool run;
+    bool grant;
+    bool issued = false;
+
+    CRITICAL_REGION_ENTER();
+    /* With only the reserved pages left, writes that open a page fail until one is reclaimed:
+     * do not back off. */
+    bool     const urgent  = (m_store.free_cnt <= RESERVED_PAGES);
+    bool     const allowed = urgent || (m_store.gc_hint == RECORD_STORE_GC_HINT_IDLE);
+    uint32_t const pool    = m_store.free_cnt + m_store.dirty_cnt;
+
+    /* Refill the pool of spare pages, by erasing dirty pages before compacting. Passes start
+     * while the pool is still full rather than once it is short, so that they can wait for the
+     * radio before writes run out of pages. Only the passes needed to fill it are repeated when
+     * they free nothing: the others would copy the same records round the log. */
+    if (   allowed && !m_store.compact_active
+        && (   (pool < RESERVED_PAGES + RECORD_STORE_SPARE_PAGES)
+            || ((pool == RESERVED_PAGES + RECORD_STORE_SPARE_PAGES) && !m_store.gc_futile))
+        && (compact_start(true) == NRF_SUCCESS))
+    {
+        m_store.gc_used_start = m_store.used_cnt;
+    }
+
+    /* Let the operations of the previous step complete first. */
+    bool const busy =    (m_store.copies_pending > 0) || m_store.victim_erasing
+                      || (m_store.erasing_cnt > 0)
+#if RECORD_STORE_CHECKPOINT_ENABLED
+                      || (m_store.ckpt_state == CKPT_WRITING)
+#endif
+                      ;
+
+    grant = allowed && !busy;
+    if (grant)
+    {
+        m_store.gc_budget = RECORD_STORE_GC_STEP_SIZE;
+    }
+    run = grant || m_store.bg_pending;
+    CRITICAL_REGION_EXIT();
+
+    if (run)
+    {
+        background_run();
+    }
+
+    if (grant)
+    {
+        CRITICAL_REGION_ENTER();
+        issued = (m_store.gc_budget < RECORD_STORE_GC_STEP_SIZE);
+        if (!issued)
+        {
+            /* Nothing could be done; the next step is granted afresh. */
+            m_store.gc_budget = 0;
+        }
+        CRITICAL_REGION_EXIT();
+    }
+
+    return issued;
+}
+
+
+void record_store_gc_hint_set(record_store_gc_hint_t hint)
+{
+    m_store.gc_hint = hint;
+}
+
+
+void record_store_stat(record_store_stat_t * p_stat)
+{
+    CRITICAL_REGION_ENTER();
+    p_stat->pages_total = m_store.page_cnt;
+    p_stat->pages_used  = m_store.used_cnt;
+    p_stat->pages_free  = m_store.free_cnt;
+    p_stat->pages_dirty = m_store.dirty_cnt;
+    p_stat->head_free   = (m_store.used_cnt > 0) ? (FLASH_LAYOUT_PAGE_SIZE - m_store.head_off) : 0;
+    p_stat->keys        = record_index_count();
+    p_stat->index_full  = !m_store.index_complete;
+    p_stat->corrupt     = m_store.corrupt_cnt;
+    p_stat->bytes_saved = m_store.bytes_saved;
+    p_stat->erase_min   = UINT32_MAX;
+    p_stat->erase_max   = 0;
+    for (uint32_t page = 0; page < m_store.page_cnt + CHECKPOINT_PAGES; page++)
+    {
+        p_stat->erase_min = MIN(p_stat->erase_min, m_store.erase_cnt[page]);
+        p_stat->erase_max = MAX(p_stat->erase_max, m_store.erase_cnt[page]);
+    }
+    CRITICAL_REGION_EXIT();
+}
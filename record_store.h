@@ -0,0 +1,482 @@
+#ifndef RECORD_STORE_H__
+#define RECORD_STORE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdk_errors.h"
+#include "nrf_fstorage.h"
+#include "flash_span.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup record_store Log-structured record store
+ * @{
+ *
+ * @brief   Append-only key/value records on top of an fstorage instance.
+ *
+ * @details The flash area of the instance is split into pages. Records are appended to the
+ *          newest page, each one preceded by a header holding its key, its length and a CRC32
+ *          of both and of the data. Writing a key again appends a new copy that supersedes the
+ *          older ones, and deleting a key appends an empty record. Compaction copies the records
+ *          of the oldest page that are still current to the newest page and erases it, so a page
+ *          erase is only needed once a whole page worth of updates has been appended.
+ *
+ *          A RAM index of the current copy of every key is built when the store is initialized
+ *          and updated as writes complete, so reading a record does not scan the flash area.
+ *          If @ref RECORD_STORE_CHECKPOINT_ENABLED is set, the last page of the flash area holds a
+ *          checkpoint of the index, rewritten whenever a new page is opened or a page has been
+ *          compacted. Initialization then only replays the records appended after it.
+ *
+ *          Every page keeps its erase count in its first word, and the least worn erased page is
+ *          opened next. Checkpoints are appended to the checkpoint page until it is full, so it
+ *          is not erased more often than the record pages.
+ *
+ *          Compaction and checkpoints run in the background, in bounded steps taken by
+ *          @ref record_store_gc_step when the application is idle. Writes and reads never wait
+ *          for them.
+ *
+ *          The CRC of a record is checked the first time it is read after initialization, and
+ *          again only once the record has moved, so that each copy is checked once per boot.
+ *          The CRC is computed with @ref flash_crc.
+ *
+ *          If @ref RECORD_STORE_COMPRESS_ENABLED is set, the data of a record is compressed with
+ *          @ref record_lz before it is queued, and stored compressed if that saves flash.
+ *          Reads decompress it transparently.
+ *
+ *          Records that fit in a line of the write cache (@ref flash_cache) are coalesced there
+ *          before they are programmed, and can be read back before they reach flash.
+ *
+ *          Records holding a single word, written with @ref record_store_write_u32, are stored as
+ *          a bare header: the word takes the place of the CRC, and a check of the key and the
+ *          word the place of the length. They take eight bytes of flash instead of twelve, and
+ *          @ref record_store_read_u32 reads them from the index without parsing a header.
+ *
+ *          Several records can be written as one transaction, which takes effect as a whole or
+ *          not at all, even if power is lost while it is being written. Its records are appended
+ *          with a flag, followed by a commit marker once they have all been written. Until the
+ *          marker is in flash, reads return the older copies, and initialization leaves the
+ *          records out if the marker is missing or torn.
+ *
+ *          Records can be iterated over with a cursor, in key order or in the order they were
+ *          appended, optionally limited to a range or a prefix of keys. The cursor only holds its
+ *          position; the data is read in place, and superseded copies are skipped by looking up
+ *          every record in the index.
+ *
+ *          One page is always kept free so that compaction can run.
+ */
+
+
+#define RECORD_STORE_KEY_MIN    0x0001  //!< Smallest valid record key.
+#define RECORD_STORE_KEY_MAX    0xFFFE  //!< Largest valid record key.
+
+
+/**@brief   Record store event IDs. */
+typedef enum
+{
+    RECORD_STORE_EVT_WRITE,     //!< A record has been written.
+    RECORD_STORE_EVT_DELETE,    //!< A record has been deleted.
+    RECORD_STORE_EVT_COMPACT,   //!< A compaction pass has completed.
+    RECORD_STORE_EVT_CHECKPOINT,//!< A checkpoint of the index has been written.
+    RECORD_STORE_EVT_COMMIT,    //!< A transaction has been committed.
+} record_store_evt_id_t;
+
+
+/**@brief   Record store event. */
+typedef struct
+{
+    record_store_evt_id_t   id;     //!< The event ID.
+    ret_code_t              result; //!< Result of the operation.
+    uint16_t                key;    //!< Key of the record. Only used for @ref RECORD_STORE_EVT_WRITE
+                                    //!< and @ref RECORD_STORE_EVT_DELETE.
+} record_store_evt_t;
+
+
+/**@brief   Record store event handler type. */
+typedef void (*record_store_evt_handler_t)(record_store_evt_t const * p_evt);
+
+
+/**@brief   Hints about other users of the flash and the radio, for garbage collection. */
+typedef enum
+{
+    RECORD_STORE_GC_HINT_IDLE,      //!< Collect garbage whenever the free pages run low.
+    RECORD_STORE_GC_HINT_BACKOFF,   //!< The radio is busy, e.g. a BLE link is up. Collect garbage
+                                    //!< only when the spare pages are used up.
+} record_store_gc_hint_t;
+
+
+/**@brief   Orders in which a cursor visits records. */
+typedef enum
+{
+    RECORD_STORE_ORDER_KEY, //!< Ascending keys, as long as every key fits in the index.
+    RECORD_STORE_ORDER_LOG, //!< The order the current copies were appended in, oldest first.
+} record_store_order_t;
+
+
+/**@brief   Position of an iteration over records. Set up with @ref record_store_cursor_init or
+ *          @ref record_store_cursor_prefix_init; the fields are private. */
+typedef struct
+{
+    uint16_t key_min;
+    uint16_t key_max;
+    uint32_t next_key;  //!< Key order: smallest key not visited yet.
+    uint32_t seq;       //!< Log order: sequence number of the page being visited.
+    uint32_t off;       //!< Log order: offset of the next record in that page.
+    uint8_t  order;
+} record_store_cursor_t;
+
+
+/**@brief   Record store usage. */
+typedef struct
+{
+    uint32_t pages_total;   //!< Pages in the flash area.
+    uint32_t pages_used;    //!< Pages holding records.
+    uint32_t pages_free;    //!< Erased pages, including the one reserved for compaction.
+    uint32_t pages_dirty;   //!< Pages waiting to be erased by garbage collection.
+    uint32_t head_free;     //!< Bytes left in the page records are currently appended to.
+    uint32_t keys;          //!< Keys in the RAM index.
+    bool     index_full;    //!< Some keys did not fit in the index; lookups of them scan flash.
+    uint32_t corrupt;       //!< Reads that failed the integrity check since initialization.
+    uint32_t bytes_saved;   //!< Flash bytes saved by compression since initialization.
+    uint32_t erase_min;     //!< Erase count of the least worn page, the checkpoint page included.
+    uint32_t erase_max;     //!< Erase count of the most worn page, the checkpoint page included.
+} record_store_stat_t;
+
+
+/**@brief   Function for initializing the record store.
+ *
+ * Scans the flash area of @p p_fs to find the pages in use and where to append the next record,
+ * and builds the index from the checkpoint and the records appended after it. Pages that hold
+ * data but are not part of the store are dirty: as many of them as needed to append records are
+ * queued for erasure, and garbage collection erases the others. If the checkpoint found was
+ * missing or out of date, a new one is requested.
+ *
+ * @param[in]   p_fs        The fstorage instance to use. Must be initialized, with pages of
+ *                          @ref FLASH_LAYOUT_PAGE_SIZE bytes, and its flash area must start on
+ *                          a page boundary.
+ * @param[in]   evt_handler Handler for record store events. Can be NULL.
+ *
+ * @retval  NRF_SUCCESS             If the store was initialized.
+ * @retval  NRF_ERROR_NULL          If @p p_fs is NULL.
+ * @retval  NRF_ERROR_INVALID_PARAM If the erase unit of the backend is not
+ *                                  @ref FLASH_LAYOUT_PAGE_SIZE.
+ * @retval  NRF_ERROR_INVALID_ADDR  If the flash area is not page-aligned.
+ * @retval  NRF_ERROR_INVALID_LENGTH If the flash area is too small or has too many pages.
+ */
+ret_code_t record_store_init(nrf_fstorage_t const * p_fs, record_store_evt_handler_t evt_handler);
+
+
+/**@brief   Function for taking a garbage collection step.
+ *
+ * Call this function from the main loop when there is nothing else to do. Garbage collection
+ * keeps @ref RECORD_STORE_SPARE_PAGES erased pages ready for new records, besides the one reserved
+ * for compaction, so that appending a record never waits for an erase. It starts compacting
+ * once the pool is down to that many pages, so that it can back off for a while before the
+ * pool is empty. Steps erase dirty pages first. When there are none left, each step compacts up to
+ * @ref RECORD_STORE_GC_STEP_SIZE bytes of the oldest page, or erases it once it has been copied.
+ * Requested checkpoints are written in steps of their own. A step is only taken once the flash
+ * operations of the previous one have completed.
+ *
+ * @retval  true    If flash operations were queued. Call again before sleeping if the backend
+ *                  completes them synchronously.
+ * @retval  false   If there was nothing to do, or the previous step is still in progress.
+ */
+bool record_store_gc_step(void);
+
+
+/**@brief   Function for telling garbage collection about radio activity.
+ *
+ * Flash operations compete with the radio for time when the SoftDevice is enabled, and may have
+ * to be retried. While backing off, garbage collection only runs if writes fail for lack of pages.
+ *
+ * @param[in]   hint    The new hint. The default is @ref RECORD_STORE_GC_HINT_IDLE.
+ */
+void record_store_gc_hint_set(record_store_gc_hint_t hint);
+
+
+/**@brief   Function for writing a record.
+ *
+ * The record is appended to the log and supersedes older records with the same key. The function
+ * returns as soon as the record is queued; @ref RECORD_STORE_EVT_WRITE reports the result. If
+ * @ref RECORD_STORE_COMPRESS_ENABLED is set, the data is compressed first, unless the function
+ * interrupts another write that is compressing its data.
+ *
+ * Results are reported in the order the records were queued. A record that could not be written
+ * leaves the older ones in effect. Its header is then marked as failed in flash, and if even that
+ * fails, the records queued after it in the same page are reported failed too, with
+ * NRF_ERROR_INTERNAL.
+ *
+ * @param[in]   key     Key of the record, between @ref RECORD_STORE_KEY_MIN and
+ *                      @ref RECORD_STORE_KEY_MAX.
+ * @param[in]   p_data  Record data. Copied before the function returns.
+ * @param[in]   len     Length of the data, in bytes. Must not be zero.
+ *
+ * @retval  NRF_SUCCESS             If the record was queued.
+ * @retval  NRF_ERROR_NULL          If @p p_data is NULL.
+ * @retval  NRF_ERROR_INVALID_PARAM If @p key is not valid.
+ * @retval  NRF_ERROR_INVALID_LENGTH If @p len is zero or the record does not fit in a page.
+ * @retval  NRF_ERROR_NO_MEM        If the store is full and must be compacted, or the queues
+ *                                  are full; try again after @ref record_store_gc_step.
+ */
+ret_code_t record_store_write(uint16_t key, void const * p_data, uint16_t len);
+
+
+/**@brief   Function for reading the current copy of a record.
+ *
+ * Records still held in the write cache are read from there. A record that is larger than a
+ * cache line is only returned once it has been written. The first read of a record from flash
+ * checks its CRC over the whole record, even if the buffer is smaller.
+ *
+ * @param[in]       key     Key of the record.
+ * @param[out]      p_dest  Buffer to read the data into.
+ * @param[in,out]   p_len   In: size of @p p_dest. Out: length of the record. If the buffer is
+ *                          smaller than the record, only the beginning is read.
+ *
+ * @retval  NRF_SUCCESS         If the record was read.
+ * @retval  NRF_ERROR_NULL      If @p p_dest or @p p_len is NULL.
+ * @retval  NRF_ERROR_NOT_FOUND If there is no record with this key.
+ * @retval  NRF_ERROR_INVALID_DATA If the record in flash is corrupt. The buffer may have been
+ *                                  written to.
+ */
+ret_code_t record_store_read(uint16_t key, void * p_dest, uint16_t * p_len);
+
+
+/**@brief   Function for reading the current copy of a record in place, without copying it.
+ *
+ * The span points to the data of the record in flash, which stays there until compaction erases
+ * its page, even if the key is written again in the meantime. Once done with the data, check
+ * @ref flash_span_is_pending to find out whether the page may have been erased: it returns true
+ * after any write or erase of the store, and the record can then be read again. The CRC of the
+ * record is checked like by @ref record_store_read.
+ *
+ * @param[in]   key     Key of the record.
+ * @param[out]  p_span  The data of the record.
+ *
+ * @retval  NRF_SUCCESS             If the span was set.
+ * @retval  NRF_ERROR_NULL          If @p p_span is NULL.
+ * @retval  NRF_ERROR_NOT_FOUND     If there is no record with this key.
+ * @retval  NRF_ERROR_INVALID_DATA  If the record in flash is corrupt.
+ * @retval  NRF_ERROR_BUSY          If the record is still in the write cache. Use
+ *                                  @ref record_store_read.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If the record is stored compressed. Use
+ *                                  @ref record_store_read.
+ */
+ret_code_t record_store_read_span(uint16_t key, flash_span_t * p_span);
+
+
+/**@brief   Function for writing a record holding a 32-bit word.
+ *
+ * The record is stored as a scalar record, which takes eight bytes of flash and is neither
+ * compressed nor checked with a CRC32. @ref RECORD_STORE_EVT_WRITE reports the result.
+ *
+ * @param[in]   key     Key of the record, between @ref RECORD_STORE_KEY_MIN and
+ *                      @ref RECORD_STORE_KEY_MAX.
+ * @param[in]   value   The word.
+ *
+ * @return  See @ref record_store_write.
+ */
+ret_code_t record_store_write_u32(uint16_t key, uint32_t value);
+
+
+/**@brief   Function for reading a record holding a 32-bit word.
+ *
+ * Scalar records that have reached flash are read straight from the index. Other records,
+ * including four-byte records written with @ref record_store_write, are read like by
+ * @ref record_store_read.
+ *
+ * @param[in]   key     Key of the record.
+ * @param[out]  p_value The word.
+ *
+ * @retval  NRF_SUCCESS             If the word was read.
+ * @retval  NRF_ERROR_NULL          If @p p_value is NULL.
+ * @retval  NRF_ERROR_NOT_FOUND     If there is no record with this key.
+ * @retval  NRF_ERROR_INVALID_LENGTH If the record does not hold a single word. @p p_value may
+ *                                  have been written to.
+ * @retval  NRF_ERROR_INVALID_DATA  If the record in flash is corrupt.
+ */
+ret_code_t record_store_read_u32(uint16_t key, uint32_t * p_value);
+
+
+/**@brief   Function for starting an iteration over the records with keys in a range.
+ *
+ * @param[out]  p_cursor    The cursor.
+ * @param[in]   order       Order to visit the records in.
+ * @param[in]   key_min     Smallest key to visit. Raised to @ref RECORD_STORE_KEY_MIN.
+ * @param[in]   key_max     Largest key to visit. Lowered to @ref RECORD_STORE_KEY_MAX.
+ *
+ * @retval  NRF_SUCCESS             If the cursor was set up.
+ * @retval  NRF_ERROR_NULL          If @p p_cursor is NULL.
+ * @retval  NRF_ERROR_INVALID_PARAM If @p order is not valid, or the range is empty.
+ * @retval  NRF_ERROR_INVALID_STATE If @p order is @ref RECORD_STORE_ORDER_KEY and some keys do not
+ *                                  fit in the index. Iterate in log order instead.
+ */
+ret_code_t record_store_cursor_init(record_store_cursor_t * p_cursor,
+                                    record_store_order_t    order,
+                                    uint16_t                key_min,
+                                    uint16_t                key_max);
+
+
+/**@brief   Function for starting an iteration over the records whose keys start with a prefix.
+ *
+ * For example, a prefix of 0x12 on 8 bits visits keys 0x1200 to 0x12FF.
+ *
+ * @param[in]   prefix  The upper bits of the keys to visit.
+ * @param[in]   bits    Number of bits of the prefix, up to 16.
+ *
+ * @retval  NRF_ERROR_INVALID_PARAM If @p bits is larger than 16, or @p prefix does not fit in it.
+ * @return  Otherwise, see @ref record_store_cursor_init.
+ */
+ret_code_t record_store_cursor_prefix_init(record_store_cursor_t * p_cursor,
+                                           record_store_order_t    order,
+                                           uint16_t                prefix,
+                                           uint8_t                 bits);
+
+
+/**@brief   Function for visiting the next record of an iteration.
+ *
+ * Only the current copy of each key is visited, and only once it has reached flash: call
+ * @ref flash_cache_sync and let the flash queue drain first to include the latest writes. The
+ * span points to the data in flash; see @ref record_store_read_span. Records written or deleted
+ * during an iteration may or may not be visited. In log order, a record that compaction moves
+ * during the iteration may be visited again.
+ *
+ * Every key is looked up in the index, so a step takes about as long as a read of the record.
+ * Iterations in key order take their keys from the index, and end if some keys stop fitting in
+ * it.
+ *
+ * The cursor moves past the record even if the function fails; @p p_key then still tells which
+ * record could not be visited, so that it can be read with @ref record_store_read.
+ *
+ * @param[in,out]   p_cursor    The cursor.
+ * @param[out]      p_key       Key of the record.
+ * @param[out]      p_span      The data of the record.
+ *
+ * @retval  NRF_SUCCESS             If the span was set.
+ * @retval  NRF_ERROR_NULL          If a parameter is NULL.
+ * @retval  NRF_ERROR_NOT_FOUND     If there are no more records.
+ * @retval  NRF_ERROR_INVALID_DATA  If the record in flash is corrupt.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If the record is stored compressed.
+ * @retval  NRF_ERROR_BUSY          If a write that overlaps the record is still queued.
+ * @retval  NRF_ERROR_INVALID_STATE If the iteration is in key order and some keys no longer fit
+ *                                  in the index. @p p_key is not set, and the iteration is over.
+ */
+ret_code_t record_store_cursor_next(record_store_cursor_t * p_cursor,
+                                    uint16_t              * p_key,
+                                    flash_span_t          * p_span);
+
+
+/**@brief   Function for deleting a record.
+ *
+ * @ref RECORD_STORE_EVT_DELETE reports the result.
+ *
+ * @return  See @ref record_store_write.
+ */
+ret_code_t record_store_delete(uint16_t key);
+
+
+/**@brief   Function for starting a transaction.
+ *
+ * Records written and deleted with @ref record_store_txn_write and @ref record_store_txn_delete
+ * take effect together when the transaction is committed. Only one transaction can be open at a
+ * time, and records written with @ref record_store_write meanwhile take effect right away.
+ * Compaction and checkpoints wait until the transaction is over, so that a transaction that runs
+ * out of pages fails with NRF_ERROR_NO_MEM and must be aborted.
+ *
+ * @retval  NRF_SUCCESS     If the transaction was started.
+ * @retval  NRF_ERROR_BUSY  If a transaction is already open or being committed.
+ */
+ret_code_t record_store_txn_begin(void);
+
+
+/**@brief   Function for writing a record as part of the open transaction.
+ *
+ * There is no @ref RECORD_STORE_EVT_WRITE event for the record: @ref RECORD_STORE_EVT_COMMIT
+ * reports the result of the whole transaction.
+ *
+ * @retval  NRF_ERROR_INVALID_STATE If no transaction is open.
+ * @retval  NRF_ERROR_NO_MEM        If the transaction already holds
+ *                                  @ref RECORD_STORE_TXN_MAX records, or for the reasons of
+ *                                  @ref record_store_write.
+ * @return  See @ref record_store_write for the other errors.
+ */
+ret_code_t record_store_txn_write(uint16_t key, void const * p_data, uint16_t len);
+
+
+/**@brief   Function for writing a record holding a 32-bit word as part of the open transaction.
+ *
+ * @return  See @ref record_store_txn_write.
+ */
+ret_code_t record_store_txn_write_u32(uint16_t key, uint32_t value);
+
+
+/**@brief   Function for deleting a record as part of the open transaction.
+ *
+ * @return  See @ref record_store_txn_write.
+ */
+ret_code_t record_store_txn_delete(uint16_t key);
+
+
+/**@brief   Function for committing the open transaction.
+ *
+ * The commit marker is queued once all records of the transaction have been written. The records
+ * take effect once it has been written, and @ref RECORD_STORE_EVT_COMMIT reports the result. If
+ * one of the records could not be written, the marker is not written and none of them take
+ * effect.
+ *
+ * @retval  NRF_SUCCESS             If the transaction is being committed.
+ * @retval  NRF_ERROR_INVALID_STATE If no transaction is open.
+ */
+ret_code_t record_store_txn_commit(void);
+
+
+/**@brief   Function for aborting the open transaction.
+ *
+ * None of its records take effect. Those already written stay in flash until compaction.
+ *
+ * @retval  NRF_SUCCESS             If the transaction was aborted.
+ * @retval  NRF_ERROR_INVALID_STATE If no transaction is open, or it is being committed.
+ */
+ret_code_t record_store_txn_abort(void);
+
+
+/**@brief   Function for starting compaction of the oldest page.
+ *
+ * Current records of the oldest page are copied to the newest page, after which the oldest page
+ * is erased. Unlike garbage collection, the pass runs to completion without waiting for idle
+ * time. @ref RECORD_STORE_EVT_COMPACT reports the result.
+ *
+ * @retval  NRF_SUCCESS             If compaction was started, or a pass started by garbage
+ *                                  collection now runs to completion.
+ * @retval  NRF_ERROR_BUSY          If compaction is already running.
+ * @retval  NRF_ERROR_INVALID_STATE If there is no page that can be compacted.
+ */
+ret_code_t record_store_compact(void);
+
+
+/**@brief   Function for writing a checkpoint of the index.
+ *
+ * The checkpoint is written by a garbage collection step, once all queued records have been
+ * written.
+ * @ref RECORD_STORE_EVT_CHECKPOINT reports the result.
+ *
+ * @retval  NRF_SUCCESS             If the checkpoint was requested.
+ * @retval  NRF_ERROR_INVALID_STATE If some keys do not fit in the index.
+ * @retval  NRF_ERROR_NOT_SUPPORTED If @ref RECORD_STORE_CHECKPOINT_ENABLED is not set.
+ */
+ret_code_t record_store_checkpoint(void);
+
+
+/**@brief   Function for retrieving usage information. */
+void record_store_stat(record_store_stat_t * p_stat);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RECORD_STORE_H__
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Decode the output of the "trace dump" CLI command.
+
+usage: trace_decode.py [dump.txt]
+
+Reads the dump from the file, or from standard input, and prints one line per entry: the time in
+seconds since the first entry, the time since the previous entry, the event and its arguments.
+The names of the events and of their arguments are taken from the descriptions of
+flash_trace_id_t in flash_trace.h, next to this script.
+"""
+
+import os
+import re
+import sys
+
+HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'flash_trace.h')
+COUNTER_BITS = 24   # Width of the app_timer counter in the timestamps.
+
+
+def events_load(path):
+    """Return a list of (name, [argument names]) indexed by event ID."""
+    with open(path) as f:
+        text = f.read()
+    body = re.search(r'typedef enum\s*{(.*?)}\s*flash_trace_id_t;', text, re.S).group(1)
+    events = []
+    for name, desc in re.findall(r'FLASH_TRACE_(\w+),\s*//!<\s*(.*)', body):
+        args = desc.rsplit(':', 1)[1] if ':' in desc else ''
+        events.append((name, [a.strip(' .') for a in args.split(',')] if args else []))
+    return events
+
+
+def entries_read(src, events):
+    """Yield the entries of a dump as (seq, seconds, delta, name, argument names, arguments), and
+    its comment lines as strings. The times are in seconds."""
+    freq = 32768
+    prev = None
+    ticks = 0
+
+    for line in src:
+        m = re.match(r'\s*# flash_trace (\d+) Hz', line)
+        if m:
+            freq = int(m.group(1))
+            continue
+        words = line.split()
+        if len(words) != 4 or not all(re.fullmatch(r'[0-9a-fA-F]{8}', w) for w in words):
+            if line.startswith('#'):
+                yield line.rstrip()
+            continue
+
+        seq, stamp, arg0, arg1 = (int(w, 16) for w in words)
+        cnt = stamp >> 8
+        eid = stamp & 0xFF
+
+        # The counter wraps around; entries are in order, so each step is taken forward.
+        delta = 0 if prev is None else (cnt - prev) % (1 << COUNTER_BITS)
+        ticks += delta
+        prev = cnt
+
+        name, names = events[eid] if eid < len(events) else ('EVT_%d' % eid, [])
+        names = (names + ['arg0', 'arg1'])[:2]
+        yield seq, ticks / freq, delta / freq, name, names, (arg0, arg1)
+
+
+def main():
+    events = events_load(HEADER)
+    src = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    found = False
+
+    for entry in entries_read(src, events):
+        if isinstance(entry, str):
+            print(entry)
+            continue
+        seq, secs, delta, name, names, args = entry
+        found = True
+        print('%8u %11.6f +%9.6f %-14s %s=0x%x %s=0x%x'
+              % (seq, secs, delta, name, names[0], args[0], names[1], args[1]))
+
+    if not found:
+        print('no trace entries found', file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
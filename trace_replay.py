@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+"""Replay the output of the "trace dump" CLI command against a model of the flash.
+
+usage: trace_replay.py [-b board] [--sd] [dump.txt]
+
+Reads the dump from the file, or from standard input, and replays the writes and erases handed
+to nrf_fstorage. The page size and the timings of the board are those of the simulated flash in
+its sdk_config.h, next to this script: FLASH_SIM_PAGE_SIZE, FLASH_CHUNK_WORD_US and
+FLASH_POWER_ERASE_MS. Prints:
+
+- the throughput of the data given by the application, over the time the trace covers, and the
+  most the modelled flash could take if it were busy all the time;
+- the write amplification, the bytes written to the flash per byte given by the application,
+  counting the words written with flash_write() and the records queued, before compression;
+- the latencies traced between submission and result, next to the modelled ones;
+- the erase count of each page.
+
+The ring of the trace holds the latest entries only; dump it often enough that none are lost, or
+the figures only cover part of the run.
+
+This models the flash only. host/trace_sim replays the same dump through the storage layers
+themselves, built for the host over the simulated flash, with faults and power cuts.
+"""
+
+import argparse
+import collections
+import os
+import re
+import sys
+
+import trace_decode
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+PAGES_PER_LINE = 8
+
+
+def config_load(board, sd):
+    """Return the page size, the time to write a word in us and to erase a page in ms."""
+    targets = sorted(t for t in os.listdir(os.path.join(HERE, board)) if (t == 'blank') != sd)
+    path = os.path.join(HERE, board, targets[0], 'config', 'sdk_config.h')
+    with open(path) as f:
+        values = dict(re.findall(r'^#define (\w+) (\d+)\s*$', f.read(), re.M))
+    return (int(values['FLASH_SIM_PAGE_SIZE']), int(values['FLASH_CHUNK_WORD_US']),
+            int(values['FLASH_POWER_ERASE_MS']))
+
+
+def latency_line(name, traced, modelled):
+    if not traced:
+        return '  %-5s -' % name
+    return ('  %-5s %6u ops, traced %8.3f ms mean, %8.3f ms max; modelled %8.3f ms mean'
+            % (name, len(traced), 1000 * sum(traced) / len(traced), 1000 * max(traced),
+               1000 * sum(modelled) / len(modelled)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('-b', '--board', default='pca10056', help='board directory')
+    parser.add_argument('--sd', action='store_true', help='use the SoftDevice configuration')
+    parser.add_argument('dump', nargs='?', help='output of "trace dump"')
+    args = parser.parse_args()
+
+    page_size, word_us, erase_ms = config_load(args.board, args.sd)
+    events = trace_decode.events_load(trace_decode.HEADER)
+    src = open(args.dump) if args.dump else sys.stdin
+
+    entries = 0
+    lost = 0
+    start = end = None
+    next_seq = None
+    app_bytes = 0
+    flash_bytes = 0
+    writes = 0
+    erased = 0
+    busy_us = 0
+    counts = collections.Counter()
+    wear = collections.Counter()
+    pending = collections.defaultdict(collections.deque)    # (kind, address) -> [(time, us)]
+    traced = {'WRITE': [], 'ERASE': []}
+    modelled = {'WRITE': [], 'ERASE': []}
+
+    for entry in trace_decode.entries_read(src, events):
+        if isinstance(entry, str):
+            continue
+        seq, secs, _, name, _, (arg0, arg1) = entry
+
+        entries += 1
+        if next_seq is not None and seq != next_seq:
+            lost += (seq - next_seq) % (1 << 32)
+        next_seq = (seq + 1) % (1 << 32)
+        start = secs if start is None else start
+        end = secs
+
+        if name == 'WRITE':
+            app_bytes += 4
+        elif name == 'RECORD_DATA':
+            app_bytes += arg1
+        elif name == 'SUBMIT_WRITE':
+            us = (arg1 // 4) * word_us
+            writes += 1
+            flash_bytes += arg1
+            busy_us += us
+            pending[('WRITE', arg0)].append((secs, us))
+        elif name == 'SUBMIT_ERASE':
+            us = arg1 * erase_ms * 1000
+            erased += arg1
+            busy_us += us
+            for page in range(arg1):
+                wear[arg0 // page_size + page] += 1
+            pending[('ERASE', arg0)].append((secs, us))
+        elif name in ('WRITE_DONE', 'ERASE_DONE'):
+            kind = name.split('_')[0]
+            if arg1 != 0:
+                counts[kind.lower() + 's failed'] += 1
+            if pending[(kind, arg0)]:
+                submitted, us = pending[(kind, arg0)].popleft()
+                traced[kind].append(secs - submitted)
+                modelled[kind].append(us / 1e6)
+        elif name in ('RETRY', 'SUBMIT_DROP', 'COMPACT_ERASE'):
+            counts[name.lower()] += 1
+
+    if entries == 0:
+        print('no trace entries found', file=sys.stderr)
+        return
+
+    span = end - start
+    busy = busy_us / 1e6
+
+    print('model: %s%s, %u-byte pages, %u us per word, %u ms per page erase'
+          % (args.board, ' (sd)' if args.sd else '', page_size, word_us, erase_ms))
+    print('trace: %u entries over %.3f s, %u lost%s'
+          % (entries, span, lost, '; the figures below cover part of the run' if lost else ''))
+    print('application: %u bytes, %.1f bytes/s' % (app_bytes, app_bytes / span if span else 0))
+    print('flash: %u bytes in %u writes, %u pages erased, busy %.3f s (%.1f%% of the trace)'
+          % (flash_bytes, writes, erased, busy, 100 * busy / span if span else 0))
+    if app_bytes:
+        print('write amplification: %.2f (%.2f with the erased bytes)'
+              % (flash_bytes / app_bytes, (flash_bytes + erased * page_size) / app_bytes))
+    if busy:
+        print('most the modelled flash takes: %.1f application bytes/s' % (app_bytes / busy))
+    if counts:
+        print('events: ' + ', '.join('%u %s' % (n, k) for k, n in sorted(counts.items())))
+
+    print('latency:')
+    for kind in ('WRITE', 'ERASE'):
+        print(latency_line(kind.lower(), traced[kind], modelled[kind]))
+
+    if wear:
+        values = list(wear.values())
+        print('erases per page erased: %u min, %.2f mean, %u max, over %u pages'
+              % (min(values), sum(values) / len(values), max(values), len(values)))
+        pages = sorted(wear)
+        for i in range(0, len(pages), PAGES_PER_LINE):
+            print('  ' + ' '.join('%05x:%u' % (page * page_size, wear[page])
+                                  for page in pages[i:i + PAGES_PER_LINE]))
+
+
+if __name__ == '__main__':
+    main()
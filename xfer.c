@@ -0,0 +1,518 @@
+#include "xfer.h"
+
+#include <string.h>
+
+#include "sdk_config.h"
+#include "nordic_common.h"
+#include "app_util.h"
+#include "nrf_atomic.h"
+#include "flash_crc.h"
+#include "flash_queue.h"
+#include "flash_cache.h"
+
+
+#define FRAME_HDR_LEN   2                                       /**< Type and sequence number. */
+#define FRAME_CRC_LEN   sizeof(uint32_t)
+#define FRAME_MIN_LEN   (FRAME_HDR_LEN + FRAME_CRC_LEN)
+#define FRAME_MAX_LEN   (FRAME_MIN_LEN + XFER_PAYLOAD_SIZE)
+#define RANGE_LEN       (2 * sizeof(uint32_t))                  /**< Payload of open and read frames. */
+#define ACK_LEN         8
+
+/**@brief   Worst-case length of @p n bytes once COBS-encoded: one code byte per 254 bytes. */
+#define COBS_MAX_LEN(n) ((n) + (n) / 254 + 1)
+
+STATIC_ASSERT((XFER_PAYLOAD_SIZE % sizeof(uint32_t)) == 0);
+STATIC_ASSERT(XFER_PAYLOAD_SIZE >= RANGE_LEN);
+STATIC_ASSERT(XFER_PAYLOAD_SIZE <= FLASH_QUEUE_STAGING_SIZE);
+STATIC_ASSERT(sizeof(xfer_ack_t) == ACK_LEN);
+
+
+/**@brief   Why frames are dropped until a retry is requested. */
+typedef enum
+{
+    STALL_NONE,
+    STALL_SPACE,    //!< A write did not fit in the flash queue.
+    STALL_WRITES,   //!< A read must wait for the queued writes.
+} stall_t;
+
+
+static struct
+{
+    nrf_fstorage_t const  * p_fs;
+    xfer_send_t             send;
+    void const            * p_ctx;
+    uint8_t                 window;
+    uint8_t                 seq_next;   //!< Sequence number of the next frame to accept.
+    bool                    resync;     //!< A retry was requested; frames up to seq_next are dropped.
+    stall_t                 stall;
+    bool                    range_open;
+    uint32_t                addr;       //!< Range opened for writing.
+    uint32_t                len;
+    uint32_t                offset;     //!< Bytes of the range queued so far.
+    bool                    closing;
+    uint8_t                 close_seq;
+} m_xfer;
+
+static bool       volatile  m_active;
+static ret_code_t volatile  m_write_result;
+static nrf_atomic_u32_t     m_writes_pending;
+
+static uint8_t  m_rx[COBS_MAX_LEN(FRAME_MAX_LEN)];
+static size_t   m_rx_len;
+static bool     m_rx_overflow;
+static uint8_t  m_frame[FRAME_MAX_LEN];
+static uint8_t  m_tx[COBS_MAX_LEN(FRAME_MAX_LEN) + 1];
+static uint32_t m_pad[XFER_PAYLOAD_SIZE / sizeof(uint32_t)];
+
+
+/**@brief   Encode @p len bytes so that they do not contain any zero byte.
+ *
+ * @return  Length of the encoded data.
+ */
+static size_t cobs_encode(uint8_t * p_out, uint8_t const * p_in, size_t len)
+{
+    size_t  code_idx = 0;
+    size_t  out      = 1;
+    uint8_t code     = 1;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (p_in[i] != 0)
+        {
+            p_out[out++] = p_in[i];
+            code++;
+        }
+        if ((p_in[i] == 0) || (code == 0xFF))
+        {
+            p_out[code_idx] = code;
+            code_idx        = out++;
+            code            = 1;
+        }
+    }
+    p_out[code_idx] = code;
+
+    return out;
+}
+
+
+/**@brief   Decode COBS-encoded data in place.
+ *
+ * @return  false if the data is not valid COBS.
+ */
+static bool cobs_decode(uint8_t * p_buf, size_t len, size_t * p_len)
+{
+    size_t in  = 0;
+    size_t out = 0;
+
+    while (in < len)
+    {
+        uint8_t const code = p_buf[in++];
+
+        if ((code == 0) || ((size_t)(code - 1) > len - in))
+        {
+            return false;
+        }
+        for (uint8_t i = 1; i < code; i++)
+        {
+            p_buf[out++] = p_buf[in++];
+        }
+        if ((code != 0xFF) && (in < len))
+        {
+            p_buf[out++] = 0;
+        }
+    }
+
+    *p_len = out;
+    return true;
+}
+
+
+/**@brief   Send the frame in m_frame, whose payload has already been filled in. */
+static void frame_send(uint8_t type, uint8_t seq, size_t payload_len)
+{
+    uint32_t crc;
+    size_t   len;
+
+    m_frame[0] = type;
+    m_frame[1] = seq;
+    crc        = flash_crc32(m_frame, FRAME_HDR_LEN + payload_len, NULL);
+    (void) uint32_encode(crc, &m_frame[FRAME_HDR_LEN + payload_len]);
+
+    len         = cobs_encode(m_tx, m_frame, FRAME_MIN_LEN + payload_len);
+    m_tx[len++] = 0;
+
+    m_xfer.send(m_xfer.p_ctx, (char const *)m_tx, len);
+}
+
+
+static void ack_send(xfer_status_t status, uint8_t seq)
+{
+    uint8_t * const p_ack = &m_frame[FRAME_HDR_LEN];
+
+    p_ack[0] = status;
+    p_ack[1] = m_xfer.window;
+    (void) uint16_encode(XFER_PAYLOAD_SIZE, &p_ack[2]);
+    (void) uint32_encode(m_xfer.offset, &p_ack[4]);
+
+    frame_send(XFER_FRAME_ACK, seq, ACK_LEN);
+}
+
+
+/**@brief   Reply to the frame that was accepted, and move on to the next one. */
+static void frame_done(xfer_status_t status)
+{
+    ack_send(status, m_xfer.seq_next);
+    m_xfer.seq_next++;
+}
+
+
+/**@brief   Drop the frame that was not accepted and the ones after it. */
+static void frame_drop(void)
+{
+    /* The first frame dropped asks for all of them again, and the host then resends the window. */
+    if (!m_xfer.resync && (m_xfer.stall == STALL_NONE))
+    {
+        m_xfer.resync = true;
+        ack_send(XFER_STATUS_RETRY, (uint8_t)(m_xfer.seq_next - 1));
+    }
+}
+
+
+/**@brief   Reply again to a frame that was already accepted, as the host did not get the reply. */
+static void frame_repeat(void)
+{
+    if (m_xfer.closing)
+    {
+        return;
+    }
+    m_xfer.resync = true;
+    ack_send((m_xfer.stall == STALL_NONE) ? XFER_STATUS_RETRY : XFER_STATUS_BUSY,
+             (uint8_t)(m_xfer.seq_next - 1));
+}
+
+
+/**@brief   Drop the frame until @ref xfer_process finds that it can be accepted. */
+static void frame_stall(stall_t stall)
+{
+    m_xfer.stall = stall;
+    ack_send(XFER_STATUS_BUSY, (uint8_t)(m_xfer.seq_next - 1));
+}
+
+
+static bool range_is_valid(uint32_t addr, uint32_t len)
+{
+    return    (len > 0)
+           && (addr >= m_xfer.p_fs->start_addr)
+           && (addr <= m_xfer.p_fs->end_addr)
+           && (len - 1 <= m_xfer.p_fs->end_addr - addr);
+}
+
+
+static void write_evt_handler(flash_queue_evt_t const * p_evt)
+{
+    if (p_evt->result != NRF_SUCCESS)
+    {
+        m_write_result = p_evt->result;
+    }
+    (void) nrf_atomic_u32_sub(&m_writes_pending, p_evt->cnt);
+}
+
+
+static void open_handle(uint8_t const * p_payload, size_t len)
+{
+    if (len != RANGE_LEN)
+    {
+        frame_done(XFER_STATUS_ERROR);
+        return;
+    }
+
+    uint32_t const addr = uint32_decode(&p_payload[0]);
+    uint32_t const size = uint32_decode(&p_payload[4]);
+
+    if (!range_is_valid(addr, size) || (addr % sizeof(uint32_t)))
+    {
+        frame_done(XFER_STATUS_ERROR);
+        return;
+    }
+
+    /* Cached writes were issued first, so they must reach flash before the data streamed in. */
+    ret_code_t const rc = flash_cache_sync();
+    if (rc == NRF_ERROR_NO_MEM)
+    {
+        frame_stall(STALL_SPACE);
+        return;
+    }
+
+    m_xfer.range_open = (rc == NRF_SUCCESS);
+    m_xfer.addr       = addr;
+    m_xfer.len        = size;
+    m_xfer.offset     = 0;
+
+    frame_done(m_xfer.range_open ? XFER_STATUS_OK : XFER_STATUS_ERROR);
+}
+
+
+static void data_handle(uint8_t const * p_payload, size_t len)
+{
+    /* Only the last frame of the range may end in the middle of a word. */
+    if (   !m_xfer.range_open
+        || (len == 0)
+        || (len > m_xfer.len - m_xfer.offset)
+        || ((len % sizeof(uint32_t)) && (m_xfer.offset + len != m_xfer.len)))
+    {
+        frame_done(XFER_STATUS_ERROR);
+        return;
+    }
+
+    /* The tail of a partial word keeps the erased value. */
+    uint32_t const words = (len + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+    m_pad[words - 1] = UINT32_MAX;
+    memcpy(m_pad, p_payload, len);
+
+    (void) nrf_atomic_u32_add(&m_writes_pending, 1);
+
+    ret_code_t const rc = flash_queue_write(m_xfer.p_fs, m_xfer.addr + m_xfer.offset, m_pad,
+                                            words * sizeof(uint32_t), write_evt_handler, NULL);
+    if (rc != NRF_SUCCESS)
+    {
+        (void) nrf_atomic_u32_sub(&m_writes_pending, 1);
+        if (rc == NRF_ERROR_NO_MEM)
+        {
+            frame_stall(STALL_SPACE);
+        }
+        else
+        {
+            frame_done(XFER_STATUS_ERROR);
+        }
+        return;
+    }
+
+    m_xfer.offset += len;
+    frame_done(XFER_STATUS_OK);
+}
+
+
+static void read_handle(uint8_t const * p_payload, size_t len)
+{
+    if (len != RANGE_LEN)
+    {
+        frame_done(XFER_STATUS_ERROR);
+        return;
+    }
+
+    uint32_t const addr = uint32_decode(&p_payload[0]);
+    uint32_t const size = uint32_decode(&p_payload[4]);
+
+    if (!range_is_valid(addr, size) || (size > XFER_PAYLOAD_SIZE))
+    {
+        frame_done(XFER_STATUS_ERROR);
+        return;
+    }
+
+    /* Data that was uploaded is only read back once it has been written. */
+    if (m_writes_pending > 0)
+    {
+        frame_stall(STALL_WRITES);
+        return;
+    }
+
+    if (flash_cache_read(m_xfer.p_fs, addr, &m_frame[FRAME_HDR_LEN], size) != NRF_SUCCESS)
+    {
+        frame_done(XFER_STATUS_ERROR);
+        return;
+    }
+
+    frame_send(XFER_FRAME_READ_DATA, m_xfer.seq_next, size);
+    m_xfer.seq_next++;
+}
+
+
+static void frame_handle(uint8_t const * p_frame, size_t len)
+{
+    if (len < FRAME_MIN_LEN)
+    {
+        frame_drop();
+        return;
+    }
+
+    size_t   const payload_len = len - FRAME_MIN_LEN;
+    uint32_t const crc         = uint32_decode(&p_frame[FRAME_HDR_LEN + payload_len]);
+
+    if (flash_crc32(p_frame, FRAME_HDR_LEN + payload_len, NULL) != crc)
+    {
+        frame_drop();
+        return;
+    }
+
+    /* Sequence numbers up to 127 behind the next one are of frames accepted before. */
+    if ((uint8_t)(m_xfer.seq_next - 1 - p_frame[1]) < 0x80)
+    {
+        frame_repeat();
+        return;
+    }
+
+    /* Otherwise frames are only accepted in order, and not after the close frame. */
+    if (   (p_frame[1] != m_xfer.seq_next)
+        || (m_xfer.stall != STALL_NONE)
+        || m_xfer.closing)
+    {
+        frame_drop();
+        return;
+    }
+
+    m_xfer.resync = false;
+
+    switch (p_frame[0])
+    {
+        case XFER_FRAME_OPEN:
+            open_handle(&p_frame[FRAME_HDR_LEN], payload_len);
+            break;
+
+        case XFER_FRAME_DATA:
+            data_handle(&p_frame[FRAME_HDR_LEN], payload_len);
+            break;
+
+        case XFER_FRAME_READ:
+            read_handle(&p_frame[FRAME_HDR_LEN], payload_len);
+            break;
+
+        case XFER_FRAME_CLOSE:
+            /* Replied to once the data has been written. */
+            m_xfer.closing   = true;
+            m_xfer.close_seq = m_xfer.seq_next++;
+            xfer_process();
+            break;
+
+        default:
+            frame_done(XFER_STATUS_ERROR);
+            break;
+    }
+}
+
+
+ret_code_t xfer_start(nrf_fstorage_t const * p_fs,
+                      xfer_send_t            send,
+                      void const           * p_ctx,
+                      uint8_t                window)
+{
+    if ((p_fs == NULL) || (send == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+    if (window == 0)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if (m_active)
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    memset(&m_xfer, 0x00, sizeof(m_xfer));
+    m_xfer.p_fs    = p_fs;
+    m_xfer.send    = send;
+    m_xfer.p_ctx   = p_ctx;
+    m_xfer.window  = window;
+    m_rx_len       = 0;
+    m_rx_overflow  = false;
+    m_write_result = NRF_SUCCESS;
+    m_active       = true;
+
+    return NRF_SUCCESS;
+}
+
+
+void xfer_rx(uint8_t const * p_data, size_t len)
+{
+    for (size_t i = 0; (i < len) && m_active; i++)
+    {
+        if (p_data[i] != 0)
+        {
+            if (m_rx_len < sizeof(m_rx))
+            {
+                m_rx[m_rx_len++] = p_data[i];
+            }
+            else
+            {
+                m_rx_overflow = true;
+            }
+            continue;
+        }
+
+        /* Zero bytes end frames. The host may also send them to flush out a partial frame. */
+        if (m_rx_len > 0)
+        {
+            size_t frame_len;
+
+            if (!m_rx_overflow && cobs_decode(m_rx, m_rx_len, &frame_len))
+            {
+                frame_handle(m_rx, frame_len);
+            }
+            else
+            {
+                frame_drop();
+            }
+        }
+        m_rx_len      = 0;
+        m_rx_overflow = false;
+    }
+}
+
+
+void xfer_process(void)
+{
+    if (!m_active)
+    {
+        return;
+    }
+
+    switch (m_xfer.stall)
+    {
+        case STALL_SPACE:
+        {
+            flash_queue_space_t space;
+
+            flash_queue_space_get(&space);
+            if ((space.ops == 0) || (space.stage_bytes < XFER_PAYLOAD_SIZE))
+            {
+                return;
+            }
+        } break;
+
+        case STALL_WRITES:
+            if (m_writes_pending > 0)
+            {
+                return;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if (m_xfer.stall != STALL_NONE)
+    {
+        m_xfer.stall = STALL_NONE;
+        frame_drop();
+    }
+
+    if (m_xfer.closing && (m_writes_pending == 0))
+    {
+        ack_send((m_write_result == NRF_SUCCESS) ? XFER_STATUS_OK : XFER_STATUS_ERROR,
+                 m_xfer.close_seq);
+        m_active = false;
+    }
+}
+
+
+void xfer_stop(void)
+{
+    m_active = false;
+}
+
+
+bool xfer_is_active(void)
+{
+    return m_active;
+}
@@ -0,0 +1,130 @@
+#ifndef XFER_H__
+#define XFER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sdk_errors.h"
+#include "nrf_fstorage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@file
+ *
+ * @defgroup xfer Framed binary transfer
+ * @{
+ *
+ * @brief   Binary upload and download of flash contents over a byte stream.
+ *
+ * @details The host sends frames, each one COBS-encoded and terminated by a zero byte. Before
+ *          encoding, a frame holds a one-byte type, a one-byte sequence number and a payload,
+ *          followed by the CRC32 of all of them, little-endian like every other field.
+ *
+ *          Every frame the host sends carries the next sequence number, starting from zero. The
+ *          host may send as many frames as the window of the session before waiting for the reply
+ *          to the first, and the device acknowledges the frames it accepts in order. A frame that
+ *          is corrupt, out of order or cannot be handled yet is dropped along with the frames
+ *          after it, and the device asks for all of them again, starting from the first one
+ *          missing. Frames that were already accepted are answered the same way, so a host that
+ *          has just sent the frames again should ignore further requests for the same frame. Read
+ *          requests are answered only once; a host that misses the data sends the request again
+ *          as a new frame.
+ *
+ *          Data frames are streamed into the flash queue as they arrive, so that consecutive
+ *          frames are merged into large program operations. The range written to must be erased.
+ */
+
+
+#define XFER_FRAME_OPEN         0x01    //!< Host: start writing. Payload: address, length.
+#define XFER_FRAME_DATA         0x02    //!< Host: data that follows the previous data frame.
+#define XFER_FRAME_READ         0x03    //!< Host: read flash. Payload: address, length.
+#define XFER_FRAME_CLOSE        0x04    //!< Host: end the session once all data is written.
+#define XFER_FRAME_ACK          0x80    //!< Device: reply. Payload: @ref xfer_ack_t.
+#define XFER_FRAME_READ_DATA    0x83    //!< Device: reply to @ref XFER_FRAME_READ with the data.
+
+
+/**@brief   Status of an @ref XFER_FRAME_ACK reply, for the frame with the sequence number of the
+ *          reply. */
+typedef enum
+{
+    XFER_STATUS_OK,     //!< The frame and the ones before it were accepted.
+    XFER_STATUS_ERROR,  //!< The frame was rejected, or for @ref XFER_FRAME_CLOSE, a write failed.
+    XFER_STATUS_RETRY,  //!< Frames after this one were dropped. Send them again.
+    XFER_STATUS_BUSY,   //!< The next frame was dropped for lack of room. Wait for
+                        //!< @ref XFER_STATUS_RETRY.
+} xfer_status_t;
+
+
+/**@brief   Payload of an @ref XFER_FRAME_ACK reply. */
+typedef struct
+{
+    uint8_t     status;         //!< See @ref xfer_status_t.
+    uint8_t     window;         //!< Frames the host may send ahead.
+    uint16_t    payload_max;    //!< Largest payload of a frame, see @ref XFER_PAYLOAD_SIZE.
+    uint32_t    offset;         //!< Bytes of the range opened by @ref XFER_FRAME_OPEN queued so far.
+} xfer_ack_t;
+
+
+/**@brief   Function for sending bytes to the host. Has the prototype of nrf_cli_print_stream.
+ *
+ * @param[in]   p_ctx   Context given to @ref xfer_start.
+ * @param[in]   p_data  Bytes to send. Only valid until the function returns.
+ * @param[in]   len     Number of bytes.
+ */
+typedef void (*xfer_send_t)(void const * p_ctx, char const * p_data, size_t len);
+
+
+/**@brief   Function for starting a transfer session.
+ *
+ * @param[in]   p_fs    The fstorage instance to transfer to and from.
+ * @param[in]   send    Function sending replies to the host.
+ * @param[in]   p_ctx   Context passed to @p send.
+ * @param[in]   window  Frames the host may send ahead. The transport must be able to buffer this
+ *                      many frames of @ref XFER_PAYLOAD_SIZE bytes, and the replies to them.
+ *
+ * @retval  NRF_SUCCESS             If the session was started.
+ * @retval  NRF_ERROR_NULL          If @p p_fs or @p send is NULL.
+ * @retval  NRF_ERROR_INVALID_PARAM If @p window is zero.
+ * @retval  NRF_ERROR_BUSY          If a session is already running.
+ */
+ret_code_t xfer_start(nrf_fstorage_t const * p_fs,
+                      xfer_send_t            send,
+                      void const           * p_ctx,
+                      uint8_t                window);
+
+
+/**@brief   Function for passing bytes received from the host.
+ *
+ * Replies are sent before the function returns. Must not be called concurrently with
+ * @ref xfer_process.
+ */
+void xfer_rx(uint8_t const * p_data, size_t len);
+
+
+/**@brief   Function for sending the replies that wait for flash operations to complete.
+ *
+ * Call this function regularly while the session is running.
+ */
+void xfer_process(void);
+
+
+/**@brief   Function for ending the session. Queued writes still complete. */
+void xfer_stop(void);
+
+
+/**@brief   Function for checking whether a session is running.
+ *
+ * A session ends with @ref xfer_stop, or once the reply to @ref XFER_FRAME_CLOSE has been sent.
+ */
+bool xfer_is_active(void);
+
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // XFER_H__